@@ -253,6 +253,9 @@ CDemoCamera::CDemoCamera() :
    readoutStartTime_ = GetCurrentMMTime();
    thd_ = new MySequenceThread(this);
 
+   // Tags only change through AddTag()/RemoveTag(), so the Core may cache them
+   EnableTagsVersion();
+
    // parent ID display
    CreateHubIDProperty();
 
@@ -1086,22 +1089,8 @@ int CDemoCamera::StartSequenceAcquisition(long numImages, double interval_ms, bo
  */
 int CDemoCamera::InsertImage()
 {
-   MM::MMTime timeStamp = this->GetCurrentMMTime();
-   char label[MM::MaxStrLength];
-   this->GetLabel(label);
- 
-   // Important:  metadata about the image are generated here:
-   Metadata md;
-   md.put(MM::g_Keyword_Metadata_CameraLabel, label);
-   md.put(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString((timeStamp - sequenceStartTime_).getMsec()));
-   md.put(MM::g_Keyword_Metadata_ROI_X, CDeviceUtils::ConvertToString( (long) roiX_)); 
-   md.put(MM::g_Keyword_Metadata_ROI_Y, CDeviceUtils::ConvertToString( (long) roiY_)); 
-
-   imageCounter_++;
-
-   char buf[MM::MaxStrLength];
-   GetProperty(MM::g_Keyword_Binning, buf);
-   md.put(MM::g_Keyword_Binning, buf);
+   SequenceImageTags tags;
+   GenerateSequenceMetadata(tags);
 
    MMThreadGuard g(imgPixelsLock_);
 
@@ -1112,13 +1101,15 @@ int CDemoCamera::InsertImage()
    unsigned int h = GetImageHeight();
    unsigned int b = GetImageBytesPerPixel();
 
-   int ret = GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md.Serialize().c_str());
+   int ret = GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_,
+         tags.Keys(), tags.Values(), tags.Count());
    if (!stopOnOverflow_ && ret == DEVICE_BUFFER_OVERFLOW)
    {
       // do not stop on overflow - just reset the buffer
       GetCoreCallback()->ClearImageBuffer(this);
       // don't process this same image again...
-      return GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_, md.Serialize().c_str(), false);
+      return GetCoreCallback()->InsertImage(this, pI, w, h, b, nComponents_,
+            tags.Keys(), tags.Values(), tags.Count(), false);
    }
    else
    {
@@ -1126,6 +1117,72 @@ int CDemoCamera::InsertImage()
    }
 }
 
+/*
+ * Inserts the next sequence image. Rendering takes much longer than copying,
+ * and other inserts are blocked while a frame of the MMCore circular buffer
+ * is held, so synthetic images are rendered first and inserted with
+ * InsertImage(). A precomputed image (fast image mode) is copied directly
+ * into a frame of the buffer instead, the way a camera transfers pixels,
+ * avoiding the copy made by InsertImage().
+ */
+int CDemoCamera::InsertSyntheticImage(double exposure)
+{
+   if (!fastImage_)
+   {
+      GenerateSyntheticImage(img_, exposure);
+      return InsertImage();
+   }
+
+   unsigned int w = GetImageWidth();
+   unsigned int h = GetImageHeight();
+   unsigned int b = GetImageBytesPerPixel();
+
+   unsigned char* pBuf = 0;
+   int ret = GetCoreCallback()->AcquireWritableFrame(this, w, h, b, nComponents_, &pBuf);
+   if (!stopOnOverflow_ && ret == DEVICE_BUFFER_OVERFLOW)
+   {
+      // do not stop on overflow - just reset the buffer
+      GetCoreCallback()->ClearImageBuffer(this);
+      ret = GetCoreCallback()->AcquireWritableFrame(this, w, h, b, nComponents_, &pBuf);
+   }
+   if (ret != DEVICE_OK)
+   {
+      return ret;
+   }
+
+   {
+      MMThreadGuard g(imgPixelsLock_);
+      memcpy(pBuf, img_.GetPixels(), w * h * b);
+   }
+
+   SequenceImageTags tags;
+   GenerateSequenceMetadata(tags);
+   return GetCoreCallback()->CommitFrame(this, tags.Keys(), tags.Values(), tags.Count());
+}
+
+/*
+ * Metadata about the sequence images are generated here
+ */
+void CDemoCamera::GenerateSequenceMetadata(SequenceImageTags& tags)
+{
+   MM::MMTime timeStamp = this->GetCurrentMMTime();
+   char label[MM::MaxStrLength];
+   this->GetLabel(label);
+
+   tags.Add(MM::g_Keyword_Metadata_CameraLabel, label);
+   tags.Add(MM::g_Keyword_Elapsed_Time_ms, CDeviceUtils::ConvertToString((timeStamp - sequenceStartTime_).getMsec()));
+   tags.Add(MM::g_Keyword_Metadata_ROI_X, CDeviceUtils::ConvertToString( (long) roiX_)); 
+   tags.Add(MM::g_Keyword_Metadata_ROI_Y, CDeviceUtils::ConvertToString( (long) roiY_)); 
+   tags.Add(MM::g_Keyword_Metadata_HardwareFrameNumber, CDeviceUtils::ConvertToString(imageCounter_));
+   tags.Add(MM::g_Keyword_Metadata_HardwareTimestamp, CDeviceUtils::ConvertToString(timeStamp.getUsec()));
+
+   imageCounter_++;
+
+   char buf[MM::MaxStrLength];
+   GetProperty(MM::g_Keyword_Binning, buf);
+   tags.Add(MM::g_Keyword_Binning, buf);
+}
+
 /*
  * Do actual capturing
  * Called from inside the thread  
@@ -1146,18 +1203,13 @@ int CDemoCamera::RunSequenceOnThread()
 
    double exposure = GetSequenceExposure();
 
-   if (!fastImage_)
-   {
-      GenerateSyntheticImage(img_, exposure);
-   }
-
    // Simulate exposure duration
    while ((GetCurrentMMTime() - startTime).getMsec() < exposure)
    {
       CDeviceUtils::SleepMs(1);
    }
 
-   ret = InsertImage();
+   ret = InsertSyntheticImage(exposure);
 
    if (ret != DEVICE_OK)
    {
@@ -35,8 +35,10 @@
 #include <string>
 #include <map>
 #include <algorithm>
+#include <cstdio>
 #include <stdint.h>
 #include <future>
+#include <vector>
 
 //////////////////////////////////////////////////////////////////////////////
 // Error codes
@@ -113,6 +115,46 @@ private:
 
 class MySequenceThread;
 
+// Metadata tags of a sequence image, in the key-value form accepted by
+// MM::Core::InsertImage() and CommitFrame() (no serialization needed)
+class SequenceImageTags
+{
+public:
+   SequenceImageTags()
+   {
+      keys_.reserve(typicalTagCount);
+      values_.reserve(typicalTagCount);
+   }
+
+   // The key is not copied, so it must outlive this object (e.g. a
+   // keyword constant); the value is copied.
+   void Add(const char* key, const char* value)
+   {
+      keys_.push_back(key);
+      values_.push_back(value);
+   }
+
+   const char* const* Keys() const { return keys_.data(); }
+   // Valid until the next call of Add()
+   const char* const* Values() const
+   {
+      valuePtrs_.resize(values_.size());
+      for (std::size_t i = 0; i < values_.size(); ++i)
+         valuePtrs_[i] = values_[i].c_str();
+      return valuePtrs_.data();
+   }
+   unsigned Count() const { return static_cast<unsigned>(keys_.size()); }
+
+private:
+   SequenceImageTags(const SequenceImageTags&);
+   SequenceImageTags& operator=(const SequenceImageTags&);
+
+   static const std::size_t typicalTagCount = 8;
+   std::vector<const char*> keys_;
+   std::vector<std::string> values_;
+   mutable std::vector<const char*> valuePtrs_;
+};
+
 class CDemoCamera : public CCameraBase<CDemoCamera>  
 {
 public:
@@ -153,6 +195,7 @@ public:
    int StartSequenceAcquisition(long numImages, double interval_ms, bool stopOnOverflow);
    int StopSequenceAcquisition();
    int InsertImage();
+   int InsertSyntheticImage(double exposure);
    int RunSequenceOnThread();
    bool IsCapturing();
    void OnThreadExiting() throw(); 
@@ -220,6 +263,7 @@ private:
    void TestResourceLocking(const bool);
    void GenerateEmptyImage(ImgBuffer& img);
    void GenerateSyntheticImage(ImgBuffer& img, double exp);
+   void GenerateSequenceMetadata(SequenceImageTags& tags);
    bool GenerateColorTestPattern(ImgBuffer& img);
    int ResizeImageBuffer();
 
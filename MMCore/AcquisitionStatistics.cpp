@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          AcquisitionStatistics.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Per-camera counters and insert latency histograms
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "AcquisitionStatistics.h"
+
+namespace mm {
+
+namespace {
+
+const char* const stageNames[AcquisitionStatistics::StageCount] = {
+   "Metadata",
+   "Processing",
+   "Copy",
+};
+
+unsigned HistogramBin(long long ns)
+{
+   unsigned bin = 0;
+   for (long long us = ns / 1000; us > 0 &&
+         bin < AcquisitionStatistics::HistogramBinCount - 1; us >>= 1)
+      ++bin;
+   return bin;
+}
+
+} // anonymous namespace
+
+AcquisitionStatistics::AcquisitionStatistics()
+{
+   Reset();
+}
+
+void AcquisitionStatistics::Reset()
+{
+   insertedCount_.store(0, std::memory_order_relaxed);
+   rejectedCount_.store(0, std::memory_order_relaxed);
+   firstInsertNs_.store(0, std::memory_order_relaxed);
+   lastInsertNs_.store(0, std::memory_order_relaxed);
+   intervalAverageNs_.store(0, std::memory_order_relaxed);
+   lastHardwareFrameNumber_.store(-1, std::memory_order_relaxed);
+   haveHardwareTimestamp_.store(false, std::memory_order_relaxed);
+   lastHardwareTimestampUs_.store(0.0, std::memory_order_relaxed);
+   hardwareFrameGaps_.store(0, std::memory_order_relaxed);
+   hardwareFramesMissed_.store(0, std::memory_order_relaxed);
+   hardwareFrameNumberRegressions_.store(0, std::memory_order_relaxed);
+   hardwareTimestampRegressions_.store(0, std::memory_order_relaxed);
+   for (Histogram& h : histograms_)
+   {
+      for (std::atomic<unsigned long long>& bin : h.bins)
+         bin.store(0, std::memory_order_relaxed);
+      h.totalNs.store(0, std::memory_order_relaxed);
+      h.maxNs.store(0, std::memory_order_relaxed);
+   }
+}
+
+long long AcquisitionStatistics::NowNs()
+{
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void AcquisitionStatistics::RecordStage(Stage stage,
+      std::chrono::steady_clock::duration duration)
+{
+   const long long ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+   Histogram& h = histograms_[stage];
+   h.bins[HistogramBin(ns)].fetch_add(1, std::memory_order_relaxed);
+   h.totalNs.fetch_add(ns, std::memory_order_relaxed);
+   long long max = h.maxNs.load(std::memory_order_relaxed);
+   while (ns > max && !h.maxNs.compare_exchange_weak(max, ns,
+            std::memory_order_relaxed))
+   {
+   }
+}
+
+void AcquisitionStatistics::RecordInserted()
+{
+   const long long now = NowNs();
+   const long long last = lastInsertNs_.exchange(now, std::memory_order_relaxed);
+   if (insertedCount_.fetch_add(1, std::memory_order_relaxed) == 0)
+   {
+      firstInsertNs_.store(now, std::memory_order_relaxed);
+      return;
+   }
+
+   // Smoothed over about 8 frames. Images are normally inserted by one
+   // thread per camera; concurrent inserts only lose an update.
+   const long long interval = now - last;
+   const long long average = intervalAverageNs_.load(std::memory_order_relaxed);
+   intervalAverageNs_.store(average == 0 ? interval :
+         average + (interval - average) / 8, std::memory_order_relaxed);
+}
+
+void AcquisitionStatistics::RecordRejected()
+{
+   rejectedCount_.fetch_add(1, std::memory_order_relaxed);
+}
+
+long long AcquisitionStatistics::RecordHardwareFrameNumber(long long frameNumber)
+{
+   const long long previous =
+      lastHardwareFrameNumber_.exchange(frameNumber, std::memory_order_relaxed);
+   if (previous < 0)
+      return previous;
+   if (frameNumber <= previous)
+   {
+      // Duplicate, out of order, or the counter was reset or wrapped
+      hardwareFrameNumberRegressions_.fetch_add(1, std::memory_order_relaxed);
+   }
+   else if (frameNumber > previous + 1)
+   {
+      hardwareFrameGaps_.fetch_add(1, std::memory_order_relaxed);
+      hardwareFramesMissed_.fetch_add(
+            static_cast<unsigned long long>(frameNumber - previous - 1),
+            std::memory_order_relaxed);
+   }
+   return previous;
+}
+
+bool AcquisitionStatistics::RecordHardwareTimestamp(double timestampUs,
+      double& previousUs)
+{
+   previousUs = lastHardwareTimestampUs_.exchange(timestampUs,
+         std::memory_order_relaxed);
+   if (!haveHardwareTimestamp_.exchange(true, std::memory_order_relaxed))
+      return true;
+   if (timestampUs > previousUs)
+      return true;
+   hardwareTimestampRegressions_.fetch_add(1, std::memory_order_relaxed);
+   return false;
+}
+
+void AcquisitionStatistics::GetSnapshot(std::map<std::string, double>& stats) const
+{
+   const unsigned long long inserted = GetInsertedCount();
+   stats["FramesInserted"] = static_cast<double>(inserted);
+   stats["FramesRejected"] = static_cast<double>(GetRejectedCount());
+
+   const long long first = firstInsertNs_.load(std::memory_order_relaxed);
+   const long long last = lastInsertNs_.load(std::memory_order_relaxed);
+   stats["AverageFrameRate"] = (inserted > 1 && last > first) ?
+      (inserted - 1) * 1e9 / (last - first) : 0.0;
+   const long long interval = intervalAverageNs_.load(std::memory_order_relaxed);
+   stats["CurrentFrameRate"] = interval > 0 ? 1e9 / interval : 0.0;
+   stats["MillisecondsSinceLastFrame"] = inserted > 0 ? (NowNs() - last) / 1e6 : 0.0;
+
+   stats["HardwareFrameGaps"] = static_cast<double>(
+         hardwareFrameGaps_.load(std::memory_order_relaxed));
+   stats["HardwareFramesMissed"] = static_cast<double>(
+         hardwareFramesMissed_.load(std::memory_order_relaxed));
+   stats["HardwareFrameNumberRegressions"] = static_cast<double>(
+         hardwareFrameNumberRegressions_.load(std::memory_order_relaxed));
+   stats["HardwareTimestampRegressions"] = static_cast<double>(
+         hardwareTimestampRegressions_.load(std::memory_order_relaxed));
+
+   for (unsigned s = 0; s < StageCount; ++s)
+   {
+      const Histogram& h = histograms_[s];
+      const std::string prefix = std::string(stageNames[s]) + "Latency";
+      unsigned long long count = 0;
+      for (unsigned i = 0; i < HistogramBinCount; ++i)
+      {
+         const unsigned long long binCount =
+            h.bins[i].load(std::memory_order_relaxed);
+         count += binCount;
+         const std::string name = (i + 1 < HistogramBinCount) ?
+            "Below" + std::to_string(1ULL << i) + "us" :
+            "AtLeast" + std::to_string(1ULL << (i - 1)) + "us";
+         stats[prefix + name] = static_cast<double>(binCount);
+      }
+      stats[prefix + "Count"] = static_cast<double>(count);
+      stats[prefix + "MeanUs"] = count > 0 ?
+         h.totalNs.load(std::memory_order_relaxed) / 1e3 / count : 0.0;
+      stats[prefix + "MaxUs"] = h.maxNs.load(std::memory_order_relaxed) / 1e3;
+   }
+}
+
+} // namespace mm
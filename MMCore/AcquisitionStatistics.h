@@ -0,0 +1,135 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          AcquisitionStatistics.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Per-camera counters and insert latency histograms
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+
+namespace mm {
+
+/**
+ * Statistics on the images a camera inserts into the sequence buffer.
+ *
+ * All updates are lock-free (relaxed atomics), so that they can be made for
+ * every frame on the insert path. A snapshot is consistent per value but not
+ * across values.
+ *
+ * The time spent inserting each image is recorded by stage, in histograms
+ * with power-of-two microsecond bins.
+ */
+class AcquisitionStatistics
+{
+public:
+   enum Stage
+   {
+      StageMetadata, // Adding the camera's metadata
+      StageProcessing, // Running the image processor
+      StageCopy, // Copying into the sequence buffer
+      StageCount
+   };
+
+   // Bin i counts durations below 2^i us (and at least 2^(i-1) us); the last
+   // bin counts everything longer
+   static const unsigned HistogramBinCount = 21;
+
+   /**
+    * Times the consecutive stages of one insert.
+    */
+   class StageTimer
+   {
+   public:
+      StageTimer(AcquisitionStatistics& stats,
+            std::chrono::steady_clock::time_point start) :
+         stats_(stats), last_(start) {}
+      void EndStage(Stage stage)
+      {
+         const std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+         stats_.RecordStage(stage, now - last_);
+         last_ = now;
+      }
+      void SkipStage() { last_ = std::chrono::steady_clock::now(); }
+
+   private:
+      AcquisitionStatistics& stats_;
+      std::chrono::steady_clock::time_point last_;
+   };
+
+   AcquisitionStatistics();
+
+   void Reset();
+
+   void RecordStage(Stage stage, std::chrono::steady_clock::duration duration);
+   void RecordInserted();
+   void RecordRejected(); // The sequence buffer was full
+
+   /**
+    * Check the camera's hardware frame number against the previous one.
+    * Returns the previous number, or -1 if there is none; the frame is out of
+    * sequence unless frameNumber is one more than that. Gaps (frames lost
+    * before reaching the Core) and frame numbers that do not increase are
+    * counted.
+    */
+   long long RecordHardwareFrameNumber(long long frameNumber);
+
+   /**
+    * Check the camera's hardware timestamp against the previous one. Returns
+    * false (and counts it) if it is not later than the previous one.
+    */
+   bool RecordHardwareTimestamp(double timestampUs, double& previousUs);
+
+   unsigned long long GetInsertedCount() const
+   { return insertedCount_.load(std::memory_order_relaxed); }
+   unsigned long long GetRejectedCount() const
+   { return rejectedCount_.load(std::memory_order_relaxed); }
+
+   /**
+    * Add the statistics to stats, replacing values of the same name.
+    */
+   void GetSnapshot(std::map<std::string, double>& stats) const;
+
+private:
+   struct Histogram
+   {
+      std::atomic<unsigned long long> bins[HistogramBinCount];
+      std::atomic<long long> totalNs;
+      std::atomic<long long> maxNs;
+   };
+
+   static long long NowNs();
+
+   std::atomic<unsigned long long> insertedCount_;
+   std::atomic<unsigned long long> rejectedCount_;
+   std::atomic<long long> firstInsertNs_;
+   std::atomic<long long> lastInsertNs_;
+   // Exponential moving average of the interval between inserts
+   std::atomic<long long> intervalAverageNs_;
+   std::atomic<long long> lastHardwareFrameNumber_; // -1 if none
+   std::atomic<bool> haveHardwareTimestamp_;
+   std::atomic<double> lastHardwareTimestampUs_;
+   std::atomic<unsigned long long> hardwareFrameGaps_;
+   std::atomic<unsigned long long> hardwareFramesMissed_;
+   std::atomic<unsigned long long> hardwareFrameNumberRegressions_;
+   std::atomic<unsigned long long> hardwareTimestampRegressions_;
+   Histogram histograms_[StageCount];
+};
+
+} // namespace mm
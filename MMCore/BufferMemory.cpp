@@ -0,0 +1,526 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          BufferMemory.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Contiguous memory region backing the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "BufferMemory.h"
+
+#include "ErrorCodes.h"
+#include "SharedBufferProtocol.h"
+#include "TaskSet.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable: 4290) // 'C++ exception specification ignored'
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+// 'dynamic exception specifications are deprecated in C++11 [-Wdeprecated]'
+#pragma GCC diagnostic ignored "-Wdeprecated"
+#endif
+
+namespace mm {
+
+namespace {
+
+const std::size_t bytesInMB = 1 << 20;
+
+// Pre-faulting is done in chunks of this size, with progress reported after
+// each chunk
+const std::size_t prefaultChunkSize = 256 * bytesInMB;
+
+std::size_t PageSize()
+{
+#ifdef _WIN32
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwPageSize;
+#else
+   return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+std::size_t RoundUp(std::size_t bytes, std::size_t unit)
+{
+   return (bytes + unit - 1) / unit * unit;
+}
+
+std::string LastErrorText()
+{
+   std::ostringstream oss;
+#ifdef _WIN32
+   oss << "Windows error " << GetLastError();
+#else
+   oss << std::strerror(errno);
+#endif
+   return oss.str();
+}
+
+std::string SizeText(std::size_t bytes)
+{
+   std::ostringstream oss;
+   oss << (bytes + bytesInMB - 1) / bytesInMB << " MB";
+   return oss.str();
+}
+
+// Writes one byte per page of a memory range, splitting the range among the
+// thread pool's threads.
+class TaskSet_TouchPages : public TaskSet
+{
+   class ATask : public Task
+   {
+   public:
+      ATask(std::shared_ptr<Semaphore> semDone, size_t taskIndex, size_t totalTaskCount) :
+         Task(semDone, taskIndex, totalTaskCount)
+      {}
+
+      void SetUp(unsigned char* begin, std::size_t pages, std::size_t pageSize,
+            std::size_t usedTaskCount)
+      {
+         usedTaskCount_ = usedTaskCount;
+         begin_ = begin;
+         pages_ = pages;
+         pageSize_ = pageSize;
+      }
+
+      virtual void Execute() override
+      {
+         const std::size_t perTask = (pages_ + usedTaskCount_ - 1) / usedTaskCount_;
+         const std::size_t first = taskIndex_ * perTask;
+         const std::size_t last = (std::min)(pages_, first + perTask);
+         volatile unsigned char* p = begin_;
+         for (std::size_t i = first; i < last; ++i)
+            p[i * pageSize_] = 0;
+      }
+
+   private:
+      unsigned char* begin_ = nullptr;
+      std::size_t pages_ = 0;
+      std::size_t pageSize_ = 0;
+   };
+
+public:
+   explicit TaskSet_TouchPages(std::shared_ptr<ThreadPool> pool) :
+      TaskSet(pool)
+   {
+      CreateTasks<ATask>();
+   }
+
+   void TouchPages(unsigned char* begin, std::size_t bytes, std::size_t pageSize)
+   {
+      const std::size_t pages = (bytes + pageSize - 1) / pageSize;
+      for (Task* task : tasks_)
+         static_cast<ATask*>(task)->SetUp(begin, pages, pageSize, usedTaskCount_);
+      Execute();
+      Wait();
+   }
+};
+
+} // anonymous namespace
+
+BufferMemory::BufferMemory(std::size_t bytes,
+      const BufferAllocationOptions& options,
+      std::shared_ptr<ThreadPool> pool,
+      ProgressFunction progress) throw (CMMError) :
+   data_(0),
+   size_(bytes),
+   mappedSize_(0),
+   hugePageKind_(HugePagesNone),
+   locked_(false),
+   prefaulted_(false),
+   fileBacked_(false),
+#ifdef _WIN32
+   fileHandle_(INVALID_HANDLE_VALUE),
+   mappingHandle_(NULL)
+#else
+   fileDescriptor_(-1)
+#endif
+{
+   if (!options.sharedMemoryName.empty())
+   {
+      if (!options.backingFile.empty())
+         throw CMMError("A shared memory sequence buffer cannot be file-backed");
+      MapShared(options.sharedMemoryName);
+   }
+   else if (options.backingFile.empty())
+   {
+      Map(options.hugePages);
+   }
+   else
+   {
+      if (options.lockInRAM)
+         throw CMMError("A file-backed sequence buffer cannot be locked in RAM");
+      MapFile(options.backingFile);
+   }
+   try
+   {
+      if (options.lockInRAM && !locked_)
+         Lock();
+      if (options.prefault)
+         Prefault(pool, progress);
+   }
+   catch (...)
+   {
+      Unmap();
+      throw;
+   }
+}
+
+BufferMemory::~BufferMemory()
+{
+   Unmap();
+}
+
+#ifdef _WIN32
+
+namespace {
+
+// Large pages require the "Lock pages in memory" privilege, which must be
+// enabled in the process token even if granted to the user.
+bool EnableLockMemoryPrivilege()
+{
+   HANDLE token;
+   if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+      return false;
+   TOKEN_PRIVILEGES privileges;
+   privileges.PrivilegeCount = 1;
+   privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+   bool ok = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+      AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+      GetLastError() == ERROR_SUCCESS;
+   CloseHandle(token);
+   return ok;
+}
+
+} // anonymous namespace
+
+void BufferMemory::Map(bool hugePages) throw (CMMError)
+{
+   if (hugePages)
+   {
+      const std::size_t largePageSize = GetLargePageMinimum();
+      if (largePageSize > 0 && EnableLockMemoryPrivilege())
+      {
+         const std::size_t mappedSize = RoundUp(size_, largePageSize);
+         void* p = VirtualAlloc(NULL, mappedSize,
+               MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+         if (p)
+         {
+            data_ = static_cast<unsigned char*>(p);
+            mappedSize_ = mappedSize;
+            hugePageKind_ = HugePagesExplicit;
+            locked_ = true; // Large pages are never paged out
+            return;
+         }
+      }
+   }
+
+   const std::size_t mappedSize = RoundUp(size_, PageSize());
+   void* p = VirtualAlloc(NULL, mappedSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+   if (!p)
+      throw CMMError("Cannot allocate " + SizeText(size_) +
+            " for the sequence buffer (" + LastErrorText() + ")",
+            MMERR_OutOfMemory);
+   data_ = static_cast<unsigned char*>(p);
+   mappedSize_ = mappedSize;
+}
+
+void BufferMemory::MapFile(const std::string& path) throw (CMMError)
+{
+   // Temporary files are kept in the cache unless memory is needed
+   HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+         NULL, CREATE_NEW, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+         NULL);
+   if (file == INVALID_HANDLE_VALUE)
+      throw CMMError("Cannot create sequence buffer file " + path + " (" +
+            LastErrorText() + ")", MMERR_FileOpenFailed);
+
+   // Creating the mapping extends the file to the mapping size
+   const std::size_t mappedSize = RoundUp(size_, PageSize());
+   const unsigned long long size64 = mappedSize;
+   HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE,
+         static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), NULL);
+   void* p = mapping ?
+      MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, mappedSize) : NULL;
+   if (!p)
+   {
+      const std::string err = LastErrorText();
+      if (mapping)
+         CloseHandle(mapping);
+      CloseHandle(file);
+      throw CMMError("Cannot map " + SizeText(size_) +
+            " of sequence buffer file " + path + " (" + err + ")",
+            MMERR_OutOfMemory);
+   }
+   fileHandle_ = file;
+   mappingHandle_ = mapping;
+   data_ = static_cast<unsigned char*>(p);
+   mappedSize_ = mappedSize;
+   fileBacked_ = true;
+}
+
+void BufferMemory::MapShared(const std::string& name) throw (CMMError)
+{
+   const std::string objectName = sharedbuffer::ObjectName(name);
+   const std::size_t mappedSize = RoundUp(size_, PageSize());
+   const unsigned long long size64 = mappedSize;
+   HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL,
+         PAGE_READWRITE, static_cast<DWORD>(size64 >> 32),
+         static_cast<DWORD>(size64), objectName.c_str());
+   if (mapping && GetLastError() == ERROR_ALREADY_EXISTS)
+   {
+      CloseHandle(mapping);
+      throw CMMError("Shared memory segment " + objectName +
+            " already exists", MMERR_FileOpenFailed);
+   }
+   void* p = mapping ?
+      MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, mappedSize) : NULL;
+   if (!p)
+   {
+      const std::string err = LastErrorText();
+      if (mapping)
+         CloseHandle(mapping);
+      throw CMMError("Cannot create " + SizeText(size_) +
+            " shared memory segment " + objectName + " (" + err + ")",
+            MMERR_OutOfMemory);
+   }
+   mappingHandle_ = mapping;
+   data_ = static_cast<unsigned char*>(p);
+   mappedSize_ = mappedSize;
+   sharedName_ = objectName;
+}
+
+void BufferMemory::Unmap()
+{
+   if (data_)
+   {
+      if (fileBacked_ || !sharedName_.empty())
+         UnmapViewOfFile(data_);
+      else
+         VirtualFree(data_, 0, MEM_RELEASE);
+   }
+   data_ = 0;
+   if (mappingHandle_)
+      CloseHandle(mappingHandle_);
+   mappingHandle_ = NULL;
+   if (fileHandle_ != INVALID_HANDLE_VALUE)
+      CloseHandle(fileHandle_); // Deletes the file
+   fileHandle_ = INVALID_HANDLE_VALUE;
+   sharedName_.clear(); // Removed once no process has it open
+}
+
+void BufferMemory::Lock() throw (CMMError)
+{
+   // The working set must be large enough to hold the locked pages
+   SIZE_T minSize, maxSize;
+   if (!GetProcessWorkingSetSize(GetCurrentProcess(), &minSize, &maxSize) ||
+         !SetProcessWorkingSetSize(GetCurrentProcess(),
+            minSize + mappedSize_, maxSize + mappedSize_) ||
+         !VirtualLock(data_, mappedSize_))
+   {
+      throw CMMError("Cannot lock " + SizeText(size_) +
+            " of sequence buffer memory in RAM (" + LastErrorText() + ")",
+            MMERR_OutOfMemory);
+   }
+   locked_ = true;
+}
+
+#else // POSIX
+
+void BufferMemory::Map(bool hugePages) throw (CMMError)
+{
+#ifdef MAP_HUGETLB
+   if (hugePages)
+   {
+      // Explicit huge pages from the pool reserved by the administrator
+      // (vm.nr_hugepages); the length must be a multiple of the huge page
+      // size, assumed to be the usual 2 MB.
+      const std::size_t mappedSize = RoundUp(size_, 2 * bytesInMB);
+      void* p = mmap(0, mappedSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (p != MAP_FAILED)
+      {
+         data_ = static_cast<unsigned char*>(p);
+         mappedSize_ = mappedSize;
+         hugePageKind_ = HugePagesExplicit;
+         return;
+      }
+   }
+#endif
+
+   const std::size_t mappedSize = RoundUp(size_, PageSize());
+   void* p = mmap(0, mappedSize, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (p == MAP_FAILED)
+      throw CMMError("Cannot allocate " + SizeText(size_) +
+            " for the sequence buffer (" + LastErrorText() + ")",
+            MMERR_OutOfMemory);
+   data_ = static_cast<unsigned char*>(p);
+   mappedSize_ = mappedSize;
+
+#ifdef MADV_HUGEPAGE
+   if (hugePages && madvise(p, mappedSize, MADV_HUGEPAGE) == 0)
+      hugePageKind_ = HugePagesTransparent;
+#else
+   (void)hugePages;
+#endif
+}
+
+void BufferMemory::MapFile(const std::string& path) throw (CMMError)
+{
+   const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+   if (fd < 0)
+      throw CMMError("Cannot create sequence buffer file " + path + " (" +
+            LastErrorText() + ")", MMERR_FileOpenFailed);
+
+   // The file only needs a name until it is open; removing it right away
+   // ensures that the space is reclaimed even if the process crashes.
+   unlink(path.c_str());
+
+   // Reserve the disk space up front, so that running out of space is
+   // reported here rather than as a SIGBUS while writing frames.
+   const std::size_t mappedSize = RoundUp(size_, PageSize());
+#ifdef __linux__
+   const int err = posix_fallocate(fd, 0, static_cast<off_t>(mappedSize));
+#else
+   const int err = ftruncate(fd, static_cast<off_t>(mappedSize)) == 0 ? 0 : errno;
+#endif
+   if (err != 0)
+   {
+      close(fd);
+      throw CMMError("Cannot reserve " + SizeText(size_) +
+            " for sequence buffer file " + path + " (" + std::strerror(err) +
+            ")", MMERR_OutOfMemory);
+   }
+
+   void* p = mmap(0, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (p == MAP_FAILED)
+   {
+      const std::string err = LastErrorText();
+      close(fd);
+      throw CMMError("Cannot map " + SizeText(size_) +
+            " of sequence buffer file " + path + " (" + err + ")",
+            MMERR_OutOfMemory);
+   }
+   fileDescriptor_ = fd;
+   data_ = static_cast<unsigned char*>(p);
+   mappedSize_ = mappedSize;
+   fileBacked_ = true;
+}
+
+void BufferMemory::MapShared(const std::string& name) throw (CMMError)
+{
+   const std::string objectName = sharedbuffer::ObjectName(name);
+   const int fd = shm_open(objectName.c_str(),
+         O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+   if (fd < 0)
+      throw CMMError("Cannot create shared memory segment " + objectName +
+            " (" + LastErrorText() + ")", MMERR_FileOpenFailed);
+
+   // As for files, reserve the space up front (shared memory may be limited,
+   // e.g. by the size of /dev/shm)
+   const std::size_t mappedSize = RoundUp(size_, PageSize());
+#ifdef __linux__
+   const int err = posix_fallocate(fd, 0, static_cast<off_t>(mappedSize));
+#else
+   const int err = ftruncate(fd, static_cast<off_t>(mappedSize)) == 0 ? 0 : errno;
+#endif
+   void* p = err == 0 ?
+      mmap(0, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) :
+      MAP_FAILED;
+   if (p == MAP_FAILED)
+   {
+      const std::string errText = err ? std::strerror(err) : LastErrorText();
+      close(fd);
+      shm_unlink(objectName.c_str());
+      throw CMMError("Cannot create " + SizeText(size_) +
+            " shared memory segment " + objectName + " (" + errText + ")",
+            MMERR_OutOfMemory);
+   }
+   // The mapping keeps the segment alive
+   close(fd);
+   data_ = static_cast<unsigned char*>(p);
+   mappedSize_ = mappedSize;
+   sharedName_ = objectName;
+}
+
+void BufferMemory::Unmap()
+{
+   if (data_)
+      munmap(data_, mappedSize_);
+   data_ = 0;
+   if (fileDescriptor_ >= 0)
+      close(fileDescriptor_);
+   fileDescriptor_ = -1;
+   // Readers that have it mapped keep access until they unmap it
+   if (!sharedName_.empty())
+      shm_unlink(sharedName_.c_str());
+   sharedName_.clear();
+}
+
+void BufferMemory::Lock() throw (CMMError)
+{
+   if (mlock(data_, mappedSize_) != 0)
+   {
+      throw CMMError("Cannot lock " + SizeText(size_) +
+            " of sequence buffer memory in RAM (" + LastErrorText() +
+            "; check the locked memory limit, ulimit -l)",
+            MMERR_OutOfMemory);
+   }
+   locked_ = true;
+}
+
+#endif // POSIX
+
+void BufferMemory::Prefault(std::shared_ptr<ThreadPool> pool,
+      ProgressFunction progress)
+{
+   // Locked memory is already resident
+   if (!locked_)
+   {
+      TaskSet_TouchPages touch(pool);
+      const std::size_t pageSize = PageSize();
+      for (std::size_t offset = 0; offset < mappedSize_; offset += prefaultChunkSize)
+      {
+         const std::size_t chunk = (std::min)(prefaultChunkSize, mappedSize_ - offset);
+         touch.TouchPages(data_ + offset, chunk, pageSize);
+         if (progress)
+            progress(offset + chunk, mappedSize_);
+      }
+   }
+   else if (progress)
+   {
+      progress(mappedSize_, mappedSize_);
+   }
+   prefaulted_ = true;
+}
+
+} // namespace mm
@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          BufferMemory.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Contiguous memory region backing the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Error.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable: 4290) // 'C++ exception specification ignored'
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+// 'dynamic exception specifications are deprecated in C++11 [-Wdeprecated]'
+#pragma GCC diagnostic ignored "-Wdeprecated"
+#endif
+
+class ThreadPool;
+
+namespace mm {
+
+/**
+ * How the sequence buffer memory is obtained from the operating system.
+ */
+struct BufferAllocationOptions
+{
+   // Back the buffer with huge pages: explicit huge pages (Linux hugetlbfs
+   // pool or Windows large pages) if available, otherwise transparent huge
+   // pages (Linux). Falls back to normal pages without error.
+   bool hugePages = false;
+
+   // Touch every page at allocation time (in parallel on the thread pool),
+   // so that the first pass through the buffer does not page-fault.
+   bool prefault = false;
+
+   // Lock the buffer in physical memory. Allocation fails if this is not
+   // permitted (e.g. RLIMIT_MEMLOCK on Linux).
+   bool lockInRAM = false;
+
+   // If not empty, the buffer is a shared memory mapping of a file created
+   // at this path (which must not exist), so that it can be larger than
+   // physical memory, with the OS writing out pages as needed. The file is
+   // deleted when the buffer is freed. Incompatible with lockInRAM; huge
+   // pages are not used.
+   std::string backingFile;
+
+   // If not empty, the buffer is a named shared memory segment (see
+   // SharedBufferProtocol.h) that other processes can map to read frames.
+   // The segment must not exist; it is removed when the buffer is freed.
+   // Incompatible with backingFile; huge pages are not used.
+   std::string sharedMemoryName;
+
+   bool operator==(const BufferAllocationOptions& other) const
+   {
+      return hugePages == other.hugePages && prefault == other.prefault &&
+         lockInRAM == other.lockInRAM && backingFile == other.backingFile &&
+         sharedMemoryName == other.sharedMemoryName;
+   }
+   bool operator!=(const BufferAllocationOptions& other) const
+   { return !(*this == other); }
+};
+
+/**
+ * A single contiguous, page-aligned memory region allocated directly from
+ * the operating system, either anonymous, backed by a file, or a named
+ * shared memory segment.
+ */
+class BufferMemory
+{
+public:
+   // Called with the number of bytes pre-faulted so far and the total
+   typedef std::function<void(std::size_t, std::size_t)> ProgressFunction;
+
+   /**
+    * Allocate the region. Throws CMMError (MMERR_OutOfMemory) with a
+    * description of the cause if the memory cannot be allocated or locked.
+    */
+   BufferMemory(std::size_t bytes, const BufferAllocationOptions& options,
+         std::shared_ptr<ThreadPool> pool,
+         ProgressFunction progress = ProgressFunction()) throw (CMMError);
+   ~BufferMemory();
+
+   BufferMemory(const BufferMemory&) = delete;
+   BufferMemory& operator=(const BufferMemory&) = delete;
+
+   unsigned char* Data() const { return data_; }
+   std::size_t Size() const { return size_; }
+
+   enum HugePageKind
+   {
+      HugePagesNone,
+      HugePagesExplicit,
+      HugePagesTransparent,
+   };
+   HugePageKind GetHugePageKind() const { return hugePageKind_; }
+   bool IsLocked() const { return locked_; }
+   bool IsPrefaulted() const { return prefaulted_; }
+   bool IsFileBacked() const { return fileBacked_; }
+   bool IsShared() const { return !sharedName_.empty(); }
+
+private:
+   unsigned char* data_;
+   std::size_t size_; // Requested size
+   std::size_t mappedSize_; // Size actually reserved (rounded up to pages)
+   HugePageKind hugePageKind_;
+   bool locked_;
+   bool prefaulted_;
+   bool fileBacked_;
+   std::string sharedName_; // Operating system name of a shared segment
+#ifdef _WIN32
+   void* fileHandle_;
+   void* mappingHandle_;
+#else
+   int fileDescriptor_;
+#endif
+
+   void Map(bool hugePages) throw (CMMError);
+   void MapFile(const std::string& path) throw (CMMError);
+   void MapShared(const std::string& name) throw (CMMError);
+   void Unmap();
+   void Lock() throw (CMMError);
+   void Prefault(std::shared_ptr<ThreadPool> pool, ProgressFunction progress);
+};
+
+} // namespace mm
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
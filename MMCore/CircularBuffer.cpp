@@ -24,17 +24,24 @@
 // AUTHOR:        Nenad Amodaj, nenad@amodaj.com, 01/05/2007
 // 
 #include "CircularBuffer.h"
+#include "CoreFeatures.h"
 #include "CoreUtils.h"
+#include "ErrorCodes.h"
+#include "FrameCompression.h"
+#include "SharedBufferExport.h"
 
+#include "TaskSet_CompressFrame.h"
 #include "TaskSet_CopyMemory.h"
+#include "TaskSet_PixelStatistics.h"
 
 #include "../MMDevice/DeviceUtils.h"
 
+#include <algorithm>
 #include <chrono>
-#include <cstdio>
-#include <ctime>
+#include <map>
 #include <memory>
 #include <string>
+#include <thread>
 
 #ifdef _MSC_VER
 #pragma warning(disable: 4290) // 'C++ exception specification ignored'
@@ -46,42 +53,188 @@
 #endif
 
 const long long bytesInMB = 1 << 20;
-const long adjustThreshold = LONG_MAX / 2;
 
 // Maximum number of images allowed in the buffer. This arbitrary limit is code
 // smell, but kept for now until careful checks for integer overflow and
 // division by zero can be added.
 const unsigned long maxCBSize = 10000000;
 
-CircularBuffer::CircularBuffer(unsigned int memorySizeMB) :
+// Frames start at multiples of this in the slab
+const std::size_t frameAlignment = 64;
+
+// In compressed mode, the buffer has this many times more slots than frames
+// fit uncompressed (the slab may still fill up first)
+const unsigned long compressedSlotFactor = 8;
+
+// Uncompressed frames kept for reuse in compressed mode: the newest one, the
+// one being inserted, and a few held by readers
+const std::size_t maxLiveFrames = 4;
+
+static std::size_t AlignFrameSize(std::size_t bytes)
+{
+   return (bytes + frameAlignment - 1) & ~(frameAlignment - 1);
+}
+
+namespace {
+
+typedef std::map<const CircularBuffer*,
+   std::vector<std::shared_ptr<const mm::ImgBuffer>>> HeldImageMap;
+
+// Images returned as plain pointers in compressed mode, kept for the calling
+// thread until its next such call on the same buffer
+HeldImageMap& AllHeldImages()
+{
+   static thread_local HeldImageMap images;
+   return images;
+}
+
+std::vector<std::shared_ptr<const mm::ImgBuffer>>& HeldImages(
+      const CircularBuffer* buffer)
+{
+   return AllHeldImages()[buffer];
+}
+
+const mm::ImgBuffer* HoldImage(const CircularBuffer* buffer,
+      std::shared_ptr<const mm::ImgBuffer> image)
+{
+   if (!image)
+      return 0;
+   std::vector<std::shared_ptr<const mm::ImgBuffer>>& held = HeldImages(buffer);
+   held.push_back(std::move(image));
+   return held.back().get();
+}
+
+} // anonymous namespace
+
+struct CircularBuffer::FramePins
+{
+   std::mutex mutex;
+   // Frame index -> slab offset of the frame's pixels
+   std::multimap<long long, std::size_t> frames;
+   // Frames below this index may have been overwritten, and cannot be pinned
+   long long reclaimedBelow = 0;
+
+   void Unpin(long long frameIndex)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = frames.find(frameIndex);
+      if (it != frames.end())
+         frames.erase(it);
+   }
+};
+
+struct CircularBuffer::LiveFrame
+{
+   std::vector<unsigned char> pixels; // The channels back to back
+   mm::FrameBuffer frame; // Images attached to pixels
+   unsigned numChannels = 0;
+   long long frameIndex = -1;
+};
+
+CircularBuffer::CircularBuffer(unsigned int memorySizeMB,
+      const mm::BufferAllocationOptions& allocationOptions,
+      mm::BufferMemory::ProgressFunction allocationProgress,
+      std::shared_ptr<ThreadPool> threadPool) :
    width_(0), 
    height_(0), 
    pixDepth_(0), 
    imageCounter_(0), 
+   lastImageNumber_(imageNumbers_.end()),
    insertIndex_(0), 
    saveIndex_(0), 
    memorySizeMB_(memorySizeMB), 
    overflow_(false),
-   threadPool_(std::make_shared<ThreadPool>()),
-   tasksMemCopy_(std::make_shared<TaskSet_CopyMemory>(threadPool_))
+   overwriteOldest_(false),
+   droppedCount_(0),
+   poppedCount_(0),
+   highWaterMark_(0),
+   lockFree_(false),
+   activeReaders_(0),
+   resizing_(false),
+   allocationOptions_(allocationOptions),
+   allocationProgress_(allocationProgress),
+   slabData_(0),
+   slabSize_(0),
+   writeOffset_(0),
+   pins_(std::make_shared<FramePins>()),
+   writeSlot_(0),
+   writeSlotComponents_(1),
+   writeSlotStaged_(false),
+   writeSlotReserved_(false),
+   writeSlotPreviousOffset_(0),
+   waiterCount_(0),
+   acqFinishedCount_(0),
+   threadPool_(threadPool ? threadPool : std::make_shared<ThreadPool>()),
+   tasksMemCopy_(std::make_shared<TaskSet_CopyMemory>(threadPool_)),
+   pixelStatsEnabled_(false),
+   pixelStatsBitDepth_(0),
+   pixelStatsHistogramBins_(0),
+   compressed_(false),
+   framesCompressed_(0),
+   rawBytesCompressed_(0),
+   compressedBytes_(0),
+   compressionNs_(0),
+   compressionCpuNs_(0),
+   imagesDecompressed_(0),
+   decompressionNs_(0)
+{
+}
+
+CircularBuffer::~CircularBuffer()
+{
+   // Those held for other threads are released when the threads exit
+   AllHeldImages().erase(this);
+}
+
+CircularBuffer::ReaderGuard::ReaderGuard(const CircularBuffer& cb) :
+   cb_(cb)
 {
+   // Pairs with ResizeGuard: either Initialize() sees this reader and waits
+   // for it, or this reader sees the resize and waits for Initialize()
+   for (;;)
+   {
+      cb_.activeReaders_.fetch_add(1, std::memory_order_seq_cst);
+      if (!cb_.resizing_.load(std::memory_order_seq_cst))
+         return;
+      cb_.activeReaders_.fetch_sub(1, std::memory_order_release);
+      MMThreadGuard wait(cb_.g_insertLock); // Held throughout Initialize()
+   }
 }
 
-CircularBuffer::~CircularBuffer() {}
+CircularBuffer::ResizeGuard::ResizeGuard(CircularBuffer& cb) :
+   cb_(cb)
+{
+   cb_.resizing_.store(true, std::memory_order_seq_cst);
+   while (cb_.activeReaders_.load(std::memory_order_seq_cst) > 0)
+      std::this_thread::yield();
+}
 
-bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int h, unsigned int pixDepth)
+bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int h, unsigned int pixDepth) throw (CMMError)
 {
+   // Wait for any pending write slot to be committed before reallocating,
+   // and for readers of the slots (which hold no lock in lock-free mode)
+   MMThreadGuard insertGuard(g_insertLock);
+   ResizeGuard resizeGuard(*this);
    MMThreadGuard guard(g_bufferLock);
    imageNumbers_.clear();
+   lastImageNumber_ = imageNumbers_.end();
    startTime_ = std::chrono::steady_clock::now();
 
+   // Readers only check the mode once registered, so they see the new one
+   lockFree_ = mm::features::flags().lockFreeSequenceBuffer;
+
+   // Other processes read a shared buffer's frames as they are
+   const bool compress = mm::features::flags().compressedSequenceBuffer &&
+      allocationOptions_.sharedMemoryName.empty();
+
    bool ret = true;
    try
    {
       if (w == 0 || h==0 || pixDepth == 0 || channels == 0)
          return false; // does not make sense
 
-      if (w == width_ && height_ == h && pixDepth_ == pixDepth && channels == numChannels_)
+      if (w == width_ && height_ == h && pixDepth_ == pixDepth && channels == numChannels_ &&
+            compress == compressed_)
          if (frameArray_.size() > 0)
             return true; // nothing to change
 
@@ -89,44 +242,90 @@ bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int
       height_ = h;
       pixDepth_ = pixDepth;
       numChannels_ = channels;
+      compressed_ = compress;
+      {
+         // Readers may still hold it
+         std::lock_guard<std::mutex> liveLock(liveMutex_);
+         liveFrame_.reset();
+      }
 
-      insertIndex_ = 0;
-      saveIndex_ = 0;
+      saveIndex_ = insertIndex_.load(); // Discard any unread frames
       overflow_ = false;
+      droppedCount_ = 0;
+      poppedCount_ = 0;
+      highWaterMark_ = 0;
+
+      // One copy task per worker, in case the pool was resized
+      if (tasksMemCopy_->GetTaskCount() != threadPool_->GetSize())
+         tasksMemCopy_ = std::make_shared<TaskSet_CopyMemory>(threadPool_);
+      if (tasksPixelStats_ && tasksPixelStats_->GetTaskCount() != threadPool_->GetSize())
+         tasksPixelStats_.reset();
+      if (compressed_ && (!tasksCompress_ ||
+               tasksCompress_->GetTaskCount() != threadPool_->GetSize()))
+         tasksCompress_ = std::make_shared<TaskSet_CompressFrame>(threadPool_);
+
+      // All frames are stored in a single slab, allocated once for the
+      // lifetime of the buffer, so that changing the image size only
+      // requires re-laying out the slots (which hold no pixels).
+      if (!slab_)
+      {
+         // A shared slab starts with the header read by other processes
+         const std::size_t headerSize = allocationOptions_.sharedMemoryName.empty() ?
+            0 : mm::SharedBufferExport::HeaderSize();
+         slab_.reset(new mm::BufferMemory(headerSize + (std::size_t)memorySizeMB_ * bytesInMB,
+                  allocationOptions_, threadPool_, allocationProgress_));
+         slabData_ = slab_->Data() + headerSize;
+         slabSize_ = slab_->Size() - headerSize;
+         if (slab_->IsShared())
+            sharedExport_.reset(new mm::SharedBufferExport(slab_->Data(), slabSize_));
+      }
+      if (sharedExport_)
+         sharedExport_->Clear();
 
-      // calculate the size of the entire buffer array once all images get allocated
-      // the actual size at the time of the creation is going to be less, because
-      // images are not allocated until pixels become available
+      // The number of slots is the number of frames of the current size
+      // that fit in the slab
       unsigned long frameSizeBytes = width_ * height_ * pixDepth_ * numChannels_;
-      unsigned long cbSize = (unsigned long) ((memorySizeMB_ * bytesInMB) / frameSizeBytes);
+      unsigned long cbSize = (unsigned long) (slabSize_ / AlignFrameSize(frameSizeBytes));
 
       if (cbSize == 0) 
       {
          frameArray_.resize(0);
+         slotOffsets_.resize(0);
          return false; // memory footprint too small
       }
 
+      if (compressed_)
+         cbSize *= compressedSlotFactor;
+
       // set a reasonable limit to circular buffer capacity 
       if (cbSize > maxCBSize)
          cbSize = maxCBSize; 
 
-      // TODO: verify if we have enough RAM to satisfy this request
-
+      // Slots must be emptied before resizing the vector (FrameBuffer
+      // copies share their images)
       for (unsigned long i=0; i<frameArray_.size(); i++)
          frameArray_[i].Clear();
 
-      // allocate buffers  - could conceivably throw an out-of-memory exception
       frameArray_.resize(cbSize);
+      slotOffsets_.assign(cbSize, 0);
       for (unsigned long i=0; i<frameArray_.size(); i++)
       {
-         frameArray_[i].Resize(w, h, pixDepth);
+         // Pixels are attached from the slab on insertion
+         frameArray_[i].Resize(0, 0, pixDepth);
          frameArray_[i].Preallocate(numChannels_);
       }
    }
 
+   catch (const CMMError&)
+   {
+      frameArray_.resize(0);
+      slotOffsets_.resize(0);
+      throw;
+   }
    catch( ... /* std::bad_alloc& ex */)
    {
       frameArray_.resize(0);
+      slotOffsets_.resize(0);
       ret = false;
    }
    return ret;
@@ -134,12 +333,28 @@ bool CircularBuffer::Initialize(unsigned channels, unsigned int w, unsigned int
 
 void CircularBuffer::Clear() 
 {
+   // Wait for a pending write slot, if any
+   MMThreadGuard insertGuard(g_insertLock);
    MMThreadGuard guard(g_bufferLock); 
-   insertIndex_=0; 
-   saveIndex_=0; 
+   // Indices keep increasing, and the next frame is written after the last
+   // one, so that leased frames stay intact
+   saveIndex_ = insertIndex_.load();
+   if (sharedExport_)
+      sharedExport_->Clear();
    overflow_ = false;
+   droppedCount_ = 0;
+   poppedCount_ = 0;
+   highWaterMark_ = 0;
+   framesCompressed_ = 0;
+   rawBytesCompressed_ = 0;
+   compressedBytes_ = 0;
+   compressionNs_ = 0;
+   compressionCpuNs_ = 0;
+   imagesDecompressed_ = 0;
+   decompressionNs_ = 0;
    startTime_ = std::chrono::steady_clock::now();
    imageNumbers_.clear();
+   lastImageNumber_ = imageNumbers_.end();
 }
 
 unsigned long CircularBuffer::GetSize() const
@@ -150,8 +365,8 @@ unsigned long CircularBuffer::GetSize() const
 
 unsigned long CircularBuffer::GetFreeSize() const
 {
-   MMThreadGuard guard(g_bufferLock);
-   long freeSize = (long)frameArray_.size() - (insertIndex_ - saveIndex_);
+   IndexGuard guard(*this);
+   long long freeSize = (long long)frameArray_.size() - (insertIndex_ - saveIndex_);
    if (freeSize < 0)
       return 0;
    else
@@ -160,35 +375,191 @@ unsigned long CircularBuffer::GetFreeSize() const
 
 unsigned long CircularBuffer::GetRemainingImageCount() const
 {
-   MMThreadGuard guard(g_bufferLock);
-   return (unsigned long)(insertIndex_ - saveIndex_);
-}
-
-static std::string FormatLocalTime(std::chrono::time_point<std::chrono::system_clock> tp) {
-   using namespace std::chrono;
-   auto us = duration_cast<microseconds>(tp.time_since_epoch());
-   auto secs = duration_cast<seconds>(us);
-   auto whole = duration_cast<microseconds>(secs);
-   auto frac = static_cast<int>((us - whole).count());
-
-   // As of C++14/17, it is simpler (and probably faster) to use C functions for
-   // date-time formatting
-
-   std::time_t t(secs.count()); // time_t is seconds on platforms we support
-   std::tm *ptm;
-#ifdef _WIN32 // Windows localtime() is documented thread-safe
-   ptm = std::localtime(&t);
-#else // POSIX has localtime_r()
-   std::tm tmstruct;
-   ptm = localtime_r(&t, &tmstruct);
-#endif
+   IndexGuard guard(*this);
+   // Load the save index first so that the difference is never negative
+   long long saveIndex = saveIndex_.load(std::memory_order_acquire);
+   return (unsigned long)(insertIndex_.load(std::memory_order_acquire) - saveIndex);
+}
+
+/**
+* Returns the index of the oldest frame that must not be overwritten (the
+* oldest unread or leased frame; insertIndex_ if there is none), and the slab
+* offset of its pixels; pinned tells whether that frame is leased, in which
+* case discarding unread frames does not free it. From then on, frames below
+* the returned index can no longer be leased.
+*
+* Must be called with g_insertLock held (and g_bufferLock in locked mode).
+*/
+long long CircularBuffer::RetainedFrameIndex(std::size_t& offset, bool& pinned)
+{
+   std::lock_guard<std::mutex> lock(pins_->mutex);
+   long long retainedIndex = saveIndex_.load(std::memory_order_acquire);
+   offset = slotOffsets_.empty() ? 0 :
+      slotOffsets_[retainedIndex % slotOffsets_.size()];
+   pinned = !pins_->frames.empty() &&
+      pins_->frames.begin()->first <= retainedIndex;
+   if (pinned)
+   {
+      retainedIndex = pins_->frames.begin()->first;
+      offset = pins_->frames.begin()->second;
+   }
+   pins_->reclaimedBelow = retainedIndex;
+   return retainedIndex;
+}
+
+// Must be called with g_insertLock held (and g_bufferLock in locked mode).
+bool CircularBuffer::IsFull(long long retainedIndex) const
+{
+   return (insertIndex_.load(std::memory_order_relaxed) - retainedIndex) >=
+      static_cast<long long>(frameArray_.size());
+}
+
+/**
+* Finds the slab offset for a frame of (aligned) size bytes to be inserted at
+* insertIndex_. Returns false if the frame does not fit without overwriting
+* the frames from retainedIndex on (see RetainedFrameIndex()).
+*
+* Must be called with g_insertLock held (and g_bufferLock in locked mode).
+*/
+bool CircularBuffer::FindFrameOffset(std::size_t bytes,
+      long long retainedIndex, std::size_t retainedOffset,
+      std::size_t& offset) const
+{
+   const long long insertIndex = insertIndex_.load(std::memory_order_relaxed);
+
+   offset = writeOffset_;
+   if (insertIndex > retainedIndex)
+   {
+      // Retained frames occupy the slab from the oldest one's offset (tail)
+      // up to writeOffset_, possibly wrapping around the end.
+      const std::size_t tail = retainedOffset;
+      if (offset > tail)
+      {
+         if (offset + bytes > slabSize_)
+         {
+            if (bytes > tail)
+               return false;
+            offset = 0; // Leave the end of the slab unused and wrap
+         }
+      }
+      else if (offset < tail)
+      {
+         if (offset + bytes > tail)
+            return false;
+      }
+      else
+      {
+         return false; // Completely full
+      }
+   }
+   else if (offset + bytes > slabSize_)
+   {
+      if (bytes > slabSize_)
+         return false;
+      offset = 0;
+   }
+   return true;
+}
+
+/**
+* Reserves room in the slab for the frame to be inserted at insertIndex_, and
+* records its location. Returns null if the frame does not fit (see
+* FindFrameOffset()).
+*
+* Must be called with g_insertLock held (and g_bufferLock in locked mode).
+*/
+unsigned char* CircularBuffer::ReserveFrameBytes(std::size_t bytes,
+      long long retainedIndex, std::size_t retainedOffset)
+{
+   bytes = AlignFrameSize(bytes);
+
+   std::size_t offset;
+   if (!FindFrameOffset(bytes, retainedIndex, retainedOffset, offset))
+      return 0;
+
+   if (sharedExport_)
+      sharedExport_->BeginFrame(writeOffset_, offset, bytes);
+   const long long insertIndex = insertIndex_.load(std::memory_order_relaxed);
+   slotOffsets_[insertIndex % slotOffsets_.size()] = offset;
+   writeOffset_ = offset + bytes;
+   return slabData_ + offset;
+}
+
+/**
+* Reserves room for the next frame, discarding the oldest unread frames as
+* needed in ring mode. Sets the overflow flag and returns null on failure.
+* Frames are only discarded while that makes room: once the oldest retained
+* frame is leased, the unread frames after it are kept.
+*
+* Must be called with g_insertLock held (and g_bufferLock in locked mode).
+*/
+unsigned char* CircularBuffer::ReserveFrame(std::size_t bytes)
+{
+   for (;;)
+   {
+      // In lock-free mode, saveIndex_ may advance concurrently; a stale
+      // value only makes the free space appear smaller.
+      std::size_t retainedOffset;
+      bool pinned;
+      const long long retainedIndex = RetainedFrameIndex(retainedOffset, pinned);
+      if (!IsFull(retainedIndex))
+      {
+         unsigned char* pixels = ReserveFrameBytes(bytes, retainedIndex,
+               retainedOffset);
+         if (pixels)
+            return pixels;
+      }
+      // A frame larger than the whole slab never fits; stop once there is
+      // nothing left to discard.
+      if (!overwriteOldest_ || pinned || !DropOldestFrame())
+      {
+         overflow_ = true;
+         return 0;
+      }
+   }
+}
+
+/**
+* Discards the oldest unread frame, as if it had been popped by a reader.
+* Returns false if there is no unread frame.
+*
+* Must be called with g_insertLock held (and g_bufferLock in locked mode).
+*/
+bool CircularBuffer::DropOldestFrame()
+{
+   const long long insertIndex = insertIndex_.load(std::memory_order_relaxed);
+   long long saveIndex = saveIndex_.load(std::memory_order_acquire);
+   if (saveIndex >= insertIndex)
+      return false;
+
+   // In lock-free mode, readers may pop the oldest frame concurrently. It
+   // only counts as dropped if we discard it; either way there is now more
+   // room, and saveIndex_ cannot pass insertIndex_ while we hold the insert
+   // lock, so the caller's retry loop terminates.
+   while (saveIndex < insertIndex)
+   {
+      if (saveIndex_.compare_exchange_weak(saveIndex, saveIndex + 1,
+               std::memory_order_acq_rel))
+      {
+         ++droppedCount_;
+         break;
+      }
+   }
+   return true;
+}
+
+void CircularBuffer::SetOverwriteOldest(bool overwrite)
+{
+   MMThreadGuard insertGuard(g_insertLock);
+   overwriteOldest_ = overwrite;
+}
 
-   // Format as "yyyy-mm-dd hh:mm:ss.uuuuuu" (26 chars)
-   const char *timeFmt = "%Y-%m-%d %H:%M:%S";
-   char buf[32];
-   std::size_t len = std::strftime(buf, sizeof(buf), timeFmt, ptm);
-   std::snprintf(buf + len, sizeof(buf) - len, ".%06d", frac);
-   return buf;
+void CircularBuffer::SetPixelStatistics(bool enable, unsigned bitDepth, unsigned histogramBins)
+{
+   MMThreadGuard insertGuard(g_insertLock);
+   pixelStatsEnabled_ = enable;
+   pixelStatsBitDepth_ = bitDepth;
+   pixelStatsHistogramBins_ = histogramBins;
 }
 
 /**
@@ -222,108 +593,495 @@ bool CircularBuffer::InsertMultiChannel(const unsigned char* pixArray, unsigned
 {
     MMThreadGuard insertGuard(g_insertLock);
  
-    mm::ImgBuffer* pImg;
-    unsigned long singleChannelSize = (unsigned long)width * height * byteDepth;
- 
+    const std::size_t singleChannelSize = (std::size_t)width * height * byteDepth;
+
+    // The channels share all metadata except the image number, so prepare
+    // it once, before taking the index lock
+    if (pMd)
+       insertMetadata_.Assign(*pMd);
+    else
+       insertMetadata_.Clear();
+    AddStandardTags(insertMetadata_, width, height, byteDepth, nComponents);
+    if (!insertMetadata_.FindValue(MM::g_Keyword_Metadata_CameraLabel))
+       throw CMMError("Image metadata lacks the camera label");
+
+    // Dimensions only change with g_insertLock held
+    if (width != width_ || height != height_ || byteDepth != pixDepth_)
+       throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+    if (frameArray_.empty() || numChannels > numChannels_)
+       return false;
+
+    // In compressed mode, the frame is compressed before reserving room for
+    // it, and copied to the live frame along the way
+    const std::size_t rawBytes = singleChannelSize * numChannels;
+    std::size_t frameBytes = rawBytes;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (compressed_)
+       frameBytes = tasksCompress_->Compress(pixArray, numChannels,
+             singleChannelSize, byteDepth, PrepareLiveFrame().pixels.data());
+
+    unsigned char* pixels;
     {
-       MMThreadGuard guard(g_bufferLock);
- 
-       // check image dimensions
-       if (width != width_ || height != height_ || byteDepth != pixDepth_)
-          throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+       IndexGuard guard(*this);
  
-       bool overflowed = (insertIndex_ - saveIndex_) >= static_cast<long>(frameArray_.size());
-       if (overflowed) {
-          overflow_ = true;
+       pixels = ReserveFrame(frameBytes);
+       if (!pixels)
           return false;
+
+       mm::FrameBuffer& frame = frameArray_[insertIndex_ % frameArray_.size()];
+       for (unsigned i = 0; i < numChannels; i++)
+       {
+          mm::ImgBuffer* pImg = frame.FindImage(i);
+          const std::size_t offset = compressed_ ?
+             tasksCompress_->GetChannelOffset(i) : i * singleChannelSize;
+          pImg->Attach(pixels + offset, width, height, byteDepth);
+          pImg->GetFrameMetadata() = insertMetadata_;
+          AssignImageNumber(pImg->GetFrameMetadata());
        }
     }
- 
-    for (unsigned i=0; i<numChannels; i++)
-    {
-       Metadata md;
-       {
-          MMThreadGuard guard(g_bufferLock);
-          // we assume that all buffers are pre-allocated
-          pImg = frameArray_[insertIndex_ % frameArray_.size()].FindImage(i);
-          if (!pImg)
-             return false;
- 
-          if (pMd)
-          {
-             // TODO: the same metadata is inserted for each channel ???
-             // Perhaps we need to add specific tags to each channel
-             md = *pMd;
-          }
-
-         std::string cameraName = md.GetSingleTag(MM::g_Keyword_Metadata_CameraLabel).GetValue();
-         if (imageNumbers_.end() == imageNumbers_.find(cameraName))
-         {
-            imageNumbers_[cameraName] = 0;
-         }
 
-         // insert image number. 
-         md.put(MM::g_Keyword_Metadata_ImageNumber, CDeviceUtils::ConvertToString(imageNumbers_[cameraName]));
-         ++imageNumbers_[cameraName];
+   if (compressed_)
+   {
+      WriteCompressedFrame(pixels, rawBytes, frameBytes, start);
+   }
+   else
+   {
+      // The channels are stored back to back, as in pixArray, so all of them
+      // are copied by a single parallel copy.
+      // TODO: Pass tasksMemCopy_ to ImgBuffer constructor
+      //       and utilize parallel copy also in single snap acquisitions.
+      tasksMemCopy_->MemCopy(pixels, pixArray, rawBytes);
+   }
+
+   ComputePixelStatistics(numChannels, nComponents);
+   PublishInsertedFrame(numChannels);
+
+   return true;
+}
+
+/**
+* Reserves the next slot of the buffer for the caller to fill in place. Only
+* single-channel buffers are supported.
+*
+* Returns a pointer to the (channel 0) pixels of the slot, or null if the
+* buffer is full. On success, g_insertLock remains held by the calling thread
+* until CommitWriteSlot() or AbortWriteSlot() is called, so that inserts
+* from other threads cannot claim the same slot.
+*
+* The slot is only placed in the slab right away if that is invisible to
+* readers. If room has to be made first (discarding the oldest unread frames
+* in ring mode), or the frame is compressed or exported to shared memory,
+* the slot is staged and stored (with a copy) on commit, so that aborting
+* never loses frames.
+*/
+unsigned char* CircularBuffer::AcquireWriteSlot(unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents) throw (CMMError)
+{
+   g_insertLock.Lock();
+
+   {
+      IndexGuard guard(*this);
+
+      if (writeSlot_)
+      {
+         // Only reachable from the thread already holding the slot, because
+         // g_insertLock is recursive.
+         g_insertLock.Unlock();
+         throw CMMError("A circular buffer slot is already being written");
+      }
+
+      if (width != width_ || height != height_ || byteDepth != pixDepth_)
+      {
+         g_insertLock.Unlock();
+         throw CMMError("Incompatible image dimensions in the circular buffer", MMERR_CircularBufferIncompatibleImage);
+      }
+
+      // Only channel 0 would be filled, leaving the others stale
+      if (numChannels_ != 1)
+      {
+         g_insertLock.Unlock();
+         throw CMMError("Zero-copy insertion requires a single-channel circular buffer", MMERR_CircularBufferIncompatibleImage);
+      }
+
+      if (frameArray_.empty())
+      {
+         g_insertLock.Unlock();
+         return 0;
       }
 
-      if (!md.HasTag(MM::g_Keyword_Elapsed_Time_ms))
+      // In compressed mode, the size of the frame is only known on commit
+      const std::size_t bytes = (std::size_t)width * height * byteDepth;
+      std::size_t retainedOffset;
+      bool pinned;
+      const long long retainedIndex = RetainedFrameIndex(retainedOffset, pinned);
+      std::size_t offset;
+      const bool fits = !IsFull(retainedIndex) && (compressed_ ||
+            FindFrameOffset(AlignFrameSize(bytes), retainedIndex,
+               retainedOffset, offset));
+      if (!fits && (!overwriteOldest_ || pinned))
       {
-         // if time tag was not supplied by the camera insert current timestamp
-         using namespace std::chrono;
-         auto elapsed = steady_clock::now() - startTime_;
-         md.PutImageTag(MM::g_Keyword_Elapsed_Time_ms,
-            std::to_string(duration_cast<milliseconds>(elapsed).count()));
+         overflow_ = true;
+         g_insertLock.Unlock();
+         return 0;
       }
 
-      // Note: It is not ideal to use local time. I think this tag is rarely
-      // used. Consider replacing with UTC (micro)seconds-since-epoch (with
-      // different tag key) after addressing current usage.
-      auto now = std::chrono::system_clock::now();
-      md.PutImageTag(MM::g_Keyword_Metadata_TimeInCore, FormatLocalTime(now));
-
-      md.PutImageTag("Width",width);
-      md.PutImageTag("Height",height);
-      if (byteDepth == 1)
-         md.PutImageTag("PixelType","GRAY8");
-      else if (byteDepth == 2)
-         md.PutImageTag("PixelType","GRAY16");
-      else if (byteDepth == 4)
+      unsigned char* pixels;
+      writeSlotReserved_ = false;
+      writeSlotStaged_ = !fits || compressed_ || sharedExport_;
+      if (compressed_)
+      {
+         pixels = PrepareLiveFrame().pixels.data();
+      }
+      else if (writeSlotStaged_)
       {
-         if (nComponents == 1)
-            md.PutImageTag("PixelType","GRAY32");
-         else
-            md.PutImageTag("PixelType","RGB32");
+         stagedSlot_.resize(bytes);
+         pixels = stagedSlot_.data();
       }
-      else if (byteDepth == 8)
-         md.PutImageTag("PixelType","RGB64");
       else
-         md.PutImageTag("PixelType","Unknown"); 
+      {
+         writeSlotPreviousOffset_ = writeOffset_;
+         pixels = ReserveFrameBytes(bytes, retainedIndex, retainedOffset);
+         writeSlotReserved_ = true;
+         frameArray_[insertIndex_ % frameArray_.size()].FindImage(0)->
+            Attach(pixels, width, height, byteDepth);
+      }
+      writeSlotComponents_ = nComponents;
+      writeSlot_ = pixels;
+      return pixels;
+   }
+}
 
-      pImg->SetMetadata(md);
-      //pImg->SetPixels(pixArray + i * singleChannelSize);
-      // TODO: In MMCore the ImgBuffer::GetPixels() returns const pointer.
-      //       It would be better to have something like ImgBuffer::GetPixelsRW() in MMDevice.
-      //       Or even better - pass tasksMemCopy_ to ImgBuffer constructor
-      //       and utilize parallel copy also in single snap acquisitions.
-      tasksMemCopy_->MemCopy((void*)pImg->GetPixels(),
-            pixArray + i * singleChannelSize, singleChannelSize);
+/**
+* Returns the pixels of the pending write slot, or null if there is none.
+* Only meaningful on the thread that called AcquireWriteSlot().
+*/
+unsigned char* CircularBuffer::GetWriteSlot() const
+{
+   return writeSlot_;
+}
+
+/**
+* Attaches metadata to the pending write slot and makes it available to
+* readers. Returns false if no slot is pending, or (with the overflow flag
+* set) if a staged slot does not fit.
+*/
+bool CircularBuffer::CommitWriteSlot(const Metadata* pMd)
+{
+   if (!writeSlot_)
+      return false;
+
+   try
+   {
+      // Checked before any frame is discarded to make room
+      if (pMd)
+         insertMetadata_.Assign(*pMd);
+      else
+         insertMetadata_.Clear();
+      AddStandardTags(insertMetadata_, width_, height_, pixDepth_,
+            writeSlotComponents_);
+      if (!insertMetadata_.FindValue(MM::g_Keyword_Metadata_CameraLabel))
+         throw CMMError("Image metadata lacks the camera label");
+
+      if (writeSlotStaged_ && !StoreStagedWriteSlot())
+      {
+         AbortWriteSlot();
+         return false;
+      }
+
+      // Only once the frame is known to fit, so that a failed commit does
+      // not skip an image number
+      {
+         IndexGuard guard(*this);
+         mm::ImgBuffer* pImg =
+            frameArray_[insertIndex_ % frameArray_.size()].FindImage(0);
+         pImg->GetFrameMetadata() = insertMetadata_;
+         AssignImageNumber(pImg->GetFrameMetadata());
+      }
+      ComputePixelStatistics(1, writeSlotComponents_);
    }
+   catch (...)
+   {
+      // Never leave the insert lock held
+      AbortWriteSlot();
+      throw;
+   }
+
+   PublishInsertedFrame(1);
 
+   writeSlot_ = 0;
+   g_insertLock.Unlock();
+   return true;
+}
+
+/**
+* Stores the pending, staged write slot's frame into the slab (compressing
+* it in compressed mode), discarding the oldest unread frames as needed in
+* ring mode. Returns false, with the overflow flag set, if it does not fit.
+*
+* Must be called with g_insertLock held.
+*/
+bool CircularBuffer::StoreStagedWriteSlot()
+{
+   const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   const std::size_t rawBytes = (std::size_t)width_ * height_ * pixDepth_;
+   const std::size_t frameBytes = compressed_ ?
+      tasksCompress_->Compress(writeSlot_, 1, rawBytes, pixDepth_, 0) : rawBytes;
+
+   unsigned char* pixels;
+   {
+      IndexGuard guard(*this);
+      writeSlotPreviousOffset_ = writeOffset_;
+      pixels = ReserveFrame(frameBytes);
+      if (!pixels)
+         return false;
+      writeSlotReserved_ = true;
+      frameArray_[insertIndex_ % frameArray_.size()].FindImage(0)->
+         Attach(pixels, width_, height_, pixDepth_);
+   }
+   if (compressed_)
+      WriteCompressedFrame(pixels, rawBytes, frameBytes, start);
+   else
+      tasksMemCopy_->MemCopy(pixels, writeSlot_, rawBytes);
+   return true;
+}
+
+/**
+* Discards the pending write slot. Nothing is published, and the slab space
+* reserved for it is reused by the next frame.
+*/
+void CircularBuffer::AbortWriteSlot()
+{
+   if (!writeSlot_.exchange(0))
+      return;
+   if (writeSlotReserved_)
+   {
+      IndexGuard guard(*this);
+      writeOffset_ = writeSlotPreviousOffset_;
+      writeSlotReserved_ = false;
+   }
+   g_insertLock.Unlock();
+}
+
+// Must be called with g_insertLock held (and g_bufferLock in locked mode).
+void CircularBuffer::AssignImageNumber(mm::FrameMetadata& md)
+{
+   const char* cameraLabel = md.FindValue(MM::g_Keyword_Metadata_CameraLabel);
+   if (!cameraLabel)
+      throw MetadataKeyError();
+   if (lastImageNumber_ == imageNumbers_.end() ||
+         lastImageNumber_->first != cameraLabel)
+   {
+      lastImageNumber_ = imageNumbers_.insert(
+            std::make_pair(std::string(cameraLabel), 0L)).first;
+   }
+
+   // insert image number. 
+   md.SetImageNumber(lastImageNumber_->second++);
+}
+
+// Standard tags are stored unformatted; see mm::FrameMetadata.
+void CircularBuffer::AddStandardTags(mm::FrameMetadata& md, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents) const
+{
+   if (!md.HasTag(MM::g_Keyword_Elapsed_Time_ms))
+   {
+      // if time tag was not supplied by the camera insert current timestamp
+      md.SetElapsedTime(std::chrono::steady_clock::now() - startTime_);
+   }
+
+   md.SetTimeInCore(std::chrono::system_clock::now());
+   md.SetImageFormat(width, height, byteDepth, nComponents);
+}
+
+// Must be called with g_insertLock held, before the frame is published (so
+// that readers cannot see its metadata change).
+void CircularBuffer::ComputePixelStatistics(unsigned numChannels, unsigned nComponents)
+{
+   if (!pixelStatsEnabled_ || !TaskSet_PixelStatistics::IsSupported(pixDepth_, nComponents))
+      return;
+
+   // Created on first use (and again after Initialize() if the pool was
+   // resized)
+   if (!tasksPixelStats_)
+      tasksPixelStats_ = std::make_shared<TaskSet_PixelStatistics>(threadPool_);
+
+   // In compressed mode, the pixels are read from the live frame
+   mm::FrameBuffer& frame = frameArray_[insertIndex_ % frameArray_.size()];
+   const mm::FrameBuffer& source = compressed_ ? pendingLiveFrame_->frame : frame;
+   for (unsigned i = 0; i < numChannels; i++)
+   {
+      const mm::ImgBuffer* pSource = source.FindImage(i);
+      tasksPixelStats_->Compute(pSource->GetPixels(),
+            (std::size_t)pSource->Width() * pSource->Height(), pSource->Depth(),
+            pixelStatsBitDepth_, pixelStatsHistogramBins_, pixelStats_);
+      frame.FindImage(i)->GetFrameMetadata().SetPixelStatistics(pixelStats_);
+   }
+}
+
+/**
+* Returns the live frame for the frame being inserted in compressed mode (an
+* uncompressed copy, which becomes the newest frame when published), reusing
+* one that neither readers nor the buffer refer to anymore.
+*
+* Must be called with g_insertLock held.
+*/
+CircularBuffer::LiveFrame& CircularBuffer::PrepareLiveFrame()
+{
+   pendingLiveFrame_.reset();
+   for (std::size_t i = 0; i < liveFrames_.size(); i++)
+   {
+      if (liveFrames_[i].use_count() == 1)
+      {
+         pendingLiveFrame_ = liveFrames_[i];
+         break;
+      }
+   }
+   if (!pendingLiveFrame_)
+   {
+      // Frames still held by readers are freed once released
+      pendingLiveFrame_ = std::make_shared<LiveFrame>();
+      if (liveFrames_.size() < maxLiveFrames)
+         liveFrames_.push_back(pendingLiveFrame_);
+      else
+         liveFrames_[insertIndex_ % maxLiveFrames] = pendingLiveFrame_;
+   }
+
+   LiveFrame& live = *pendingLiveFrame_;
+   const mm::ImgBuffer* pImg = live.frame.FindImage(0);
+   if (!pImg || live.numChannels != numChannels_ || pImg->Width() != width_ ||
+         pImg->Height() != height_ || pImg->Depth() != pixDepth_)
+   {
+      const std::size_t singleChannelSize = (std::size_t)width_ * height_ * pixDepth_;
+      live.pixels.resize(singleChannelSize * numChannels_);
+      live.frame.Resize(0, 0, pixDepth_);
+      live.frame.Preallocate(numChannels_);
+      for (unsigned i = 0; i < numChannels_; i++)
+         live.frame.FindImage(i)->Attach(live.pixels.data() + i * singleChannelSize,
+               width_, height_, pixDepth_);
+      live.numChannels = numChannels_;
+   }
+   return live;
+}
+
+/**
+* Writes out the frame compressed by tasksCompress_, and records the costs.
+*
+* Must be called with g_insertLock held.
+*/
+void CircularBuffer::WriteCompressedFrame(unsigned char* pixels,
+      std::size_t rawBytes, std::size_t compressedBytes,
+      std::chrono::steady_clock::time_point start)
+{
+   tasksCompress_->Write(pixels);
+
+   framesCompressed_.fetch_add(1, std::memory_order_relaxed);
+   rawBytesCompressed_.fetch_add(rawBytes, std::memory_order_relaxed);
+   compressedBytes_.fetch_add(compressedBytes, std::memory_order_relaxed);
+   compressionNs_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+   compressionCpuNs_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            tasksCompress_->GetCpuTime()).count(), std::memory_order_relaxed);
+}
+
+CircularBuffer::CompressionStatistics CircularBuffer::GetCompressionStatistics() const
+{
+   CompressionStatistics stats;
+   stats.framesCompressed = framesCompressed_.load(std::memory_order_relaxed);
+   stats.rawBytes = rawBytesCompressed_.load(std::memory_order_relaxed);
+   stats.compressedBytes = compressedBytes_.load(std::memory_order_relaxed);
+   stats.compressionTime = std::chrono::nanoseconds(compressionNs_.load(std::memory_order_relaxed));
+   stats.compressionCpuTime = std::chrono::nanoseconds(compressionCpuNs_.load(std::memory_order_relaxed));
+   stats.imagesDecompressed = imagesDecompressed_.load(std::memory_order_relaxed);
+   stats.decompressionTime = std::chrono::nanoseconds(decompressionNs_.load(std::memory_order_relaxed));
+   return stats;
+}
+
+// Must be called with g_insertLock held.
+void CircularBuffer::PublishInsertedFrame(unsigned numChannels)
+{
+   if (sharedExport_)
+   {
+      const mm::ImgBuffer* pImg =
+         frameArray_[insertIndex_ % frameArray_.size()].FindImage(0);
+      sharedExport_->PublishFrame(*pImg, numChannels);
+   }
+
+   if (compressed_)
+   {
+      // The live frame becomes the newest frame, with the same metadata
+      const mm::FrameBuffer& frame = frameArray_[insertIndex_ % frameArray_.size()];
+      for (unsigned i = 0; i < numChannels; i++)
+         pendingLiveFrame_->frame.FindImage(i)->GetFrameMetadata() =
+            frame.FindImage(i)->GetFrameMetadata();
+      pendingLiveFrame_->frameIndex = insertIndex_.load(std::memory_order_relaxed);
+      std::lock_guard<std::mutex> liveLock(liveMutex_);
+      liveFrame_ = std::move(pendingLiveFrame_);
+   }
+
+   // 64-bit indices never need adjusting (leases rely on them never
+   // decreasing)
+   if (lockFree_)
+   {
+      // Readers may be advancing saveIndex_ concurrently
+      imageCounter_++;
+      insertIndex_.fetch_add(1, std::memory_order_release);
+   }
+   else
    {
       MMThreadGuard guard(g_bufferLock);
 
       imageCounter_++;
       insertIndex_++;
-      if ((insertIndex_ - (long)frameArray_.size()) > adjustThreshold && (saveIndex_- (long)frameArray_.size()) > adjustThreshold)
-      {
-         // adjust buffer indices to avoid overflowing integer size
-         insertIndex_ -= adjustThreshold;
-         saveIndex_ -= adjustThreshold;
-      }
    }
 
-   return true;
+   // A concurrent pop only makes this an overestimate by one
+   const long long unread = insertIndex_.load(std::memory_order_relaxed) -
+      saveIndex_.load(std::memory_order_relaxed);
+   if (unread > highWaterMark_.load(std::memory_order_relaxed))
+      highWaterMark_.store(unread, std::memory_order_relaxed);
+
+   WakeWaiters();
+}
+
+void CircularBuffer::WakeWaiters()
+{
+   // Pairs with the fence in WaitForImage(): either the waiter sees the new
+   // insert index, or we see the waiter and notify it.
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (waiterCount_.load(std::memory_order_relaxed) == 0)
+      return;
+   {
+      // Ensure that the waiter is blocked in wait_for() (not between its
+      // check and the wait) before notifying
+      std::lock_guard<std::mutex> lock(waitMutex_);
+   }
+   waitCond_.notify_all();
+}
+
+unsigned long CircularBuffer::GetAcquisitionFinishedCount() const
+{
+   std::lock_guard<std::mutex> lock(waitMutex_);
+   return acqFinishedCount_;
+}
+
+bool CircularBuffer::WaitForImage(long timeoutMs, unsigned long finishedCount)
+{
+   std::unique_lock<std::mutex> lock(waitMutex_);
+   ++waiterCount_;
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   waitCond_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&] {
+      return GetRemainingImageCount() > 0 ||
+         acqFinishedCount_ != finishedCount;
+   });
+   --waiterCount_;
+   return GetRemainingImageCount() > 0;
+}
+
+void CircularBuffer::NotifyAcquisitionFinished()
+{
+   {
+      std::lock_guard<std::mutex> lock(waitMutex_);
+      ++acqFinishedCount_;
+   }
+   waitCond_.notify_all();
 }
  
 
@@ -348,15 +1106,24 @@ const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(unsigned long n) c
 const mm::ImgBuffer* CircularBuffer::GetNthFromTopImageBuffer(long n,
       unsigned channel) const
 {
-   MMThreadGuard guard(g_bufferLock);
+   if (compressed_)
+   {
+      HeldImages(this).clear();
+      return HoldImage(this, LeaseNthFromTopImage(n, channel));
+   }
+
+   ReaderGuard reader(*this);
+   IndexGuard guard(*this);
 
-   long availableImages = insertIndex_ - saveIndex_;
+   long long saveIndex = saveIndex_.load(std::memory_order_acquire);
+   long long insertIndex = insertIndex_.load(std::memory_order_acquire);
+   long long availableImages = insertIndex - saveIndex;
    if (n + 1 > availableImages)
       return 0;
 
-   long targetIndex = insertIndex_ - n - 1L;
+   long long targetIndex = insertIndex - n - 1L;
    while (targetIndex < 0)
-      targetIndex += (long) frameArray_.size();
+      targetIndex += (long long) frameArray_.size();
    targetIndex %= frameArray_.size();
 
    return frameArray_[targetIndex].FindImage(channel);
@@ -372,13 +1139,323 @@ const unsigned char* CircularBuffer::GetNextImage()
 
 const mm::ImgBuffer* CircularBuffer::GetNextImageBuffer(unsigned channel)
 {
+   if (compressed_)
+   {
+      HeldImages(this).clear();
+      return HoldImage(this, LeaseNextImage(channel));
+   }
+
+   ReaderGuard reader(*this);
+   if (lockFree_)
+   {
+      // Claim the oldest frame; competing readers retry with the next one
+      long long saveIndex = saveIndex_.load(std::memory_order_relaxed);
+      do
+      {
+         if (insertIndex_.load(std::memory_order_acquire) - saveIndex < 1)
+            return 0;
+      } while (!saveIndex_.compare_exchange_weak(saveIndex, saveIndex + 1,
+               std::memory_order_acq_rel, std::memory_order_relaxed));
+      poppedCount_.fetch_add(1, std::memory_order_relaxed);
+      return frameArray_[saveIndex % frameArray_.size()].FindImage(channel);
+   }
+
    MMThreadGuard guard(g_bufferLock);
 
-   long availableImages = insertIndex_ - saveIndex_;
+   long long availableImages = insertIndex_ - saveIndex_;
    if (availableImages < 1)
       return 0;
 
-   long targetIndex = saveIndex_ % frameArray_.size();
+   long long targetIndex = saveIndex_ % frameArray_.size();
    ++saveIndex_;
+   poppedCount_.fetch_add(1, std::memory_order_relaxed);
    return frameArray_[targetIndex].FindImage(channel);
 }
+
+/**
+* Removes up to maxCount of the oldest images from the buffer in one step.
+* The removed images are appended to images, oldest first. Returns the number
+* of images removed.
+*/
+unsigned long CircularBuffer::GetNextImageBuffers(unsigned long maxCount, unsigned channel, std::vector<const mm::ImgBuffer*>& images)
+{
+   if (compressed_)
+   {
+      // Each image is decompressed as it is removed
+      HeldImages(this).clear();
+      unsigned long count = 0;
+      for (; count < maxCount; ++count)
+      {
+         const mm::ImgBuffer* image = HoldImage(this, LeaseNextImage(channel));
+         if (!image)
+            break;
+         images.push_back(image);
+      }
+      return count;
+   }
+
+   ReaderGuard reader(*this);
+   long long firstIndex;
+   long long count;
+   if (lockFree_)
+   {
+      firstIndex = saveIndex_.load(std::memory_order_relaxed);
+      do
+      {
+         count = (std::min)(static_cast<long long>(maxCount),
+               insertIndex_.load(std::memory_order_acquire) - firstIndex);
+         if (count < 1)
+            return 0;
+      } while (!saveIndex_.compare_exchange_weak(firstIndex, firstIndex + count,
+               std::memory_order_acq_rel, std::memory_order_relaxed));
+   }
+   else
+   {
+      MMThreadGuard guard(g_bufferLock);
+
+      firstIndex = saveIndex_;
+      count = (std::min)(static_cast<long long>(maxCount), insertIndex_ - saveIndex_);
+      if (count < 1)
+         return 0;
+      saveIndex_ += count;
+   }
+   poppedCount_.fetch_add(static_cast<unsigned long long>(count),
+         std::memory_order_relaxed);
+
+   images.reserve(images.size() + static_cast<std::size_t>(count));
+   for (long long i = firstIndex; i < firstIndex + count; ++i)
+      images.push_back(frameArray_[i % frameArray_.size()].FindImage(channel));
+   return static_cast<unsigned long>(count);
+}
+
+/**
+* Adds a pin for the frame, unless it may already have been overwritten.
+*/
+bool CircularBuffer::PinFrame(long long frameIndex) const
+{
+   std::lock_guard<std::mutex> lock(pins_->mutex);
+   if (frameIndex < pins_->reclaimedBelow)
+      return false;
+   // Once pinned, the slot and its offset are not reused until unpinned
+   pins_->frames.insert(std::make_pair(frameIndex,
+            slotOffsets_[frameIndex % slotOffsets_.size()]));
+   return true;
+}
+
+/**
+* Creates the lease for a pinned frame, which removes the pin when
+* destroyed. Removes the pin and returns null if there is no such channel.
+*/
+std::shared_ptr<const mm::ImgBuffer> CircularBuffer::LeasePinnedFrame(long long frameIndex, unsigned channel) const
+{
+   const mm::ImgBuffer* source =
+      frameArray_[frameIndex % frameArray_.size()].FindImage(channel);
+   if (!source)
+   {
+      pins_->Unpin(frameIndex);
+      return std::shared_ptr<const mm::ImgBuffer>();
+   }
+
+   mm::ImgBuffer* image = new mm::ImgBuffer(0, 0, source->Depth());
+   image->Attach(const_cast<unsigned char*>(source->GetPixels()),
+         source->Width(), source->Height(), source->Depth());
+   image->GetFrameMetadata() = source->GetFrameMetadata();
+
+   // The slab must outlive the lease, even if this buffer does not
+   std::shared_ptr<FramePins> pins = pins_;
+   std::shared_ptr<mm::BufferMemory> slab = slab_;
+   return std::shared_ptr<const mm::ImgBuffer>(image,
+         [pins, slab, frameIndex](const mm::ImgBuffer* p) {
+            delete p;
+            pins->Unpin(frameIndex);
+         });
+}
+
+/**
+* Creates the lease for a pinned frame in compressed mode, and removes the
+* pin: the newest frame is shared, older ones decompressed. Called without
+* the index lock, so that other threads are not held up by decompression.
+*/
+std::shared_ptr<const mm::ImgBuffer> CircularBuffer::LeaseCompressedFrame(long long frameIndex, unsigned channel) const
+{
+   std::shared_ptr<LiveFrame> live;
+   {
+      std::lock_guard<std::mutex> liveLock(liveMutex_);
+      live = liveFrame_;
+   }
+   if (live && live->frameIndex == frameIndex)
+   {
+      pins_->Unpin(frameIndex);
+      const mm::ImgBuffer* image = live->frame.FindImage(channel);
+      if (!image)
+         return std::shared_ptr<const mm::ImgBuffer>();
+      return std::shared_ptr<const mm::ImgBuffer>(live, image);
+   }
+
+   const mm::ImgBuffer* source =
+      frameArray_[frameIndex % frameArray_.size()].FindImage(channel);
+   if (!source)
+   {
+      pins_->Unpin(frameIndex);
+      return std::shared_ptr<const mm::ImgBuffer>();
+   }
+
+   const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   std::shared_ptr<mm::ImgBuffer> image = std::make_shared<mm::ImgBuffer>(0, 0, source->Depth());
+   image->Resize(source->Width(), source->Height(), source->Depth());
+   image->GetFrameMetadata() = source->GetFrameMetadata();
+   const bool decompressed = mm::DecompressImage(source->GetPixels(),
+         (std::size_t)source->Width() * source->Height() * source->Depth(),
+         source->Depth(), image->GetPixelsRW());
+   pins_->Unpin(frameIndex);
+   if (!decompressed)
+      throw CMMError("Corrupt compressed image in the circular buffer");
+
+   imagesDecompressed_.fetch_add(1, std::memory_order_relaxed);
+   decompressionNs_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+   return image;
+}
+
+std::shared_ptr<const mm::ImgBuffer> CircularBuffer::LeaseNthFromTopImage(long n, unsigned channel) const
+{
+   ReaderGuard reader(*this);
+   long long frameIndex;
+   {
+      IndexGuard guard(*this);
+
+      long long saveIndex = saveIndex_.load(std::memory_order_acquire);
+      long long insertIndex = insertIndex_.load(std::memory_order_acquire);
+      if (n < 0 || n + 1 > insertIndex - saveIndex)
+         return std::shared_ptr<const mm::ImgBuffer>();
+
+      // If the frame has been popped and overwritten in the meantime
+      // (lock-free mode), pinning fails
+      frameIndex = insertIndex - n - 1L;
+      if (!PinFrame(frameIndex))
+         return std::shared_ptr<const mm::ImgBuffer>();
+      if (!compressed_)
+         return LeasePinnedFrame(frameIndex, channel);
+   }
+   return LeaseCompressedFrame(frameIndex, channel);
+}
+
+std::shared_ptr<const mm::ImgBuffer> CircularBuffer::LeaseNextImage(unsigned channel)
+{
+   ReaderGuard reader(*this);
+   if (lockFree_)
+   {
+      // Pin the oldest frame before claiming it, so that it cannot be
+      // overwritten as soon as it is claimed
+      for (;;)
+      {
+         long long saveIndex = saveIndex_.load(std::memory_order_acquire);
+         if (insertIndex_.load(std::memory_order_acquire) - saveIndex < 1)
+            return std::shared_ptr<const mm::ImgBuffer>();
+         if (!PinFrame(saveIndex))
+            continue; // Claimed by another reader in the meantime
+         const long long frameIndex = saveIndex;
+         if (saveIndex_.compare_exchange_strong(saveIndex, saveIndex + 1,
+                  std::memory_order_acq_rel, std::memory_order_relaxed))
+         {
+            poppedCount_.fetch_add(1, std::memory_order_relaxed);
+            return compressed_ ? LeaseCompressedFrame(frameIndex, channel) :
+               LeasePinnedFrame(frameIndex, channel);
+         }
+         pins_->Unpin(frameIndex);
+      }
+   }
+
+   long long frameIndex;
+   {
+      MMThreadGuard guard(g_bufferLock);
+
+      if (insertIndex_ - saveIndex_ < 1)
+         return std::shared_ptr<const mm::ImgBuffer>();
+      frameIndex = saveIndex_;
+      if (!PinFrame(frameIndex))
+         return std::shared_ptr<const mm::ImgBuffer>();
+      ++saveIndex_;
+      poppedCount_.fetch_add(1, std::memory_order_relaxed);
+      if (!compressed_)
+         return LeasePinnedFrame(frameIndex, channel);
+   }
+   return LeaseCompressedFrame(frameIndex, channel);
+}
+
+/**
+* Removes up to maxCount of the oldest images from the buffer in one step, and
+* appends leases of them to images, oldest first. Returns the number of images
+* removed (leases are null for frames lacking the channel).
+*/
+unsigned long CircularBuffer::LeaseNextImages(unsigned long maxCount, unsigned channel,
+      std::vector<std::shared_ptr<const mm::ImgBuffer>>& images)
+{
+   ReaderGuard reader(*this);
+   long long firstIndex;
+   long long count;
+   if (lockFree_)
+   {
+      // Pin the frames before claiming them, as in LeaseNextImage()
+      for (;;)
+      {
+         firstIndex = saveIndex_.load(std::memory_order_acquire);
+         count = (std::min)(static_cast<long long>(maxCount),
+               insertIndex_.load(std::memory_order_acquire) - firstIndex);
+         if (count < 1)
+            return 0;
+         // Once the first frame is pinned, the later ones cannot be
+         // reclaimed either
+         if (!PinFrame(firstIndex))
+            continue; // Claimed by another reader in the meantime
+         for (long long i = firstIndex + 1; i < firstIndex + count; ++i)
+            PinFrame(i);
+         long long expected = firstIndex;
+         if (saveIndex_.compare_exchange_strong(expected, firstIndex + count,
+                  std::memory_order_acq_rel, std::memory_order_relaxed))
+            break;
+         for (long long i = firstIndex; i < firstIndex + count; ++i)
+            pins_->Unpin(i);
+      }
+   }
+   else
+   {
+      MMThreadGuard guard(g_bufferLock);
+
+      firstIndex = saveIndex_;
+      count = (std::min)(static_cast<long long>(maxCount), insertIndex_ - saveIndex_);
+      if (count < 1)
+         return 0;
+      if (!PinFrame(firstIndex))
+         return 0;
+      for (long long i = firstIndex + 1; i < firstIndex + count; ++i)
+         PinFrame(i);
+      saveIndex_ += count;
+   }
+   poppedCount_.fetch_add(static_cast<unsigned long long>(count),
+         std::memory_order_relaxed);
+
+   // Pinned frames stay in place without the index lock
+   images.reserve(images.size() + static_cast<std::size_t>(count));
+   long long i = firstIndex;
+   try
+   {
+      for (; i < firstIndex + count; ++i)
+         images.push_back(compressed_ ? LeaseCompressedFrame(i, channel) :
+               LeasePinnedFrame(i, channel));
+   }
+   catch (...)
+   {
+      // Frame i was unpinned by its (failed) lease
+      for (++i; i < firstIndex + count; ++i)
+         pins_->Unpin(i);
+      throw;
+   }
+   return static_cast<unsigned long>(count);
+}
+
+unsigned long CircularBuffer::GetLeaseCount() const
+{
+   std::lock_guard<std::mutex> lock(pins_->mutex);
+   return static_cast<unsigned long>(pins_->frames.size());
+}
@@ -24,6 +24,7 @@
 
 #pragma once
 
+#include "BufferMemory.h"
 #include "Error.h"
 #include "ErrorCodes.h"
 #include "FrameBuffer.h"
@@ -31,8 +32,11 @@
 #include "../MMDevice/DeviceThreads.h"
 #include "../MMDevice/MMDevice.h"
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -47,17 +51,31 @@
 #endif
 
 class ThreadPool;
+class TaskSet_CompressFrame;
 class TaskSet_CopyMemory;
+class TaskSet_PixelStatistics;
+
+namespace mm {
+class SharedBufferExport;
+}
 
 class CircularBuffer
 {
 public:
-   CircularBuffer(unsigned int memorySizeMB);
+   // The memory is allocated on the first call to Initialize(), which throws
+   // if it cannot be allocated with the given options. Copies and
+   // pre-faulting run on threadPool (the Core's pool); the buffer creates a
+   // pool of its own if none is given.
+   CircularBuffer(unsigned int memorySizeMB,
+         const mm::BufferAllocationOptions& allocationOptions = mm::BufferAllocationOptions(),
+         mm::BufferMemory::ProgressFunction allocationProgress = mm::BufferMemory::ProgressFunction(),
+         std::shared_ptr<ThreadPool> threadPool = std::shared_ptr<ThreadPool>());
    ~CircularBuffer();
 
    unsigned GetMemorySizeMB() const { return memorySizeMB_; }
+   const mm::BufferAllocationOptions& GetAllocationOptions() const { return allocationOptions_; }
 
-   bool Initialize(unsigned channels, unsigned int xSize, unsigned int ySize, unsigned int pixDepth);
+   bool Initialize(unsigned channels, unsigned int xSize, unsigned int ySize, unsigned int pixDepth) throw (CMMError);
    unsigned long GetSize() const;
    unsigned long GetFreeSize() const;
    unsigned long GetRemainingImageCount() const;
@@ -70,40 +88,267 @@ public:
    bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, const Metadata* pMd) throw (CMMError);
    bool InsertImage(const unsigned char* pixArray, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
    bool InsertMultiChannel(const unsigned char* pixArray, unsigned int numChannels, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents, const Metadata* pMd) throw (CMMError);
+
+   // Zero-copy insertion into a single-channel buffer: the caller fills the
+   // returned slot in place and then commits or aborts it. g_insertLock is
+   // held in between, blocking other inserts, so the slot should only be
+   // held for as long as it takes to transfer the pixels. Aborting leaves
+   // the buffer as it was: no frame is discarded before the commit.
+   unsigned char* AcquireWriteSlot(unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents) throw (CMMError);
+   unsigned char* GetWriteSlot() const;
+   unsigned int GetWriteSlotComponents() const { return writeSlotComponents_; }
+   bool CommitWriteSlot(const Metadata* pMd);
+   void AbortWriteSlot();
+
    const unsigned char* GetTopImage() const;
    const unsigned char* GetNextImage();
    const mm::ImgBuffer* GetTopImageBuffer(unsigned channel) const;
    const mm::ImgBuffer* GetNthFromTopImageBuffer(unsigned long n) const;
    const mm::ImgBuffer* GetNthFromTopImageBuffer(long n, unsigned channel) const;
    const mm::ImgBuffer* GetNextImageBuffer(unsigned channel);
+   unsigned long GetNextImageBuffers(unsigned long maxCount, unsigned channel, std::vector<const mm::ImgBuffer*>& images);
+
+   // Leases: like GetNthFromTopImageBuffer() and GetNextImageBuffer(), but
+   // the returned image (a copy of the frame's header, with the pixels in
+   // place) keeps the frame's pixels from being overwritten until it is
+   // destroyed, even if the frame is popped, the buffer cleared, or the
+   // buffer itself destroyed. Inserts treat leased frames (and the frames
+   // after them) like unread frames, so the buffer fills up if leases are
+   // held for long. Returns null if there is no such image.
+   // In compressed mode, the image holds decompressed pixels of its own
+   // (or shares those of the newest frame), and holds no frame.
+   std::shared_ptr<const mm::ImgBuffer> LeaseNthFromTopImage(long n, unsigned channel) const;
+   std::shared_ptr<const mm::ImgBuffer> LeaseNextImage(unsigned channel);
+   // Like GetNextImageBuffers(), but appends leases
+   unsigned long LeaseNextImages(unsigned long maxCount, unsigned channel,
+         std::vector<std::shared_ptr<const mm::ImgBuffer>>& images);
+   unsigned long GetLeaseCount() const;
    void Clear(); 
 
-   bool Overflow() {MMThreadGuard guard(g_bufferLock); return overflow_;}
+   // Blocking wait for inserted images. WaitForImage() returns true once an
+   // image is available, or false on timeout or when
+   // NotifyAcquisitionFinished() has been called since finishedCount was
+   // obtained from GetAcquisitionFinishedCount().
+   unsigned long GetAcquisitionFinishedCount() const;
+   bool WaitForImage(long timeoutMs, unsigned long finishedCount);
+   void NotifyAcquisitionFinished();
+
+   bool Overflow() {IndexGuard guard(*this); return overflow_;}
+
+   // Ring mode: when the buffer is full, inserts discard the oldest unread
+   // frame(s) to make room instead of failing. Overflow() then stays false
+   // and the discarded frames are counted by GetDroppedCount() (reset by
+   // Clear()).
+   void SetOverwriteOldest(bool overwrite);
+   bool GetOverwriteOldest() const { return overwriteOldest_; }
+   unsigned long long GetDroppedCount() const { return droppedCount_.load(); }
+
+   // Acquisition health: the number of frames removed by readers, and the
+   // largest number of unread frames seen after an insert (both reset by
+   // Clear())
+   unsigned long long GetPoppedCount() const { return poppedCount_.load(std::memory_order_relaxed); }
+   long long GetHighWaterMark() const { return highWaterMark_.load(std::memory_order_relaxed); }
+
+   // Whether the indices are published with atomics instead of g_bufferLock
+   // (selected by the LockFreeSequenceBuffer Core feature at Initialize())
+   bool IsLockFree() const { return lockFree_; }
+
+   // Whether frames are stored compressed (selected by the
+   // CompressedSequenceBuffer Core feature at Initialize(); never for a
+   // shared buffer). Frames are compressed on the thread pool as they are
+   // inserted, so that several times more of them fit in the buffer, and
+   // decompressed by the thread reading them. The newest frame is also kept
+   // uncompressed, so that displaying it costs nothing. The images returned
+   // as plain pointers (GetTopImage(), GetNextImageBuffer(), etc.) then
+   // remain valid until the calling thread's next call of one of them on
+   // the same buffer.
+   bool IsCompressed() const { return compressed_; }
+
+   // Compression costs since the buffer was last cleared
+   struct CompressionStatistics
+   {
+      unsigned long long framesCompressed;
+      unsigned long long rawBytes;
+      unsigned long long compressedBytes;
+      std::chrono::nanoseconds compressionTime; // Of inserts
+      std::chrono::nanoseconds compressionCpuTime; // Summed over the threads
+      unsigned long long imagesDecompressed;
+      std::chrono::nanoseconds decompressionTime;
+   };
+   CompressionStatistics GetCompressionStatistics() const;
+
+   // Per-frame pixel statistics (FramePixelStatistics Core feature): when
+   // enabled, the statistics of each grayscale image are computed on the
+   // thread pool before the frame is made available, and stored in its
+   // metadata. bitDepth sets the saturation level and the histogram range;
+   // histogramBins is 0 (no histogram), 256 or 4096.
+   void SetPixelStatistics(bool enable, unsigned bitDepth, unsigned histogramBins);
 
    mutable MMThreadLock g_bufferLock;
    mutable MMThreadLock g_insertLock;
 
 private:
+   // Holds g_bufferLock unless the buffer is in lock-free mode
+   class IndexGuard
+   {
+   public:
+      explicit IndexGuard(const CircularBuffer& cb) :
+         lock_(cb.lockFree_ ? 0 : &cb.g_bufferLock)
+      { if (lock_) lock_->Lock(); }
+      ~IndexGuard() { if (lock_) lock_->Unlock(); }
+   private:
+      IndexGuard(const IndexGuard&);
+      IndexGuard& operator=(const IndexGuard&);
+      MMThreadLock* lock_;
+   };
+
+   // Registers a reader of frameArray_ and slotOffsets_ for its lifetime.
+   // Initialize() waits for registered readers before resizing them, and
+   // readers arriving in the meantime wait for it to finish, so that readers
+   // in lock-free mode need no lock. Must not be nested on one thread.
+   class ReaderGuard
+   {
+   public:
+      explicit ReaderGuard(const CircularBuffer& cb);
+      ~ReaderGuard() { cb_.activeReaders_.fetch_sub(1, std::memory_order_release); }
+   private:
+      ReaderGuard(const ReaderGuard&);
+      ReaderGuard& operator=(const ReaderGuard&);
+      const CircularBuffer& cb_;
+   };
+
+   // Held by Initialize() (with g_insertLock) while it may resize the slots
+   class ResizeGuard
+   {
+   public:
+      explicit ResizeGuard(CircularBuffer& cb);
+      ~ResizeGuard() { cb_.resizing_.store(false, std::memory_order_release); }
+   private:
+      ResizeGuard(const ResizeGuard&);
+      ResizeGuard& operator=(const ResizeGuard&);
+      CircularBuffer& cb_;
+   };
+
+   long long RetainedFrameIndex(std::size_t& offset, bool& pinned);
+   bool IsFull(long long retainedIndex) const;
+   bool FindFrameOffset(std::size_t bytes, long long retainedIndex, std::size_t retainedOffset, std::size_t& offset) const;
+   unsigned char* ReserveFrameBytes(std::size_t bytes, long long retainedIndex, std::size_t retainedOffset);
+   unsigned char* ReserveFrame(std::size_t bytes);
+   bool DropOldestFrame();
+   bool PinFrame(long long frameIndex) const;
+   std::shared_ptr<const mm::ImgBuffer> LeasePinnedFrame(long long frameIndex, unsigned channel) const;
+   struct LiveFrame;
+   LiveFrame& PrepareLiveFrame();
+   bool StoreStagedWriteSlot();
+   void WriteCompressedFrame(unsigned char* pixels, std::size_t rawBytes,
+         std::size_t compressedBytes, std::chrono::steady_clock::time_point start);
+   std::shared_ptr<const mm::ImgBuffer> LeaseCompressedFrame(long long frameIndex, unsigned channel) const;
+   void AssignImageNumber(mm::FrameMetadata& md);
+   void AddStandardTags(mm::FrameMetadata& md, unsigned int width, unsigned int height, unsigned int byteDepth, unsigned int nComponents) const;
+   void PublishInsertedFrame(unsigned numChannels);
+   void ComputePixelStatistics(unsigned numChannels, unsigned nComponents);
+   void WakeWaiters();
+
    unsigned int width_;
    unsigned int height_;
    unsigned int pixDepth_;
    long imageCounter_;
    std::chrono::time_point<std::chrono::steady_clock> startTime_;
    std::map<std::string, long> imageNumbers_;
+   // Entry of the camera that inserted last, so that consecutive images
+   // from the same camera do not need a map lookup
+   std::map<std::string, long>::iterator lastImageNumber_;
+   // Metadata shared by the channels of the frame being inserted (only used
+   // with g_insertLock held)
+   mm::FrameMetadata insertMetadata_;
 
    // Invariants:
    // 0 <= saveIndex_ <= insertIndex_
    // insertIndex_ - saveIndex_ <= frameArray_.size()
-   long insertIndex_;
-   long saveIndex_;
+   // Both only ever increase (so that leases can refer to frames by index).
+   // In lock-free mode, insertIndex_ is only advanced by the thread holding
+   // g_insertLock (release), and saveIndex_ by readers using CAS (acq_rel).
+   // Everything else (frameArray_, dimensions, image numbers) only changes
+   // with g_insertLock held, so the producer needs no other lock.
+   std::atomic<long long> insertIndex_;
+   std::atomic<long long> saveIndex_;
 
    unsigned long memorySizeMB_;
    unsigned int numChannels_;
-   bool overflow_;
+   std::atomic<bool> overflow_;
+   std::atomic<bool> overwriteOldest_;
+   std::atomic<unsigned long long> droppedCount_;
+   std::atomic<unsigned long long> poppedCount_;
+   std::atomic<long long> highWaterMark_; // Only written with g_insertLock held
+   std::atomic<bool> lockFree_;
+   mutable std::atomic<int> activeReaders_; // See ReaderGuard
+   std::atomic<bool> resizing_;
+   // Frames are stored back to back (wrapping around) in a single slab,
+   // allocated once. The slots of frameArray_ hold the per-frame headers
+   // (dimensions and metadata) and point into the slab; slotOffsets_ holds
+   // the slab offset of each slot's frame. writeOffset_ and slotOffsets_
+   // only change with g_insertLock held.
    std::vector<mm::FrameBuffer> frameArray_;
+   mm::BufferAllocationOptions allocationOptions_;
+   mm::BufferMemory::ProgressFunction allocationProgress_;
+   std::shared_ptr<mm::BufferMemory> slab_; // Shared with leases
+   unsigned char* slabData_; // Follows the shared header, if any
+   std::size_t slabSize_;
+   std::size_t writeOffset_;
+   std::vector<std::size_t> slotOffsets_;
+   // Set if the slab is a shared memory segment (allocation option
+   // sharedMemoryName); only used with g_insertLock held.
+   std::unique_ptr<mm::SharedBufferExport> sharedExport_;
+
+   // Leased frames, shared with the leases
+   struct FramePins;
+   std::shared_ptr<FramePins> pins_;
+
+   // Pixels of the slot handed out by AcquireWriteSlot(), non-null while it
+   // is pending. The slot is either reserved in the slab right away, or
+   // staged (in the live frame in compressed mode, otherwise in
+   // stagedSlot_) when making room would discard or invalidate frames, and
+   // only stored on commit. The rest is only used with g_insertLock held.
+   std::atomic<unsigned char*> writeSlot_;
+   unsigned int writeSlotComponents_;
+   bool writeSlotStaged_;
+   bool writeSlotReserved_; // Slab space taken, returned on abort
+   std::size_t writeSlotPreviousOffset_; // writeOffset_ before reserving
+   std::vector<unsigned char> stagedSlot_;
+
+   // Waiters in WaitForImage(); inserts only notify when there are any
+   mutable std::mutex waitMutex_;
+   std::condition_variable waitCond_;
+   std::atomic<int> waiterCount_;
+   unsigned long acqFinishedCount_; // Guarded by waitMutex_
 
    std::shared_ptr<ThreadPool> threadPool_;
    std::shared_ptr<TaskSet_CopyMemory> tasksMemCopy_;
+
+   // Pixel statistics settings; only used with g_insertLock held
+   bool pixelStatsEnabled_;
+   unsigned pixelStatsBitDepth_;
+   unsigned pixelStatsHistogramBins_;
+   std::shared_ptr<TaskSet_PixelStatistics> tasksPixelStats_;
+   mm::PixelStatistics pixelStats_; // Reused to avoid allocations
+
+   // Compressed mode (see IsCompressed()). The frame being inserted is
+   // written uncompressed to pendingLiveFrame_ (picked from liveFrames_ by
+   // PrepareLiveFrame()), which becomes liveFrame_ when it is published.
+   std::atomic<bool> compressed_;
+   std::shared_ptr<TaskSet_CompressFrame> tasksCompress_;
+   std::shared_ptr<LiveFrame> liveFrame_; // Guarded by liveMutex_
+   mutable std::mutex liveMutex_;
+   // Only used with g_insertLock held
+   std::vector<std::shared_ptr<LiveFrame>> liveFrames_;
+   std::shared_ptr<LiveFrame> pendingLiveFrame_;
+   std::atomic<unsigned long long> framesCompressed_;
+   std::atomic<unsigned long long> rawBytesCompressed_;
+   std::atomic<unsigned long long> compressedBytes_;
+   std::atomic<long long> compressionNs_;
+   std::atomic<long long> compressionCpuNs_;
+   mutable std::atomic<unsigned long long> imagesDecompressed_;
+   mutable std::atomic<long long> decompressionNs_;
 };
 
 #if defined(__GNUC__) && !defined(__clang__)
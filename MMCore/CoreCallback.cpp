@@ -30,10 +30,12 @@
 #include "../MMDevice/ImgBuffer.h"
 #include "CircularBuffer.h"
 #include "CoreCallback.h"
+#include "CoreFeatures.h"
 #include "DeviceManager.h"
 
 #include <cassert>
 #include <chrono>
+#include <cstdlib>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -206,99 +208,281 @@ CoreCallback::Sleep(const MM::Device*, double intervalMs)
 
 
 /**
- * Get the metadata tags attached to device caller, and merge them with metadata
- * in pMd (if not null). Returns a metadata object.
+ * Get the metadata tags attached to device caller, and merge them with the
+ * metadata in md.
  */
-Metadata
-CoreCallback::AddCameraMetadata(const MM::Device* caller, const Metadata* pMd)
+std::shared_ptr<CameraInstance>
+CoreCallback::AddCameraMetadata(const MM::Device* caller, Metadata& md)
 {
-   Metadata newMD;
-   if (pMd)
-   {
-      newMD = *pMd;
-   }
-
    std::shared_ptr<CameraInstance> camera =
       std::static_pointer_cast<CameraInstance>(
             core_->deviceManager_->GetDevice(caller));
 
    std::string label = camera->GetLabel();
-   newMD.put(MM::g_Keyword_Metadata_CameraLabel, label);
+   md.put(MM::g_Keyword_Metadata_CameraLabel, label);
 
-   std::string serializedMD;
    try
    {
-      serializedMD = camera->GetTags();
+      camera->MergeCachedTags(md);
    }
    catch (const CMMError&)
    {
-      return newMD;
    }
-
-   Metadata devMD;
-   devMD.Restore(serializedMD.c_str());
-   newMD.Merge(devMD);
-
-   return newMD;
+   return camera;
 }
 
-int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess)
+/**
+ * Count a frame from caller that did not fit in the sequence buffer.
+ */
+void
+CoreCallback::RecordRejectedFrame(const MM::Device* caller)
 {
-   Metadata md;
-   md.Restore(serializedMetadata);
-   return InsertImage(caller, buf, width, height, byteDepth, &md, doProcess);
+   std::shared_ptr<CameraInstance> camera;
+   try
+   {
+      camera = std::dynamic_pointer_cast<CameraInstance>(
+            core_->deviceManager_->GetDevice(caller));
+   }
+   catch (const CMMError&)
+   {
+   }
+   if (camera)
+      camera->GetAcquisitionStatistics().RecordRejected();
 }
 
-int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd, bool doProcess)
+/**
+ * Check the hardware frame number and timestamp that camera attached to md,
+ * if any, against those of its previous image. Anomalies are counted in the
+ * camera's acquisition statistics, logged, and, if enabled, sent to the
+ * MMEventCallback. Tags with values that are not numbers are ignored.
+ */
+void
+CoreCallback::CheckHardwareFrameTags(CameraInstance& camera, Metadata& md)
 {
-   try 
+   mm::AcquisitionStatistics& stats = camera.GetAcquisitionStatistics();
+
+   if (md.HasTag(MM::g_Keyword_Metadata_HardwareFrameNumber))
    {
-      Metadata md = AddCameraMetadata(caller, pMd);
+      const std::string value = md.GetSingleTag(
+            MM::g_Keyword_Metadata_HardwareFrameNumber).GetValue();
+      char* end;
+      const long long frameNumber = std::strtoll(value.c_str(), &end, 10);
+      if (end != value.c_str() && *end == '\0' && frameNumber >= 0)
+      {
+         const long long previous = stats.RecordHardwareFrameNumber(frameNumber);
+         if (previous >= 0 && frameNumber != previous + 1)
+         {
+            const std::string label = camera.GetLabel();
+            LOG_WARNING(core_->coreLogger_) << "Camera " << label <<
+               ": hardware frame number " << frameNumber <<
+               " follows " << previous;
+            if (core_->frameGapEventsEnabled_ && core_->externalCallback_)
+            {
+               MMThreadGuard g(*pValueChangeLock_);
+               core_->externalCallback_->onHardwareFrameGap(label.c_str(),
+                     previous, frameNumber);
+            }
+         }
+      }
+   }
 
-      if(doProcess)
+   if (md.HasTag(MM::g_Keyword_Metadata_HardwareTimestamp))
+   {
+      const std::string value = md.GetSingleTag(
+            MM::g_Keyword_Metadata_HardwareTimestamp).GetValue();
+      char* end;
+      const double timestampUs = std::strtod(value.c_str(), &end);
+      if (end != value.c_str() && *end == '\0')
       {
-         MM::ImageProcessor* ip = GetImageProcessor(caller);
-         if( NULL != ip)
+         double previousUs;
+         if (!stats.RecordHardwareTimestamp(timestampUs, previousUs))
          {
-            ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
+            const std::string label = camera.GetLabel();
+            LOG_WARNING(core_->coreLogger_) << "Camera " << label <<
+               ": hardware timestamp " << value << " us does not follow " <<
+               previousUs << " us";
+            if (core_->frameGapEventsEnabled_ && core_->externalCallback_)
+            {
+               MMThreadGuard g(*pValueChangeLock_);
+               core_->externalCallback_->onHardwareTimestampRegression(
+                     label.c_str(), previousUs, timestampUs);
+            }
          }
       }
-      if (core_->cbuf_->InsertImage(buf, width, height, byteDepth, &md))
-         return DEVICE_OK;
-      else
-         return DEVICE_BUFFER_OVERFLOW;
    }
-   catch (CMMError& /*e*/)
+}
+
+/**
+ * Return the sequence buffer that images from caller go to: the camera's own
+ * buffer (PerCameraSequenceBuffers feature) if it has one, otherwise the
+ * Core's shared buffer.
+ *
+ * A camera's own buffer is only replaced while the camera is not capturing,
+ * so the returned pointer remains valid while an image is being inserted.
+ */
+CircularBuffer*
+CoreCallback::GetSequenceBuffer(const MM::Device* caller)
+{
+   std::shared_ptr<CameraInstance> camera;
+   try
    {
-      return DEVICE_INCOMPATIBLE_IMAGE;
+      camera = std::dynamic_pointer_cast<CameraInstance>(
+            core_->deviceManager_->GetDevice(caller));
+   }
+   catch (const CMMError&)
+   {
+   }
+   if (camera)
+   {
+      std::shared_ptr<CircularBuffer> buffer = camera->GetSequenceBuffer();
+      if (buffer)
+         return buffer.get();
+   }
+   return core_->cbuf_;
+}
+
+/**
+ * Copy an image from caller to the camera's latest frame buffer
+ * (LatestFrameBuffers feature), whether or not it fit in the sequence
+ * buffer.
+ */
+void
+CoreCallback::PublishLatestFrame(const MM::Device* caller,
+      const unsigned char* buf, unsigned width, unsigned height,
+      unsigned byteDepth, unsigned nComponents, const Metadata& md)
+{
+   if (!mm::features::flags().latestFrameBuffers)
+      return;
+   std::shared_ptr<CameraInstance> camera =
+      std::dynamic_pointer_cast<CameraInstance>(
+            core_->deviceManager_->GetDevice(caller));
+   if (camera)
+      camera->GetLatestFrameBuffer().Publish(buf, width, height, byteDepth,
+            nComponents, md);
+}
+
+/**
+ * Copy metadata received from a device into md.
+ *
+ * Each tag is rebuilt by the Core from its name, device and values, so that
+ * md does not share tag objects (or their vtables) with the device adapter
+ * module, without serializing the metadata to text.
+ */
+void
+CoreCallback::CopyDeviceMetadata(const Metadata* pMd, Metadata& md)
+{
+   struct Copier
+   {
+      Metadata& target;
+      void operator()(const MetadataTag& tag)
+      {
+         if (const MetadataSingleTag* single = tag.ToSingleTag())
+         {
+            MetadataSingleTag copy(tag.GetName().c_str(),
+                  tag.GetDevice().c_str(), tag.IsReadOnly());
+            copy.SetValue(single->GetValue().c_str());
+            target.SetTag(copy);
+         }
+         else if (const MetadataArrayTag* array = tag.ToArrayTag())
+         {
+            MetadataArrayTag copy(tag.GetName().c_str(),
+                  tag.GetDevice().c_str(), tag.IsReadOnly());
+            for (std::size_t i = 0; i < array->GetSize(); ++i)
+               copy.AddValue(array->GetValue(i).c_str());
+            target.SetTag(copy);
+         }
+      }
+   } copier = { md };
+
+   if (pMd)
+      pMd->VisitTags(copier);
+}
+
+/**
+ * Set image tags from the key-value pairs passed by a device.
+ */
+void
+CoreCallback::PutImageTags(const char* const* keys, const char* const* values,
+      unsigned count, Metadata& md)
+{
+   if (!keys || !values)
+      return;
+   for (unsigned i = 0; i < count; ++i)
+   {
+      if (!keys[i] || !values[i])
+         continue;
+      MetadataSingleTag tag(keys[i], "_", true);
+      tag.SetValue(values[i]);
+      md.SetTag(tag);
    }
 }
 
+int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess)
+{
+   return InsertImage(caller, buf, width, height, byteDepth, 1, serializedMetadata, doProcess);
+}
+
+int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd, bool doProcess)
+{
+   return InsertImage(caller, buf, width, height, byteDepth, 1, pMd, doProcess);
+}
+
 int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const char* serializedMetadata, const bool doProcess)
 {
    Metadata md;
    md.Restore(serializedMetadata);
-   return InsertImage(caller, buf, width, height, byteDepth, nComponents, &md, doProcess);
+   return InsertImageWithMetadata(caller, buf, width, height, byteDepth, nComponents, md, doProcess);
 }
 
 int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd, bool doProcess)
+{
+   Metadata md;
+   CopyDeviceMetadata(pMd, md);
+   return InsertImageWithMetadata(caller, buf, width, height, byteDepth, nComponents, md, doProcess);
+}
+
+int CoreCallback::InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const char* const* mdKeys, const char* const* mdValues, unsigned mdCount, const bool doProcess)
+{
+   Metadata md;
+   PutImageTags(mdKeys, mdValues, mdCount, md);
+   return InsertImageWithMetadata(caller, buf, width, height, byteDepth, nComponents, md, doProcess);
+}
+
+/**
+ * Common implementation of the InsertImage() variants. md must have been
+ * created by the Core; camera tags are merged into it in place.
+ */
+int CoreCallback::InsertImageWithMetadata(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, Metadata& md, bool doProcess)
 {
    try 
    {
-      Metadata md = AddCameraMetadata(caller, pMd);
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      std::shared_ptr<CameraInstance> camera = AddCameraMetadata(caller, md);
+      CheckHardwareFrameTags(*camera, md);
+      mm::AcquisitionStatistics& stats = camera->GetAcquisitionStatistics();
+      mm::AcquisitionStatistics::StageTimer timer(stats, start);
+      timer.EndStage(mm::AcquisitionStatistics::StageMetadata);
 
       if(doProcess)
       {
          MM::ImageProcessor* ip = GetImageProcessor(caller);
          if( NULL != ip)
          {
+            timer.SkipStage();
             ip->Process(const_cast<unsigned char*>(buf), width, height, byteDepth);
+            timer.EndStage(mm::AcquisitionStatistics::StageProcessing);
          }
       }
-      if (core_->cbuf_->InsertImage(buf, width, height, byteDepth, nComponents, &md))
+      const bool inserted = GetSequenceBuffer(caller)->InsertImage(buf, width, height, byteDepth, nComponents, &md);
+      timer.EndStage(mm::AcquisitionStatistics::StageCopy);
+      PublishLatestFrame(caller, buf, width, height, byteDepth, nComponents, md);
+      if (inserted)
+      {
+         stats.RecordInserted();
          return DEVICE_OK;
-      else
-         return DEVICE_BUFFER_OVERFLOW;
+      }
+      stats.RecordRejected();
+      return DEVICE_BUFFER_OVERFLOW;
    }
    catch (CMMError& /*e*/)
    {
@@ -320,9 +504,108 @@ int CoreCallback::InsertImage(const MM::Device* caller, const ImgBuffer & imgBuf
       imgBuf.Height(), imgBuf.Depth(), &md);
 }
 
-void CoreCallback::ClearImageBuffer(const MM::Device* /*caller*/)
+int CoreCallback::AcquireWritableFrame(const MM::Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, unsigned char** ppBuf)
 {
-   core_->cbuf_->Clear();
+   if (!ppBuf)
+      return DEVICE_INVALID_INPUT_PARAM;
+
+   try
+   {
+      unsigned char* pSlot = GetSequenceBuffer(caller)->AcquireWriteSlot(width, height, byteDepth, nComponents);
+      if (!pSlot)
+      {
+         RecordRejectedFrame(caller);
+         return DEVICE_BUFFER_OVERFLOW;
+      }
+      *ppBuf = pSlot;
+      return DEVICE_OK;
+   }
+   catch (CMMError& /*e*/)
+   {
+      return DEVICE_INCOMPATIBLE_IMAGE;
+   }
+}
+
+int CoreCallback::CommitFrame(const MM::Device* caller, const char* serializedMetadata, const bool doProcess)
+{
+   Metadata md;
+   md.Restore(serializedMetadata);
+   return CommitFrameWithMetadata(caller, md, doProcess);
+}
+
+int CoreCallback::CommitFrame(const MM::Device* caller, const char* const* mdKeys, const char* const* mdValues, unsigned mdCount, const bool doProcess)
+{
+   Metadata md;
+   PutImageTags(mdKeys, mdValues, mdCount, md);
+   return CommitFrameWithMetadata(caller, md, doProcess);
+}
+
+int CoreCallback::CommitFrameWithMetadata(const MM::Device* caller, Metadata& md, bool doProcess)
+{
+   CircularBuffer* cbuf = GetSequenceBuffer(caller);
+   unsigned char* pSlot = cbuf->GetWriteSlot();
+   if (!pSlot)
+      return DEVICE_ERR;
+
+   try
+   {
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      std::shared_ptr<CameraInstance> camera = AddCameraMetadata(caller, md);
+      CheckHardwareFrameTags(*camera, md);
+      mm::AcquisitionStatistics& stats = camera->GetAcquisitionStatistics();
+      mm::AcquisitionStatistics::StageTimer timer(stats, start);
+      timer.EndStage(mm::AcquisitionStatistics::StageMetadata);
+
+      if (doProcess)
+      {
+         MM::ImageProcessor* ip = GetImageProcessor(caller);
+         if (NULL != ip)
+         {
+            timer.SkipStage();
+            ip->Process(pSlot, cbuf->Width(), cbuf->Height(), cbuf->Depth());
+            timer.EndStage(mm::AcquisitionStatistics::StageProcessing);
+         }
+      }
+
+      // Before committing, while the slot cannot be reused
+      PublishLatestFrame(caller, pSlot, cbuf->Width(), cbuf->Height(),
+            cbuf->Depth(), cbuf->GetWriteSlotComponents(), md);
+
+      // The pixels are already in place; this is the cost of committing
+      timer.SkipStage();
+      if (cbuf->CommitWriteSlot(&md))
+      {
+         timer.EndStage(mm::AcquisitionStatistics::StageCopy);
+         stats.RecordInserted();
+         return DEVICE_OK;
+      }
+      // In compressed mode, whether the frame fits is only known now
+      if (cbuf->Overflow())
+      {
+         RecordRejectedFrame(caller);
+         return DEVICE_BUFFER_OVERFLOW;
+      }
+      return DEVICE_ERR;
+   }
+   catch (...)
+   {
+      // E.g. unregistered caller, or std::bad_alloc; do not leave the slot
+      // (and the insert lock) held, nor let the exception reach the device
+      // module.
+      cbuf->AbortWriteSlot();
+      return DEVICE_ERR;
+   }
+}
+
+int CoreCallback::AbortFrame(const MM::Device* caller)
+{
+   GetSequenceBuffer(caller)->AbortWriteSlot();
+   return DEVICE_OK;
+}
+
+void CoreCallback::ClearImageBuffer(const MM::Device* caller)
+{
+   GetSequenceBuffer(caller)->Clear();
 }
 
 bool CoreCallback::InitializeImageBuffer(unsigned channels, unsigned slices,
@@ -332,7 +615,17 @@ bool CoreCallback::InitializeImageBuffer(unsigned channels, unsigned slices,
    if (slices != 1)
       return false;
 
-   return core_->cbuf_->Initialize(channels, w, h, pixDepth);
+   // There is no caller argument, so this always applies to the shared
+   // buffer, not to a camera's own buffer.
+   try
+   {
+      return core_->cbuf_->Initialize(channels, w, h, pixDepth);
+   }
+   catch (const CMMError& e)
+   {
+      LOG_ERROR(core_->coreLogger_) << e.getMsg();
+      return false;
+   }
 }
 
 int CoreCallback::InsertMultiChannel(const MM::Device* caller,
@@ -345,17 +638,33 @@ int CoreCallback::InsertMultiChannel(const MM::Device* caller,
 {
    try
    {
-      Metadata md = AddCameraMetadata(caller, pMd);
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      Metadata md;
+      CopyDeviceMetadata(pMd, md);
+      std::shared_ptr<CameraInstance> camera = AddCameraMetadata(caller, md);
+      CheckHardwareFrameTags(*camera, md);
+      mm::AcquisitionStatistics& stats = camera->GetAcquisitionStatistics();
+      mm::AcquisitionStatistics::StageTimer timer(stats, start);
+      timer.EndStage(mm::AcquisitionStatistics::StageMetadata);
 
       MM::ImageProcessor* ip = GetImageProcessor(caller);
       if( NULL != ip)
       {
+         timer.SkipStage();
          ip->Process( const_cast<unsigned char*>(buf), width, height, byteDepth);
+         timer.EndStage(mm::AcquisitionStatistics::StageProcessing);
       }
-      if (core_->cbuf_->InsertMultiChannel(buf, numChannels, width, height, byteDepth, &md))
+      const bool inserted = GetSequenceBuffer(caller)->InsertMultiChannel(buf, numChannels, width, height, byteDepth, &md);
+      timer.EndStage(mm::AcquisitionStatistics::StageCopy);
+      // Only the first channel
+      PublishLatestFrame(caller, buf, width, height, byteDepth, 1, md);
+      if (inserted)
+      {
+         stats.RecordInserted();
          return DEVICE_OK;
-      else
-         return DEVICE_BUFFER_OVERFLOW;
+      }
+      stats.RecordRejected();
+      return DEVICE_BUFFER_OVERFLOW;
    }
    catch (CMMError& /*e*/)
    {
@@ -424,11 +733,36 @@ int CoreCallback::AcqFinished(const MM::Device* caller, int /*statusCode*/)
          }
       }
    }
+
+   // Wake up waitForNextImage() callers
+   GetSequenceBuffer(caller)->NotifyAcquisitionFinished();
    return DEVICE_OK;
 }
 
-int CoreCallback::PrepareForAcq(const MM::Device* /*caller*/)
+int CoreCallback::PrepareForAcq(const MM::Device* caller)
 {
+   std::shared_ptr<CameraInstance> camera;
+   try
+   {
+      camera = std::dynamic_pointer_cast<CameraInstance>(
+            core_->deviceManager_->GetDevice(caller));
+   }
+   catch (const CMMError&)
+   {
+   }
+   if (camera)
+   {
+      try
+      {
+         core_->initializeStartedCameraSequenceBuffer(camera);
+      }
+      catch (const CMMError& e)
+      {
+         LOG_ERROR(core_->coreLogger_) << e.getMsg();
+         return DEVICE_OUT_OF_MEMORY;
+      }
+   }
+
    if (core_->autoShutter_)
    {
       std::shared_ptr<ShutterInstance> shutter =
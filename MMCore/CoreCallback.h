@@ -86,11 +86,17 @@ public:
    int InsertImage(const MM::Device* caller, const ImgBuffer& imgBuf); // Note: _not_ mm::ImgBuffer
    int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess = true);
    int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const char* serializedMetadata, const bool doProcess = true);
+   int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const char* const* mdKeys, const char* const* mdValues, unsigned mdCount, const bool doProcess = true);
 
    /*Deprecated*/ int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* pMd = 0, const bool doProcess = true);
    /*Deprecated*/ int InsertImage(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const Metadata* pMd = 0, const bool doProcess = true);
 
    /*Deprecated*/ int InsertMultiChannel(const MM::Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, Metadata* pMd = 0);
+   int AcquireWritableFrame(const MM::Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, unsigned char** ppBuf);
+   int CommitFrame(const MM::Device* caller, const char* serializedMetadata, const bool doProcess = true);
+   int CommitFrame(const MM::Device* caller, const char* const* mdKeys, const char* const* mdValues, unsigned mdCount, const bool doProcess = true);
+   int AbortFrame(const MM::Device* caller);
+
    void ClearImageBuffer(const MM::Device* caller);
    bool InitializeImageBuffer(unsigned channels, unsigned slices, unsigned int w, unsigned int h, unsigned int pixDepth);
 
@@ -140,7 +146,18 @@ private:
    CMMCore* core_;
    MMThreadLock* pValueChangeLock_;
 
-   Metadata AddCameraMetadata(const MM::Device* caller, const Metadata* pMd);
+   CircularBuffer* GetSequenceBuffer(const MM::Device* caller);
+   std::shared_ptr<CameraInstance> AddCameraMetadata(const MM::Device* caller, Metadata& md);
+   void RecordRejectedFrame(const MM::Device* caller);
+   void CheckHardwareFrameTags(CameraInstance& camera, Metadata& md);
+   void PublishLatestFrame(const MM::Device* caller, const unsigned char* buf,
+         unsigned width, unsigned height, unsigned byteDepth,
+         unsigned nComponents, const Metadata& md);
+   static void CopyDeviceMetadata(const Metadata* pMd, Metadata& md);
+   static void PutImageTags(const char* const* keys, const char* const* values,
+         unsigned count, Metadata& md);
+   int InsertImageWithMetadata(const MM::Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, Metadata& md, bool doProcess);
+   int CommitFrameWithMetadata(const MM::Device* caller, Metadata& md, bool doProcess);
 
    int OnConfigGroupChanged(const char* groupName, const char* newConfigName);
    int OnPixelSizeChanged(double newPixelSizeUm);
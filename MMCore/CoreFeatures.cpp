@@ -118,6 +118,47 @@ const auto& featureMap() {
             [](bool e) { g_flags.ParallelDeviceInitialization = e; }
          }
       },
+      {
+         "LockFreeSequenceBuffer", {
+            [] { return g_flags.lockFreeSequenceBuffer; },
+            [](bool e) { g_flags.lockFreeSequenceBuffer = e; }
+            // Switchable while the atomic index publication in
+            // CircularBuffer is being validated; the locked implementation
+            // remains the default. Takes effect at the next buffer
+            // (re)initialization.
+         }
+      },
+      {
+         "PerCameraSequenceBuffers", {
+            [] { return g_flags.perCameraSequenceBuffers; },
+            [](bool e) { g_flags.perCameraSequenceBuffers = e; }
+            // Opt-in because the unlabeled image retrieval functions keep
+            // reading the shared buffer, which cameras then no longer fill.
+            // Takes effect when an acquisition is started.
+         }
+      },
+      {
+         "LatestFrameBuffers", {
+            [] { return g_flags.latestFrameBuffers; },
+            [](bool e) { g_flags.latestFrameBuffers = e; }
+            // Opt-in because it costs an extra copy of every frame.
+         }
+      },
+      {
+         "FramePixelStatistics", {
+            [] { return g_flags.framePixelStatistics; },
+            [](bool e) { g_flags.framePixelStatistics = e; }
+            // Opt-in because it costs an extra pass over every frame.
+         }
+      },
+      {
+         "CompressedSequenceBuffer", {
+            [] { return g_flags.compressedSequenceBuffer; },
+            [](bool e) { g_flags.compressedSequenceBuffer = e; }
+            // Opt-in because it trades CPU time on insert and retrieval for
+            // capacity. Takes effect at the next buffer (re)initialization.
+         }
+      },
       // How to add a new Core feature: see the comment at the top of this file.
       // Features (the string names) must never be removed once added!
    };
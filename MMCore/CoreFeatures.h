@@ -27,6 +27,11 @@ namespace features {
 struct Flags {
    bool strictInitializationChecks = false;
    bool ParallelDeviceInitialization = true;
+   bool lockFreeSequenceBuffer = false;
+   bool perCameraSequenceBuffers = false;
+   bool latestFrameBuffers = false;
+   bool framePixelStatistics = false;
+   bool compressedSequenceBuffer = false;
    // How to add a new Core feature: see the comment in the .cpp file.
 };
 
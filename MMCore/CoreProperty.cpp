@@ -160,6 +160,14 @@ void CorePropertyCollection::Execute(const char* propName, const char* value)
    {
       core_->setChannelGroup(value);
    }
+   else if (strcmp(propName, MM::g_Keyword_CoreThreadPoolSize) == 0)
+   {
+      core_->setThreadPoolSize(static_cast<unsigned>(atol(value)));
+   }
+   else if (strcmp(propName, MM::g_Keyword_CoreThreadPoolAffinity) == 0)
+   {
+      core_->setThreadPoolAffinity(strcmp(value, "1") == 0);
+   }
    // unknown property
    else
    {
@@ -241,6 +249,10 @@ void CorePropertyCollection::Refresh()
    // Channel group
    Set(MM::g_Keyword_CoreChannelGroup, core_->getChannelGroup().c_str());
 
+   // Thread pool
+   Set(MM::g_Keyword_CoreThreadPoolSize, CDeviceUtils::ConvertToString((long)core_->getThreadPoolSize()));
+   Set(MM::g_Keyword_CoreThreadPoolAffinity, core_->getThreadPoolAffinity() ? "1" : "0");
+
 }
 
 bool CorePropertyCollection::IsReadOnly(const char* propName) const
@@ -145,6 +145,31 @@ std::string CameraInstance::GetTags()
    return serializedMetadataBuf.Get();
 }
 
+long CameraInstance::GetTagsVersion() { RequireInitialized(__func__); return GetImpl()->GetTagsVersion(); }
+
+/**
+ * Merge the camera's tags into md.
+ *
+ * The serialized tags are only fetched and parsed again when the camera
+ * reports a new tags version, so that this is cheap enough to call for every
+ * inserted image. Cameras without a tags version (negative) are asked for
+ * their tags every time.
+ */
+void CameraInstance::MergeCachedTags(Metadata& md)
+{
+   const long version = GetTagsVersion();
+
+   std::lock_guard<std::mutex> lock(cachedTagsMutex_);
+   if (version < 0 || !cachedTagsValid_ || version != cachedTagsVersion_)
+   {
+      const std::string serializedMD = GetTags();
+      cachedTags_.Restore(serializedMD.c_str());
+      cachedTagsVersion_ = version;
+      cachedTagsValid_ = true;
+   }
+   md.Merge(cachedTags_);
+}
+
 void CameraInstance::AddTag(const char* key, const char* deviceLabel, const char* value) { RequireInitialized(__func__); return GetImpl()->AddTag(key, deviceLabel, value); }
 void CameraInstance::RemoveTag(const char* key) { RequireInitialized(__func__); return GetImpl()->RemoveTag(key); }
 int CameraInstance::IsExposureSequenceable(bool& isSequenceable) const { RequireInitialized(__func__); return GetImpl()->IsExposureSequenceable(isSequenceable); }
@@ -154,3 +179,15 @@ int CameraInstance::StopExposureSequence() { RequireInitialized(__func__); retur
 int CameraInstance::ClearExposureSequence() { RequireInitialized(__func__); return GetImpl()->ClearExposureSequence(); }
 int CameraInstance::AddToExposureSequence(double exposureTime_ms) { RequireInitialized(__func__); return GetImpl()->AddToExposureSequence(exposureTime_ms); }
 int CameraInstance::SendExposureSequence() const { RequireInitialized(__func__); return GetImpl()->SendExposureSequence(); }
+
+std::shared_ptr<CircularBuffer> CameraInstance::GetSequenceBuffer() const
+{
+   std::lock_guard<std::mutex> lock(sequenceBufferMutex_);
+   return sequenceBuffer_;
+}
+
+void CameraInstance::SetSequenceBuffer(std::shared_ptr<CircularBuffer> buffer)
+{
+   std::lock_guard<std::mutex> lock(sequenceBufferMutex_);
+   sequenceBuffer_ = buffer;
+}
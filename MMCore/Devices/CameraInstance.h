@@ -20,6 +20,16 @@
 #pragma once
 
 #include "DeviceInstanceBase.h"
+#include "../AcquisitionStatistics.h"
+#include "../LatestFrameBuffer.h"
+
+#include "../../MMDevice/ImageMetadata.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+class CircularBuffer;
 
 
 class CameraInstance : public DeviceInstanceBase<MM::Camera>
@@ -33,7 +43,10 @@ public:
          const std::string& label,
          mm::logging::Logger deviceLogger,
          mm::logging::Logger coreLogger) :
-      DeviceInstanceBase<MM::Camera>(core, adapter, name, pDevice, deleteFunction, label, deviceLogger, coreLogger)
+      DeviceInstanceBase<MM::Camera>(core, adapter, name, pDevice, deleteFunction, label, deviceLogger, coreLogger),
+      composite_(false),
+      cachedTagsVersion_(0),
+      cachedTagsValid_(false)
    {}
 
    int SnapImage();
@@ -73,6 +86,8 @@ public:
    int PrepareSequenceAcqusition();
    bool IsCapturing();
    std::string GetTags();
+   long GetTagsVersion();
+   void MergeCachedTags(Metadata& md);
    void AddTag(const char* key, const char* deviceLabel, const char* value);
    void RemoveTag(const char* key);
    int IsExposureSequenceable(bool& isSequenceable) const;
@@ -82,4 +97,34 @@ public:
    int ClearExposureSequence();
    int AddToExposureSequence(double exposureTime_ms);
    int SendExposureSequence() const;
+
+   // The camera's own sequence buffer (PerCameraSequenceBuffers feature), or
+   // null if its images go to the Core's shared buffer.
+   std::shared_ptr<CircularBuffer> GetSequenceBuffer() const;
+   void SetSequenceBuffer(std::shared_ptr<CircularBuffer> buffer);
+
+   // Whether the camera streams by starting other cameras (such as
+   // Utilities' Multi Camera), whose images go to their own buffers
+   bool IsComposite() const { return composite_; }
+   void SetComposite(bool composite) { composite_ = composite; }
+
+   // The camera's most recent frame (LatestFrameBuffers feature)
+   mm::LatestFrameBuffer& GetLatestFrameBuffer() { return latestFrame_; }
+
+   // Counters for the images the camera inserts
+   mm::AcquisitionStatistics& GetAcquisitionStatistics() { return acquisitionStats_; }
+
+private:
+   mm::LatestFrameBuffer latestFrame_;
+   mm::AcquisitionStatistics acquisitionStats_;
+
+   mutable std::mutex sequenceBufferMutex_;
+   std::shared_ptr<CircularBuffer> sequenceBuffer_;
+   std::atomic<bool> composite_;
+
+   // Parsed copy of GetTags(), refreshed when GetTagsVersion() changes
+   std::mutex cachedTagsMutex_;
+   Metadata cachedTags_;
+   long cachedTagsVersion_;
+   bool cachedTagsValid_;
 };
@@ -24,7 +24,7 @@
 namespace mm {
 
 ImgBuffer::ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth) :
-   pixels_(0), width_(xSize), height_(ySize), pixDepth_(pixDepth)
+   pixels_(0), ownsPixels_(true), width_(xSize), height_(ySize), pixDepth_(pixDepth)
 {
    pixels_ = new unsigned char[xSize * ySize * pixDepth];
    memset(pixels_, 0, xSize * ySize * pixDepth);
@@ -32,7 +32,30 @@ ImgBuffer::ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth) :
 
 ImgBuffer::~ImgBuffer()
 {
-   delete[] pixels_;
+   ReleasePixels();
+}
+
+void ImgBuffer::ReleasePixels()
+{
+   if (ownsPixels_)
+      delete[] pixels_;
+   pixels_ = 0;
+   ownsPixels_ = true;
+}
+
+/**
+ * Use memory owned by someone else (e.g. the sequence buffer's slab) for the
+ * pixels, without copying. The memory must outlive this object or the next
+ * call to Attach() or Resize().
+ */
+void ImgBuffer::Attach(unsigned char* pixels, unsigned xSize, unsigned ySize, unsigned pixDepth)
+{
+   ReleasePixels();
+   pixels_ = pixels;
+   ownsPixels_ = false;
+   width_ = xSize;
+   height_ = ySize;
+   pixDepth_ = pixDepth;
 }
 
 const unsigned char* ImgBuffer::GetPixels() const
@@ -40,6 +63,11 @@ const unsigned char* ImgBuffer::GetPixels() const
    return pixels_;
 }
 
+unsigned char* ImgBuffer::GetPixelsRW()
+{
+   return pixels_;
+}
+
 void ImgBuffer::SetPixels(const void* pix)
 {
    memcpy((void*)pixels_, pix, width_ * height_ * pixDepth_);
@@ -48,9 +76,9 @@ void ImgBuffer::SetPixels(const void* pix)
 void ImgBuffer::Resize(unsigned xSize, unsigned ySize, unsigned pixDepth)
 {
    // re-allocate internal buffer if it is not big enough
-   if (width_ * height_ * pixDepth_ < xSize * ySize * pixDepth)
+   if (!ownsPixels_ || width_ * height_ * pixDepth_ < xSize * ySize * pixDepth)
    {
-      delete[] pixels_;
+      ReleasePixels();
       pixels_ = new unsigned char [xSize * ySize * pixDepth];
    }
 
@@ -62,9 +90,9 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize, unsigned pixDepth)
 void ImgBuffer::Resize(unsigned xSize, unsigned ySize)
 {
    // re-allocate internal buffer if it is not big enough
-   if (width_ * height_ < xSize * ySize)
+   if (!ownsPixels_ || width_ * height_ < xSize * ySize)
    {
-      delete[] pixels_;
+      ReleasePixels();
       pixels_ = new unsigned char[xSize * ySize * pixDepth_];
    }
 
@@ -76,11 +104,19 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize)
 
 void ImgBuffer::SetMetadata(const Metadata& md)
 {
-   //metadata_ = md;
-   // Serialize/Restore instead of =operator used to avoid object new/delete
-   // issues across the DLL boundary (on Windows)
-   // TODO: this is inefficient and should be revised
-    metadata_.Restore(md.Serialize().c_str());
+   metadata_.Assign(md);
+}
+
+void ImgBuffer::GetMetadata(Metadata& md) const
+{
+   metadata_.ToMetadata(md);
+}
+
+Metadata ImgBuffer::GetMetadata() const
+{
+   Metadata md;
+   metadata_.ToMetadata(md);
+   return md;
 }
 
 
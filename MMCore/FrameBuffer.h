@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "FrameMetadata.h"
 #include "../MMDevice/ImageMetadata.h"
 
 #include <string>
@@ -29,10 +30,11 @@ namespace mm {
 class ImgBuffer
 {
    unsigned char* pixels_;
+   bool ownsPixels_;
    unsigned int width_;
    unsigned int height_;
    unsigned int pixDepth_;
-   Metadata metadata_;
+   FrameMetadata metadata_;
 
 public:
    ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth);
@@ -43,14 +45,20 @@ public:
    unsigned int Depth() const {return pixDepth_;}
    void SetPixels(const void* pixArray);
    const unsigned char* GetPixels() const;
+   unsigned char* GetPixelsRW();
 
    void Resize(unsigned xSize, unsigned ySize, unsigned pixDepth);
    void Resize(unsigned xSize, unsigned ySize);
+   void Attach(unsigned char* pixels, unsigned xSize, unsigned ySize, unsigned pixDepth);
 
    void SetMetadata(const Metadata& md);
-   const Metadata& GetMetadata() const {return metadata_;}
+   void GetMetadata(Metadata& md) const;
+   Metadata GetMetadata() const;
+   FrameMetadata& GetFrameMetadata() {return metadata_;}
+   const FrameMetadata& GetFrameMetadata() const {return metadata_;}
 
 private:
+   void ReleasePixels();
    ImgBuffer& operator=(const ImgBuffer&);
 };
 
@@ -0,0 +1,509 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameCompression.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Lossless compression of images held in the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "FrameCompression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MMCORE_X86_64
+#include <emmintrin.h>
+#endif
+
+namespace mm {
+
+namespace {
+
+// Transpose the 8x8 bit matrix whose rows are the bytes of x: bit b of byte
+// i becomes bit i of byte b
+inline std::uint64_t TransposeBits(std::uint64_t x)
+{
+   std::uint64_t t;
+   t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+   x = x ^ t ^ (t << 7);
+   t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+   x = x ^ t ^ (t << 14);
+   t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+   x = x ^ t ^ (t << 28);
+   return x;
+}
+
+// Bit plane (j, b), holding bit b of byte j of each element, is stored at
+// ((j * 8 + b) * groups), one bit per element, for the groups of 8 elements.
+// Elements beyond the last whole group are stored as is after the planes.
+inline void BitShuffle(const unsigned char* src, std::size_t groups,
+      std::size_t firstGroup, unsigned elementSize, unsigned char* dst)
+{
+   for (std::size_t g = firstGroup; g < groups; ++g)
+   {
+      const unsigned char* group = src + g * 8 * elementSize;
+      for (unsigned j = 0; j < elementSize; ++j)
+      {
+         std::uint64_t x = 0;
+         for (unsigned i = 0; i < 8; ++i)
+            x |= std::uint64_t(group[i * elementSize + j]) << (8 * i);
+         x = TransposeBits(x);
+         for (unsigned b = 0; b < 8; ++b)
+            dst[(j * 8 + b) * groups + g] = static_cast<unsigned char>(x >> (8 * b));
+      }
+   }
+}
+
+inline void BitUnshuffle(const unsigned char* src, std::size_t groups,
+      std::size_t firstGroup, unsigned elementSize, unsigned char* dst)
+{
+   for (std::size_t g = firstGroup; g < groups; ++g)
+   {
+      unsigned char* group = dst + g * 8 * elementSize;
+      for (unsigned j = 0; j < elementSize; ++j)
+      {
+         std::uint64_t x = 0;
+         for (unsigned b = 0; b < 8; ++b)
+            x |= std::uint64_t(src[(j * 8 + b) * groups + g]) << (8 * b);
+         x = TransposeBits(x);
+         for (unsigned i = 0; i < 8; ++i)
+            group[i * elementSize + j] = static_cast<unsigned char>(x >> (8 * i));
+      }
+   }
+}
+
+#ifdef MMCORE_X86_64
+
+// Separate byte 0 and byte 1 of 16 2-byte elements
+inline void SplitBytes(const unsigned char* p, __m128i* bytes)
+{
+   const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+   const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+   const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+   bytes[0] = _mm_packus_epi16(_mm_and_si128(v0, lowBytes), _mm_and_si128(v1, lowBytes));
+   bytes[1] = _mm_packus_epi16(_mm_srli_epi16(v0, 8), _mm_srli_epi16(v1, 8));
+}
+
+// Shuffles 8 groups of 1- or 2-byte elements at a time, taking each bit
+// plane from the sign bits of the bytes. Returns the number of groups done.
+template <unsigned ElementSize>
+std::size_t BitShuffleSSE2(const unsigned char* src, std::size_t groups,
+      unsigned char* dst)
+{
+   std::size_t g = 0;
+   for (; g + 8 <= groups; g += 8)
+   {
+      // Collected so that each plane gets 8 bytes at once
+      std::uint64_t planes[ElementSize][8] = {};
+      for (unsigned v = 0; v < 4; ++v)
+      {
+         __m128i bytes[2];
+         const unsigned char* p = src + (g + 2 * v) * 8 * ElementSize;
+         if (ElementSize == 1)
+            bytes[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+         else
+            SplitBytes(p, bytes);
+         for (unsigned j = 0; j < ElementSize; ++j)
+         {
+            __m128i x = bytes[j];
+            for (unsigned b = 8; b-- > 0; )
+            {
+               // Bit i of the mask is the bit of element i
+               planes[j][b] |= std::uint64_t(_mm_movemask_epi8(x)) << (16 * v);
+               x = _mm_add_epi8(x, x);
+            }
+         }
+      }
+      for (unsigned j = 0; j < ElementSize; ++j)
+      {
+         for (unsigned b = 0; b < 8; ++b)
+            std::memcpy(dst + (j * 8 + b) * groups + g, &planes[j][b], 8);
+      }
+   }
+   return g;
+}
+
+// Transpose the bit matrices formed by byte k of p[0] to p[7], for each k:
+// bit b of byte k of p[e] becomes bit e of byte k of p[b]
+inline void TransposeBitPlanes(__m128i* p)
+{
+   const __m128i masks[3] = { _mm_set1_epi8(0x55), _mm_set1_epi8(0x33),
+      _mm_set1_epi8(0x0f) };
+   for (unsigned step = 0; step < 3; ++step)
+   {
+      const unsigned k = 1u << step;
+      const __m128i shift = _mm_cvtsi32_si128(static_cast<int>(k));
+      for (unsigned a = 0; a < 8; ++a)
+      {
+         if (a & k)
+            continue;
+         const __m128i t = _mm_and_si128(_mm_xor_si128(
+                  _mm_srl_epi16(p[a], shift), p[a + k]), masks[step]);
+         p[a + k] = _mm_xor_si128(p[a + k], t);
+         p[a] = _mm_xor_si128(p[a], _mm_sll_epi16(t, shift));
+      }
+   }
+}
+
+// Interleave q[e] (byte e of groups 0 to 15) into r[k] (all bytes of groups
+// 2k and 2k + 1)
+inline void InterleaveGroups(const __m128i* q, __m128i* r)
+{
+   __m128i pairs[8];
+   for (unsigned e = 0; e < 8; e += 2)
+   {
+      pairs[e] = _mm_unpacklo_epi8(q[e], q[e + 1]);
+      pairs[e + 1] = _mm_unpackhi_epi8(q[e], q[e + 1]);
+   }
+   __m128i quads[8];
+   for (unsigned h = 0; h < 2; ++h)
+   {
+      quads[4 * h] = _mm_unpacklo_epi16(pairs[h], pairs[2 + h]);
+      quads[4 * h + 1] = _mm_unpackhi_epi16(pairs[h], pairs[2 + h]);
+      quads[4 * h + 2] = _mm_unpacklo_epi16(pairs[4 + h], pairs[6 + h]);
+      quads[4 * h + 3] = _mm_unpackhi_epi16(pairs[4 + h], pairs[6 + h]);
+   }
+   for (unsigned h = 0; h < 2; ++h)
+   {
+      for (unsigned i = 0; i < 2; ++i)
+      {
+         r[4 * h + 2 * i] = _mm_unpacklo_epi32(quads[4 * h + i], quads[4 * h + 2 + i]);
+         r[4 * h + 2 * i + 1] = _mm_unpackhi_epi32(quads[4 * h + i], quads[4 * h + 2 + i]);
+      }
+   }
+}
+
+// Unshuffles 16 groups at a time. Returns the number of groups done.
+template <unsigned ElementSize>
+std::size_t BitUnshuffleSSE2(const unsigned char* src, std::size_t groups,
+      unsigned char* dst)
+{
+   std::size_t g = 0;
+   for (; g + 16 <= groups; g += 16)
+   {
+      __m128i bytes[2][8];
+      for (unsigned j = 0; j < ElementSize; ++j)
+      {
+         __m128i p[8];
+         for (unsigned b = 0; b < 8; ++b)
+            p[b] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                     src + (j * 8 + b) * groups + g));
+         TransposeBitPlanes(p);
+         InterleaveGroups(p, bytes[j]);
+      }
+      unsigned char* out = dst + g * 8 * ElementSize;
+      for (unsigned k = 0; k < 8; ++k)
+      {
+         if (ElementSize == 1)
+         {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * k), bytes[0][k]);
+         }
+         else
+         {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32 * k),
+                  _mm_unpacklo_epi8(bytes[0][k], bytes[1][k]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32 * k + 16),
+                  _mm_unpackhi_epi8(bytes[0][k], bytes[1][k]));
+         }
+      }
+   }
+   return g;
+}
+
+#endif // MMCORE_X86_64
+
+void Shuffle(const unsigned char* src, std::size_t bytes, unsigned elementSize,
+      unsigned char* dst, bool inverse)
+{
+   const std::size_t groups = bytes / elementSize / 8;
+   std::size_t done = 0;
+#ifdef MMCORE_X86_64
+   if (elementSize == 1)
+      done = inverse ? BitUnshuffleSSE2<1>(src, groups, dst) :
+         BitShuffleSSE2<1>(src, groups, dst);
+   else if (elementSize == 2)
+      done = inverse ? BitUnshuffleSSE2<2>(src, groups, dst) :
+         BitShuffleSSE2<2>(src, groups, dst);
+#endif
+
+   // Constant element sizes let the compiler unroll the loops
+   switch (elementSize)
+   {
+      case 1:
+         inverse ? BitUnshuffle(src, groups, done, 1, dst) :
+            BitShuffle(src, groups, done, 1, dst);
+         break;
+      case 2:
+         inverse ? BitUnshuffle(src, groups, done, 2, dst) :
+            BitShuffle(src, groups, done, 2, dst);
+         break;
+      case 4:
+         inverse ? BitUnshuffle(src, groups, done, 4, dst) :
+            BitShuffle(src, groups, done, 4, dst);
+         break;
+      default:
+         inverse ? BitUnshuffle(src, groups, done, elementSize, dst) :
+            BitShuffle(src, groups, done, elementSize, dst);
+         break;
+   }
+
+   const std::size_t shuffled = groups * 8 * elementSize;
+   std::memcpy(dst + shuffled, src + shuffled, bytes - shuffled);
+}
+
+// LZ4 block format parameters
+const std::size_t minMatch = 4;
+const std::size_t lastLiterals = 5; // The last bytes are always literals
+const std::size_t matchFindLimit = 12; // No match starts after end - 12
+const unsigned hashBits = 12;
+
+inline std::uint32_t Read32(const unsigned char* p)
+{
+   std::uint32_t v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+inline std::uint64_t Read64(const unsigned char* p)
+{
+   std::uint64_t v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+inline unsigned Hash(std::uint32_t sequence)
+{
+   return (sequence * 2654435761u) >> (32 - hashBits);
+}
+
+// Number of equal bytes at p and q, stopping at limit (for p)
+inline std::size_t MatchLength(const unsigned char* p, const unsigned char* q,
+      const unsigned char* limit)
+{
+   const unsigned char* start = p;
+   while (p + 8 <= limit && Read64(p) == Read64(q))
+   {
+      p += 8;
+      q += 8;
+   }
+   while (p < limit && *p == *q)
+   {
+      ++p;
+      ++q;
+   }
+   return static_cast<std::size_t>(p - start);
+}
+
+inline unsigned char* WriteLength(unsigned char* op, std::size_t length)
+{
+   for (; length >= 255; length -= 255)
+      *op++ = 255;
+   *op++ = static_cast<unsigned char>(length);
+   return op;
+}
+
+inline unsigned char* WriteLiterals(unsigned char* op, unsigned char* token,
+      const unsigned char* literals, std::size_t count)
+{
+   *token = static_cast<unsigned char>((std::min)(count, std::size_t(15)) << 4);
+   if (count >= 15)
+      op = WriteLength(op, count - 15);
+   std::memcpy(op, literals, count);
+   return op + count;
+}
+
+// Returns the compressed size (at most MaxCompressedBlockBytes(n)); n must
+// be at most 65536 so that positions fit 16 bits.
+std::size_t LzCompress(const unsigned char* src, std::size_t n, unsigned char* dst)
+{
+   unsigned char* op = dst;
+   std::size_t anchor = 0;
+   if (n > matchFindLimit)
+   {
+      std::uint16_t table[1 << hashBits] = {};
+      const unsigned char* matchLimit = src + n - lastLiterals;
+      const std::size_t inputLimit = n - matchFindLimit;
+      std::size_t ip = 0;
+      while (ip < inputLimit)
+      {
+         const std::uint32_t sequence = Read32(src + ip);
+         const unsigned h = Hash(sequence);
+         std::size_t ref = table[h];
+         table[h] = static_cast<std::uint16_t>(ip);
+         if (ref >= ip || Read32(src + ref) != sequence)
+         {
+            // Skip ahead faster the longer nothing matches
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+         }
+
+         std::size_t length = minMatch + MatchLength(src + ip + minMatch,
+               src + ref + minMatch, matchLimit);
+         while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1])
+         {
+            --ip;
+            --ref;
+            ++length;
+         }
+
+         unsigned char* token = op++;
+         op = WriteLiterals(op, token, src + anchor, ip - anchor);
+         const std::size_t offset = ip - ref;
+         *op++ = static_cast<unsigned char>(offset);
+         *op++ = static_cast<unsigned char>(offset >> 8);
+         const std::size_t extra = length - minMatch;
+         *token |= static_cast<unsigned char>((std::min)(extra, std::size_t(15)));
+         if (extra >= 15)
+            op = WriteLength(op, extra - 15);
+
+         ip += length;
+         anchor = ip;
+         if (ip < inputLimit)
+            table[Hash(Read32(src + ip - 2))] = static_cast<std::uint16_t>(ip - 2);
+      }
+   }
+   unsigned char* token = op++;
+   return static_cast<std::size_t>(
+         WriteLiterals(op, token, src + anchor, n - anchor) - dst);
+}
+
+inline bool ReadLength(const unsigned char*& ip, const unsigned char* end,
+      std::size_t& length)
+{
+   unsigned char byte;
+   do
+   {
+      if (ip >= end)
+         return false;
+      byte = *ip++;
+      length += byte;
+   } while (byte == 255);
+   return true;
+}
+
+bool LzDecompress(const unsigned char* src, std::size_t srcBytes,
+      unsigned char* dst, std::size_t dstBytes)
+{
+   const unsigned char* ip = src;
+   const unsigned char* const iend = src + srcBytes;
+   unsigned char* op = dst;
+   unsigned char* const oend = dst + dstBytes;
+   for (;;)
+   {
+      if (ip >= iend)
+         return false;
+      const unsigned token = *ip++;
+
+      std::size_t literals = token >> 4;
+      if (literals == 15 && !ReadLength(ip, iend, literals))
+         return false;
+      if (literals > static_cast<std::size_t>(iend - ip) ||
+            literals > static_cast<std::size_t>(oend - op))
+         return false;
+      std::memcpy(op, ip, literals);
+      ip += literals;
+      op += literals;
+      if (ip == iend)
+         return op == oend; // The last sequence has no match
+
+      if (iend - ip < 2)
+         return false;
+      const std::size_t offset = ip[0] | (std::size_t(ip[1]) << 8);
+      ip += 2;
+      std::size_t length = token & 15;
+      if (length == 15 && !ReadLength(ip, iend, length))
+         return false;
+      length += minMatch;
+      if (offset == 0 || offset > static_cast<std::size_t>(op - dst) ||
+            length > static_cast<std::size_t>(oend - op))
+         return false;
+
+      // The match may overlap the bytes it produces
+      const unsigned char* ref = op - offset;
+      if (offset == 1)
+         std::memset(op, *ref, length);
+      else if (offset >= length)
+         std::memcpy(op, ref, length);
+      else if (offset >= 8)
+      {
+         for (std::size_t i = 0; i < length; i += 8)
+            std::memcpy(op + i, ref + i, (std::min)(std::size_t(8), length - i));
+      }
+      else
+      {
+         for (std::size_t i = 0; i < length; ++i)
+            op[i] = ref[i];
+      }
+      op += length;
+   }
+}
+
+} // anonymous namespace
+
+std::uint32_t CompressBlock(const unsigned char* src, std::size_t rawBytes,
+      unsigned elementSize, unsigned char* scratch, unsigned char* dst)
+{
+   Shuffle(src, rawBytes, elementSize, scratch, false);
+   const std::size_t compressed = LzCompress(scratch, rawBytes, dst);
+   if (compressed < rawBytes)
+      return static_cast<std::uint32_t>(compressed);
+   std::memcpy(dst, src, rawBytes);
+   return static_cast<std::uint32_t>(rawBytes) | CompressionStoredFlag;
+}
+
+void WriteCompressionEntry(unsigned char* header, std::size_t block,
+      std::uint32_t entry)
+{
+   unsigned char* p = header + 4 * block;
+   for (unsigned i = 0; i < 4; ++i)
+      p[i] = static_cast<unsigned char>(entry >> (8 * i));
+}
+
+bool DecompressImage(const unsigned char* src, std::size_t rawBytes,
+      unsigned elementSize, unsigned char* dst)
+{
+   static thread_local std::vector<unsigned char> scratch;
+   scratch.resize(CompressionBlockBytes);
+
+   const std::size_t blocks = CompressionBlockCount(rawBytes);
+   const unsigned char* data = src + CompressionHeaderBytes(rawBytes);
+   for (std::size_t block = 0; block < blocks; ++block)
+   {
+      const unsigned char* p = src + 4 * block;
+      const std::uint32_t entry = std::uint32_t(p[0]) |
+         (std::uint32_t(p[1]) << 8) | (std::uint32_t(p[2]) << 16) |
+         (std::uint32_t(p[3]) << 24);
+      const std::size_t offset = block * CompressionBlockBytes;
+      const std::size_t blockBytes =
+         (std::min)(CompressionBlockBytes, rawBytes - offset);
+      const std::size_t dataBytes = CompressedBlockBytes(entry);
+      if (entry & CompressionStoredFlag)
+      {
+         if (dataBytes != blockBytes)
+            return false;
+         std::memcpy(dst + offset, data, blockBytes);
+      }
+      else
+      {
+         if (!LzDecompress(data, dataBytes, scratch.data(), blockBytes))
+            return false;
+         Shuffle(scratch.data(), blockBytes, elementSize, dst + offset, true);
+      }
+      data += dataBytes;
+   }
+   return true;
+}
+
+} // namespace mm
@@ -0,0 +1,72 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameCompression.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Lossless compression of images held in the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mm {
+
+// A compressed image consists of a table with one 32-bit (little-endian)
+// entry per block of CompressionBlockBytes of the image (the last one may be
+// shorter), followed by the data of the blocks. Each entry holds the size of
+// the block's data, with CompressionStoredFlag set if the block is stored
+// as is because it did not compress.
+//
+// Blocks are compressed independently, by bit-shuffling the pixel values
+// (gathering bit 0 of all pixels, then bit 1, etc., so that the unused high
+// bits of low-valued pixels become runs of zeros) and coding the result in
+// the LZ4 block format.
+
+const std::size_t CompressionBlockBytes = 65536;
+const std::uint32_t CompressionStoredFlag = 0x80000000u;
+
+inline std::size_t CompressionBlockCount(std::size_t rawBytes)
+{ return (rawBytes + CompressionBlockBytes - 1) / CompressionBlockBytes; }
+
+// Size of the block table of a compressed image
+inline std::size_t CompressionHeaderBytes(std::size_t rawBytes)
+{ return 4 * CompressionBlockCount(rawBytes); }
+
+// The largest size of a compressed block of rawBytes
+inline std::size_t MaxCompressedBlockBytes(std::size_t rawBytes)
+{ return rawBytes + rawBytes / 255 + 16; }
+
+/**
+ * Compress a block of at most CompressionBlockBytes, consisting of pixel
+ * values of elementSize bytes each. scratch must hold rawBytes; dst must
+ * hold MaxCompressedBlockBytes(rawBytes). Returns the block's table entry.
+ */
+std::uint32_t CompressBlock(const unsigned char* src, std::size_t rawBytes,
+      unsigned elementSize, unsigned char* scratch, unsigned char* dst);
+
+inline std::size_t CompressedBlockBytes(std::uint32_t entry)
+{ return entry & ~CompressionStoredFlag; }
+
+void WriteCompressionEntry(unsigned char* header, std::size_t block,
+      std::uint32_t entry);
+
+/**
+ * Decompress a compressed image of rawBytes into dst. Returns false if the
+ * data is corrupt.
+ */
+bool DecompressImage(const unsigned char* src, std::size_t rawBytes,
+      unsigned elementSize, unsigned char* dst);
+
+} // namespace mm
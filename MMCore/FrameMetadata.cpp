@@ -0,0 +1,401 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameMetadata.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Compact per-frame metadata storage for the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "FrameMetadata.h"
+
+#include "../MMDevice/MMDeviceConstants.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+
+namespace mm {
+
+namespace {
+
+// Process-wide table of tag names and device labels. The set of distinct
+// strings is small (bounded by the devices and tags in use), so entries are
+// never removed.
+class InternTable
+{
+   std::mutex mutex_;
+   std::map<std::string, unsigned> ids_;
+   std::deque<std::string> strings_; // Stable references
+
+public:
+   unsigned Intern(const std::string& s)
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::map<std::string, unsigned>::const_iterator it = ids_.find(s);
+      if (it != ids_.end())
+         return it->second;
+      const unsigned id = static_cast<unsigned>(strings_.size());
+      strings_.push_back(s);
+      ids_.insert(std::make_pair(s, id));
+      return id;
+   }
+
+   bool Find(const char* s, unsigned& id)
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::map<std::string, unsigned>::const_iterator it = ids_.find(s);
+      if (it == ids_.end())
+         return false;
+      id = it->second;
+      return true;
+   }
+
+   const std::string& Get(unsigned id)
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return strings_[id];
+   }
+};
+
+InternTable& Interned()
+{
+   static InternTable table;
+   return table;
+}
+
+const char* const g_NoDevice = "_";
+
+std::string FormatLocalTime(std::chrono::time_point<std::chrono::system_clock> tp) {
+   using namespace std::chrono;
+   auto us = duration_cast<microseconds>(tp.time_since_epoch());
+   auto secs = duration_cast<seconds>(us);
+   auto whole = duration_cast<microseconds>(secs);
+   auto frac = static_cast<int>((us - whole).count());
+
+   // As of C++14/17, it is simpler (and probably faster) to use C functions for
+   // date-time formatting
+
+   std::time_t t(secs.count()); // time_t is seconds on platforms we support
+   std::tm *ptm;
+#ifdef _WIN32 // Windows localtime() is documented thread-safe
+   ptm = std::localtime(&t);
+#else // POSIX has localtime_r()
+   std::tm tmstruct;
+   ptm = localtime_r(&t, &tmstruct);
+#endif
+
+   // Format as "yyyy-mm-dd hh:mm:ss.uuuuuu" (26 chars)
+   const char *timeFmt = "%Y-%m-%d %H:%M:%S";
+   char buf[32];
+   std::size_t len = std::strftime(buf, sizeof(buf), timeFmt, ptm);
+   std::snprintf(buf + len, sizeof(buf) - len, ".%06d", frac);
+   return buf;
+}
+
+std::string FormatNumber(double value)
+{
+   char buf[32];
+   std::snprintf(buf, sizeof(buf), "%.15g", value);
+   return buf;
+}
+
+void SetImageTag(Metadata& md, const char* key, const std::string& value)
+{
+   MetadataSingleTag tag(key, g_NoDevice, true);
+   tag.SetValue(value.c_str());
+   md.SetTag(tag);
+}
+
+} // anonymous namespace
+
+void FrameMetadata::Clear()
+{
+   entries_.clear();
+   values_.clear();
+   arena_.clear();
+   standardTags_ = 0;
+}
+
+void FrameMetadata::Assign(const Metadata& md)
+{
+   struct Adder
+   {
+      FrameMetadata& target;
+      void operator()(const MetadataTag& tag) { target.AddTag(tag); }
+   } adder = { *this };
+
+   Clear();
+   md.VisitTags(adder);
+}
+
+void FrameMetadata::ToMetadata(Metadata& md) const
+{
+   md.Clear();
+   InternTable& table = Interned();
+   for (std::vector<Entry>::const_iterator it = entries_.begin(),
+         end = entries_.end(); it != end; ++it)
+   {
+      const std::string& name = table.Get(it->name);
+      const std::string& device = table.Get(it->device);
+      if (it->isArray)
+      {
+         MetadataArrayTag tag(name.c_str(), device.c_str(), it->readOnly);
+         for (unsigned i = 0; i < it->valueCount; ++i)
+            tag.AddValue(ValueAt(it->firstValue + i));
+         md.SetTag(tag);
+      }
+      else
+      {
+         MetadataSingleTag tag(name.c_str(), device.c_str(), it->readOnly);
+         tag.SetValue(ValueAt(it->firstValue));
+         md.SetTag(tag);
+      }
+   }
+   AddStandardTags(md);
+}
+
+void FrameMetadata::SetImageNumber(long number)
+{
+   imageNumber_ = number;
+   standardTags_ |= HasImageNumber;
+}
+
+void FrameMetadata::SetElapsedTime(std::chrono::steady_clock::duration elapsed)
+{
+   elapsedTime_ = elapsed;
+   standardTags_ |= HasElapsedTime;
+}
+
+void FrameMetadata::SetTimeInCore(std::chrono::system_clock::time_point time)
+{
+   timeInCore_ = time;
+   standardTags_ |= HasTimeInCore;
+}
+
+void FrameMetadata::SetImageFormat(unsigned width, unsigned height,
+      unsigned byteDepth, unsigned nComponents)
+{
+   width_ = width;
+   height_ = height;
+   if (byteDepth == 1)
+      pixelType_ = PixelTypeGray8;
+   else if (byteDepth == 2)
+      pixelType_ = PixelTypeGray16;
+   else if (byteDepth == 4)
+      pixelType_ = (nComponents == 1) ? PixelTypeGray32 : PixelTypeRGB32;
+   else if (byteDepth == 8)
+      pixelType_ = PixelTypeRGB64;
+   else
+      pixelType_ = PixelTypeUnknown;
+   standardTags_ |= HasImageFormat;
+}
+
+void FrameMetadata::SetPixelStatistics(const PixelStatistics& stats)
+{
+   pixelStatistics_ = stats;
+   standardTags_ |= HasPixelStatistics;
+   if (stats.histogram.empty())
+      standardTags_ &= ~HasPixelHistogram;
+   else
+      standardTags_ |= HasPixelHistogram;
+}
+
+void FrameMetadata::AddStandardTags(Metadata& md) const
+{
+   if (standardTags_ & HasImageNumber)
+      SetImageTag(md, MM::g_Keyword_Metadata_ImageNumber,
+            std::to_string(imageNumber_));
+
+   if (standardTags_ & HasElapsedTime)
+   {
+      using namespace std::chrono;
+      SetImageTag(md, MM::g_Keyword_Elapsed_Time_ms,
+            std::to_string(duration_cast<milliseconds>(elapsedTime_).count()));
+   }
+
+   // Note: It is not ideal to use local time. I think this tag is rarely
+   // used. Consider replacing with UTC (micro)seconds-since-epoch (with
+   // different tag key) after addressing current usage.
+   if (standardTags_ & HasTimeInCore)
+      SetImageTag(md, MM::g_Keyword_Metadata_TimeInCore,
+            FormatLocalTime(timeInCore_));
+
+   if (standardTags_ & HasImageFormat)
+   {
+      SetImageTag(md, "Width", std::to_string(width_));
+      SetImageTag(md, "Height", std::to_string(height_));
+      const char* pixelType;
+      switch (pixelType_)
+      {
+         case PixelTypeGray8: pixelType = "GRAY8"; break;
+         case PixelTypeGray16: pixelType = "GRAY16"; break;
+         case PixelTypeGray32: pixelType = "GRAY32"; break;
+         case PixelTypeRGB32: pixelType = "RGB32"; break;
+         case PixelTypeRGB64: pixelType = "RGB64"; break;
+         default: pixelType = "Unknown"; break;
+      }
+      SetImageTag(md, "PixelType", pixelType);
+   }
+
+   if (standardTags_ & HasPixelStatistics)
+   {
+      SetImageTag(md, MM::g_Keyword_Metadata_PixelMin,
+            FormatNumber(pixelStatistics_.min));
+      SetImageTag(md, MM::g_Keyword_Metadata_PixelMax,
+            FormatNumber(pixelStatistics_.max));
+      SetImageTag(md, MM::g_Keyword_Metadata_PixelMean,
+            FormatNumber(pixelStatistics_.mean));
+      SetImageTag(md, MM::g_Keyword_Metadata_SaturatedPixelCount,
+            std::to_string(pixelStatistics_.saturatedCount));
+   }
+
+   if (standardTags_ & HasPixelHistogram)
+   {
+      MetadataArrayTag tag(MM::g_Keyword_Metadata_PixelHistogram, g_NoDevice,
+            true);
+      for (unsigned count : pixelStatistics_.histogram)
+         tag.AddValue(std::to_string(count).c_str());
+      md.SetTag(tag);
+   }
+}
+
+unsigned FrameMetadata::StandardTagBit(const char* key) const
+{
+   if (std::strcmp(key, MM::g_Keyword_Metadata_ImageNumber) == 0)
+      return HasImageNumber;
+   if (std::strcmp(key, MM::g_Keyword_Elapsed_Time_ms) == 0)
+      return HasElapsedTime;
+   if (std::strcmp(key, MM::g_Keyword_Metadata_TimeInCore) == 0)
+      return HasTimeInCore;
+   if (std::strcmp(key, "Width") == 0 || std::strcmp(key, "Height") == 0 ||
+         std::strcmp(key, "PixelType") == 0)
+      return HasImageFormat;
+   if (std::strcmp(key, MM::g_Keyword_Metadata_PixelMin) == 0 ||
+         std::strcmp(key, MM::g_Keyword_Metadata_PixelMax) == 0 ||
+         std::strcmp(key, MM::g_Keyword_Metadata_PixelMean) == 0 ||
+         std::strcmp(key, MM::g_Keyword_Metadata_SaturatedPixelCount) == 0)
+      return HasPixelStatistics;
+   if (std::strcmp(key, MM::g_Keyword_Metadata_PixelHistogram) == 0)
+      return HasPixelHistogram;
+   return 0;
+}
+
+void FrameMetadata::PutImageTag(const char* key, const char* value)
+{
+   InternTable& table = Interned();
+   const unsigned name = table.Intern(key);
+   RemoveEntry(name);
+
+   Entry entry;
+   entry.key = name;
+   entry.name = name;
+   entry.device = table.Intern(g_NoDevice);
+   entry.firstValue = AppendValue(value, std::strlen(value));
+   entry.valueCount = 1;
+   entry.readOnly = true;
+   entry.isArray = false;
+   entries_.push_back(entry);
+}
+
+bool FrameMetadata::HasTag(const char* key) const
+{
+   if (standardTags_ & StandardTagBit(key))
+      return true;
+   unsigned id;
+   return Interned().Find(key, id) && FindEntry(id) != 0;
+}
+
+const char* FrameMetadata::FindValue(const char* key) const
+{
+   unsigned id;
+   if (!Interned().Find(key, id))
+      return 0;
+   const Entry* entry = FindEntry(id);
+   if (!entry || entry->isArray)
+      return 0;
+   return ValueAt(entry->firstValue);
+}
+
+FrameMetadata::Entry* FrameMetadata::FindEntry(unsigned key)
+{
+   for (std::vector<Entry>::iterator it = entries_.begin(),
+         end = entries_.end(); it != end; ++it)
+   {
+      if (it->key == key)
+         return &*it;
+   }
+   return 0;
+}
+
+const FrameMetadata::Entry* FrameMetadata::FindEntry(unsigned key) const
+{
+   return const_cast<FrameMetadata*>(this)->FindEntry(key);
+}
+
+void FrameMetadata::RemoveEntry(unsigned key)
+{
+   // Values of the removed entry stay in the arena until the next Clear().
+   Entry* entry = FindEntry(key);
+   if (entry)
+      entries_.erase(entries_.begin() + (entry - &entries_[0]));
+}
+
+void FrameMetadata::AddTag(const MetadataTag& tag)
+{
+   InternTable& table = Interned();
+
+   Entry entry;
+   entry.name = table.Intern(tag.GetName());
+   entry.device = table.Intern(tag.GetDevice());
+   entry.key = (tag.GetDevice() == g_NoDevice) ? entry.name :
+      table.Intern(tag.GetQualifiedName());
+   entry.readOnly = tag.IsReadOnly();
+   RemoveEntry(entry.key);
+
+   if (const MetadataArrayTag* atag = tag.ToArrayTag())
+   {
+      entry.isArray = true;
+      entry.valueCount = static_cast<unsigned>(atag->GetSize());
+      entry.firstValue = static_cast<unsigned>(values_.size());
+      for (size_t i = 0; i < atag->GetSize(); ++i)
+         AppendValue(atag->GetValue(i));
+   }
+   else
+   {
+      entry.isArray = false;
+      entry.valueCount = 1;
+      entry.firstValue = AppendValue(tag.ToSingleTag()->GetValue());
+   }
+   entries_.push_back(entry);
+}
+
+unsigned FrameMetadata::AppendValue(const std::string& value)
+{
+   return AppendValue(value.c_str(), value.size());
+}
+
+unsigned FrameMetadata::AppendValue(const char* value, std::size_t length)
+{
+   ValueSpan span;
+   span.offset = arena_.size();
+   span.length = length;
+   arena_.insert(arena_.end(), value, value + length);
+   arena_.push_back('\0');
+   values_.push_back(span);
+   return static_cast<unsigned>(values_.size() - 1);
+}
+
+} // namespace mm
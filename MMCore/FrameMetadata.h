@@ -0,0 +1,190 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          FrameMetadata.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Compact per-frame metadata storage for the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "../MMDevice/ImageMetadata.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace mm {
+
+/**
+ * Statistics on the pixel values of a grayscale image, computed by the Core
+ * when the FramePixelStatistics feature is enabled.
+ */
+struct PixelStatistics
+{
+   double min = 0.0;
+   double max = 0.0;
+   double mean = 0.0;
+   // Pixels at or above the largest value of the camera's bit depth (always
+   // 0 for floating point images)
+   unsigned long long saturatedCount = 0;
+   // Counts of pixel values in equal bins spanning the camera's bit depth;
+   // empty if not requested or for floating point images
+   std::vector<unsigned> histogram;
+};
+
+/**
+ * Flat storage for the metadata of a single frame.
+ *
+ * Tag names and device labels are interned process-wide, so that each tag is
+ * a small fixed-size entry; tag values are stored back to back in a single
+ * character arena. All storage is held in vectors of trivially copyable
+ * elements, so that copying or reusing a FrameMetadata (as happens for each
+ * frame in the sequence buffer) does not allocate once capacity has been
+ * reached.
+ *
+ * The standard tags that the sequence buffer adds to every image (image
+ * number, timestamps, dimensions and pixel type, and pixel statistics if
+ * enabled) are stored as raw values and only formatted into tags when a
+ * consumer asks for the Metadata.
+ *
+ * Conversion to and from Metadata is provided for the public API.
+ */
+class FrameMetadata
+{
+public:
+   void Clear();
+   bool IsEmpty() const { return entries_.empty(); }
+   std::size_t Size() const { return entries_.size(); }
+
+   /**
+    * Replace the contents with the tags of md.
+    */
+   void Assign(const Metadata& md);
+
+   /**
+    * Build the equivalent Metadata, replacing the previous contents of md.
+    */
+   void ToMetadata(Metadata& md) const;
+
+   /**
+    * Add or replace a single-valued tag that is not associated with any
+    * device (the equivalent of Metadata::PutImageTag()).
+    */
+   void PutImageTag(const char* key, const char* value);
+   void PutImageTag(const char* key, const std::string& value)
+   { PutImageTag(key, value.c_str()); }
+
+   /**
+    * Set the standard tags. These replace any tags of the same name when
+    * converting to Metadata.
+    */
+   void SetImageNumber(long number);
+   void SetElapsedTime(std::chrono::steady_clock::duration elapsed);
+   void SetTimeInCore(std::chrono::system_clock::time_point time);
+   void SetImageFormat(unsigned width, unsigned height, unsigned byteDepth,
+         unsigned nComponents);
+   void SetPixelStatistics(const PixelStatistics& stats);
+
+   /**
+    * Raw values of the standard tags (defaults if not set).
+    */
+   long GetImageNumber() const { return imageNumber_; }
+   std::chrono::steady_clock::duration GetElapsedTime() const
+   { return elapsedTime_; }
+   unsigned GetNumberOfComponents() const
+   { return (pixelType_ == PixelTypeRGB32 || pixelType_ == PixelTypeRGB64) ? 4 : 1; }
+   // Null if not set
+   const PixelStatistics* GetPixelStatistics() const
+   { return (standardTags_ & HasPixelStatistics) ? &pixelStatistics_ : 0; }
+
+   /**
+    * Return whether a tag with the given (qualified) key is present,
+    * including the standard tags.
+    */
+   bool HasTag(const char* key) const;
+
+   /**
+    * Return the value of the single-valued tag with the given (qualified)
+    * key, or null if there is no such tag. Standard tags are not formatted
+    * and cannot be retrieved this way. The pointer is invalidated by any
+    * modification of this object.
+    */
+   const char* FindValue(const char* key) const;
+
+private:
+   struct Entry
+   {
+      unsigned key; // Interned qualified name
+      unsigned name;
+      unsigned device;
+      unsigned firstValue;
+      unsigned valueCount;
+      bool readOnly;
+      bool isArray;
+   };
+
+   struct ValueSpan
+   {
+      std::size_t offset; // Into arena_; value is null-terminated
+      std::size_t length;
+   };
+
+   enum PixelType
+   {
+      PixelTypeUnknown,
+      PixelTypeGray8,
+      PixelTypeGray16,
+      PixelTypeGray32,
+      PixelTypeRGB32,
+      PixelTypeRGB64,
+   };
+
+   // Bits of standardTags_
+   enum
+   {
+      HasImageNumber = 1 << 0,
+      HasElapsedTime = 1 << 1,
+      HasTimeInCore = 1 << 2,
+      HasImageFormat = 1 << 3,
+      HasPixelStatistics = 1 << 4,
+      HasPixelHistogram = 1 << 5,
+   };
+
+   std::vector<Entry> entries_;
+   std::vector<ValueSpan> values_;
+   std::vector<char> arena_;
+
+   unsigned standardTags_ = 0;
+   long imageNumber_ = 0;
+   std::chrono::steady_clock::duration elapsedTime_{};
+   std::chrono::system_clock::time_point timeInCore_{};
+   unsigned width_ = 0;
+   unsigned height_ = 0;
+   PixelType pixelType_ = PixelTypeUnknown;
+   PixelStatistics pixelStatistics_;
+
+   Entry* FindEntry(unsigned key);
+   const Entry* FindEntry(unsigned key) const;
+   void RemoveEntry(unsigned key);
+   void AddTag(const MetadataTag& tag);
+   unsigned AppendValue(const std::string& value);
+   unsigned AppendValue(const char* value, std::size_t length);
+   const char* ValueAt(unsigned index) const
+   { return &arena_[values_[index].offset]; }
+   unsigned StandardTagBit(const char* key) const;
+   void AddStandardTags(Metadata& md) const;
+};
+
+} // namespace mm
@@ -0,0 +1,477 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          ImageDownsampling.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Binning and decimation of images for display
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "ImageDownsampling.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MMCORE_X86_64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Binning is done in two passes for each row of output: the factor source
+// rows are first combined element by element into a row accumulator, which
+// is the bulk of the work and is vectorized, then each run of factor
+// accumulated pixels is reduced to one output pixel.
+
+namespace mm {
+
+namespace {
+
+#ifdef MMCORE_X86_64
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MMCORE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MMCORE_TARGET_AVX2
+#endif
+
+bool CpuSupportsAVX2()
+{
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 0);
+   if (info[0] < 7)
+      return false;
+   __cpuid(info, 1);
+   const bool osSavesYmm = (info[2] & (1 << 27)) != 0; // OSXSAVE
+   const bool avx = (info[2] & (1 << 28)) != 0;
+   if (!osSavesYmm || !avx || (_xgetbv(0) & 6) != 6)
+      return false;
+   __cpuidex(info, 7, 0);
+   return (info[1] & (1 << 5)) != 0;
+#else
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool UseAVX2()
+{
+   static const bool avx2 = CpuSupportsAVX2();
+   return avx2;
+}
+
+// SSE2 has no unsigned 16-bit max
+inline __m128i MaxEpu16SSE2(__m128i a, __m128i b)
+{
+   return _mm_adds_epu16(_mm_subs_epu16(a, b), b);
+}
+
+MMCORE_TARGET_AVX2
+std::size_t MaxRowAVX2(std::uint8_t* acc, const std::uint8_t* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 32 <= n; i += 32)
+   {
+      const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+      const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_max_epu8(a, b));
+   }
+   _mm256_zeroupper();
+   return i;
+}
+
+MMCORE_TARGET_AVX2
+std::size_t MaxRowAVX2(std::uint16_t* acc, const std::uint16_t* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+      const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_max_epu16(a, b));
+   }
+   _mm256_zeroupper();
+   return i;
+}
+
+MMCORE_TARGET_AVX2
+std::size_t MaxRowAVX2(float* acc, const float* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+      _mm256_storeu_ps(acc + i,
+            _mm256_max_ps(_mm256_loadu_ps(acc + i), _mm256_loadu_ps(row + i)));
+   _mm256_zeroupper();
+   return i;
+}
+
+MMCORE_TARGET_AVX2
+std::size_t AddRowAVX2(std::uint32_t* acc, const std::uint8_t* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m256i v = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + i)));
+      __m256i* p = reinterpret_cast<__m256i*>(acc + i);
+      _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), v));
+   }
+   _mm256_zeroupper();
+   return i;
+}
+
+MMCORE_TARGET_AVX2
+std::size_t AddRowAVX2(std::uint32_t* acc, const std::uint16_t* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m256i v = _mm256_cvtepu16_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+      __m256i* p = reinterpret_cast<__m256i*>(acc + i);
+      _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), v));
+   }
+   _mm256_zeroupper();
+   return i;
+}
+
+MMCORE_TARGET_AVX2
+std::size_t AddRowAVX2(float* acc, const float* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+      _mm256_storeu_ps(acc + i,
+            _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_loadu_ps(row + i)));
+   _mm256_zeroupper();
+   return i;
+}
+
+std::size_t MaxRowSSE2(std::uint8_t* acc, const std::uint8_t* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), _mm_max_epu8(a, b));
+   }
+   return i;
+}
+
+std::size_t MaxRowSSE2(std::uint16_t* acc, const std::uint16_t* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), MaxEpu16SSE2(a, b));
+   }
+   return i;
+}
+
+std::size_t MaxRowSSE2(float* acc, const float* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 4 <= n; i += 4)
+      _mm_storeu_ps(acc + i, _mm_max_ps(_mm_loadu_ps(acc + i), _mm_loadu_ps(row + i)));
+   return i;
+}
+
+std::size_t AddRowSSE2(std::uint32_t* acc, const std::uint8_t* row, std::size_t n)
+{
+   const __m128i zero = _mm_setzero_si128();
+   std::size_t i = 0;
+   for (; i + 16 <= n; i += 16)
+   {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+      const __m128i lo = _mm_unpacklo_epi8(v, zero);
+      const __m128i hi = _mm_unpackhi_epi8(v, zero);
+      const __m128i parts[4] = {
+         _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+         _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero),
+      };
+      for (int k = 0; k < 4; ++k)
+      {
+         __m128i* p = reinterpret_cast<__m128i*>(acc + i + 4 * k);
+         _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), parts[k]));
+      }
+   }
+   return i;
+}
+
+std::size_t AddRowSSE2(std::uint32_t* acc, const std::uint16_t* row, std::size_t n)
+{
+   const __m128i zero = _mm_setzero_si128();
+   std::size_t i = 0;
+   for (; i + 8 <= n; i += 8)
+   {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+      __m128i* p = reinterpret_cast<__m128i*>(acc + i);
+      _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), _mm_unpacklo_epi16(v, zero)));
+      _mm_storeu_si128(p + 1, _mm_add_epi32(_mm_loadu_si128(p + 1), _mm_unpackhi_epi16(v, zero)));
+   }
+   return i;
+}
+
+std::size_t AddRowSSE2(float* acc, const float* row, std::size_t n)
+{
+   std::size_t i = 0;
+   for (; i + 4 <= n; i += 4)
+      _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_loadu_ps(row + i)));
+   return i;
+}
+
+#endif // MMCORE_X86_64
+
+// acc[i] = max(acc[i], row[i]) for i < n
+template <typename T>
+void MaxRow(T* acc, const T* row, std::size_t n)
+{
+   std::size_t i = 0;
+#ifdef MMCORE_X86_64
+   i = UseAVX2() ? MaxRowAVX2(acc, row, n) : MaxRowSSE2(acc, row, n);
+#endif
+   for (; i < n; ++i)
+      acc[i] = (std::max)(acc[i], row[i]);
+}
+
+// acc[i] += row[i] for i < n
+template <typename S, typename T>
+void AddRow(S* acc, const T* row, std::size_t n)
+{
+   std::size_t i = 0;
+#ifdef MMCORE_X86_64
+   i = UseAVX2() ? AddRowAVX2(acc, row, n) : AddRowSSE2(acc, row, n);
+#endif
+   for (; i < n; ++i)
+      acc[i] += row[i];
+}
+
+template <typename T> struct SumType { typedef std::uint32_t type; };
+template <> struct SumType<float> { typedef float type; };
+
+template <typename T>
+inline T MeanOf(typename SumType<T>::type sum, unsigned count)
+{
+   return static_cast<T>((sum + count / 2) / count);
+}
+
+template <>
+inline float MeanOf<float>(float sum, unsigned count)
+{
+   return sum / count;
+}
+
+template <typename T>
+struct StoreNative
+{
+   T* dst;
+   void operator()(std::size_t i, T value) const { dst[i] = value; }
+   void Mean(std::size_t i, typename SumType<T>::type sum, unsigned count) const
+   { dst[i] = MeanOf<T>(sum, count); }
+};
+
+// Scaling is applied to the exact mean, before any rounding
+template <typename T>
+struct StoreScaled
+{
+   std::uint8_t* dst;
+   float offset;
+   float scale;
+   void operator()(std::size_t i, T value) const
+   { Scale(i, static_cast<float>(value)); }
+   void Mean(std::size_t i, typename SumType<T>::type sum, unsigned count) const
+   { Scale(i, static_cast<float>(sum) / count); }
+   void Scale(std::size_t i, float value) const
+   {
+      const float v = (value - offset) * scale;
+      dst[i] = v <= 0.0f ? 0 : v >= 255.0f ? 255 :
+         static_cast<std::uint8_t>(v + 0.5f);
+   }
+};
+
+template <typename T, typename Store>
+void Downsample(const T* src, unsigned width, unsigned height,
+      unsigned numComponents, unsigned factor, DownsamplingMode mode,
+      Store store)
+{
+   const unsigned outWidth = width / factor;
+   const unsigned outHeight = height / factor;
+   const std::size_t rowElements = static_cast<std::size_t>(width) * numComponents;
+   const std::size_t usedElements =
+      static_cast<std::size_t>(outWidth) * factor * numComponents;
+   const std::size_t blockStride = static_cast<std::size_t>(factor) * numComponents;
+   std::size_t out = 0;
+
+   if (mode == DownsampleNearest)
+   {
+      for (unsigned y = 0; y < outHeight; ++y)
+      {
+         const T* row = src + y * factor * rowElements;
+         for (std::size_t x = 0; x < usedElements; x += blockStride)
+            for (unsigned c = 0; c < numComponents; ++c)
+               store(out++, row[x + c]);
+      }
+      return;
+   }
+
+   if (mode == DownsampleMax)
+   {
+      std::vector<T> acc(usedElements);
+      for (unsigned y = 0; y < outHeight; ++y)
+      {
+         const T* rows = src + y * factor * rowElements;
+         std::memcpy(acc.data(), rows, usedElements * sizeof(T));
+         for (unsigned r = 1; r < factor; ++r)
+            MaxRow(acc.data(), rows + r * rowElements, usedElements);
+         for (std::size_t x = 0; x < usedElements; x += blockStride)
+         {
+            for (unsigned c = 0; c < numComponents; ++c)
+            {
+               T m = acc[x + c];
+               for (std::size_t k = numComponents; k < blockStride; k += numComponents)
+                  m = (std::max)(m, acc[x + k + c]);
+               store(out++, m);
+            }
+         }
+      }
+      return;
+   }
+
+   typedef typename SumType<T>::type Sum;
+   std::vector<Sum> acc(usedElements);
+   const unsigned count = factor * factor;
+   for (unsigned y = 0; y < outHeight; ++y)
+   {
+      const T* rows = src + y * factor * rowElements;
+      std::fill(acc.begin(), acc.end(), Sum());
+      for (unsigned r = 0; r < factor; ++r)
+         AddRow(acc.data(), rows + r * rowElements, usedElements);
+      for (std::size_t x = 0; x < usedElements; x += blockStride)
+      {
+         for (unsigned c = 0; c < numComponents; ++c)
+         {
+            Sum s = Sum();
+            for (std::size_t k = 0; k < blockStride; k += numComponents)
+               s += acc[x + k + c];
+            store.Mean(out++, s, count);
+         }
+      }
+   }
+}
+
+template <typename T>
+void DownsampleTyped(const unsigned char* src, unsigned width, unsigned height,
+      unsigned numComponents, unsigned factor, DownsamplingMode mode,
+      unsigned char* dst)
+{
+   StoreNative<T> store = { reinterpret_cast<T*>(dst) };
+   Downsample(reinterpret_cast<const T*>(src), width, height, numComponents,
+         factor, mode, store);
+}
+
+template <typename T>
+void DownsampleTypedTo8Bit(const unsigned char* src, unsigned width,
+      unsigned height, unsigned numComponents, unsigned factor,
+      DownsamplingMode mode, double displayMin, double displayMax,
+      unsigned char* dst)
+{
+   StoreScaled<T> store = { dst, static_cast<float>(displayMin),
+      static_cast<float>(255.0 / (displayMax - displayMin)) };
+   Downsample(reinterpret_cast<const T*>(src), width, height, numComponents,
+         factor, mode, store);
+}
+
+} // anonymous namespace
+
+bool ParseDownsamplingMode(const char* name, DownsamplingMode& mode)
+{
+   if (std::strcmp(name, "Mean") == 0)
+      mode = DownsampleMean;
+   else if (std::strcmp(name, "Max") == 0)
+      mode = DownsampleMax;
+   else if (std::strcmp(name, "Nearest") == 0)
+      mode = DownsampleNearest;
+   else
+      return false;
+   return true;
+}
+
+bool IsDownsamplingSupported(unsigned bytesPerPixel, unsigned numComponents)
+{
+   if (numComponents == 1)
+      return bytesPerPixel == 1 || bytesPerPixel == 2 || bytesPerPixel == 4;
+   if (numComponents == 4)
+      return bytesPerPixel == 4 || bytesPerPixel == 8;
+   return false;
+}
+
+void DownsampleImage(const unsigned char* src, unsigned width, unsigned height,
+      unsigned bytesPerPixel, unsigned numComponents, unsigned factor,
+      DownsamplingMode mode, unsigned char* dst)
+{
+   switch (bytesPerPixel / numComponents)
+   {
+      case 1:
+         DownsampleTyped<std::uint8_t>(src, width, height, numComponents,
+               factor, mode, dst);
+         break;
+      case 2:
+         DownsampleTyped<std::uint16_t>(src, width, height, numComponents,
+               factor, mode, dst);
+         break;
+      case 4:
+         DownsampleTyped<float>(src, width, height, numComponents,
+               factor, mode, dst);
+         break;
+   }
+}
+
+void DownsampleImageTo8Bit(const unsigned char* src, unsigned width,
+      unsigned height, unsigned bytesPerPixel, unsigned numComponents,
+      unsigned factor, DownsamplingMode mode, double displayMin,
+      double displayMax, unsigned char* dst)
+{
+   switch (bytesPerPixel / numComponents)
+   {
+      case 1:
+         DownsampleTypedTo8Bit<std::uint8_t>(src, width, height, numComponents,
+               factor, mode, displayMin, displayMax, dst);
+         break;
+      case 2:
+         DownsampleTypedTo8Bit<std::uint16_t>(src, width, height, numComponents,
+               factor, mode, displayMin, displayMax, dst);
+         break;
+      case 4:
+         DownsampleTypedTo8Bit<float>(src, width, height, numComponents,
+               factor, mode, displayMin, displayMax, dst);
+         break;
+   }
+}
+
+const char* DownsamplingInstructionSet()
+{
+#ifdef MMCORE_X86_64
+   return UseAVX2() ? "AVX2" : "SSE2";
+#else
+   return "None";
+#endif
+}
+
+} // namespace mm
@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          ImageDownsampling.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Binning and decimation of images for display
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+namespace mm {
+
+enum DownsamplingMode
+{
+   DownsampleMean, // Mean of each factor x factor block, rounded
+   DownsampleMax, // Maximum of each block
+   DownsampleNearest, // Top left pixel of each block
+};
+
+// The largest factor for which the sums of DownsampleMean cannot overflow
+const unsigned MaxDownsamplingFactor = 256;
+
+/**
+ * Parse "Mean", "Max" or "Nearest". Returns false for any other name.
+ */
+bool ParseDownsamplingMode(const char* name, DownsamplingMode& mode);
+
+/**
+ * Whether images in the given format can be downsampled: 8- and 16-bit and
+ * 32-bit float grayscale (1 component), and 8- and 16-bit per component RGB
+ * (4 components).
+ */
+bool IsDownsamplingSupported(unsigned bytesPerPixel, unsigned numComponents);
+
+/**
+ * Reduce the image src by factor (1 to MaxDownsamplingFactor) in each
+ * dimension, treating each component separately. The result is
+ * (width / factor) x (height / factor) pixels in the same format; pixels
+ * beyond the last whole block on the right and bottom are left out.
+ */
+void DownsampleImage(const unsigned char* src, unsigned width, unsigned height,
+      unsigned bytesPerPixel, unsigned numComponents, unsigned factor,
+      DownsamplingMode mode, unsigned char* dst);
+
+/**
+ * As DownsampleImage(), but with each component of the result scaled to 8
+ * bits, mapping displayMin and below to 0 and displayMax and above to 255
+ * (displayMax must be greater than displayMin). The result has numComponents
+ * bytes per pixel.
+ */
+void DownsampleImageTo8Bit(const unsigned char* src, unsigned width,
+      unsigned height, unsigned bytesPerPixel, unsigned numComponents,
+      unsigned factor, DownsamplingMode mode, double displayMin,
+      double displayMax, unsigned char* dst);
+
+/**
+ * Name of the instruction set used for binning: "AVX2", "SSE2", or "None".
+ */
+const char* DownsamplingInstructionSet();
+
+} // namespace mm
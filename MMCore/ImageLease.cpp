@@ -0,0 +1,58 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          ImageLease.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Handle to an image in the sequence buffer that keeps it
+//                from being overwritten
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "ImageLease.h"
+
+#include "FrameBuffer.h"
+
+const void* ImageLease::getPixels() const
+{
+   return image_ ? image_->GetPixels() : nullptr;
+}
+
+unsigned ImageLease::getImageWidth() const
+{
+   return image_ ? image_->Width() : 0;
+}
+
+unsigned ImageLease::getImageHeight() const
+{
+   return image_ ? image_->Height() : 0;
+}
+
+unsigned ImageLease::getBytesPerPixel() const
+{
+   return image_ ? image_->Depth() : 0;
+}
+
+unsigned ImageLease::getNumberOfComponents() const
+{
+   return image_ ? image_->GetFrameMetadata().GetNumberOfComponents() : 0;
+}
+
+/**
+ * Gets the image's metadata, as getLastImageMD() or popNextImageMD() would.
+ */
+void ImageLease::getMetadata(Metadata& md) const
+{
+   if (image_)
+      image_->GetMetadata(md);
+   else
+      md.Clear();
+}
@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          ImageLease.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Handle to an image in the sequence buffer that keeps it
+//                from being overwritten
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <memory>
+
+class CMMCore;
+class Metadata;
+
+namespace mm {
+class ImgBuffer;
+}
+
+/**
+ * An image in the circular buffer, obtained with CMMCore::getLastImageLease()
+ * or CMMCore::popNextImageLease().
+ *
+ * Unlike the pointers returned by getLastImage() or popNextImage(), the
+ * pixels of a leased image are not overwritten by later images for as long
+ * as the lease is held, so they can be read without first copying them.
+ * Copies of a lease share the same image, which is released when the last
+ * copy is destroyed or released.
+ *
+ * While an image is leased, the circular buffer cannot reuse its memory or
+ * that of any later image, so leases should be released as soon as possible:
+ * otherwise the buffer fills up as if the images had not been retrieved.
+ */
+class ImageLease
+{
+public:
+   /**
+    * Creates an empty lease.
+    */
+   ImageLease() {}
+
+   /**
+    * Returns whether the lease holds an image.
+    */
+   bool isValid() const { return image_ != nullptr; }
+
+   /**
+    * Releases the image (if this is the last copy of the lease).
+    */
+   void release() { image_.reset(); }
+
+   /**
+    * Returns the pixels, or null if the lease is empty. See
+    * CMMCore::getLastImage() for the pixel format.
+    */
+   const void* getPixels() const;
+
+   unsigned getImageWidth() const;
+   unsigned getImageHeight() const;
+   unsigned getBytesPerPixel() const;
+   unsigned getNumberOfComponents() const;
+   void getMetadata(Metadata& md) const;
+
+private:
+   friend class CMMCore;
+   explicit ImageLease(std::shared_ptr<const mm::ImgBuffer> image) :
+      image_(image)
+   {}
+
+   std::shared_ptr<const mm::ImgBuffer> image_;
+};
@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          LatestFrameBuffer.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Triple buffer holding a camera's most recent frame, for
+//                live display
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "LatestFrameBuffer.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace mm {
+
+LatestFrameBuffer::LatestFrameBuffer() :
+   middle_(1),
+   publishedCount_(0),
+   back_(0),
+   front_(2)
+{
+}
+
+void LatestFrameBuffer::Publish(const unsigned char* pixels, unsigned width,
+      unsigned height, unsigned bytesPerPixel, unsigned numComponents,
+      const Metadata& md)
+{
+   unsigned char* dest = AcquireWriteSlot(width, height, bytesPerPixel,
+         numComponents);
+   std::memcpy(dest, pixels, slots_[back_].pixels.size());
+   CommitWriteSlot(md);
+}
+
+unsigned char* LatestFrameBuffer::AcquireWriteSlot(unsigned width,
+      unsigned height, unsigned bytesPerPixel, unsigned numComponents)
+{
+   writerMutex_.lock();
+   Frame& frame = slots_[back_];
+   // Only grows the first time a slot is used at a given size
+   frame.pixels.resize(std::size_t(width) * height * bytesPerPixel);
+   frame.width = width;
+   frame.height = height;
+   frame.bytesPerPixel = bytesPerPixel;
+   frame.numComponents = numComponents;
+   return frame.pixels.data();
+}
+
+void LatestFrameBuffer::CommitWriteSlot(const Metadata& md)
+{
+   Frame& frame = slots_[back_];
+   frame.metadata.Assign(md);
+   frame.metadata.SetTimeInCore(std::chrono::system_clock::now());
+   frame.metadata.SetImageFormat(frame.width, frame.height,
+         frame.bytesPerPixel, frame.numComponents);
+   frame.frameNumber = publishedCount_.load(std::memory_order_relaxed);
+
+   // The release half publishes the slot's contents to the reader; the
+   // acquire half ensures that the reader is done with the slot we get back
+   const unsigned previous = middle_.exchange(back_ | FreshBit,
+         std::memory_order_acq_rel);
+   back_ = previous & IndexMask;
+   publishedCount_.fetch_add(1, std::memory_order_release);
+   writerMutex_.unlock();
+}
+
+void LatestFrameBuffer::AbortWriteSlot()
+{
+   writerMutex_.unlock();
+}
+
+bool LatestFrameBuffer::CopyLatestFrame(Frame& frame)
+{
+   std::lock_guard<std::mutex> lock(readerMutex_);
+   if (middle_.load(std::memory_order_relaxed) & FreshBit)
+   {
+      const unsigned previous = middle_.exchange(front_,
+            std::memory_order_acq_rel);
+      front_ = previous & IndexMask;
+   }
+   const Frame& front = slots_[front_];
+   if (front.width == 0)
+      return false;
+   frame = front;
+   return true;
+}
+
+} // namespace mm
@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          LatestFrameBuffer.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Triple buffer holding a camera's most recent frame, for
+//                live display
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "FrameMetadata.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class Metadata;
+
+namespace mm {
+
+/**
+ * Holds the most recent complete frame from one camera, independently of the
+ * sequence buffer.
+ *
+ * This is a triple buffer: the writer fills a back slot and then swaps it
+ * with the middle slot in a single atomic exchange; the reader swaps the
+ * middle slot into its front slot when it holds a newer frame. Neither side
+ * ever waits for the other, and the reader always sees a whole frame.
+ *
+ * Writers are serialized among themselves, as are readers, but a writer and
+ * a reader never share a lock. Readers copy the frame out while holding the
+ * reader lock, as the front slot is swapped by the next reader.
+ */
+class LatestFrameBuffer
+{
+public:
+   struct Frame
+   {
+      std::vector<unsigned char> pixels;
+      unsigned width = 0;
+      unsigned height = 0;
+      unsigned bytesPerPixel = 0;
+      unsigned numComponents = 0;
+      FrameMetadata metadata;
+      unsigned long long frameNumber = 0;
+   };
+
+   LatestFrameBuffer();
+
+   LatestFrameBuffer(const LatestFrameBuffer&) = delete;
+   LatestFrameBuffer& operator=(const LatestFrameBuffer&) = delete;
+
+   /**
+    * Copy a frame in and publish it.
+    */
+   void Publish(const unsigned char* pixels, unsigned width, unsigned height,
+         unsigned bytesPerPixel, unsigned numComponents, const Metadata& md);
+
+   // Two-step writing, for filling the frame in place: the caller writes the
+   // pixels to the returned pointer and then commits or aborts the frame.
+   // The writer lock is held in between.
+   unsigned char* AcquireWriteSlot(unsigned width, unsigned height,
+         unsigned bytesPerPixel, unsigned numComponents);
+   void CommitWriteSlot(const Metadata& md);
+   void AbortWriteSlot();
+
+   /**
+    * Copy the most recent frame into frame, reusing its pixel storage.
+    * Returns false (leaving frame unchanged) if none has been published.
+    */
+   bool CopyLatestFrame(Frame& frame);
+
+   /**
+    * Number of frames published so far.
+    */
+   unsigned long long GetPublishedCount() const
+   { return publishedCount_.load(std::memory_order_acquire); }
+
+private:
+   static const unsigned IndexMask = 3;
+   static const unsigned FreshBit = 4;
+
+   Frame slots_[3];
+
+   // Index of the middle slot, plus FreshBit if it holds a frame that the
+   // reader has not taken yet
+   std::atomic<unsigned> middle_;
+   std::atomic<unsigned long long> publishedCount_;
+
+   std::mutex writerMutex_;
+   unsigned back_; // Synchronized by writerMutex_
+
+   std::mutex readerMutex_;
+   unsigned front_; // Synchronized by readerMutex_
+};
+
+} // namespace mm
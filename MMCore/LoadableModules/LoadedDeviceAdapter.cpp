@@ -31,6 +31,7 @@
 
 LoadedDeviceAdapter::LoadedDeviceAdapter(const std::string& name, const std::string& filename) :
    name_(name),
+   mock_(0),
    InitializeModuleData_(0),
    CreateDevice_(0),
    DeleteDevice_(0),
@@ -66,6 +67,37 @@ LoadedDeviceAdapter::LoadedDeviceAdapter(const std::string& name, const std::str
 }
 
 
+LoadedDeviceAdapter::LoadedDeviceAdapter(const std::string& name, MockDeviceAdapter* mock) :
+   name_(name),
+   mock_(mock),
+   InitializeModuleData_(0),
+   CreateDevice_(0),
+   DeleteDevice_(0),
+   GetModuleVersion_(0),
+   GetDeviceInterfaceVersion_(0),
+   GetNumberOfDevices_(0),
+   GetDeviceName_(0),
+   GetDeviceType_(0),
+   GetDeviceDescription_(0)
+{
+   if (!mock_)
+      throw CMMError("Null mock device adapter " + ToQuotedString(name_));
+   InitializeModuleData();
+}
+
+
+const LoadedDeviceAdapter::MockDevice*
+LoadedDeviceAdapter::FindMockDevice(const char* deviceName) const
+{
+   for (const MockDevice& device : mockDevices_)
+   {
+      if (deviceName && device.name == deviceName)
+         return &device;
+   }
+   return 0;
+}
+
+
 MMThreadLock*
 LoadedDeviceAdapter::GetLock()
 {
@@ -233,6 +265,18 @@ LoadedDeviceAdapter::CheckInterfaceVersion() const
 void
 LoadedDeviceAdapter::InitializeModuleData()
 {
+   if (mock_)
+   {
+      mock_->InitializeModuleData([this](const char* name,
+               MM::DeviceType type, const char* description) {
+            MockDevice device;
+            device.name = name ? name : "";
+            device.type = type;
+            device.description = description ? description : "";
+            mockDevices_.push_back(device);
+         });
+      return;
+   }
    if (!InitializeModuleData_)
       InitializeModuleData_ = reinterpret_cast<fnInitializeModuleData>
          (module_->GetFunction("InitializeModuleData"));
@@ -243,6 +287,8 @@ LoadedDeviceAdapter::InitializeModuleData()
 MM::Device*
 LoadedDeviceAdapter::CreateDevice(const char* deviceName)
 {
+   if (mock_)
+      return mock_->CreateDevice(deviceName);
    if (!CreateDevice_)
       CreateDevice_ = reinterpret_cast<fnCreateDevice>
          (module_->GetFunction("CreateDevice"));
@@ -253,6 +299,11 @@ LoadedDeviceAdapter::CreateDevice(const char* deviceName)
 void
 LoadedDeviceAdapter::DeleteDevice(MM::Device* device)
 {
+   if (mock_)
+   {
+      mock_->DeleteDevice(device);
+      return;
+   }
    if (!DeleteDevice_)
       DeleteDevice_ = reinterpret_cast<fnDeleteDevice>
          (module_->GetFunction("DeleteDevice"));
@@ -283,6 +334,8 @@ LoadedDeviceAdapter::GetDeviceInterfaceVersion() const
 unsigned
 LoadedDeviceAdapter::GetNumberOfDevices() const
 {
+   if (mock_)
+      return static_cast<unsigned>(mockDevices_.size());
    if (!GetNumberOfDevices_)
       GetNumberOfDevices_ = reinterpret_cast<fnGetNumberOfDevices>
          (module_->GetFunction("GetNumberOfDevices"));
@@ -293,6 +346,13 @@ LoadedDeviceAdapter::GetNumberOfDevices() const
 bool
 LoadedDeviceAdapter::GetDeviceName(unsigned index, char* buf, unsigned bufLen) const
 {
+   if (mock_)
+   {
+      if (index >= mockDevices_.size() || mockDevices_[index].name.size() >= bufLen)
+         return false;
+      std::strcpy(buf, mockDevices_[index].name.c_str());
+      return true;
+   }
    if (!GetDeviceName_)
       GetDeviceName_ = reinterpret_cast<fnGetDeviceName>
          (module_->GetFunction("GetDeviceName"));
@@ -303,6 +363,14 @@ LoadedDeviceAdapter::GetDeviceName(unsigned index, char* buf, unsigned bufLen) c
 bool
 LoadedDeviceAdapter::GetDeviceType(const char* deviceName, int* type) const
 {
+   if (mock_)
+   {
+      const MockDevice* device = FindMockDevice(deviceName);
+      if (!device)
+         return false;
+      *type = device->type;
+      return true;
+   }
    if (!GetDeviceType_)
       GetDeviceType_ = reinterpret_cast<fnGetDeviceType>
          (module_->GetFunction("GetDeviceType"));
@@ -313,6 +381,14 @@ LoadedDeviceAdapter::GetDeviceType(const char* deviceName, int* type) const
 bool
 LoadedDeviceAdapter::GetDeviceDescription(const char* deviceName, char* buf, unsigned bufLen) const
 {
+   if (mock_)
+   {
+      const MockDevice* device = FindMockDevice(deviceName);
+      if (!device || device->description.size() >= bufLen)
+         return false;
+      std::strcpy(buf, device->description.c_str());
+      return true;
+   }
    if (!GetDeviceDescription_)
       GetDeviceDescription_ = reinterpret_cast<fnGetDeviceDescription>
          (module_->GetFunction("GetDeviceDescription"));
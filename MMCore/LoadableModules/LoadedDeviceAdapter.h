@@ -26,9 +26,12 @@
 #include "../../MMDevice/MMDevice.h"
 #include "../../MMDevice/ModuleInterface.h"
 #include "../Logging/Logger.h"
+#include "../MockDeviceAdapter.h"
 
 #include <cstring>
 #include <memory>
+#include <string>
+#include <vector>
 
 class CMMCore;
 
@@ -44,10 +47,12 @@ public:
    LoadedDeviceAdapter& operator=(const LoadedDeviceAdapter&) = delete;
 
    LoadedDeviceAdapter(const std::string& name, const std::string& filename);
+   // The mock must outlive the devices created from it
+   LoadedDeviceAdapter(const std::string& name, MockDeviceAdapter* mock);
 
    // TODO Unload() should mark the instance invalid (or require instance
    // deletion to unload)
-   void Unload() { module_->Unload(); } // For developer use only
+   void Unload() { if (module_) module_->Unload(); } // For developer use only
 
    std::string GetName() const { return name_; }
 
@@ -111,6 +116,17 @@ private:
    const std::string name_;
    std::shared_ptr<LoadedModule> module_;
 
+   // Instead of module_, for mock adapters
+   struct MockDevice
+   {
+      std::string name;
+      MM::DeviceType type;
+      std::string description;
+   };
+   MockDeviceAdapter* mock_;
+   std::vector<MockDevice> mockDevices_;
+   const MockDevice* FindMockDevice(const char* deviceName) const;
+
    MMThreadLock lock_;
 
    // Cached function pointers
@@ -50,10 +50,15 @@
 #include "CoreUtils.h"
 #include "DeviceManager.h"
 #include "Devices/DeviceInstances.h"
+#include "ImageDownsampling.h"
 #include "LogManager.h"
 #include "MMCore.h"
+#include "MemoryCopy.h"
 #include "MMEventCallback.h"
 #include "PluginManager.h"
+#include "StreamWriter.h"
+#include "TaskSet_CopyMemory.h"
+#include "ThreadPool.h"
 
 #include <algorithm>
 #include <cassert>
@@ -62,10 +67,12 @@
 #include <deque>
 #include <fstream>
 #include <future>
+#include <limits>
 #include <map>
 #include <set>
 #include <sstream>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -112,7 +119,7 @@
  * (Keep the 3 numbers on one line to make it easier to look at diffs when
  * merging/rebasing.)
  */
-const int MMCore_versionMajor = 11, MMCore_versionMinor = 2, MMCore_versionPatch = 1;
+const int MMCore_versionMajor = 11, MMCore_versionMinor = 19, MMCore_versionPatch = 1;
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -132,15 +139,20 @@ CMMCore::CMMCore() :
    pollingIntervalMs_(10),
    timeoutMs_(5000),
    autoShutter_(true),
+   dropOldestOnOverflow_(false),
+   pixelStatisticsHistogramBins_(0),
    callback_(0),
    configGroups_(0),
    properties_(0),
    externalCallback_(0),
+   frameGapEventsEnabled_(false),
    pixelSizeGroup_(0),
+   threadPool_(std::make_shared<ThreadPool>()),
    cbuf_(0),
    pluginManager_(new CPluginManager()),
    deviceManager_(new mm::DeviceManager()),
-   pPostedErrorsLock_(NULL)
+   pPostedErrorsLock_(NULL),
+   startingCameraStopOnOverflow_(false)
 {
    configGroups_ = new ConfigGroupCollection();
    pixelSizeGroup_ = new PixelSizeConfigGroup();
@@ -151,7 +163,7 @@ CMMCore::CMMCore() :
    callback_ = new CoreCallback(this);
 
    const unsigned seqBufMegabytes = (sizeof(void*) > 4) ? 250 : 25;
-   cbuf_ = new CircularBuffer(seqBufMegabytes);
+   cbuf_ = newCircularBuffer(seqBufMegabytes, mm::BufferAllocationOptions());
 
    nullAffine_ = new std::vector<double>(6);
    for (int i = 0; i < 6; i++) {
@@ -181,6 +193,7 @@ CMMCore::~CMMCore()
    delete callback_;
    delete configGroups_;
    delete properties_;
+   streamWriter_.reset(); // Uses cbuf_
    delete cbuf_;
    delete pixelSizeGroup_;
    delete pPostedErrorsLock_;
@@ -205,6 +218,45 @@ CMMCore::~CMMCore()
  *   multiple threads, one per device module.  Early testing shows this to be 
  *   reliable, but switch this off when issues are encountered during 
  *   device initialization.
+ * - "LockFreeSequenceBuffer" (default: disabled) When enabled, the sequence
+ *   (circular) buffer publishes inserted images and pops them using atomic
+ *   indices instead of a mutex, so that camera threads inserting images and
+ *   application threads retrieving them never block each other. Takes effect
+ *   the next time the buffer is initialized (e.g., when a sequence
+ *   acquisition is started). Do not switch while an acquisition is running.
+ * - "PerCameraSequenceBuffers" (default: disabled) When enabled, each camera
+ *   started for sequence acquisition gets a sequence buffer of its own (the
+ *   circular buffer memory footprint is divided equally among the loaded
+ *   cameras), so that cameras with different image sizes can stream at the
+ *   same time without sharing a buffer. Images are then retrieved with the
+ *   functions taking a camera label, such as popNextImage(const char*) and
+ *   getLastImage(const char*); the functions without a camera label keep
+ *   operating on the shared buffer. Takes effect when an acquisition is
+ *   started.
+ * - "LatestFrameBuffers" (default: disabled) When enabled, each camera keeps
+ *   a copy of its most recent image, whether snapped or inserted during a
+ *   sequence acquisition, that can be read with getLatestFrameMD() without
+ *   blocking or being blocked by the acquisition. Enabling this costs an
+ *   extra copy of every image.
+ * - "FramePixelStatistics" (default: disabled) When enabled, the minimum,
+ *   maximum and mean pixel values, the number of saturated pixels (at the
+ *   camera's bit depth) and optionally a histogram (see
+ *   setPixelStatisticsHistogramBins()) of each grayscale image inserted
+ *   into the sequence buffer are computed before the image becomes
+ *   available, and stored in its metadata (PixelMin, PixelMax, PixelMean,
+ *   SaturatedPixelCount and PixelHistogram). Enabling this costs an extra
+ *   pass over every image. Takes effect when an acquisition is started.
+ * - "CompressedSequenceBuffer" (default: disabled) When enabled, images are
+ *   stored in the sequence buffer losslessly compressed (on the Core's
+ *   worker threads, as they are inserted), so that several times more of
+ *   them fit in the same memory, depending on the image content. They are
+ *   decompressed by the thread retrieving them, except the most recent
+ *   image, which is also kept uncompressed for display. Pointers to
+ *   retrieved images then remain valid only until the same thread
+ *   retrieves another image from the same buffer. The achieved compression ratio and the costs
+ *   are reported by getAcquisitionStatistics(). Has no effect on a buffer
+ *   in shared memory. Takes effect the next time the buffer is initialized
+ *   (e.g., when a sequence acquisition is started).
  *
  * Permanently enabled features:
  * - None so far.
@@ -955,12 +1007,14 @@ void CMMCore::initializeAllDevicesParallel() throw (CMMError)
       LOG_INFO(coreLogger_) << "Did initialize device " << pPort->GetLabel();
    }
 
-   // second round, spin up threads to initialize non-port devices, one thread per module
+   // second round, initialize non-port devices on the Core's thread pool, one job per module
+   // (modules beyond the number of pool threads wait for a thread to become free)
    std::vector<std::future<int>> futures;
    std::map<std::shared_ptr<LoadedDeviceAdapter>, std::vector<std::pair<std::shared_ptr<DeviceInstance>, std::string>>>::iterator it;
    for (it = moduleMap.begin(); it != moduleMap.end(); it++)
    {
-      auto f = std::async(std::launch::async, &CMMCore::initializeVectorOfDevices, this, it->second);
+      std::vector<std::pair<std::shared_ptr<DeviceInstance>, std::string>> pDevices = it->second;
+      auto f = threadPool_->Submit([this, pDevices] { return initializeVectorOfDevices(pDevices); });
       futures.push_back(std::move(f));
    }
    for (int i = 0; i < futures.size(); i++) {
@@ -973,10 +1027,9 @@ void CMMCore::initializeAllDevicesParallel() throw (CMMError)
       catch (...)
       {
          std::exception_ptr pex = std::current_exception();
-         // The std::future returned by std::async is special and its destructor blocks until the future completes.
-         // This is okay if there are 0 or 1 errors total(the successful initializations run to completion and the exception is propagated).
-         // When there are 2 or more errors, however, the second exception would be thrown in the destructor of the future, 
-         // and throwing anything in a destructor is very bad(might terminate by default).
+         // Wait for the remaining modules to finish before propagating the first error, so that
+         // no device is still being initialized when this function returns. Later errors are
+         // ignored.
          for (int j = i + 1; j < futures.size(); j++)
          {
             try
@@ -1026,6 +1079,144 @@ int CMMCore::initializeVectorOfDevices(std::vector<std::pair<std::shared_ptr<Dev
    return DEVICE_OK;
 }
 
+/**
+ * Sets the number of threads in the Core's thread pool, which runs the Core's
+ * parallel work: copying images into the circular buffer, pre-faulting
+ * circular buffer memory and initializing devices in parallel. This is also
+ * available as the Core property ThreadPoolSize.
+ *
+ * Work queued on the pool is kept; work already running finishes first.
+ *
+ * @param threadCount the number of threads, or 0 for one thread per
+ * hardware thread (the default). At most twice the number of hardware
+ * threads.
+ * @throws CMMError if threadCount is too large or this is called from a
+ * thread pool thread (e.g. during device initialization).
+ */
+void CMMCore::setThreadPoolSize(unsigned threadCount) throw (CMMError)
+{
+   if (threadCount > getMaxThreadPoolSize())
+      throw CMMError("Thread pool size " + ToString(threadCount) +
+            " is larger than the maximum of " + ToString(getMaxThreadPoolSize()));
+   reconfigureThreadPool(threadCount, threadPool_->GetPinThreads());
+}
+
+/**
+ * Returns the number of threads in the Core's thread pool.
+ */
+unsigned CMMCore::getThreadPoolSize()
+{
+   return static_cast<unsigned>(threadPool_->GetSize());
+}
+
+/**
+ * Sets whether each thread of the Core's thread pool is bound to a single
+ * CPU (in the order of the CPUs the process may use), which can improve copy
+ * throughput on multi-socket machines. Not supported on macOS, where this
+ * setting has no effect. This is also available as the Core property
+ * ThreadPoolAffinity.
+ *
+ * @param pinThreads whether to bind the threads to CPUs (default: false).
+ * @throws CMMError if called from a thread pool thread.
+ */
+void CMMCore::setThreadPoolAffinity(bool pinThreads) throw (CMMError)
+{
+   reconfigureThreadPool(threadPool_->GetSize(), pinThreads);
+}
+
+/**
+ * Returns whether the threads of the Core's thread pool are bound to CPUs.
+ */
+bool CMMCore::getThreadPoolAffinity()
+{
+   return threadPool_->GetPinThreads();
+}
+
+/**
+ * Replaces the threads of the thread pool and updates the Core properties.
+ */
+void CMMCore::reconfigureThreadPool(unsigned threadCount, bool pinThreads) throw (CMMError)
+{
+   if (threadPool_->IsWorkerThread())
+      throw CMMError("The thread pool cannot be reconfigured from one of its own threads");
+
+   threadPool_->Reconfigure(threadCount, pinThreads);
+
+   const std::string size = ToString(threadPool_->GetSize());
+   const char* affinity = pinThreads ? "1" : "0";
+   properties_->Set(MM::g_Keyword_CoreThreadPoolSize, size.c_str());
+   properties_->Set(MM::g_Keyword_CoreThreadPoolAffinity, affinity);
+   {
+      MMThreadGuard scg(stateCacheLock_);
+      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreThreadPoolSize, size.c_str()));
+      stateCache_.addSetting(PropertySetting(MM::g_Keyword_CoreDevice, MM::g_Keyword_CoreThreadPoolAffinity, affinity));
+   }
+   LOG_INFO(coreLogger_) << "Thread pool reconfigured: " << size << " threads" <<
+      (pinThreads ? ", bound to CPUs" : "");
+}
+
+/**
+ * Returns the largest allowed thread pool size.
+ */
+unsigned CMMCore::getMaxThreadPoolSize()
+{
+   return 2 * (std::max)(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * Measures memory copy bandwidth on this machine and tunes how the Core copies
+ * images into the circular buffer: how many thread pool threads are used for
+ * a given image size, and from what size the copy bypasses the CPU cache
+ * (non-temporal stores). Until this is called, one thread is used per MB and
+ * the cache is bypassed for images larger than the last-level cache.
+ *
+ * The measurements are logged as debug messages and the chosen parameters
+ * are logged. Takes about a second; call it after setting the thread pool
+ * size and while no acquisition is running. The tuning is shared by all
+ * Core instances in the process.
+ *
+ * @return the chosen parameters: "BytesPerTask" (one more thread is used
+ * for each this many bytes) and "NonTemporalThresholdBytes" (infinite if the
+ * cache is never bypassed)
+ */
+std::map<std::string, double> CMMCore::calibrateImageCopy()
+{
+   const TaskSet_CopyMemory::Tuning previous = TaskSet_CopyMemory::GetTuning();
+   LOG_INFO(coreLogger_) << "Calibrating image copy on " <<
+      threadPool_->GetSize() << " threads (non-temporal copy instruction set: " <<
+      mm::NonTemporalCopyInstructionSet() << ", last-level cache: " <<
+      mm::GetLastLevelCacheSize() << " bytes)";
+
+   std::vector<TaskSet_CopyMemory::Measurement> measurements;
+   const TaskSet_CopyMemory::Tuning tuning =
+      TaskSet_CopyMemory::Calibrate(threadPool_, &measurements);
+   for (const auto& m : measurements)
+   {
+      LOG_DEBUG(coreLogger_) << "Image copy of " << m.bytes << " bytes on " <<
+         m.taskCount << " threads with " <<
+         (m.nonTemporal ? "non-temporal stores" : "memcpy") << ": " <<
+         m.bytesPerSecond / 1e9 << " GB/s";
+   }
+   TaskSet_CopyMemory::SetTuning(tuning);
+
+   const bool bypass = tuning.nonTemporalThreshold != (std::numeric_limits<size_t>::max)();
+   std::ostringstream threshold;
+   if (bypass)
+      threshold << "bypassing the cache from " << tuning.nonTemporalThreshold << " bytes";
+   else
+      threshold << "never bypassing the cache";
+   LOG_INFO(coreLogger_) << "Image copy tuned: one thread per " <<
+      tuning.bytesPerTask << " bytes (was " << previous.bytesPerTask <<
+      "), " << threshold.str();
+
+   std::map<std::string, double> result;
+   result["BytesPerTask"] = static_cast<double>(tuning.bytesPerTask);
+   result["NonTemporalThresholdBytes"] = bypass ?
+      static_cast<double>(tuning.nonTemporalThreshold) :
+      std::numeric_limits<double>::infinity();
+   return result;
+}
+
 /**
  * Updates CoreProperties (currently all Core properties are 
  * devices types) with the loaded hardware.
@@ -1175,6 +1366,22 @@ void CMMCore::unloadLibrary(const char* moduleName) throw (CMMError)
    }
 }
 
+/**
+ * Makes a device adapter implemented by the caller available to
+ * loadDevice() under the given module name, as if it had been found on the
+ * search path. For testing the Core with devices; not available from Java.
+ *
+ * The implementation must outlive the devices loaded from it.
+ */
+void CMMCore::loadMockDeviceAdapter(const char* name,
+      MockDeviceAdapter* implementation) throw (CMMError)
+{
+   if (name == 0 || implementation == 0)
+      throw CMMError(errorText_[MMERR_NullPointerException], MMERR_NullPointerException);
+
+   pluginManager_->LoadMockAdapter(name, implementation);
+}
+
 /**
  * Returns device name for a given device label.
  * "Name" is determined by the library and is immutable, while "label" is
@@ -2556,6 +2763,10 @@ void CMMCore::snapImage() throw (CMMError)
          logError("CMMCore::snapImage", getDeviceErrorText(ret, camera).c_str());
          throw CMMError(getDeviceErrorText(ret, camera).c_str(), MMERR_DEVICE_GENERIC);
       }
+
+      // After closing the shutter, so that an error here leaves it closed
+      if (mm::features::flags().latestFrameBuffers)
+         publishSnappedImage(camera);
    }
    else
    {
@@ -2802,6 +3013,34 @@ long CMMCore::getImageBufferSize()
    return 0;
 }
 
+/**
+ * Records the camera whose acquisition is being started for the duration of
+ * its StartSequenceAcquisition() call, so that CoreCallback::PrepareForAcq()
+ * can tell which cameras it starts in turn.
+ */
+class CMMCore::StartingCameraScope
+{
+   CMMCore& core_;
+
+public:
+   StartingCameraScope(CMMCore& core, std::shared_ptr<CameraInstance> camera,
+         bool stopOnOverflow) :
+      core_(core)
+   {
+      std::lock_guard<std::mutex> lock(core_.startingCameraMutex_);
+      core_.startingCamera_ = camera;
+      core_.startingCameraThread_ = std::this_thread::get_id();
+      core_.startingCameraStopOnOverflow_ = stopOnOverflow;
+   }
+
+   ~StartingCameraScope()
+   {
+      std::lock_guard<std::mutex> lock(core_.startingCameraMutex_);
+      core_.startingCamera_.reset();
+      core_.startingCameraThread_ = std::thread::id();
+   }
+};
+
 /**
  * Starts streaming camera sequence acquisition.
  * This command does not block the calling thread for the duration of the acquisition.
@@ -2830,15 +3069,11 @@ void CMMCore::startSequenceAcquisition(long numImages, double intervalMs, bool s
 
 		try
 		{
-			if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
-			{
-				logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
-				throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
-			}
-			cbuf_->Clear();
+			initializeSequenceBuffer(camera, stopOnOverflow);
          mm::DeviceModuleLockGuard guard(camera);
 
          LOG_DEBUG(coreLogger_) << "Will start sequence acquisition from default camera";
+         StartingCameraScope starting(*this, camera, stopOnOverflow);
 			int nRet = camera->StartSequenceAcquisition(numImages, intervalMs, stopOnOverflow);
 			if (nRet != DEVICE_OK)
 				throw CMMError(getDeviceErrorText(nRet, camera).c_str(), MMERR_DEVICE_GENERIC);
@@ -2874,16 +3109,15 @@ void CMMCore::startSequenceAcquisition(const char* label, long numImages, double
       throw CMMError(getCoreErrorText(MMERR_NotAllowedDuringSequenceAcquisition).c_str(),
                      MMERR_NotAllowedDuringSequenceAcquisition);
 
-   if (!cbuf_->Initialize(pCam->GetNumberOfChannels(), pCam->GetImageWidth(), pCam->GetImageHeight(), pCam->GetImageBytesPerPixel()))
-   {
-      logError(getDeviceName(pCam).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
-      throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
-   }
-   cbuf_->Clear();
+   initializeSequenceBuffer(pCam, stopOnOverflow);
 	
    LOG_DEBUG(coreLogger_) <<
       "Will start sequence acquisition from camera " << label;
-   int nRet = pCam->StartSequenceAcquisition(numImages, intervalMs, stopOnOverflow);
+   int nRet;
+   {
+      StartingCameraScope starting(*this, pCam, stopOnOverflow);
+      nRet = pCam->StartSequenceAcquisition(numImages, intervalMs, stopOnOverflow);
+   }
    if (nRet != DEVICE_OK)
       throw CMMError(getDeviceErrorText(nRet, pCam).c_str(), MMERR_DEVICE_GENERIC);
 
@@ -2916,6 +3150,273 @@ void CMMCore::prepareSequenceAcquisition(const char* label) throw (CMMError)
 }
 
 
+/**
+ * Initializes and clears the buffer that the camera's images will be
+ * inserted into: a buffer of its own when the PerCameraSequenceBuffers
+ * feature is enabled, otherwise the shared circular buffer. Unless the
+ * acquisition stops on overflow, the buffer drops its oldest images when
+ * full if setBufferDropOldestOnOverflow() is enabled.
+ *
+ * A composite camera gets no buffer of its own: the cameras it starts get
+ * theirs when they prepare for acquisition (see
+ * initializeStartedCameraSequenceBuffer()).
+ */
+void CMMCore::initializeSequenceBuffer(std::shared_ptr<CameraInstance> camera,
+      bool stopOnOverflow) throw (CMMError)
+{
+   CircularBuffer* buffer = cbuf_;
+   if (mm::features::flags().perCameraSequenceBuffers)
+   {
+      if (camera->IsComposite())
+      {
+         camera->SetSequenceBuffer(std::shared_ptr<CircularBuffer>());
+         camera->GetAcquisitionStatistics().Reset();
+         return;
+      }
+
+      // Each camera that streams images gets an equal share of the circular
+      // buffer memory footprint, so that the total does not depend on how
+      // many cameras stream at the same time.
+      std::size_t numCameras = 0;
+      std::vector<std::string> cameraLabels =
+         deviceManager_->GetDeviceList(MM::CameraDevice);
+      for (std::vector<std::string>::const_iterator it = cameraLabels.begin();
+            it != cameraLabels.end(); ++it)
+      {
+         if (!deviceManager_->GetDeviceOfType<CameraInstance>(*it)->IsComposite())
+            ++numCameras;
+      }
+      numCameras = (std::max)(std::size_t(1), numCameras);
+      const unsigned sizeMB = (std::max)(1u,
+            static_cast<unsigned>(cbuf_->GetMemorySizeMB() / numCameras));
+
+      mm::BufferAllocationOptions options = cbuf_->GetAllocationOptions();
+      if (!options.backingFile.empty())
+         options.backingFile += "." + camera->GetLabel();
+      if (!options.sharedMemoryName.empty())
+         options.sharedMemoryName += "." + camera->GetLabel();
+
+      std::shared_ptr<CircularBuffer> ownBuffer = camera->GetSequenceBuffer();
+      if (!ownBuffer || ownBuffer->GetMemorySizeMB() != sizeMB ||
+            ownBuffer->GetAllocationOptions() != options)
+      {
+         // Free the old buffer (and its file) first
+         camera->SetSequenceBuffer(std::shared_ptr<CircularBuffer>());
+         ownBuffer.reset();
+         ownBuffer.reset(newCircularBuffer(sizeMB, options));
+         camera->SetSequenceBuffer(ownBuffer);
+      }
+      buffer = ownBuffer.get();
+   }
+   else
+   {
+      camera->SetSequenceBuffer(std::shared_ptr<CircularBuffer>());
+   }
+
+   if (!buffer->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
+   {
+      logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
+   }
+   buffer->Clear();
+   if (mm::features::flags().compressedSequenceBuffer && !buffer->IsCompressed())
+      LOG_WARNING(coreLogger_) << "Sequence buffer is in shared memory; "
+         "images are stored uncompressed";
+   buffer->SetOverwriteOldest(dropOldestOnOverflow_ && !stopOnOverflow);
+   buffer->SetPixelStatistics(mm::features::flags().framePixelStatistics,
+         camera->GetBitDepth(), pixelStatisticsHistogramBins_);
+   camera->GetAcquisitionStatistics().Reset();
+}
+
+/**
+ * Called when a camera prepares for acquisition. If another camera's
+ * acquisition is being started on this thread, that camera is a composite
+ * camera starting this one, so this camera gets a buffer of its own
+ * (PerCameraSequenceBuffers feature) and the composite camera releases its
+ * own.
+ */
+void CMMCore::initializeStartedCameraSequenceBuffer(
+      std::shared_ptr<CameraInstance> camera) throw (CMMError)
+{
+   if (!mm::features::flags().perCameraSequenceBuffers)
+      return;
+
+   std::shared_ptr<CameraInstance> composite;
+   bool stopOnOverflow;
+   {
+      std::lock_guard<std::mutex> lock(startingCameraMutex_);
+      if (startingCameraThread_ != std::this_thread::get_id())
+         return;
+      composite = startingCamera_;
+      stopOnOverflow = startingCameraStopOnOverflow_;
+   }
+   if (!composite || composite == camera)
+      return;
+
+   if (!composite->IsComposite())
+   {
+      LOG_DEBUG(coreLogger_) << "Camera " << composite->GetLabel() <<
+         " streams from other cameras; they get their own sequence buffers";
+      composite->SetComposite(true);
+      composite->SetSequenceBuffer(std::shared_ptr<CircularBuffer>());
+   }
+   initializeSequenceBuffer(camera, stopOnOverflow);
+}
+
+/**
+ * Returns the camera's own sequence buffer.
+ */
+std::shared_ptr<CircularBuffer> CMMCore::getCameraSequenceBuffer(const char* cameraLabel) const throw (CMMError)
+{
+   std::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+   std::shared_ptr<CircularBuffer> buffer = camera->GetSequenceBuffer();
+   if (!buffer)
+      throw CMMError("Camera " + ToQuotedString(cameraLabel) +
+            " has no sequence buffer of its own (the PerCameraSequenceBuffers "
+            "feature must be enabled when its acquisition is started, and "
+            "the images of composite cameras are in the buffers of the "
+            "cameras they start)");
+   return buffer;
+}
+
+/**
+ * Returns the camera whose latest frame buffer is requested, checking that
+ * the LatestFrameBuffers feature is enabled.
+ */
+std::shared_ptr<CameraInstance> CMMCore::getLatestFrameCamera(const char* cameraLabel) const throw (CMMError)
+{
+   if (!mm::features::flags().latestFrameBuffers)
+      throw CMMError("The LatestFrameBuffers feature is not enabled");
+   if (!cameraLabel || std::string(cameraLabel).empty())
+      throw CMMError(getCoreErrorText(MMERR_CameraNotAvailable).c_str(), MMERR_CameraNotAvailable);
+   return deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+}
+
+/**
+ * Copies the image just snapped by camera to its latest frame buffer,
+ * processed as getImage() would return it. Must be called with the camera's
+ * module lock held. Throws if the camera's tags cannot be read, in which case
+ * nothing is published.
+ */
+void CMMCore::publishSnappedImage(std::shared_ptr<CameraInstance> camera)
+{
+   const unsigned char* pixels = camera->GetImageBuffer();
+   if (!pixels)
+      return;
+   const unsigned width = camera->GetImageWidth();
+   const unsigned height = camera->GetImageHeight();
+   const unsigned bytesPerPixel = camera->GetImageBytesPerPixel();
+
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, camera->GetLabel());
+   camera->MergeCachedTags(md);
+
+   // The processor runs on a copy, so that the latest frame buffer's writer
+   // lock is not held while it runs
+   std::vector<unsigned char> processed;
+   std::shared_ptr<ImageProcessorInstance> imageProcessor =
+      currentImageProcessor_.lock();
+   if (imageProcessor)
+   {
+      processed.assign(pixels, pixels + std::size_t(width) * height * bytesPerPixel);
+      imageProcessor->Process(processed.data(), width, height, bytesPerPixel);
+      pixels = processed.data();
+   }
+
+   camera->GetLatestFrameBuffer().Publish(pixels, width, height,
+         bytesPerPixel, camera->GetNumberOfComponents(), md);
+}
+
+/**
+ * Creates a circular buffer whose allocation is logged.
+ */
+CircularBuffer* CMMCore::newCircularBuffer(unsigned sizeMB,
+      const mm::BufferAllocationOptions& options)
+{
+   mm::logging::Logger logger = coreLogger_;
+   int loggedPercent = 0;
+   mm::BufferMemory::ProgressFunction progress =
+      [logger, loggedPercent](std::size_t done, std::size_t total) mutable
+      {
+         // Log in steps of 10%, as large buffers take several seconds
+         const int percent = static_cast<int>(100.0 * done / total);
+         if (percent / 10 > loggedPercent / 10 || done == total)
+         {
+            loggedPercent = percent;
+            LOG_INFO(logger) << "Pre-faulting circular buffer memory: " <<
+               percent << "% of " << (total >> 20) << " MB";
+         }
+      };
+   return new CircularBuffer(sizeMB, options, progress, threadPool_);
+}
+
+/**
+ * Replaces the circular buffer with one allocated with the given options
+ * and, if there is a camera, allocates it right away.
+ */
+void CMMCore::reallocateCircularBuffer(const mm::BufferAllocationOptions& options) throw (CMMError)
+{
+   if (isSequenceRunning())
+      throw CMMError("Cannot change the circular buffer allocation while a sequence acquisition is running");
+   if (isStreamingToDisk())
+      throw CMMError("Cannot change the circular buffer allocation while streaming to disk");
+
+   replaceCircularBuffer(cbuf_->GetMemorySizeMB(), options);
+}
+
+/**
+ * Creates a circular buffer and, if there is a camera, allocates it; the
+ * current buffer is only replaced if this succeeds.
+ *
+ * The exception is a buffer that keeps the backing file or shared memory
+ * name of the current one: the file or segment cannot be created while the
+ * current buffer holds it, so the current buffer is freed first and, on
+ * failure, is left replaced by the new, unallocated, buffer.
+ */
+void CMMCore::replaceCircularBuffer(unsigned sizeMB,
+      const mm::BufferAllocationOptions& options) throw (CMMError)
+{
+   const mm::BufferAllocationOptions& oldOptions = cbuf_->GetAllocationOptions();
+   const bool reusesNamedMemory =
+      (!options.backingFile.empty() &&
+         options.backingFile == oldOptions.backingFile) ||
+      (!options.sharedMemoryName.empty() &&
+         options.sharedMemoryName == oldOptions.sharedMemoryName);
+
+   try
+   {
+      std::unique_ptr<CircularBuffer> buffer(newCircularBuffer(sizeMB, options));
+      if (reusesNamedMemory)
+      {
+         delete cbuf_;
+         cbuf_ = buffer.release();
+      }
+      CircularBuffer* newBuffer = reusesNamedMemory ? cbuf_ : buffer.get();
+
+      std::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
+      if (camera)
+      {
+         mm::DeviceModuleLockGuard guard(camera);
+         if (!newBuffer->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
+            throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
+      }
+
+      if (!reusesNamedMemory)
+      {
+         delete cbuf_;
+         cbuf_ = buffer.release();
+      }
+   }
+   catch (const std::bad_alloc& ex)
+   {
+      // Out of memory before even allocating the buffer memory
+      std::ostringstream messs;
+      messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << '\n';
+      throw CMMError(messs.str().c_str(), MMERR_OutOfMemory);
+   }
+}
+
 /**
  * Initialize circular buffer based on the current camera settings.
  */
@@ -2977,14 +3478,13 @@ void CMMCore::startContinuousSequenceAcquisition(double intervalMs) throw (CMMEr
             ,MMERR_NotAllowedDuringSequenceAcquisition);
       }
 
-      if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
+      initializeSequenceBuffer(camera, false);
+      LOG_DEBUG(coreLogger_) << "Will start continuous sequence acquisition from current camera";
+      int nRet;
       {
-         logError(getDeviceName(camera).c_str(), getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str());
-         throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
+         StartingCameraScope starting(*this, camera, false);
+         nRet = camera->StartSequenceAcquisition(intervalMs);
       }
-      cbuf_->Clear();
-      LOG_DEBUG(coreLogger_) << "Will start continuous sequence acquisition from current camera";
-      int nRet = camera->StartSequenceAcquisition(intervalMs);
       if (nRet != DEVICE_OK)
          throw CMMError(getDeviceErrorText(nRet, camera).c_str(), MMERR_DEVICE_GENERIC);
    }
@@ -3088,6 +3588,94 @@ void* CMMCore::getLastImage() throw (CMMError)
    }
 }
 
+/**
+ * Gets the last image from the circular buffer, reduced by factor in each
+ * dimension, for display. This is much faster than getting the whole image
+ * and reducing it afterwards, especially from Java.
+ *
+ * The result is getImageWidth() / factor by getImageHeight() / factor pixels
+ * in the same format as getLastImage(); pixels beyond the last whole
+ * factor x factor block on the right and bottom are left out. It remains
+ * valid until the next call to getLastImageDownsampled() or
+ * getLastImageDownsampled8Bit() from the same thread.
+ *
+ * @param factor   the reduction factor, from 1 to 256
+ * @param mode     "Mean" (binning), "Max" (of each block), or "Nearest"
+ *                 (the top left pixel of each block)
+ */
+void* CMMCore::getLastImageDownsampled(unsigned factor, const char* mode)
+   throw (CMMError)
+{
+   return downsampleLastImage(factor, mode, false, 0.0, 0.0);
+}
+
+/**
+ * As getLastImageDownsampled(), but with the result converted to 8 bits
+ * per component for display: values of displayMin and below become 0, and
+ * values of displayMax and above become 255. The result has
+ * getNumberOfComponents() bytes per pixel.
+ *
+ * @param factor      the reduction factor, from 1 to 256
+ * @param mode        "Mean", "Max", or "Nearest"
+ * @param displayMin  the value to display as black
+ * @param displayMax  the value to display as white (greater than displayMin)
+ */
+void* CMMCore::getLastImageDownsampled8Bit(unsigned factor, const char* mode,
+      double displayMin, double displayMax) throw (CMMError)
+{
+   if (!(displayMax > displayMin))
+      throw CMMError("Display maximum must be greater than display minimum");
+   return downsampleLastImage(factor, mode, true, displayMin, displayMax);
+}
+
+void* CMMCore::downsampleLastImage(unsigned factor, const char* mode,
+      bool to8Bit, double displayMin, double displayMax) throw (CMMError)
+{
+   mm::DownsamplingMode downsamplingMode;
+   if (!mode || !mm::ParseDownsamplingMode(mode, downsamplingMode))
+      throw CMMError("Downsampling mode must be Mean, Max, or Nearest");
+   if (factor < 1 || factor > mm::MaxDownsamplingFactor)
+      throw CMMError("Downsampling factor must be between 1 and " +
+            ToString(mm::MaxDownsamplingFactor));
+
+   // Hold the image so that it cannot be overwritten while being read
+   std::shared_ptr<const mm::ImgBuffer> image = cbuf_->LeaseNthFromTopImage(0, 0);
+   if (!image)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+
+   const unsigned width = image->Width();
+   const unsigned height = image->Height();
+   const unsigned bytesPerPixel = image->Depth();
+   const unsigned numComponents =
+      image->GetFrameMetadata().GetNumberOfComponents();
+   if (!mm::IsDownsamplingSupported(bytesPerPixel, numComponents))
+      throw CMMError("Cannot downsample images with " +
+            ToString(bytesPerPixel) + " bytes per pixel and " +
+            ToString(numComponents) + " components");
+   if (factor > width || factor > height)
+      throw CMMError("Downsampling factor is larger than the image");
+
+   // The size of the result is given in terms of the current camera (as is
+   // that of the result of getLastImage()), so check that it applies
+   if (width != getImageWidth() || height != getImageHeight() ||
+         bytesPerPixel != getBytesPerPixel() ||
+         numComponents != getNumberOfComponents())
+      throw CMMError("The last image does not have the current camera's image size and format");
+
+   static thread_local std::vector<unsigned char> result;
+   const std::size_t pixelCount =
+      static_cast<std::size_t>(width / factor) * (height / factor);
+   result.resize(pixelCount * (to8Bit ? numComponents : bytesPerPixel));
+   if (to8Bit)
+      mm::DownsampleImageTo8Bit(image->GetPixels(), width, height,
+            bytesPerPixel, numComponents, factor, downsamplingMode,
+            displayMin, displayMax, result.data());
+   else
+      mm::DownsampleImage(image->GetPixels(), width, height, bytesPerPixel,
+            numComponents, factor, downsamplingMode, result.data());
+   return result.data();
+}
+
 void* CMMCore::getLastImageMD(unsigned channel, unsigned slice, Metadata& md) const throw (CMMError)
 {
    // Slices have never been implemented on the device interface side
@@ -3097,7 +3685,7 @@ void* CMMCore::getLastImageMD(unsigned channel, unsigned slice, Metadata& md) co
    const mm::ImgBuffer* pBuf = cbuf_->GetTopImageBuffer(channel);
    if (pBuf != 0)
    {
-      md = pBuf->GetMetadata();
+      pBuf->GetMetadata(md);
       return const_cast<unsigned char*>(pBuf->GetPixels());
    }
    else
@@ -3138,7 +3726,7 @@ void* CMMCore::getNBeforeLastImageMD(unsigned long n, Metadata& md) const throw
    const mm::ImgBuffer* pBuf = cbuf_->GetNthFromTopImageBuffer(n);
    if (pBuf != 0)
    {
-      md = pBuf->GetMetadata();
+      pBuf->GetMetadata(md);
       return const_cast<unsigned char*>(pBuf->GetPixels());
    }
    else
@@ -3180,7 +3768,7 @@ void* CMMCore::popNextImageMD(unsigned channel, unsigned slice, Metadata& md) th
    const mm::ImgBuffer* pBuf = cbuf_->GetNextImageBuffer(channel);
    if (pBuf != 0)
    {
-      md = pBuf->GetMetadata();
+      pBuf->GetMetadata(md);
       return const_cast<unsigned char*>(pBuf->GetPixels());
    }
    else
@@ -3195,6 +3783,340 @@ void* CMMCore::popNextImageMD(Metadata& md) throw (CMMError)
    return popNextImageMD(0, 0, md);
 }
 
+/**
+ * Gets the last image inserted by the given camera into its own sequence
+ * buffer.
+ *
+ * Requires that the camera's acquisition was started while the
+ * PerCameraSequenceBuffers feature was enabled. The image has the
+ * dimensions and pixel type of that camera, which need not be those of the
+ * current camera.
+ *
+ * @param cameraLabel the camera label.
+ * @throws CMMError if the camera has no buffer of its own or it is empty.
+ */
+void* CMMCore::getLastImage(const char* cameraLabel) throw (CMMError)
+{
+   Metadata md;
+   return getLastImageMD(cameraLabel, md);
+}
+
+/**
+ * Gets the last image (and metadata) inserted by the given camera into its
+ * own sequence buffer. See getLastImage(const char*).
+ */
+void* CMMCore::getLastImageMD(const char* cameraLabel, Metadata& md) const throw (CMMError)
+{
+   std::shared_ptr<CircularBuffer> buffer = getCameraSequenceBuffer(cameraLabel);
+   const mm::ImgBuffer* pBuf = buffer->GetTopImageBuffer(0);
+   if (pBuf == 0)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+   pBuf->GetMetadata(md);
+   return const_cast<unsigned char*>(pBuf->GetPixels());
+}
+
+/**
+ * Gets and removes the next image from the given camera's own sequence
+ * buffer.
+ *
+ * Requires that the camera's acquisition was started while the
+ * PerCameraSequenceBuffers feature was enabled. Cameras with their own
+ * buffers do not contend with each other, so each camera can be drained by
+ * a separate thread.
+ *
+ * @param cameraLabel the camera label.
+ * @throws CMMError if the camera has no buffer of its own or it is empty.
+ */
+void* CMMCore::popNextImage(const char* cameraLabel) throw (CMMError)
+{
+   Metadata md;
+   return popNextImageMD(cameraLabel, md);
+}
+
+/**
+ * Gets and removes the next image (and metadata) from the given camera's own
+ * sequence buffer. See popNextImage(const char*).
+ */
+void* CMMCore::popNextImageMD(const char* cameraLabel, Metadata& md) throw (CMMError)
+{
+   std::shared_ptr<CircularBuffer> buffer = getCameraSequenceBuffer(cameraLabel);
+   const mm::ImgBuffer* pBuf = buffer->GetNextImageBuffer(0);
+   if (pBuf == 0)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+   pBuf->GetMetadata(md);
+   return const_cast<unsigned char*>(pBuf->GetPixels());
+}
+
+/**
+ * Gets the image that was last inserted into the circular buffer, as a lease
+ * that keeps its pixels from being overwritten until it is released (see
+ * ImageLease). This allows large images to be read (e.g. for display)
+ * without first copying them.
+ */
+ImageLease CMMCore::getLastImageLease() throw (CMMError)
+{
+   std::shared_ptr<const mm::ImgBuffer> image = cbuf_->LeaseNthFromTopImage(0, 0);
+   if (!image)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+   return ImageLease(image);
+}
+
+/**
+ * Gets the last image inserted by the given camera into its own sequence
+ * buffer, as a lease (see getLastImageLease() and getLastImage(const char*)).
+ */
+ImageLease CMMCore::getLastImageLease(const char* cameraLabel) throw (CMMError)
+{
+   std::shared_ptr<CircularBuffer> buffer = getCameraSequenceBuffer(cameraLabel);
+   std::shared_ptr<const mm::ImgBuffer> image = buffer->LeaseNthFromTopImage(0, 0);
+   if (!image)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+   return ImageLease(image);
+}
+
+/**
+ * Gets and removes the next image from the circular buffer, as a lease that
+ * keeps its pixels from being overwritten until it is released (see
+ * ImageLease).
+ */
+ImageLease CMMCore::popNextImageLease() throw (CMMError)
+{
+   std::shared_ptr<const mm::ImgBuffer> image = cbuf_->LeaseNextImage(0);
+   if (!image)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+   return ImageLease(image);
+}
+
+/**
+ * Gets and removes the next image from the given camera's own sequence
+ * buffer, as a lease (see popNextImageLease() and popNextImage(const char*)).
+ */
+ImageLease CMMCore::popNextImageLease(const char* cameraLabel) throw (CMMError)
+{
+   std::shared_ptr<CircularBuffer> buffer = getCameraSequenceBuffer(cameraLabel);
+   std::shared_ptr<const mm::ImgBuffer> image = buffer->LeaseNextImage(0);
+   if (!image)
+      throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+   return ImageLease(image);
+}
+
+/**
+ * Gets the most recent image from the current camera, which was either
+ * snapped or inserted into the circular buffer. Requires the
+ * LatestFrameBuffers feature.
+ *
+ * Unlike getLastImage(), this never waits for (or delays) the acquisition,
+ * and the image is available even if it could not be inserted into the
+ * circular buffer, making this suitable for live display. The pixels are a
+ * copy, which remains valid until the calling thread's next call to this
+ * function for the same camera. Of images from multi-channel cameras, only
+ * the first channel is kept.
+ *
+ * Use getLatestFrameCount() to find out whether there is a new image.
+ *
+ * @param md receives the image metadata, including its width, height and
+ * pixel type.
+ * @throws CMMError if the feature is not enabled or there is no image yet.
+ */
+void* CMMCore::getLatestFrameMD(Metadata& md) throw (CMMError)
+{
+   return getLatestFrameMD(getCameraDevice().c_str(), md);
+}
+
+/**
+ * Gets the most recent image from the given camera (see getLatestFrameMD()).
+ *
+ * @param cameraLabel the camera label.
+ * @param md receives the image metadata.
+ */
+void* CMMCore::getLatestFrameMD(const char* cameraLabel, Metadata& md) throw (CMMError)
+{
+   std::shared_ptr<CameraInstance> camera = getLatestFrameCamera(cameraLabel);
+
+   // Per Core and camera, so that other calls do not invalidate the pixels
+   static thread_local std::map<std::pair<const CMMCore*, std::string>,
+      mm::LatestFrameBuffer::Frame> threadCopies;
+   mm::LatestFrameBuffer::Frame& frame =
+      threadCopies[std::make_pair(this, std::string(cameraLabel))];
+   if (!camera->GetLatestFrameBuffer().CopyLatestFrame(frame))
+      throw CMMError("Camera " + ToQuotedString(cameraLabel) +
+            " has not produced an image yet");
+   frame.metadata.ToMetadata(md);
+   return frame.pixels.data();
+}
+
+/**
+ * Returns the number of images that have passed through the current
+ * camera's latest frame buffer (see getLatestFrameMD()). A display can
+ * compare this with the previous value to avoid redrawing the same image.
+ */
+long long CMMCore::getLatestFrameCount() throw (CMMError)
+{
+   return getLatestFrameCount(getCameraDevice().c_str());
+}
+
+/**
+ * Returns the number of images that have passed through the given camera's
+ * latest frame buffer (see getLatestFrameCount()).
+ *
+ * @param cameraLabel the camera label.
+ */
+long long CMMCore::getLatestFrameCount(const char* cameraLabel) throw (CMMError)
+{
+   std::shared_ptr<CameraInstance> camera = getLatestFrameCamera(cameraLabel);
+   return static_cast<long long>(
+         camera->GetLatestFrameBuffer().GetPublishedCount());
+}
+
+/**
+ * Gets and removes up to maxCount images (and their metadata) from the
+ * circular buffer in a single call.
+ *
+ * The images are removed in one step, so that concurrent callers never
+ * receive interleaved images. This is much cheaper than calling
+ * popNextImageMD() for each image when draining the buffer at high frame
+ * rates.
+ *
+ * The pixels are copied out of the buffer while the frames are held, so that
+ * they cannot be overwritten by new images (in particular with
+ * setBufferDropOldestOnOverflow()) while the caller reads them. The copies
+ * remain valid until the calling thread's next call of popNextImages(),
+ * which frees them (only the latest batch is kept). Use
+ * popNextImageLeases() to read the pixels without copying them.
+ *
+ * @param maxCount the maximum number of images to remove.
+ * @param md receives the metadata of the removed images (previous contents
+ * are discarded), in the same order as the returned pixels.
+ * @returns pointers to the pixels of the removed images, oldest first. Empty
+ * if the buffer is empty.
+ */
+std::vector<void*> CMMCore::popNextImages(unsigned maxCount,
+      std::vector<Metadata>& md) throw (CMMError)
+{
+   // Holding the leases until the next call instead would keep the producer
+   // from reusing the frames (and those after them) in the meantime
+   std::vector<std::shared_ptr<const mm::ImgBuffer>> images;
+   cbuf_->LeaseNextImages(maxCount, 0, images);
+
+   // Per Core, so that popping from another Core does not invalidate them.
+   // Fresh storage for each batch, so that the previous (possibly larger)
+   // batch is freed instead of being kept for the lifetime of the thread.
+   static thread_local std::map<const CMMCore*,
+      std::vector<std::vector<unsigned char>>> threadCopies;
+   std::vector<std::vector<unsigned char>> copies(images.size());
+
+   std::vector<void*> pixels;
+   pixels.reserve(images.size());
+   md.clear();
+   md.reserve(images.size());
+   for (std::size_t i = 0; i < images.size(); ++i)
+   {
+      const mm::ImgBuffer* image = images[i].get();
+      if (!image)
+         throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+      const std::size_t bytes = (std::size_t)image->Width() * image->Height() * image->Depth();
+      copies[i].resize(bytes);
+      std::memcpy(copies[i].data(), image->GetPixels(), bytes);
+      pixels.push_back(copies[i].data());
+      md.push_back(Metadata());
+      image->GetMetadata(md.back());
+   }
+   if (copies.empty())
+      threadCopies.erase(this);
+   else
+      threadCopies[this].swap(copies);
+   return pixels;
+}
+
+/**
+ * Gets and removes up to maxCount images from the circular buffer in a
+ * single call, as leases (see popNextImages() and ImageLease).
+ *
+ * Unlike popNextImages(), the pixels are not copied: each image stays in the
+ * buffer until its lease is released, so the leases should be released as
+ * soon as the images have been read.
+ *
+ * @param maxCount the maximum number of images to remove.
+ * @returns the leases of the removed images, oldest first. Empty if the
+ * buffer is empty.
+ */
+std::vector<ImageLease> CMMCore::popNextImageLeases(unsigned maxCount)
+   throw (CMMError)
+{
+   std::vector<std::shared_ptr<const mm::ImgBuffer>> images;
+   cbuf_->LeaseNextImages(maxCount, 0, images);
+
+   std::vector<ImageLease> leases;
+   leases.reserve(images.size());
+   for (std::size_t i = 0; i < images.size(); ++i)
+   {
+      if (!images[i])
+         throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+      leases.push_back(ImageLease(images[i]));
+   }
+   return leases;
+}
+
+/**
+ * Waits until an image is available in the circular buffer.
+ *
+ * Returns as soon as an image can be retrieved with popNextImage() (or its
+ * variants), when a sequence acquisition finishes, or when the timeout
+ * expires, whichever comes first. Use this instead of polling
+ * getRemainingImageCount() in acquisition loops.
+ *
+ * @param timeoutMs the maximum time to wait, in milliseconds.
+ * @returns true if an image is available; false if the timeout expired or a
+ * sequence acquisition finished while the buffer was empty.
+ */
+bool CMMCore::waitForNextImage(long timeoutMs) throw (CMMError)
+{
+   if (timeoutMs < 0)
+      throw CMMError("Timeout must not be negative");
+
+   unsigned long finishedCount = cbuf_->GetAcquisitionFinishedCount();
+   return cbuf_->WaitForImage(timeoutMs, finishedCount);
+}
+
+/**
+ * Waits for the next image and removes it (and its metadata) from the
+ * circular buffer.
+ *
+ * Equivalent to waitForNextImage() followed by popNextImageMD(), except that
+ * the image is guaranteed to be removed by this call even if other threads
+ * are also popping images.
+ *
+ * @param timeoutMs the maximum time to wait, in milliseconds.
+ * @param md receives the image metadata.
+ * @returns the image pixels.
+ * @throws CMMError (MMERR_CircularBufferEmpty) if no image arrived before the
+ * timeout or before a sequence acquisition finished.
+ */
+void* CMMCore::waitForNextImageMD(long timeoutMs, Metadata& md) throw (CMMError)
+{
+   if (timeoutMs < 0)
+      throw CMMError("Timeout must not be negative");
+
+   using namespace std::chrono;
+   const auto deadline = steady_clock::now() + milliseconds(timeoutMs);
+   unsigned long finishedCount = cbuf_->GetAcquisitionFinishedCount();
+   for (;;)
+   {
+      const mm::ImgBuffer* pBuf = cbuf_->GetNextImageBuffer(0);
+      if (pBuf != 0)
+      {
+         pBuf->GetMetadata(md);
+         return const_cast<unsigned char*>(pBuf->GetPixels());
+      }
+
+      // Another consumer may have taken the image we were woken for
+      long remainingMs = static_cast<long>(
+            duration_cast<milliseconds>(deadline - steady_clock::now()).count());
+      if (remainingMs < 0 || !cbuf_->WaitForImage(remainingMs, finishedCount))
+         throw CMMError(getCoreErrorText(MMERR_CircularBufferEmpty).c_str(), MMERR_CircularBufferEmpty);
+   }
+}
+
 /**
  * Removes all images from the circular buffer.
  *
@@ -3206,52 +4128,248 @@ void CMMCore::clearCircularBuffer() throw (CMMError)
    cbuf_->Clear();
 }
 
+/**
+ * Start writing the images in the circular buffer to disk, on a dedicated
+ * thread of the Core.
+ *
+ * The writer pops images from the circular buffer (the shared buffer, not
+ * the per-camera buffers) as they arrive, so while streaming, the
+ * application should not pop images itself; getLastImage() and related
+ * functions can still be used to display the most recent image. Streaming
+ * cannot be started while the PerCameraSequenceBuffers feature is enabled,
+ * as the images would not go to the shared buffer; the feature should also
+ * not be enabled while streaming.
+ *
+ * Supported formats:
+ * - "raw": the pixel data of all images, back to back, in one file; a
+ *   tab-separated index file (the path followed by ".idx") lists the offset,
+ *   size, dimensions, image number, elapsed time and camera of each image.
+ * - "tiff": uncompressed multi-page TIFF; additional files, with _1, _2,
+ *   etc. inserted before the extension, are started when a file would
+ *   exceed 4 GB.
+ *
+ * The files must not already exist. Streaming continues across sequence
+ * acquisitions until stopStreamingToDisk() is called.
+ *
+ * @param path the file to write
+ * @param format "raw" or "tiff"
+ */
+void CMMCore::startStreamingToDisk(const char* path, const char* format) throw (CMMError)
+{
+   startStreamingToDisk(path, format, false);
+}
+
+/**
+ * Start writing the images in the circular buffer to disk, optionally
+ * bypassing the operating system's file cache.
+ *
+ * See startStreamingToDisk(const char*, const char*). Direct I/O (O_DIRECT
+ * or FILE_FLAG_NO_BUFFERING) avoids evicting other data from the cache and
+ * gives more predictable throughput on fast disks, but is not supported by
+ * all file systems.
+ *
+ * @param path the file to write
+ * @param format "raw" or "tiff"
+ * @param directIO whether to bypass the file cache
+ */
+void CMMCore::startStreamingToDisk(const char* path, const char* format,
+      bool directIO) throw (CMMError)
+{
+   if (!path || !format)
+      throw CMMError("Null path or format", MMERR_NullPointerException);
+   if (isStreamingToDisk())
+      throw CMMError("Already streaming to disk");
+   if (mm::features::flags().perCameraSequenceBuffers)
+      throw CMMError("Cannot stream to disk while the PerCameraSequenceBuffers "
+            "feature is enabled");
+
+   // Report any error from a previous stream that ended by itself
+   if (streamWriter_)
+   {
+      std::unique_ptr<mm::StreamWriter> previous(std::move(streamWriter_));
+      try
+      {
+         previous->Stop();
+      }
+      catch (const CMMError& e)
+      {
+         LOG_WARNING(coreLogger_) << "Discarding error from previous streaming: " << e.getMsg();
+      }
+   }
+
+   const mm::StreamWriter::Format fmt = mm::StreamWriter::ParseFormat(format);
+   LOG_INFO(coreLogger_) << "Will start streaming to " << path << " (" <<
+      format << (directIO ? ", direct I/O" : "") << ")";
+   streamWriter_.reset(new mm::StreamWriter(cbuf_, path, fmt, directIO, coreLogger_));
+}
+
+/**
+ * Stop streaming to disk, after writing all images remaining in the
+ * circular buffer.
+ *
+ * Throws if writing failed at any point since streaming was started. The
+ * statistics remain available until streaming is started again.
+ */
+void CMMCore::stopStreamingToDisk() throw (CMMError)
+{
+   if (!streamWriter_)
+      return;
+   LOG_DEBUG(coreLogger_) << "Will stop streaming to disk";
+   streamWriter_->Stop();
+   LOG_DEBUG(coreLogger_) << "Did stop streaming to disk";
+}
+
+/**
+ * Returns whether images are being written to disk. This becomes false if
+ * streaming stopped because of an error (which is then reported by
+ * stopStreamingToDisk()).
+ */
+bool CMMCore::isStreamingToDisk()
+{
+   return streamWriter_ && streamWriter_->IsRunning();
+}
+
+/**
+ * Returns statistics of the current (or last) streaming to disk.
+ *
+ * - "FramesWritten", "BytesWritten", "FilesWritten"
+ * - "ElapsedSeconds": time since streaming started (until it stopped)
+ * - "ThroughputMBps": average rate of writing, including time waiting for
+ *   images
+ * - "WriteSeconds", "WriteMBps": time spent in, and rate of, the disk writes
+ *   themselves
+ * - "BacklogFrames", "MaxBacklogFrames": number of images in the circular
+ *   buffer waiting to be written (back-pressure), now and at most
+ * - "BufferOverflowed": 1 if the circular buffer has overflowed, otherwise 0
+ *
+ * Returns an empty map if streaming was never started.
+ */
+std::map<std::string, double> CMMCore::getStreamingStatistics()
+{
+   if (!streamWriter_)
+      return std::map<std::string, double>();
+   return streamWriter_->GetStatistics();
+}
+
 /**
  * Reserve memory for the circular buffer.
  */
 void CMMCore::setCircularBufferMemoryFootprint(unsigned sizeMB ///< n megabytes
                                                ) throw (CMMError)
 {
-   delete cbuf_; // discard old buffer
+   if (isStreamingToDisk())
+      throw CMMError("Cannot change the circular buffer size while streaming to disk");
+
    LOG_DEBUG(coreLogger_) << "Will set circular buffer size to " <<
       sizeMB << " MB";
-	try
-	{
-		cbuf_ = new CircularBuffer(sizeMB);
-	}
-	catch (std::bad_alloc& ex)
-	{
-      // This is an out-of-memory error before even allocating the buffers.
-		std::ostringstream messs;
-		messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << '\n';
-		throw CMMError(messs.str().c_str() , MMERR_OutOfMemory);
-	}
-	if (NULL == cbuf_) throw CMMError(getCoreErrorText(MMERR_OutOfMemory).c_str(), MMERR_OutOfMemory);
+   // The old buffer is kept if the new one cannot be allocated
+   const mm::BufferAllocationOptions options = cbuf_->GetAllocationOptions();
+   replaceCircularBuffer(sizeMB, options);
+   LOG_DEBUG(coreLogger_) << "Did set circular buffer size to " <<
+      sizeMB << " MB";
+}
 
+/**
+ * Set how the circular buffer memory is obtained from the operating system.
+ *
+ * The buffer is always a single contiguous region. By default it is
+ * allocated with normal pages, which are only mapped to physical memory when
+ * first written to; with large buffers this can cause frame drops during the
+ * first pass through the buffer.
+ *
+ * The buffer (and any per-camera buffers) is reallocated with the new
+ * options; if a camera is loaded, the allocation takes place immediately,
+ * so that errors are reported here.
+ *
+ * @param useHugePages back the buffer with huge (large) pages if the system
+ *        provides them (explicit huge pages or, on Linux, transparent huge
+ *        pages); falls back to normal pages otherwise
+ * @param prefault map all of the buffer to physical memory at allocation
+ *        time (in parallel); progress is logged
+ * @param lockInRAM prevent the buffer from being paged out; fails if the
+ *        process is not permitted to lock that much memory
+ */
+void CMMCore::setCircularBufferAllocationOptions(bool useHugePages,
+      bool prefault, bool lockInRAM) throw (CMMError)
+{
+   mm::BufferAllocationOptions options = cbuf_->GetAllocationOptions();
+   options.hugePages = useHugePages;
+   options.prefault = prefault;
+   options.lockInRAM = lockInRAM;
+   reallocateCircularBuffer(options);
+}
 
-	try
-	{
+/**
+ * Use a file as the backing store for the circular buffer, so that the
+ * buffer (as set by setCircularBufferMemoryFootprint()) can be larger than
+ * physical memory.
+ *
+ * The buffer becomes a memory mapping of the file, and the operating system
+ * writes out the least recently used frames when memory is needed; popping
+ * images works as usual. The file should be on a fast local disk. It is
+ * created (the path must not exist) and preallocated to the full buffer size
+ * when the buffer is allocated, and deleted when the buffer is freed. Each
+ * camera with its own buffer (PerCameraSequenceBuffers feature) uses a file
+ * named after the given path followed by a period and the camera label.
+ *
+ * The file-backed buffer cannot be locked in RAM (see
+ * setCircularBufferAllocationOptions()).
+ *
+ * @param path the file to create, or an empty string to use memory only
+ */
+void CMMCore::setCircularBufferBackingFile(const char* path) throw (CMMError)
+{
+   mm::BufferAllocationOptions options = cbuf_->GetAllocationOptions();
+   options.backingFile = path ? path : "";
+   reallocateCircularBuffer(options);
+}
 
-		// attempt to initialize based on the current camera settings
-      std::shared_ptr<CameraInstance> camera = currentCameraDevice_.lock();
-      if (camera)
-		{
-         mm::DeviceModuleLockGuard guard(camera);
-         if (!cbuf_->Initialize(camera->GetNumberOfChannels(), camera->GetImageWidth(), camera->GetImageHeight(), camera->GetImageBytesPerPixel()))
-				throw CMMError(getCoreErrorText(MMERR_CircularBufferFailedToInitialize).c_str(), MMERR_CircularBufferFailedToInitialize);
-		}
+/**
+ * Returns the circular buffer backing file set with
+ * setCircularBufferBackingFile(), or an empty string if none.
+ */
+std::string CMMCore::getCircularBufferBackingFile()
+{
+   return cbuf_->GetAllocationOptions().backingFile;
+}
 
-      LOG_DEBUG(coreLogger_) << "Did set circular buffer size to " <<
-         sizeMB << " MB";
-	}
-	catch (std::bad_alloc& ex)
-	{
-		std::ostringstream messs;
-		messs << getCoreErrorText(MMERR_OutOfMemory).c_str() << " " << ex.what() << '\n';
-		throw CMMError(messs.str().c_str() , MMERR_OutOfMemory);
-	}
-	if (NULL == cbuf_)
-      throw CMMError(getCoreErrorText(MMERR_OutOfMemory).c_str(), MMERR_OutOfMemory);
+/**
+ * Place the circular buffer in a named shared memory segment, so that other
+ * processes on the same machine can read the acquired images in place,
+ * without copying them through MMCore.
+ *
+ * The segment (a POSIX shared memory object named "/" followed by name, or a
+ * Windows file mapping named "Local\" followed by name) holds a header and
+ * a table describing the most recent images, followed by the buffer memory.
+ * Readers use the protocol described in SharedBufferProtocol.h, or the
+ * reader library in SharedBufferReader/; they do not remove images from the
+ * buffer, which works as usual for MMCore's own clients.
+ *
+ * The segment is created (the name must not be in use) when the buffer is
+ * allocated, and removed when the buffer is freed. Each camera with its own
+ * buffer (PerCameraSequenceBuffers feature) uses a segment named after the
+ * given name followed by a period and the camera label. A shared buffer
+ * cannot also be file-backed (see setCircularBufferBackingFile()), and its
+ * images are always stored uncompressed, even with the
+ * CompressedSequenceBuffer feature, so that readers can use them as they
+ * are.
+ *
+ * @param name the segment name, or an empty string to not share the buffer
+ */
+void CMMCore::setCircularBufferSharedMemoryName(const char* name) throw (CMMError)
+{
+   mm::BufferAllocationOptions options = cbuf_->GetAllocationOptions();
+   options.sharedMemoryName = name ? name : "";
+   reallocateCircularBuffer(options);
+}
+
+/**
+ * Returns the shared memory segment name set with
+ * setCircularBufferSharedMemoryName(), or an empty string if none.
+ */
+std::string CMMCore::getCircularBufferSharedMemoryName()
+{
+   return cbuf_->GetAllocationOptions().sharedMemoryName;
 }
 
 /**
@@ -3278,6 +4396,15 @@ long CMMCore::getRemainingImageCount()
    return 0;
 }
 
+/**
+ * Returns the number of images available in the given camera's own sequence
+ * buffer (see popNextImage(const char*)).
+ */
+long CMMCore::getRemainingImageCount(const char* cameraLabel) throw (CMMError)
+{
+   return getCameraSequenceBuffer(cameraLabel)->GetRemainingImageCount();
+}
+
 /**
  * Returns the total number of images that can be stored in the buffer
  */
@@ -3312,6 +4439,188 @@ bool CMMCore::isBufferOverflowed() const
    return cbuf_->Overflow();
 }
 
+/**
+ * Sets what happens when a sequence acquisition that does not stop on
+ * overflow (stopOnOverflow false, or continuous acquisition) fills the
+ * circular buffer.
+ *
+ * By default, the camera is told that the buffer overflowed, and typically
+ * clears the whole buffer before inserting the new image, discarding all
+ * images that had not been retrieved. When enabled, the buffer instead
+ * drops only as many of the oldest images as needed to make room, so that
+ * the most recent images are always kept. Dropped images are counted by
+ * getBufferDroppedImageCount(), and isBufferOverflowed() stays false.
+ *
+ * Takes effect when the next sequence acquisition is started.
+ */
+void CMMCore::setBufferDropOldestOnOverflow(bool enable)
+{
+   dropOldestOnOverflow_ = enable;
+   LOG_DEBUG(coreLogger_) << "Circular buffer will " <<
+      (enable ? "drop oldest images" : "report overflow") << " when full";
+}
+
+/**
+ * Returns whether the circular buffer drops its oldest images when full (see
+ * setBufferDropOldestOnOverflow()).
+ */
+bool CMMCore::getBufferDropOldestOnOverflow() const
+{
+   return dropOldestOnOverflow_;
+}
+
+/**
+ * Sets the number of histogram bins in the pixel statistics computed for
+ * each image when the FramePixelStatistics feature is enabled: 0 (no
+ * histogram, the default), 256 or 4096. The bins evenly divide the range of
+ * the camera's bit depth (or each hold one value, if there are fewer values
+ * than bins).
+ *
+ * Takes effect when the next sequence acquisition is started.
+ */
+void CMMCore::setPixelStatisticsHistogramBins(unsigned bins) throw (CMMError)
+{
+   if (bins != 0 && bins != 256 && bins != 4096)
+      throw CMMError("Pixel statistics histograms must have 0, 256 or 4096 bins");
+   pixelStatisticsHistogramBins_ = bins;
+}
+
+/**
+ * Returns the number of histogram bins in the pixel statistics (see
+ * setPixelStatisticsHistogramBins()).
+ */
+unsigned CMMCore::getPixelStatisticsHistogramBins() const
+{
+   return pixelStatisticsHistogramBins_;
+}
+
+/**
+ * Returns the number of images dropped from the circular buffer, without
+ * having been retrieved, to make room for new ones since the buffer was last
+ * cleared (see setBufferDropOldestOnOverflow()).
+ */
+long CMMCore::getBufferDroppedImageCount()
+{
+   if (cbuf_)
+   {
+      return static_cast<long>(cbuf_->GetDroppedCount());
+   }
+   return 0;
+}
+
+/**
+ * Returns the number of images dropped from the given camera's own sequence
+ * buffer to make room for new ones (see getBufferDroppedImageCount()).
+ */
+long CMMCore::getBufferDroppedImageCount(const char* cameraLabel) throw (CMMError)
+{
+   return static_cast<long>(
+         getCameraSequenceBuffer(cameraLabel)->GetDroppedCount());
+}
+
+/**
+ * Returns acquisition statistics for the current camera (see
+ * getAcquisitionStatistics(const char*)).
+ */
+std::map<std::string, double> CMMCore::getAcquisitionStatistics() throw (CMMError)
+{
+   return getAcquisitionStatistics(getCameraDevice().c_str());
+}
+
+/**
+ * Returns a snapshot of statistics on the images the given camera has
+ * inserted since its last sequence acquisition started (or since
+ * resetAcquisitionStatistics()), to find out where frames are lost:
+ *
+ * - FramesInserted, FramesRejected: images inserted into the sequence
+ *   buffer, and images that did not fit because it was full
+ * - AverageFrameRate, CurrentFrameRate: insert rate in frames per second,
+ *   over the whole acquisition and over about the last 8 frames
+ * - MillisecondsSinceLastFrame
+ * - For cameras that attach hardware frame numbers to their images
+ *   (HardwareFrameNumber tag): HardwareFrameGaps, the number of times frames
+ *   were missing, HardwareFramesMissed, the total number of missing frames,
+ *   and HardwareFrameNumberRegressions, the number of frame numbers that did
+ *   not increase
+ * - For cameras that attach hardware timestamps (HardwareTimestamp-us tag):
+ *   HardwareTimestampRegressions, the number of timestamps that did not
+ *   increase
+ * - For each stage of inserting an image (Metadata: adding the camera's
+ *   metadata; Processing: the image processor, if any; Copy: copying into the
+ *   sequence buffer), e.g. for Copy: CopyLatencyCount, CopyLatencyMeanUs,
+ *   CopyLatencyMaxUs and a histogram in power-of-two bins:
+ *   CopyLatencyBelow1us, CopyLatencyBelow2us, ..., CopyLatencyBelow524288us,
+ *   CopyLatencyAtLeast524288us (each bin excludes the previous ones)
+ *
+ * The following describe the sequence buffer the camera inserts into (its
+ * own with the PerCameraSequenceBuffers feature, otherwise the shared one),
+ * since it was last cleared:
+ *
+ * - FramesPopped: images removed by consumers (including streaming to disk)
+ * - FramesDropped: unread images discarded to make room (see
+ *   setBufferDropOldestOnOverflow())
+ * - ConsumerLag: images waiting to be removed
+ * - BufferHighWaterMark: the largest number of images that were waiting
+ * - BufferCapacity
+ * - With the CompressedSequenceBuffer feature: CompressionRatio (of the
+ *   uncompressed to the compressed size of the images inserted),
+ *   CompressionMeanUs and CompressionCpuMeanUs (the time taken to compress
+ *   an image, and the processor time it took summed over the worker
+ *   threads), ImagesDecompressed and DecompressionMeanUs
+ *
+ * The values are updated without locking as images are inserted, so they
+ * are not taken at exactly the same time.
+ *
+ * @param cameraLabel the camera label.
+ */
+std::map<std::string, double> CMMCore::getAcquisitionStatistics(
+      const char* cameraLabel) throw (CMMError)
+{
+   std::shared_ptr<CameraInstance> camera =
+      deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel);
+
+   std::map<std::string, double> stats;
+   camera->GetAcquisitionStatistics().GetSnapshot(stats);
+
+   std::shared_ptr<CircularBuffer> ownBuffer = camera->GetSequenceBuffer();
+   const CircularBuffer* buffer = ownBuffer ? ownBuffer.get() : cbuf_;
+   stats["FramesPopped"] = static_cast<double>(buffer->GetPoppedCount());
+   stats["FramesDropped"] = static_cast<double>(buffer->GetDroppedCount());
+   stats["ConsumerLag"] = static_cast<double>(buffer->GetRemainingImageCount());
+   stats["BufferHighWaterMark"] = static_cast<double>(buffer->GetHighWaterMark());
+   stats["BufferCapacity"] = static_cast<double>(buffer->GetSize());
+   if (buffer->IsCompressed())
+   {
+      const CircularBuffer::CompressionStatistics compression =
+         buffer->GetCompressionStatistics();
+      const double frames = static_cast<double>(compression.framesCompressed);
+      const double images = static_cast<double>(compression.imagesDecompressed);
+      stats["CompressionRatio"] = compression.compressedBytes == 0 ? 0.0 :
+         static_cast<double>(compression.rawBytes) / compression.compressedBytes;
+      stats["CompressionMeanUs"] = frames == 0.0 ? 0.0 :
+         compression.compressionTime.count() / 1000.0 / frames;
+      stats["CompressionCpuMeanUs"] = frames == 0.0 ? 0.0 :
+         compression.compressionCpuTime.count() / 1000.0 / frames;
+      stats["ImagesDecompressed"] = images;
+      stats["DecompressionMeanUs"] = images == 0.0 ? 0.0 :
+         compression.decompressionTime.count() / 1000.0 / images;
+   }
+   return stats;
+}
+
+/**
+ * Resets the counters of the given camera's acquisition statistics (see
+ * getAcquisitionStatistics()). This is done automatically when a sequence
+ * acquisition starts.
+ *
+ * @param cameraLabel the camera label.
+ */
+void CMMCore::resetAcquisitionStatistics(const char* cameraLabel) throw (CMMError)
+{
+   deviceManager_->GetDeviceOfType<CameraInstance>(cameraLabel)->
+      GetAcquisitionStatistics().Reset();
+}
+
 /**
  * Returns the label of the currently selected camera device.
  * @return camera name
@@ -6945,6 +8254,30 @@ void CMMCore::registerCallback(MMEventCallback* cb)
    externalCallback_ = cb;
 }
 
+/**
+ * Enable or disable the onHardwareFrameGap() and
+ * onHardwareTimestampRegression() notifications (disabled by default).
+ *
+ * Cameras that attach the HardwareFrameNumber and HardwareTimestamp-us
+ * metadata tags to their images are checked for frames lost before reaching
+ * the Core, and for timestamps that do not increase, whether or not the
+ * notifications are enabled; the anomalies are counted in
+ * getAcquisitionStatistics() and logged. The notifications are sent from the
+ * thread inserting the image, so the callback should return quickly.
+ */
+void CMMCore::enableFrameGapEvents(bool enable)
+{
+   frameGapEventsEnabled_ = enable;
+}
+
+/**
+ * Indicates whether the notifications of enableFrameGapEvents() are enabled.
+ */
+bool CMMCore::frameGapEventsEnabled()
+{
+   return frameGapEventsEnabled_;
+}
+
 
 /**
  * Returns the latest focus score from the focusing device.
@@ -7304,6 +8637,17 @@ void CMMCore::CreateCoreProperties()
    CoreProperty propBusyTimeoutMs;
    properties_->Add(MM::g_Keyword_CoreTimeoutMs, propBusyTimeoutMs);
 
+   // Thread pool; size 0 selects one thread per hardware thread
+   CoreProperty propThreadPoolSize(ToString(threadPool_->GetSize()).c_str(), false);
+   for (unsigned n = 0; n <= getMaxThreadPoolSize(); ++n)
+      propThreadPoolSize.AddAllowedValue(ToString(n).c_str());
+   properties_->Add(MM::g_Keyword_CoreThreadPoolSize, propThreadPoolSize);
+
+   CoreProperty propThreadPoolAffinity("0", false);
+   propThreadPoolAffinity.AddAllowedValue("0");
+   propThreadPoolAffinity.AddAllowedValue("1");
+   properties_->Add(MM::g_Keyword_CoreThreadPoolAffinity, propThreadPoolAffinity);
+
    properties_->Refresh();
 }
 
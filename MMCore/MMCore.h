@@ -64,13 +64,17 @@
 #include "Configuration.h"
 #include "Error.h"
 #include "ErrorCodes.h"
+#include "ImageLease.h"
 #include "Logging/Logger.h"
 
+#include <atomic>
 #include <cstring>
 #include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 
@@ -94,7 +98,9 @@ class CoreCallback;
 class CorePropertyCollection;
 class MMEventCallback;
 class Metadata;
+class MockDeviceAdapter;
 class PixelSizeConfigGroup;
+class ThreadPool;
 
 class AutoFocusInstance;
 class CameraInstance;
@@ -109,8 +115,10 @@ class XYStageInstance;
 class CMMCore;
 
 namespace mm {
+   struct BufferAllocationOptions;
    class DeviceManager;
    class LogManager;
+   class StreamWriter;
 } // namespace mm
 
 typedef unsigned int* imgRGB32;
@@ -166,6 +174,8 @@ public:
    void reset() throw (CMMError);
 
    void unloadLibrary(const char* moduleName) throw (CMMError);
+   void loadMockDeviceAdapter(const char* name,
+         MockDeviceAdapter* implementation) throw (CMMError);
 
    void updateCoreProperties() throw (CMMError);
 
@@ -182,6 +192,14 @@ public:
    void saveSystemConfiguration(const char* fileName) throw (CMMError);
    void loadSystemConfiguration(const char* fileName) throw (CMMError);
    void registerCallback(MMEventCallback* cb);
+   void enableFrameGapEvents(bool enable);
+   bool frameGapEventsEnabled();
+
+   void setThreadPoolSize(unsigned threadCount) throw (CMMError);
+   unsigned getThreadPoolSize();
+   void setThreadPoolAffinity(bool pinThreads) throw (CMMError);
+   bool getThreadPoolAffinity();
+   std::map<std::string, double> calibrateImageCopy();
    ///@}
 
    /** \name Logging and log management. */
@@ -408,6 +426,10 @@ public:
    bool isSequenceRunning(const char* cameraLabel) throw (CMMError);
 
    void* getLastImage() throw (CMMError);
+   void* getLastImageDownsampled(unsigned factor, const char* mode)
+      throw (CMMError);
+   void* getLastImageDownsampled8Bit(unsigned factor, const char* mode,
+         double displayMin, double displayMax) throw (CMMError);
    void* popNextImage() throw (CMMError);
    void* getLastImageMD(unsigned channel, unsigned slice, Metadata& md)
       const throw (CMMError);
@@ -417,16 +439,62 @@ public:
    void* getNBeforeLastImageMD(unsigned long n, Metadata& md)
       const throw (CMMError);
    void* popNextImageMD(Metadata& md) throw (CMMError);
+   bool waitForNextImage(long timeoutMs) throw (CMMError);
+   void* waitForNextImageMD(long timeoutMs, Metadata& md) throw (CMMError);
+   std::vector<void*> popNextImages(unsigned maxCount,
+         std::vector<Metadata>& md) throw (CMMError);
+   void* getLastImage(const char* cameraLabel) throw (CMMError);
+   void* getLastImageMD(const char* cameraLabel, Metadata& md)
+      const throw (CMMError);
+   void* popNextImage(const char* cameraLabel) throw (CMMError);
+   void* popNextImageMD(const char* cameraLabel, Metadata& md)
+      throw (CMMError);
+   ImageLease getLastImageLease() throw (CMMError);
+   ImageLease getLastImageLease(const char* cameraLabel) throw (CMMError);
+   ImageLease popNextImageLease() throw (CMMError);
+   ImageLease popNextImageLease(const char* cameraLabel) throw (CMMError);
+   std::vector<ImageLease> popNextImageLeases(unsigned maxCount)
+      throw (CMMError);
+   void* getLatestFrameMD(Metadata& md) throw (CMMError);
+   void* getLatestFrameMD(const char* cameraLabel, Metadata& md)
+      throw (CMMError);
+   long long getLatestFrameCount() throw (CMMError);
+   long long getLatestFrameCount(const char* cameraLabel) throw (CMMError);
 
    long getRemainingImageCount();
+   long getRemainingImageCount(const char* cameraLabel) throw (CMMError);
    long getBufferTotalCapacity();
    long getBufferFreeCapacity();
    bool isBufferOverflowed() const;
+   void setBufferDropOldestOnOverflow(bool enable);
+   bool getBufferDropOldestOnOverflow() const;
+   void setPixelStatisticsHistogramBins(unsigned bins) throw (CMMError);
+   unsigned getPixelStatisticsHistogramBins() const;
+   long getBufferDroppedImageCount();
+   long getBufferDroppedImageCount(const char* cameraLabel) throw (CMMError);
+   std::map<std::string, double> getAcquisitionStatistics() throw (CMMError);
+   std::map<std::string, double> getAcquisitionStatistics(
+         const char* cameraLabel) throw (CMMError);
+   void resetAcquisitionStatistics(const char* cameraLabel) throw (CMMError);
    void setCircularBufferMemoryFootprint(unsigned sizeMB) throw (CMMError);
+   void setCircularBufferAllocationOptions(bool useHugePages, bool prefault,
+         bool lockInRAM) throw (CMMError);
+   void setCircularBufferBackingFile(const char* path) throw (CMMError);
+   std::string getCircularBufferBackingFile();
+   void setCircularBufferSharedMemoryName(const char* name) throw (CMMError);
+   std::string getCircularBufferSharedMemoryName();
    unsigned getCircularBufferMemoryFootprint();
    void initializeCircularBuffer() throw (CMMError);
    void clearCircularBuffer() throw (CMMError);
 
+   void startStreamingToDisk(const char* path, const char* format)
+      throw (CMMError);
+   void startStreamingToDisk(const char* path, const char* format,
+         bool directIO) throw (CMMError);
+   void stopStreamingToDisk() throw (CMMError);
+   bool isStreamingToDisk();
+   std::map<std::string, double> getStreamingStatistics();
+
    bool isExposureSequenceable(const char* cameraLabel) throw (CMMError);
    void startExposureSequence(const char* cameraLabel) throw (CMMError);
    void stopExposureSequence(const char* cameraLabel) throw (CMMError);
@@ -652,13 +720,18 @@ private:
    long pollingIntervalMs_;
    long timeoutMs_;
    bool autoShutter_;
+   bool dropOldestOnOverflow_;
+   unsigned pixelStatisticsHistogramBins_;
    std::vector<double> *nullAffine_;
    MM::Core* callback_;                 // core services for devices
    ConfigGroupCollection* configGroups_;
    CorePropertyCollection* properties_;
    MMEventCallback* externalCallback_;  // notification hook to the higher layer (e.g. GUI)
+   std::atomic<bool> frameGapEventsEnabled_;
    PixelSizeConfigGroup* pixelSizeGroup_;
+   std::shared_ptr<ThreadPool> threadPool_; // Shared by all parallel work
    CircularBuffer* cbuf_;
+   std::unique_ptr<mm::StreamWriter> streamWriter_;
 
    std::shared_ptr<CPluginManager> pluginManager_;
    std::shared_ptr<mm::DeviceManager> deviceManager_;
@@ -672,6 +745,14 @@ private:
    MMThreadLock* pPostedErrorsLock_;
    mutable std::deque<std::pair< int, std::string> > postedErrors_;
 
+   // The camera whose sequence acquisition is being started, and the thread
+   // starting it; cameras that it starts in turn get their own buffers
+   class StartingCameraScope;
+   std::mutex startingCameraMutex_;
+   std::shared_ptr<CameraInstance> startingCamera_;
+   std::thread::id startingCameraThread_;
+   bool startingCameraStopOnOverflow_;
+
 private:
    void InitializeErrorMessages();
    void CreateCoreProperties();
@@ -694,6 +775,22 @@ private:
    void logError(const char* device, const char* msg);
    void updateAllowedChannelGroups();
    void assignDefaultRole(std::shared_ptr<DeviceInstance> pDev);
+   void initializeSequenceBuffer(std::shared_ptr<CameraInstance> camera,
+         bool stopOnOverflow) throw (CMMError);
+   void initializeStartedCameraSequenceBuffer(
+         std::shared_ptr<CameraInstance> camera) throw (CMMError);
+   std::shared_ptr<CircularBuffer> getCameraSequenceBuffer(const char* cameraLabel) const throw (CMMError);
+   std::shared_ptr<CameraInstance> getLatestFrameCamera(const char* cameraLabel) const throw (CMMError);
+   void publishSnappedImage(std::shared_ptr<CameraInstance> camera);
+   void* downsampleLastImage(unsigned factor, const char* mode, bool to8Bit,
+         double displayMin, double displayMax) throw (CMMError);
+   CircularBuffer* newCircularBuffer(unsigned sizeMB,
+         const mm::BufferAllocationOptions& options);
+   void reallocateCircularBuffer(const mm::BufferAllocationOptions& options) throw (CMMError);
+   void replaceCircularBuffer(unsigned sizeMB,
+         const mm::BufferAllocationOptions& options) throw (CMMError);
+   void reconfigureThreadPool(unsigned threadCount, bool pinThreads) throw (CMMError);
+   static unsigned getMaxThreadPoolSize();
    void updateCoreProperty(const char* propName, MM::DeviceType devType) throw (CMMError);
    void loadSystemConfigurationImpl(const char* fileName) throw (CMMError);
    void initializeAllDevicesSerial() throw (CMMError);
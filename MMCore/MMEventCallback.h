@@ -86,4 +86,14 @@ public:
       std::cout << "onSLMExposureChanged()" << name << " " << newExposure << '\n';
    }
 
+   virtual void onHardwareFrameGap(const char* cameraLabel, long long previousFrameNumber, long long frameNumber)
+   {
+      std::cout << "onHardwareFrameGap() " << cameraLabel << " " << previousFrameNumber << " " << frameNumber << '\n';
+   }
+
+   virtual void onHardwareTimestampRegression(const char* cameraLabel, double previousTimestampUs, double timestampUs)
+   {
+      std::cout << "onHardwareTimestampRegression() " << cameraLabel << " " << previousTimestampUs << " " << timestampUs << '\n';
+   }
+
 };
@@ -0,0 +1,214 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MemoryCopy.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Memory copy with non-temporal stores, and cache size query
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "MemoryCopy.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MMCORE_X86_64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#include <sys/types.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace mm {
+
+namespace {
+
+using CopyFunction = void (*)(unsigned char*, const unsigned char*, std::size_t);
+
+#ifdef MMCORE_X86_64
+
+// Number of bytes to copy normally so that dst becomes aligned
+inline std::size_t BytesToAlignment(const unsigned char* dst,
+      std::size_t alignment, std::size_t bytes)
+{
+   const std::size_t misalignment =
+      reinterpret_cast<std::uintptr_t>(dst) & (alignment - 1);
+   return (std::min)(bytes, misalignment ? alignment - misalignment : 0);
+}
+
+void CopySSE2(unsigned char* dst, const unsigned char* src, std::size_t bytes)
+{
+   const std::size_t head = BytesToAlignment(dst, 16, bytes);
+   std::memcpy(dst, src, head);
+   dst += head;
+   src += head;
+   bytes -= head;
+
+   const std::size_t blocks = bytes / 64;
+   for (std::size_t i = 0; i < blocks; ++i)
+   {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+      const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+      const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48));
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst), a);
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), d);
+      src += 64;
+      dst += 64;
+   }
+   std::memcpy(dst, src, bytes % 64);
+   _mm_sfence();
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx")))
+#endif
+void CopyAVX(unsigned char* dst, const unsigned char* src, std::size_t bytes)
+{
+   const std::size_t head = BytesToAlignment(dst, 32, bytes);
+   std::memcpy(dst, src, head);
+   dst += head;
+   src += head;
+   bytes -= head;
+
+   const std::size_t blocks = bytes / 128;
+   for (std::size_t i = 0; i < blocks; ++i)
+   {
+      const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+      const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+      const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 64));
+      const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 96));
+      _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), a);
+      _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 32), b);
+      _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 64), c);
+      _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 96), d);
+      src += 128;
+      dst += 128;
+   }
+   _mm256_zeroupper();
+   std::memcpy(dst, src, bytes % 128);
+   _mm_sfence();
+}
+
+bool CpuSupportsAVX()
+{
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 1);
+   const bool osSavesYmm = (info[2] & (1 << 27)) != 0; // OSXSAVE
+   const bool avx = (info[2] & (1 << 28)) != 0;
+   return osSavesYmm && avx && (_xgetbv(0) & 6) == 6;
+#else
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx");
+#endif
+}
+
+#else
+
+void CopyPlain(unsigned char* dst, const unsigned char* src, std::size_t bytes)
+{
+   std::memcpy(dst, src, bytes);
+}
+
+#endif // MMCORE_X86_64
+
+struct NonTemporalCopy
+{
+   CopyFunction function;
+   const char* instructionSet;
+};
+
+const NonTemporalCopy& SelectNonTemporalCopy()
+{
+#ifdef MMCORE_X86_64
+   static const NonTemporalCopy copy = CpuSupportsAVX() ?
+      NonTemporalCopy{ CopyAVX, "AVX" } : NonTemporalCopy{ CopySSE2, "SSE2" };
+#else
+   static const NonTemporalCopy copy{ CopyPlain, "None" };
+#endif
+   return copy;
+}
+
+} // anonymous namespace
+
+void CopyMemoryNonTemporal(void* dst, const void* src, std::size_t bytes)
+{
+   SelectNonTemporalCopy().function(static_cast<unsigned char*>(dst),
+         static_cast<const unsigned char*>(src), bytes);
+}
+
+const char* NonTemporalCopyInstructionSet()
+{
+   return SelectNonTemporalCopy().instructionSet;
+}
+
+std::size_t GetLastLevelCacheSize()
+{
+#ifdef _WIN32
+   DWORD length = 0;
+   GetLogicalProcessorInformation(NULL, &length);
+   std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(
+         length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+   if (info.empty() || !GetLogicalProcessorInformation(info.data(), &length))
+      return 0;
+   std::size_t size = 0;
+   BYTE level = 0;
+   for (const auto& entry : info)
+   {
+      if (entry.Relationship != RelationCache || entry.Cache.Level < level)
+         continue;
+      if (entry.Cache.Level > level)
+         size = 0;
+      level = entry.Cache.Level;
+      size = (std::max)(size, static_cast<std::size_t>(entry.Cache.Size));
+   }
+   return size;
+#elif defined(__APPLE__)
+   const char* const names[] = { "hw.l3cachesize", "hw.l2cachesize" };
+   for (const char* name : names)
+   {
+      std::int64_t size = 0;
+      std::size_t length = sizeof(size);
+      if (sysctlbyname(name, &size, &length, NULL, 0) == 0 && size > 0)
+         return static_cast<std::size_t>(size);
+   }
+   return 0;
+#else
+#ifdef _SC_LEVEL3_CACHE_SIZE
+   const long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+   if (l3 > 0)
+      return static_cast<std::size_t>(l3);
+   const long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+   if (l2 > 0)
+      return static_cast<std::size_t>(l2);
+#endif
+   return 0;
+#endif
+}
+
+} // namespace mm
@@ -0,0 +1,44 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MemoryCopy.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Memory copy with non-temporal stores, and cache size query
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include <cstddef>
+
+namespace mm {
+
+/**
+ * Copy bytes using non-temporal (cache-bypassing) stores, which avoids
+ * evicting the whole cache when copying more data than it can hold. The
+ * stores are complete (fenced) on return. Falls back to std::memcpy on CPUs
+ * without support.
+ */
+void CopyMemoryNonTemporal(void* dst, const void* src, std::size_t bytes);
+
+/**
+ * Name of the instruction set used by CopyMemoryNonTemporal(): "AVX",
+ * "SSE2", or "None" if it falls back to std::memcpy.
+ */
+const char* NonTemporalCopyInstructionSet();
+
+/**
+ * Size of the largest CPU cache in bytes, or 0 if unknown.
+ */
+std::size_t GetLastLevelCacheSize();
+
+} // namespace mm
@@ -0,0 +1,50 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MockDeviceAdapter.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Device adapter implemented in-process, for testing
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "../MMDevice/MMDeviceConstants.h"
+
+#include <functional>
+
+namespace MM {
+class Device;
+}
+
+/**
+ * A device adapter provided by the application instead of a loadable module,
+ * so that the Core can be tested with devices (see
+ * CMMCore::loadMockDeviceAdapter()). It plays the role of the module's
+ * exported functions.
+ */
+class MockDeviceAdapter
+{
+public:
+   typedef std::function<void(const char* name, MM::DeviceType type,
+         const char* description)> RegisterDeviceFunction;
+
+   virtual ~MockDeviceAdapter() {}
+
+   /**
+    * Registers the available devices, once, when the adapter is loaded.
+    */
+   virtual void InitializeModuleData(RegisterDeviceFunction registerDevice) = 0;
+
+   virtual MM::Device* CreateDevice(const char* name) = 0;
+   virtual void DeleteDevice(MM::Device* device) = 0;
+};
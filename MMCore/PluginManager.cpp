@@ -154,6 +154,23 @@ CPluginManager::GetDeviceAdapter(const char* moduleName)
    return GetDeviceAdapter(std::string(moduleName));
 }
 
+void
+CPluginManager::LoadMockAdapter(const std::string& moduleName,
+      MockDeviceAdapter* mock)
+{
+   if (moduleName.empty())
+   {
+      throw CMMError("Empty device adapter module name");
+   }
+   if (moduleMap_.count(moduleName))
+   {
+      throw CMMError("A device adapter named " + ToQuotedString(moduleName) +
+            " is already loaded");
+   }
+   moduleMap_[moduleName] =
+      std::make_shared<LoadedDeviceAdapter>(moduleName, mock);
+}
+
 /** 
  * Unload a module.
  */
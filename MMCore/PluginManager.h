@@ -30,6 +30,7 @@
 #include <vector>
 
 class LoadedDeviceAdapter;
+class MockDeviceAdapter;
 
 
 class CPluginManager /* final */
@@ -55,6 +56,11 @@ public:
    std::shared_ptr<LoadedDeviceAdapter>
    GetDeviceAdapter(const char* moduleName);
 
+   /**
+    * Make a mock device adapter available under the given module name
+    */
+   void LoadMockAdapter(const std::string& moduleName, MockDeviceAdapter* mock);
+
 private:
    static std::vector<std::string> GetDefaultSearchPaths();
    static void GetModules(std::vector<std::string> &modules, const char *path);
@@ -0,0 +1,188 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SharedBufferExport.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Writer side of the shared memory sequence buffer protocol
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "SharedBufferExport.h"
+
+#include "FrameBuffer.h"
+
+#include "../MMDevice/MMDeviceConstants.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace mm {
+
+using namespace sharedbuffer;
+
+namespace {
+
+// Number of frame slots. Readers can only see this many most recent frames,
+// even if more fit in the buffer (which is only the case for small images).
+const std::uint32_t slotCount = 16384;
+
+// The data area starts at a multiple of this
+const std::size_t headerAlignment = 64 * 1024;
+
+std::uint32_t ProcessId()
+{
+#ifdef _WIN32
+   return static_cast<std::uint32_t>(GetCurrentProcessId());
+#else
+   return static_cast<std::uint32_t>(getpid());
+#endif
+}
+
+} // anonymous namespace
+
+std::size_t SharedBufferExport::HeaderSize()
+{
+   const std::size_t bytes = sizeof(SegmentHeader) +
+      std::size_t(slotCount) * sizeof(FrameSlot);
+   return (bytes + headerAlignment - 1) / headerAlignment * headerAlignment;
+}
+
+SharedBufferExport::SharedBufferExport(unsigned char* segment,
+      std::size_t dataSize) :
+   header_(new (segment) SegmentHeader()),
+   slots_(reinterpret_cast<FrameSlot*>(segment + sizeof(SegmentHeader))),
+   slotCount_(slotCount),
+   oldestIntact_(0)
+{
+   for (std::uint32_t i = 0; i < slotCount; ++i)
+   {
+      FrameSlot* slot = new (&slots_[i]) FrameSlot();
+      // No frame has a sequence of 0
+      slot->sequence.store(0, std::memory_order_relaxed);
+   }
+
+   header_->headerSize = HeaderSize();
+   header_->dataSize = dataSize;
+   header_->slotsOffset = sizeof(SegmentHeader);
+   header_->slotCount = slotCount;
+   header_->slotSize = sizeof(FrameSlot);
+   header_->publishedCount.store(0, std::memory_order_relaxed);
+   header_->clearCount.store(0, std::memory_order_relaxed);
+   header_->writerProcessId = ProcessId();
+   header_->writerState.store(WriterActive, std::memory_order_relaxed);
+   header_->version = ProtocolVersion;
+   // Readers check the magic number last
+   std::atomic_thread_fence(std::memory_order_release);
+   header_->magic = SegmentMagic;
+}
+
+SharedBufferExport::~SharedBufferExport()
+{
+   header_->writerState.store(WriterClosed, std::memory_order_release);
+}
+
+void SharedBufferExport::Invalidate(FrameSlot& slot, std::uint64_t frameNumber)
+{
+   slot.sequence.store(WritingSequence(frameNumber), std::memory_order_relaxed);
+}
+
+void SharedBufferExport::Clear()
+{
+   const std::uint64_t published =
+      header_->publishedCount.load(std::memory_order_relaxed);
+   for (; oldestIntact_ < published; ++oldestIntact_)
+   {
+      FrameSlot& slot = Slot(oldestIntact_);
+      if (slot.frameNumber == oldestIntact_)
+         Invalidate(slot, oldestIntact_);
+   }
+   header_->clearCount.fetch_add(1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SharedBufferExport::BeginFrame(std::size_t previousEnd,
+      std::size_t offset, std::size_t bytes)
+{
+   const std::uint64_t frameNumber =
+      header_->publishedCount.load(std::memory_order_relaxed);
+   const std::uint64_t dataBegin = header_->headerSize;
+
+   // The data area is used as a ring, so the frames whose pixels are about to
+   // be overwritten are the oldest intact ones, up to the last one that
+   // overlaps the new frame (or the skipped end of the data area).
+   const bool wrapped = offset < previousEnd;
+   const std::size_t skippedBegin = wrapped ? previousEnd : offset;
+   while (oldestIntact_ < frameNumber)
+   {
+      FrameSlot& slot = Slot(oldestIntact_);
+      if (slot.frameNumber == oldestIntact_)
+      {
+         const std::uint64_t begin = slot.dataOffset - dataBegin;
+         const std::uint64_t end = begin + slot.dataSize;
+         const bool overlaps = (begin < offset + bytes && offset < end) ||
+            (wrapped && end > skippedBegin);
+         if (!overlaps)
+            break;
+         Invalidate(slot, oldestIntact_);
+      }
+      ++oldestIntact_;
+   }
+
+   // The slot's previous frame is lost, whether or not its pixels are
+   FrameSlot& slot = Slot(frameNumber);
+   Invalidate(slot, frameNumber);
+   slot.frameNumber = frameNumber;
+   slot.dataOffset = dataBegin + offset;
+   slot.dataSize = bytes;
+
+   // Invalidations must be visible before any pixels are written
+   std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SharedBufferExport::PublishFrame(const ImgBuffer& image,
+      unsigned numChannels)
+{
+   const std::uint64_t frameNumber =
+      header_->publishedCount.load(std::memory_order_relaxed);
+   FrameSlot& slot = Slot(frameNumber);
+
+   const FrameMetadata& md = image.GetFrameMetadata();
+   slot.width = image.Width();
+   slot.height = image.Height();
+   slot.bytesPerPixel = image.Depth();
+   slot.numComponents = md.GetNumberOfComponents();
+   slot.numChannels = numChannels;
+   slot.dataSize = std::uint64_t(image.Width()) * image.Height() *
+      image.Depth() * numChannels;
+   slot.imageNumber = md.GetImageNumber();
+   // The camera may have provided its own elapsed time
+   const char* elapsed = md.FindValue(MM::g_Keyword_Elapsed_Time_ms);
+   slot.elapsedTimeMs = elapsed ? std::strtod(elapsed, 0) :
+      std::chrono::duration<double, std::milli>(md.GetElapsedTime()).count();
+   const char* camera = md.FindValue(MM::g_Keyword_Metadata_CameraLabel);
+   std::strncpy(slot.cameraLabel, camera ? camera : "", CameraLabelSize - 1);
+   slot.cameraLabel[CameraLabelSize - 1] = '\0';
+
+   slot.sequence.store(IntactSequence(frameNumber), std::memory_order_release);
+   header_->publishedCount.store(frameNumber + 1, std::memory_order_release);
+}
+
+} // namespace mm
@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SharedBufferExport.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Writer side of the shared memory sequence buffer protocol
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "SharedBufferProtocol.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mm {
+
+class ImgBuffer;
+
+/**
+ * Maintains the header and frame slots of a shared memory segment holding
+ * the sequence buffer's frames, as described in SharedBufferProtocol.h.
+ *
+ * Not thread-safe: all calls must be made with the buffer's insert lock
+ * held.
+ */
+class SharedBufferExport
+{
+public:
+   /**
+    * Bytes needed for the header and slots, rounded up to a page multiple so
+    * that the data area is page-aligned.
+    */
+   static std::size_t HeaderSize();
+
+   /**
+    * Initialize the header of a segment starting at segment, whose data
+    * area (following HeaderSize() bytes) holds dataSize bytes.
+    */
+   SharedBufferExport(unsigned char* segment, std::size_t dataSize);
+
+   /**
+    * Marks the segment as closed for readers.
+    */
+   ~SharedBufferExport();
+
+   SharedBufferExport(const SharedBufferExport&) = delete;
+   SharedBufferExport& operator=(const SharedBufferExport&) = delete;
+
+   /**
+    * Invalidate all frames (the buffer was cleared or re-laid out).
+    */
+   void Clear();
+
+   /**
+    * Claim the slot for the next frame, whose pixels will be written to
+    * [offset, offset + bytes) of the data area, invalidating the frames
+    * whose pixels are about to be overwritten. previousEnd is where the
+    * previous frame ended; if offset is below it, the writer has wrapped
+    * around, and the end of the data area is skipped.
+    */
+   void BeginFrame(std::size_t previousEnd, std::size_t offset,
+         std::size_t bytes);
+
+   /**
+    * Publish the frame claimed by the last BeginFrame(), described by its
+    * first channel's image.
+    */
+   void PublishFrame(const ImgBuffer& image, unsigned numChannels);
+
+private:
+   sharedbuffer::SegmentHeader* header_;
+   sharedbuffer::FrameSlot* slots_;
+   const std::uint64_t slotCount_;
+   std::uint64_t oldestIntact_; // Frames below this are all invalid
+
+   sharedbuffer::FrameSlot& Slot(std::uint64_t frameNumber)
+   { return slots_[frameNumber % slotCount_]; }
+   void Invalidate(sharedbuffer::FrameSlot& slot, std::uint64_t frameNumber);
+};
+
+} // namespace mm
@@ -0,0 +1,141 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SharedBufferProtocol.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Layout of the shared memory segment through which the
+//                sequence buffer is exported to other processes
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+// This header is shared by MMCore (the writer) and the reader library
+// (SharedBufferReader/), and must not depend on anything else in MMCore.
+//
+// Segment layout (all integers native-endian, offsets from segment start):
+//
+//   0                        SegmentHeader (128 bytes)
+//   slotsOffset              FrameSlot[slotCount] (128 bytes each)
+//   headerSize               Pixel data (dataSize bytes)
+//
+// Every frame inserted into the sequence buffer gets a frame number, counting
+// from 0 for the lifetime of the segment (unlike the ImageNumber tag, which
+// is per camera and restarts with each acquisition). Frame n is described by
+// slot n % slotCount. Its pixels (all channels, back to back) are at
+// dataOffset in the segment, and stay there until the writer reuses the
+// memory for later frames.
+//
+// Readers never modify the segment and do not hold back the writer: a frame
+// that a reader is too slow to read is simply overwritten. Whether a frame is
+// intact is determined with a per-slot sequence number (seqlock):
+//
+//   - The slot's sequence is 2 * (n + 1) while frame n is intact, and odd
+//     while the slot or the frame's pixels are being (over)written.
+//
+//   - Writer, for frame n: before writing into any part of the data area, set
+//     the sequence of every slot whose frame overlaps it to an odd value;
+//     set the slot's own sequence to 2 * n + 1; (release fence); write the
+//     pixels and the slot fields; store 2 * (n + 1) into the sequence
+//     (release); store n + 1 into publishedCount (release).
+//
+//   - Reader, for frame n: s1 = slot sequence (acquire); unless
+//     s1 == 2 * (n + 1), the frame is not available (not yet published, or
+//     already overwritten). Read the slot fields and use the pixels in place
+//     (or copy them). Then (acquire fence) s2 = slot sequence; the data read
+//     were intact only if s2 == s1. A zero-copy consumer must therefore
+//     re-check the sequence after it is done with the pixels, and discard
+//     its results if it changed.
+//
+// When the buffer is cleared or its image size changes, all slots are
+// invalidated and clearCount is incremented; frame numbers keep counting.
+//
+// POSIX: the segment is a shm_open() object named "/" + name, created by
+// MMCore with O_EXCL and unlinked when the buffer is freed. Windows: a
+// pagefile-backed file mapping named "Local\" + name.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace mm {
+namespace sharedbuffer {
+
+const std::uint32_t SegmentMagic = 0x42534D4D; // "MMSB" in memory (little-endian)
+const std::uint32_t ProtocolVersion = 1;
+
+const std::uint32_t WriterActive = 1;
+const std::uint32_t WriterClosed = 2; // The writer freed the buffer
+
+const std::size_t CameraLabelSize = 48;
+
+struct SegmentHeader
+{
+   std::uint32_t magic;
+   std::uint32_t version;
+   std::uint64_t headerSize; // Offset of the data area
+   std::uint64_t dataSize;
+   std::uint64_t slotsOffset;
+   std::uint32_t slotCount;
+   std::uint32_t slotSize; // sizeof(FrameSlot)
+   std::atomic<std::uint64_t> publishedCount; // Frames 0 .. count - 1 published
+   std::atomic<std::uint64_t> clearCount;
+   std::atomic<std::uint32_t> writerState;
+   std::uint32_t writerProcessId;
+   std::uint8_t reserved[64];
+};
+
+struct FrameSlot
+{
+   std::atomic<std::uint64_t> sequence;
+   std::uint64_t frameNumber;
+   std::uint64_t dataOffset; // From segment start
+   std::uint64_t dataSize; // All channels
+   std::uint32_t width;
+   std::uint32_t height;
+   std::uint32_t bytesPerPixel; // Including all components
+   std::uint32_t numComponents; // 1, or 4 for RGB
+   std::uint32_t numChannels;
+   std::uint32_t reserved0;
+   std::int64_t imageNumber; // ImageNumber tag
+   double elapsedTimeMs; // ElapsedTime-ms tag
+   char cameraLabel[CameraLabelSize]; // Null-terminated, possibly truncated
+   std::uint64_t reserved1;
+};
+
+static_assert(sizeof(SegmentHeader) == 128, "SegmentHeader layout");
+static_assert(sizeof(FrameSlot) == 128, "FrameSlot layout");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+      "64-bit atomics must be lock-free to be shared between processes");
+
+inline std::uint64_t IntactSequence(std::uint64_t frameNumber)
+{ return 2 * (frameNumber + 1); }
+
+inline std::uint64_t WritingSequence(std::uint64_t frameNumber)
+{ return 2 * frameNumber + 1; }
+
+// Name of the operating system object for a segment name
+inline std::string ObjectName(const std::string& name)
+{
+   std::string bare = name;
+   while (!bare.empty() && bare[0] == '/')
+      bare.erase(0, 1);
+#ifdef _WIN32
+   return "Local\\" + bare;
+#else
+   return "/" + bare;
+#endif
+}
+
+} // namespace sharedbuffer
+} // namespace mm
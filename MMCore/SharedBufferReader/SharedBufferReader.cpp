@@ -0,0 +1,243 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SharedBufferReader.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Reads frames from a sequence buffer exported by MMCore in
+//                shared memory, from another process
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "SharedBufferReader.h"
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mm {
+namespace sharedbuffer {
+
+namespace {
+
+std::string LastErrorText()
+{
+   std::ostringstream oss;
+#ifdef _WIN32
+   oss << "Windows error " << GetLastError();
+#else
+   oss << std::strerror(errno);
+#endif
+   return oss.str();
+}
+
+} // anonymous namespace
+
+Reader::Reader(const std::string& name) :
+   segment_(nullptr),
+   mappedSize_(0),
+   header_(nullptr),
+   slots_(nullptr)
+#ifdef _WIN32
+   , mappingHandle_(NULL)
+#endif
+{
+   const std::string objectName = ObjectName(name);
+#ifdef _WIN32
+   HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, objectName.c_str());
+   void* p = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+   MEMORY_BASIC_INFORMATION info;
+   if (!p || !VirtualQuery(p, &info, sizeof(info)))
+   {
+      const std::string err = LastErrorText();
+      if (p)
+         UnmapViewOfFile(p);
+      if (mapping)
+         CloseHandle(mapping);
+      throw std::runtime_error("Cannot open shared memory segment " +
+            objectName + " (" + err + ")");
+   }
+   mappingHandle_ = mapping;
+   segment_ = static_cast<const unsigned char*>(p);
+   mappedSize_ = info.RegionSize;
+#else
+   const int fd = shm_open(objectName.c_str(), O_RDONLY, 0);
+   struct stat st;
+   if (fd < 0 || fstat(fd, &st) != 0)
+   {
+      const std::string err = LastErrorText();
+      if (fd >= 0)
+         close(fd);
+      throw std::runtime_error("Cannot open shared memory segment " +
+            objectName + " (" + err + ")");
+   }
+   void* p = st.st_size > 0 ? mmap(0, static_cast<std::size_t>(st.st_size),
+         PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+   const std::string err = LastErrorText();
+   close(fd);
+   if (p == MAP_FAILED)
+      throw std::runtime_error("Cannot map shared memory segment " +
+            objectName + " (" + err + ")");
+   segment_ = static_cast<const unsigned char*>(p);
+   mappedSize_ = static_cast<std::size_t>(st.st_size);
+#endif
+
+   header_ = reinterpret_cast<const SegmentHeader*>(segment_);
+   const bool valid = mappedSize_ >= sizeof(SegmentHeader) &&
+      header_->magic == SegmentMagic;
+   std::atomic_thread_fence(std::memory_order_acquire);
+   if (!valid || header_->version != ProtocolVersion ||
+         header_->slotSize != sizeof(FrameSlot) || header_->slotCount == 0 ||
+         header_->slotsOffset + std::uint64_t(header_->slotCount) *
+            sizeof(FrameSlot) > header_->headerSize ||
+         header_->headerSize + header_->dataSize > mappedSize_)
+   {
+      Unmap();
+      throw std::runtime_error("Shared memory segment " + objectName +
+            " is not a compatible Micro-Manager sequence buffer");
+   }
+   slots_ = reinterpret_cast<const FrameSlot*>(segment_ + header_->slotsOffset);
+}
+
+Reader::~Reader()
+{
+   Unmap();
+}
+
+void Reader::Unmap()
+{
+#ifdef _WIN32
+   if (segment_)
+      UnmapViewOfFile(segment_);
+   if (mappingHandle_)
+      CloseHandle(mappingHandle_);
+   mappingHandle_ = NULL;
+#else
+   if (segment_)
+      munmap(const_cast<unsigned char*>(segment_), mappedSize_);
+#endif
+   segment_ = nullptr;
+}
+
+std::uint64_t Reader::GetPublishedCount() const
+{
+   return header_->publishedCount.load(std::memory_order_acquire);
+}
+
+std::uint64_t Reader::GetClearCount() const
+{
+   return header_->clearCount.load(std::memory_order_acquire);
+}
+
+bool Reader::IsWriterClosed() const
+{
+   return header_->writerState.load(std::memory_order_acquire) == WriterClosed;
+}
+
+bool Reader::WaitForFrame(std::uint64_t frameNumber, long timeoutMs) const
+{
+   const auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(timeoutMs);
+   for (;;)
+   {
+      if (GetPublishedCount() > frameNumber)
+         return true;
+      if (IsWriterClosed() || std::chrono::steady_clock::now() >= deadline)
+         return false;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+   }
+}
+
+bool Reader::Peek(std::uint64_t frameNumber, Frame& frame) const
+{
+   const FrameSlot& slot = slots_[frameNumber % header_->slotCount];
+   const std::uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+   if (sequence != IntactSequence(frameNumber))
+      return false;
+
+   const std::uint64_t offset = slot.dataOffset;
+   const std::uint64_t bytes = slot.dataSize;
+   frame.width = slot.width;
+   frame.height = slot.height;
+   frame.bytesPerPixel = slot.bytesPerPixel;
+   frame.numComponents = slot.numComponents;
+   frame.numChannels = slot.numChannels;
+   frame.imageNumber = slot.imageNumber;
+   frame.elapsedTimeMs = slot.elapsedTimeMs;
+   char label[CameraLabelSize];
+   std::memcpy(label, slot.cameraLabel, CameraLabelSize);
+
+   std::atomic_thread_fence(std::memory_order_acquire);
+   if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+      return false;
+
+   // Intact fields can be trusted to be within the segment, but check anyway
+   if (offset < header_->headerSize || offset + bytes > mappedSize_)
+      return false;
+   label[CameraLabelSize - 1] = '\0';
+   frame.cameraLabel = label;
+   frame.frameNumber = frameNumber;
+   frame.sequence = sequence;
+   frame.pixels = segment_ + offset;
+   frame.bytes = static_cast<std::size_t>(bytes);
+   return true;
+}
+
+bool Reader::IsIntact(const Frame& frame) const
+{
+   const FrameSlot& slot = slots_[frame.frameNumber % header_->slotCount];
+   std::atomic_thread_fence(std::memory_order_acquire);
+   return slot.sequence.load(std::memory_order_relaxed) == frame.sequence;
+}
+
+bool Reader::Copy(std::uint64_t frameNumber, Frame& frame,
+      std::vector<unsigned char>& pixels) const
+{
+   if (!Peek(frameNumber, frame))
+      return false;
+   pixels.resize(frame.bytes);
+   std::memcpy(pixels.data(), frame.pixels, frame.bytes);
+   if (!IsIntact(frame))
+      return false;
+   frame.pixels = pixels.data();
+   return true;
+}
+
+bool Reader::PeekLatest(Frame& frame) const
+{
+   // The latest frame can only be overwritten if the writer has moved on,
+   // in which case there is a newer one to try
+   for (int attempt = 0; attempt < 3; ++attempt)
+   {
+      const std::uint64_t count = GetPublishedCount();
+      if (count == 0)
+         return false;
+      if (Peek(count - 1, frame))
+         return true;
+   }
+   return false;
+}
+
+} // namespace sharedbuffer
+} // namespace mm
@@ -0,0 +1,150 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          SharedBufferReader.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Reads frames from a sequence buffer exported by MMCore in
+//                shared memory, from another process
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+// This library does not depend on MMCore or MMDevice. It is used like this:
+//
+//    mm::sharedbuffer::Reader reader("mmbuffer"); // Name given to MMCore
+//    std::uint64_t next = reader.GetPublishedCount();
+//    for (;;) {
+//       if (!reader.WaitForFrame(next, 1000))
+//          continue;
+//       mm::sharedbuffer::Frame frame;
+//       if (reader.Peek(next, frame)) {
+//          Process(frame.pixels, frame.width, frame.height); // Zero-copy
+//          if (!reader.IsIntact(frame))
+//             DiscardResults(); // Overwritten while processing
+//       }
+//       ++next; // Frames that were not available are skipped
+//    }
+
+#pragma once
+
+#include "../SharedBufferProtocol.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mm {
+namespace sharedbuffer {
+
+/**
+ * A frame in the shared segment. The pixels point into the segment and may
+ * be overwritten by the writer at any time; see Reader::IsIntact().
+ */
+struct Frame
+{
+   std::uint64_t frameNumber = 0;
+   std::uint64_t sequence = 0;
+   const unsigned char* pixels = nullptr; // All channels, back to back
+   std::size_t bytes = 0;
+   unsigned width = 0;
+   unsigned height = 0;
+   unsigned bytesPerPixel = 0;
+   unsigned numComponents = 0;
+   unsigned numChannels = 0;
+   long long imageNumber = 0;
+   double elapsedTimeMs = 0.0;
+   std::string cameraLabel;
+};
+
+/**
+ * Read-only view of a shared memory segment created by MMCore (see
+ * CMMCore::setCircularBufferSharedMemoryName()). Readers do not remove
+ * frames from the buffer, and any number of them can be attached.
+ *
+ * All functions are thread-safe.
+ */
+class Reader
+{
+public:
+   /**
+    * Map the segment. Throws std::runtime_error if it does not exist or is
+    * not a compatible segment.
+    */
+   explicit Reader(const std::string& name);
+   ~Reader();
+
+   Reader(const Reader&) = delete;
+   Reader& operator=(const Reader&) = delete;
+
+   /**
+    * Number of frames published so far; the most recent frame, if any, is
+    * the count minus 1.
+    */
+   std::uint64_t GetPublishedCount() const;
+
+   /**
+    * Incremented whenever the writer discards all frames (when the buffer is
+    * cleared, e.g. at the start of an acquisition).
+    */
+   std::uint64_t GetClearCount() const;
+
+   /**
+    * Whether the writer has freed the buffer. No further frames will be
+    * published, and a new segment must be opened to continue.
+    */
+   bool IsWriterClosed() const;
+
+   /**
+    * Wait (polling) until frame frameNumber has been published. Returns
+    * false on timeout or if the writer is closed.
+    */
+   bool WaitForFrame(std::uint64_t frameNumber, long timeoutMs) const;
+
+   /**
+    * Zero-copy access: describe frame frameNumber, pointing into the segment.
+    * Returns false if the frame is not published yet or was overwritten.
+    * Once done with the pixels, check IsIntact().
+    */
+   bool Peek(std::uint64_t frameNumber, Frame& frame) const;
+
+   /**
+    * Whether a frame obtained with Peek() has not been overwritten since.
+    */
+   bool IsIntact(const Frame& frame) const;
+
+   /**
+    * Copy frame frameNumber into pixels (resized as needed). Returns false if
+    * the frame is not available or was overwritten during the copy.
+    */
+   bool Copy(std::uint64_t frameNumber, Frame& frame,
+         std::vector<unsigned char>& pixels) const;
+
+   /**
+    * The most recent intact frame, as with Peek(). Returns false if there is
+    * none.
+    */
+   bool PeekLatest(Frame& frame) const;
+
+private:
+   const unsigned char* segment_;
+   std::size_t mappedSize_;
+   const SegmentHeader* header_;
+   const FrameSlot* slots_;
+#ifdef _WIN32
+   void* mappingHandle_;
+#endif
+
+   void Unmap();
+};
+
+} // namespace sharedbuffer
+} // namespace mm
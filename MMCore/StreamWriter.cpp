@@ -0,0 +1,628 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          StreamWriter.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Writes images from the sequence buffer to disk on a
+//                dedicated thread
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "StreamWriter.h"
+
+#include "BufferMemory.h"
+#include "CircularBuffer.h"
+#include "ErrorCodes.h"
+#include "FrameBuffer.h"
+
+#include "../MMDevice/MMDeviceConstants.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <sstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable: 4290) // 'C++ exception specification ignored'
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+// 'dynamic exception specifications are deprecated in C++11 [-Wdeprecated]'
+#pragma GCC diagnostic ignored "-Wdeprecated"
+#endif
+
+namespace mm {
+
+namespace {
+
+// Size of the writes; a multiple of directIOAlignment
+const std::size_t stagingSize = 8 << 20;
+
+// Direct I/O requires the offset, size and memory address of writes to be
+// multiples of the logical block size, which is at most the page size on
+// the systems we support.
+const std::size_t directIOAlignment = 4096;
+
+// Classic TIFF uses 32-bit offsets
+const std::uint64_t maxTIFFFileSize = 0xffffffffULL;
+
+const unsigned tiffEntryCount = 10;
+const std::size_t tiffIFDSize = 2 + tiffEntryCount * 12 + 4;
+
+std::string LastErrorText()
+{
+   std::ostringstream oss;
+#ifdef _WIN32
+   oss << "Windows error " << GetLastError();
+#else
+   oss << std::strerror(errno);
+#endif
+   return oss.str();
+}
+
+void Put16(unsigned char*& p, std::uint16_t v)
+{
+   *p++ = static_cast<unsigned char>(v);
+   *p++ = static_cast<unsigned char>(v >> 8);
+}
+
+void Put32(unsigned char*& p, std::uint32_t v)
+{
+   Put16(p, static_cast<std::uint16_t>(v));
+   Put16(p, static_cast<std::uint16_t>(v >> 16));
+}
+
+// TIFF directory entry with a single value, or an offset
+void PutEntry(unsigned char*& p, std::uint16_t tag, std::uint16_t type,
+      std::uint32_t count, std::uint32_t value)
+{
+   const std::uint16_t typeShort = 3;
+   Put16(p, tag);
+   Put16(p, type);
+   Put32(p, count);
+   if (type == typeShort && count == 1)
+   {
+      Put16(p, static_cast<std::uint16_t>(value));
+      Put16(p, 0);
+   }
+   else
+   {
+      Put32(p, value);
+   }
+}
+
+} // anonymous namespace
+
+namespace internal {
+
+// A file created for writing, optionally with OS caching disabled
+class OutputFile
+{
+   std::string path_;
+   bool direct_;
+#ifdef _WIN32
+   HANDLE handle_;
+#else
+   int fd_;
+#endif
+
+public:
+   OutputFile(const std::string& path, bool direct) throw (CMMError) :
+      path_(path),
+      direct_(direct)
+   {
+#ifdef _WIN32
+      const DWORD flags = direct ?
+         (FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH) :
+         FILE_FLAG_SEQUENTIAL_SCAN;
+      handle_ = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+            NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL | flags, NULL);
+      if (handle_ == INVALID_HANDLE_VALUE)
+         throw CMMError("Cannot create file " + path + " (" +
+               LastErrorText() + ")", MMERR_FileOpenFailed);
+#else
+      int flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+#ifdef O_DIRECT
+      if (direct)
+         flags |= O_DIRECT;
+#endif
+      fd_ = open(path.c_str(), flags, 0644);
+      if (fd_ < 0)
+         throw CMMError("Cannot create file " + path + " (" +
+               LastErrorText() + ")", MMERR_FileOpenFailed);
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+      if (direct)
+         fcntl(fd_, F_NOCACHE, 1);
+#endif
+#endif
+   }
+
+   ~OutputFile()
+   {
+      Close();
+   }
+
+   void Write(const unsigned char* data, std::size_t bytes) throw (CMMError)
+   {
+#ifdef _WIN32
+      while (bytes > 0)
+      {
+         DWORD written;
+         const DWORD chunk = static_cast<DWORD>((std::min)(bytes, std::size_t(1) << 30));
+         if (!WriteFile(handle_, data, chunk, &written, NULL))
+            throw CMMError("Cannot write to file " + path_ + " (" +
+                  LastErrorText() + ")", MMERR_FileOpenFailed);
+         data += written;
+         bytes -= written;
+      }
+#else
+      while (bytes > 0)
+      {
+         const ssize_t written = write(fd_, data, bytes);
+         if (written < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            throw CMMError("Cannot write to file " + path_ + " (" +
+                  LastErrorText() + ")", MMERR_FileOpenFailed);
+         }
+         data += written;
+         bytes -= static_cast<std::size_t>(written);
+      }
+#endif
+   }
+
+   /**
+    * Close the file, truncating it to length (to remove the padding of
+    * direct writes) and writing a 32-bit little-endian zero at zeroOffset,
+    * if not zero.
+    */
+   void Finish(std::uint64_t length, std::uint64_t zeroOffset) throw (CMMError)
+   {
+      const unsigned char zero[4] = { 0, 0, 0, 0 };
+#ifdef _WIN32
+      if (direct_)
+      {
+         // Unbuffered handles only allow aligned writes
+         CloseHandle(handle_);
+         handle_ = CreateFileA(path_.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+               NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+         if (handle_ == INVALID_HANDLE_VALUE)
+            throw CMMError("Cannot reopen file " + path_ + " (" +
+                  LastErrorText() + ")", MMERR_FileOpenFailed);
+      }
+      LARGE_INTEGER pos;
+      pos.QuadPart = static_cast<LONGLONG>(length);
+      bool ok = SetFilePointerEx(handle_, pos, NULL, FILE_BEGIN) &&
+         SetEndOfFile(handle_);
+      if (ok && zeroOffset != 0)
+      {
+         DWORD written;
+         pos.QuadPart = static_cast<LONGLONG>(zeroOffset);
+         ok = SetFilePointerEx(handle_, pos, NULL, FILE_BEGIN) &&
+            WriteFile(handle_, zero, sizeof(zero), &written, NULL) &&
+            written == sizeof(zero);
+      }
+#else
+      if (direct_)
+      {
+         // Direct I/O only allows aligned writes
+         close(fd_);
+         fd_ = open(path_.c_str(), O_WRONLY | O_CLOEXEC);
+         if (fd_ < 0)
+            throw CMMError("Cannot reopen file " + path_ + " (" +
+                  LastErrorText() + ")", MMERR_FileOpenFailed);
+      }
+      bool ok = ftruncate(fd_, static_cast<off_t>(length)) == 0;
+      if (ok && zeroOffset != 0)
+         ok = pwrite(fd_, zero, sizeof(zero),
+               static_cast<off_t>(zeroOffset)) == sizeof(zero);
+#endif
+      if (!ok)
+         throw CMMError("Cannot finish writing file " + path_ + " (" +
+               LastErrorText() + ")", MMERR_FileOpenFailed);
+      Close();
+   }
+
+private:
+   void Close()
+   {
+#ifdef _WIN32
+      if (handle_ != INVALID_HANDLE_VALUE)
+         CloseHandle(handle_);
+      handle_ = INVALID_HANDLE_VALUE;
+#else
+      if (fd_ >= 0)
+         close(fd_);
+      fd_ = -1;
+#endif
+   }
+};
+
+} // namespace internal
+
+StreamWriter::Format StreamWriter::ParseFormat(const std::string& name) throw (CMMError)
+{
+   if (name == "raw")
+      return FormatRaw;
+   if (name == "tiff" || name == "tif")
+      return FormatTIFF;
+   throw CMMError("Unknown streaming format \"" + name +
+         "\" (must be \"raw\" or \"tiff\")");
+}
+
+StreamWriter::StreamWriter(CircularBuffer* buffer, const std::string& path,
+      Format format, bool directIO, logging::Logger logger) throw (CMMError) :
+   buffer_(buffer),
+   path_(path),
+   format_(format),
+   directIO_(directIO),
+   logger_(logger),
+   stopRequested_(false),
+   abortRequested_(false),
+   running_(false),
+   stagingUsed_(0),
+   fileOffset_(0),
+   fileCount_(0),
+   lastNextIFDOffset_(0),
+   ended_(false),
+   overflowed_(false),
+   framesWritten_(0),
+   bytesWritten_(0),
+   writeTime_(0),
+   backlog_(0),
+   maxBacklog_(0)
+{
+   // Page-aligned, as required for direct I/O
+   staging_.reset(new BufferMemory(stagingSize, BufferAllocationOptions(),
+            std::shared_ptr<ThreadPool>()));
+
+   if (format_ == FormatRaw)
+   {
+      const std::string indexPath = path_ + ".idx";
+      if (std::ifstream(indexPath.c_str()).good())
+         throw CMMError("File " + indexPath + " already exists",
+               MMERR_FileOpenFailed);
+      OpenFile();
+      index_.open(indexPath.c_str());
+      if (!index_)
+         throw CMMError("Cannot create file " + indexPath,
+               MMERR_FileOpenFailed);
+      index_ << "Image\tOffset\tBytes\tWidth\tHeight\tBytesPerPixel\t"
+         "Components\tImageNumber\tElapsedTime-ms\tCamera\n";
+   }
+   else
+   {
+      OpenFile();
+   }
+
+   startTime_ = std::chrono::steady_clock::now();
+   running_ = true;
+   thread_ = std::thread(&StreamWriter::Run, this);
+}
+
+StreamWriter::~StreamWriter()
+{
+   if (thread_.joinable())
+   {
+      abortRequested_ = true;
+      stopRequested_ = true;
+      thread_.join();
+   }
+}
+
+void StreamWriter::Stop() throw (CMMError)
+{
+   if (thread_.joinable())
+   {
+      stopRequested_ = true;
+      thread_.join();
+   }
+   if (!error_.empty())
+      throw CMMError(error_, MMERR_FileOpenFailed);
+}
+
+std::map<std::string, double> StreamWriter::GetStatistics() const
+{
+   using namespace std::chrono;
+   std::map<std::string, double> stats;
+
+   std::lock_guard<std::mutex> lock(statsMutex_);
+   const steady_clock::time_point end = ended_ ? endTime_ : steady_clock::now();
+   const double elapsed = duration<double>(end - startTime_).count();
+   const double writing = duration<double>(writeTime_).count();
+   const double mb = static_cast<double>(bytesWritten_) / (1 << 20);
+
+   stats["FramesWritten"] = static_cast<double>(framesWritten_);
+   stats["BytesWritten"] = static_cast<double>(bytesWritten_);
+   stats["FilesWritten"] = fileCount_ + 1;
+   stats["ElapsedSeconds"] = elapsed;
+   stats["ThroughputMBps"] = elapsed > 0.0 ? mb / elapsed : 0.0;
+   stats["WriteSeconds"] = writing;
+   stats["WriteMBps"] = writing > 0.0 ? mb / writing : 0.0;
+   stats["BacklogFrames"] = backlog_;
+   stats["MaxBacklogFrames"] = maxBacklog_;
+   stats["BufferOverflowed"] = overflowed_ ? 1.0 : 0.0;
+   return stats;
+}
+
+void StreamWriter::Run()
+{
+   try
+   {
+      while (!abortRequested_)
+      {
+         const unsigned long finishedCount = buffer_->GetAcquisitionFinishedCount();
+         // The lease keeps the frame from being overwritten while it is
+         // being written
+         std::shared_ptr<const ImgBuffer> img = buffer_->LeaseNextImage(0);
+         if (img)
+         {
+            WriteFrame(*img);
+            img.reset();
+
+            const unsigned long backlog = buffer_->GetRemainingImageCount();
+            const bool overflowed = buffer_->Overflow();
+            std::lock_guard<std::mutex> lock(statsMutex_);
+            backlog_ = backlog;
+            maxBacklog_ = (std::max)(maxBacklog_, backlog);
+            overflowed_ = overflowed;
+            continue;
+         }
+         if (stopRequested_)
+            break;
+         buffer_->WaitForImage(100, finishedCount);
+      }
+      CloseFile();
+      LOG_INFO(logger_) << "Finished streaming " << framesWritten_ <<
+         " images to " << path_;
+   }
+   catch (const CMMError& e)
+   {
+      error_ = e.getMsg();
+      LOG_ERROR(logger_) << "Streaming to " << path_ << " stopped: " <<
+         error_;
+   }
+   catch (const std::exception& e)
+   {
+      // E.g. std::bad_alloc; must not escape the thread
+      error_ = e.what();
+      LOG_ERROR(logger_) << "Streaming to " << path_ << " stopped: " <<
+         error_;
+   }
+
+   // The buffer is not accessed after this point, so that it can be
+   // replaced once the writer has stopped
+   const bool overflowed = buffer_->Overflow();
+   {
+      std::lock_guard<std::mutex> lock(statsMutex_);
+      endTime_ = std::chrono::steady_clock::now();
+      ended_ = true;
+      overflowed_ = overflowed;
+   }
+   running_ = false;
+}
+
+void StreamWriter::WriteFrame(const ImgBuffer& img)
+{
+   const FrameMetadata& md = img.GetFrameMetadata();
+   const unsigned nComponents = md.GetNumberOfComponents();
+   std::size_t bytes = static_cast<std::size_t>(img.Width()) * img.Height() *
+      img.Depth();
+   const unsigned char* pixels = img.GetPixels();
+
+   if (format_ == FormatTIFF)
+   {
+      if (nComponents == 4)
+         pixels = ConvertRGB(img, bytes);
+      BeginTIFFPage(img, nComponents, bytes);
+      Append(pixels, bytes);
+      if (bytes % 2)
+      {
+         // Keep the next directory on a word boundary
+         const unsigned char pad = 0;
+         Append(&pad, 1);
+      }
+   }
+   else
+   {
+      const std::uint64_t offset = fileOffset_;
+      Append(pixels, bytes);
+
+      const char* camera = md.FindValue(MM::g_Keyword_Metadata_CameraLabel);
+      index_ << framesWritten_ << '\t' << offset << '\t' << bytes << '\t' <<
+         img.Width() << '\t' << img.Height() << '\t' <<
+         img.Depth() / nComponents << '\t' << nComponents << '\t' <<
+         md.GetImageNumber() << '\t';
+      // The camera may have provided its own elapsed time
+      const char* elapsed = md.FindValue(MM::g_Keyword_Elapsed_Time_ms);
+      if (elapsed)
+         index_ << elapsed;
+      else
+         index_ << std::chrono::duration<double, std::milli>(md.GetElapsedTime()).count();
+      index_ << '\t' << (camera ? camera : "") << '\n';
+   }
+
+   std::lock_guard<std::mutex> lock(statsMutex_);
+   ++framesWritten_;
+}
+
+const unsigned char* StreamWriter::ConvertRGB(const ImgBuffer& img,
+      std::size_t& bytes)
+{
+   // Images are stored as BGRA with 8 or 16 bits per sample; TIFF wants RGB
+   const std::size_t pixelCount = static_cast<std::size_t>(img.Width()) * img.Height();
+   const std::size_t sampleBytes = img.Depth() / 4;
+   rgbScratch_.resize(pixelCount * 3 * sampleBytes);
+   const unsigned char* src = img.GetPixels();
+   unsigned char* dst = rgbScratch_.data();
+   for (std::size_t i = 0; i < pixelCount; ++i)
+   {
+      for (unsigned c = 0; c < 3; ++c)
+         std::memcpy(dst + (i * 3 + c) * sampleBytes,
+               src + (i * 4 + 2 - c) * sampleBytes, sampleBytes);
+   }
+   bytes = rgbScratch_.size();
+   return rgbScratch_.data();
+}
+
+void StreamWriter::BeginTIFFPage(const ImgBuffer& img, unsigned nComponents,
+      std::size_t pixelBytes)
+{
+   const bool rgb = (nComponents == 4);
+   const std::uint16_t samples = rgb ? 3 : 1;
+   const std::uint16_t bitsPerSample =
+      static_cast<std::uint16_t>(8 * img.Depth() / nComponents);
+   const std::size_t headerBytes = tiffIFDSize + (rgb ? 6 : 0);
+   const std::size_t pageBytes = headerBytes + pixelBytes + (pixelBytes % 2);
+
+   if (lastNextIFDOffset_ != 0 && fileOffset_ + pageBytes > maxTIFFFileSize)
+   {
+      CloseFile();
+      {
+         std::lock_guard<std::mutex> lock(statsMutex_);
+         ++fileCount_;
+      }
+      OpenFile();
+   }
+   if (fileOffset_ + pageBytes > maxTIFFFileSize)
+      throw CMMError("Image too large for TIFF");
+
+   const std::uint64_t pageOffset = fileOffset_;
+   const std::uint32_t extraOffset = static_cast<std::uint32_t>(pageOffset + tiffIFDSize);
+   const std::uint32_t dataOffset = static_cast<std::uint32_t>(pageOffset + headerBytes);
+   const std::uint32_t nextOffset = static_cast<std::uint32_t>(pageOffset + pageBytes);
+
+   const std::uint16_t typeShort = 3;
+   const std::uint16_t typeLong = 4;
+   unsigned char header[tiffIFDSize + 6];
+   unsigned char* p = header;
+   Put16(p, tiffEntryCount);
+   PutEntry(p, 256, typeLong, 1, img.Width()); // ImageWidth
+   PutEntry(p, 257, typeLong, 1, img.Height()); // ImageLength
+   if (rgb) // BitsPerSample
+      PutEntry(p, 258, typeShort, 3, extraOffset);
+   else
+      PutEntry(p, 258, typeShort, 1, bitsPerSample);
+   PutEntry(p, 259, typeShort, 1, 1); // Compression: none
+   PutEntry(p, 262, typeShort, 1, rgb ? 2 : 1); // Photometric: RGB, BlackIsZero
+   PutEntry(p, 273, typeLong, 1, dataOffset); // StripOffsets
+   PutEntry(p, 277, typeShort, 1, samples); // SamplesPerPixel
+   PutEntry(p, 278, typeLong, 1, img.Height()); // RowsPerStrip
+   PutEntry(p, 279, typeLong, 1, static_cast<std::uint32_t>(pixelBytes)); // StripByteCounts
+   PutEntry(p, 284, typeShort, 1, 1); // PlanarConfiguration: chunky
+   Put32(p, nextOffset);
+   if (rgb)
+   {
+      for (int i = 0; i < 3; ++i)
+         Put16(p, bitsPerSample);
+   }
+
+   lastNextIFDOffset_ = pageOffset + tiffIFDSize - 4;
+   Append(header, headerBytes);
+}
+
+void StreamWriter::Append(const unsigned char* data, std::size_t bytes)
+{
+   while (bytes > 0)
+   {
+      const std::size_t chunk = (std::min)(bytes, stagingSize - stagingUsed_);
+      std::memcpy(staging_->Data() + stagingUsed_, data, chunk);
+      stagingUsed_ += chunk;
+      fileOffset_ += chunk;
+      data += chunk;
+      bytes -= chunk;
+      if (stagingUsed_ == stagingSize)
+         FlushStaging(false);
+   }
+}
+
+void StreamWriter::FlushStaging(bool final)
+{
+   std::size_t bytes = stagingUsed_;
+   if (final && directIO_)
+   {
+      // Pad the last write to the block size; the file is truncated to its
+      // actual length afterwards
+      const std::size_t padded = (bytes + directIOAlignment - 1) /
+         directIOAlignment * directIOAlignment;
+      std::memset(staging_->Data() + bytes, 0, padded - bytes);
+      bytes = padded;
+   }
+   if (bytes == 0)
+      return;
+
+   const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   file_->Write(staging_->Data(), bytes);
+   const std::chrono::steady_clock::duration elapsed =
+      std::chrono::steady_clock::now() - start;
+
+   std::lock_guard<std::mutex> lock(statsMutex_);
+   writeTime_ += elapsed;
+   bytesWritten_ += stagingUsed_;
+   stagingUsed_ = 0;
+}
+
+std::string StreamWriter::FilePath(unsigned fileNumber) const
+{
+   if (fileNumber == 0)
+      return path_;
+   std::ostringstream suffix;
+   suffix << '_' << fileNumber;
+   const std::string::size_type dot = path_.find_last_of('.');
+   const std::string::size_type sep = path_.find_last_of("/\\");
+   if (dot == std::string::npos || (sep != std::string::npos && dot < sep))
+      return path_ + suffix.str();
+   return path_.substr(0, dot) + suffix.str() + path_.substr(dot);
+}
+
+void StreamWriter::OpenFile()
+{
+   file_.reset(new internal::OutputFile(FilePath(fileCount_), directIO_));
+   fileOffset_ = 0;
+   lastNextIFDOffset_ = 0;
+
+   if (format_ == FormatTIFF)
+   {
+      // Little-endian header; the first directory follows immediately
+      unsigned char header[8] = { 'I', 'I', 42, 0 };
+      unsigned char* p = header + 4;
+      Put32(p, 8);
+      Append(header, sizeof(header));
+   }
+}
+
+void StreamWriter::CloseFile()
+{
+   FlushStaging(true);
+   // The last directory has no successor
+   file_->Finish(fileOffset_, lastNextIFDOffset_);
+   file_.reset();
+   if (index_.is_open())
+   {
+      index_.close();
+      if (!index_)
+         throw CMMError("Cannot write file " + path_ + ".idx",
+               MMERR_FileOpenFailed);
+   }
+}
+
+} // namespace mm
@@ -0,0 +1,180 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          StreamWriter.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Writes images from the sequence buffer to disk on a
+//                dedicated thread
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "Error.h"
+#include "Logging/Logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable: 4290) // 'C++ exception specification ignored'
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+// 'dynamic exception specifications are deprecated in C++11 [-Wdeprecated]'
+#pragma GCC diagnostic ignored "-Wdeprecated"
+#endif
+
+class CircularBuffer;
+
+namespace mm {
+
+class BufferMemory;
+class ImgBuffer;
+
+namespace internal {
+class OutputFile;
+}
+
+/**
+ * Consumes (pops) images from a sequence buffer on its own thread and
+ * writes them to disk.
+ *
+ * Formats:
+ * - "raw": pixel data of all images back to back in one file, plus a
+ *   tab-separated index (path + ".idx") giving the offset, dimensions,
+ *   image number, elapsed time and camera of each image.
+ * - "tiff": multi-page baseline TIFF, uncompressed. A new file (path with
+ *   _1, _2, ... inserted before the extension) is started whenever a file
+ *   would exceed the 4 GB limit of TIFF. RGB images are written as 3-sample
+ *   RGB.
+ *
+ * Data are accumulated in a page-aligned staging buffer and written in
+ * large chunks, optionally bypassing the OS cache (O_DIRECT or
+ * FILE_FLAG_NO_BUFFERING). Files must not already exist.
+ */
+class StreamWriter
+{
+public:
+   enum Format
+   {
+      FormatRaw,
+      FormatTIFF,
+   };
+
+   /**
+    * Parse a format name ("raw" or "tiff"). Throws CMMError if unknown.
+    */
+   static Format ParseFormat(const std::string& name) throw (CMMError);
+
+   /**
+    * Create the output file(s) and start the writer thread. The buffer must
+    * outlive the writer thread (it is not accessed once IsRunning() returns
+    * false).
+    */
+   StreamWriter(CircularBuffer* buffer, const std::string& path,
+         Format format, bool directIO, logging::Logger logger) throw (CMMError);
+
+   /**
+    * Stops writing without draining the buffer, if Stop() was not called.
+    */
+   ~StreamWriter();
+
+   StreamWriter(const StreamWriter&) = delete;
+   StreamWriter& operator=(const StreamWriter&) = delete;
+
+   /**
+    * Write all images remaining in the buffer, then close the files. Throws
+    * CMMError if writing failed at any point.
+    */
+   void Stop() throw (CMMError);
+
+   /**
+    * Whether the writer thread is running (false after Stop() or after a
+    * write error).
+    */
+   bool IsRunning() const { return running_.load(); }
+
+   /**
+    * Current statistics, by name (see CMMCore::getStreamingStatistics()).
+    * Does not access the buffer.
+    */
+   std::map<std::string, double> GetStatistics() const;
+
+private:
+   CircularBuffer* const buffer_;
+   const std::string path_;
+   const Format format_;
+   const bool directIO_;
+   logging::Logger logger_;
+
+   std::thread thread_;
+   std::atomic<bool> stopRequested_;
+   std::atomic<bool> abortRequested_;
+   std::atomic<bool> running_;
+   std::string error_; // Set by the writer thread before it exits
+
+   // Written by the writer thread only
+   std::unique_ptr<BufferMemory> staging_;
+   std::size_t stagingUsed_;
+   std::unique_ptr<internal::OutputFile> file_;
+   std::uint64_t fileOffset_; // Logical end of the current file
+   unsigned fileCount_; // Changed under statsMutex_
+   std::uint64_t lastNextIFDOffset_; // TIFF; 0 if no page yet
+   std::ofstream index_;
+   std::vector<unsigned char> rgbScratch_;
+
+   // Statistics
+   mutable std::mutex statsMutex_;
+   std::chrono::steady_clock::time_point startTime_;
+   std::chrono::steady_clock::time_point endTime_;
+   bool ended_;
+   bool overflowed_; // Buffer overflow flag as last seen by the writer thread
+   std::uint64_t framesWritten_;
+   std::uint64_t bytesWritten_;
+   std::chrono::steady_clock::duration writeTime_;
+   unsigned long backlog_;
+   unsigned long maxBacklog_;
+
+   void Run();
+   void WriteFrame(const ImgBuffer& img);
+   void Append(const unsigned char* data, std::size_t bytes);
+   void FlushStaging(bool final);
+   void OpenFile();
+   void CloseFile();
+   std::string FilePath(unsigned fileNumber) const;
+   void BeginTIFFPage(const ImgBuffer& img, unsigned nComponents,
+         std::size_t pixelBytes);
+   const unsigned char* ConvertRGB(const ImgBuffer& img, std::size_t& bytes);
+};
+
+} // namespace mm
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
@@ -38,6 +38,11 @@ TaskSet::~TaskSet()
         delete task;
 }
 
+size_t TaskSet::GetTaskCount() const
+{
+    return tasks_.size();
+}
+
 size_t TaskSet::GetUsedTaskCount() const
 {
     return usedTaskCount_;
@@ -39,6 +39,7 @@ public:
     TaskSet(const TaskSet&) = delete;
     TaskSet& operator=(const TaskSet&) = delete;
 
+    size_t GetTaskCount() const;
     size_t GetUsedTaskCount() const;
 
     virtual void Execute();
@@ -0,0 +1,162 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          TaskSet_CompressFrame.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Parallel compression of frames for the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "TaskSet_CompressFrame.h"
+
+#include "FrameCompression.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Fewer blocks are not worth handing to another thread
+    const size_t minBlocksPerTask = 4;
+}
+
+TaskSet_CompressFrame::ATask::ATask(std::shared_ptr<Semaphore> semDone, size_t taskIndex, size_t totalTaskCount)
+    : Task(semDone, taskIndex, totalTaskCount)
+{
+}
+
+void TaskSet_CompressFrame::ATask::SetUp(Job* job, size_t usedTaskCount)
+{
+    job_ = job;
+    usedTaskCount_ = usedTaskCount;
+}
+
+void TaskSet_CompressFrame::ATask::Execute()
+{
+    const size_t blockCount = job_->blocks.size();
+    const size_t firstBlock = blockCount * taskIndex_ / usedTaskCount_;
+    const size_t lastBlock = blockCount * (taskIndex_ + 1) / usedTaskCount_;
+    if (job_->writing)
+        Write(firstBlock, lastBlock);
+    else
+        Compress(firstBlock, lastBlock);
+}
+
+void TaskSet_CompressFrame::ATask::Compress(size_t firstBlock, size_t lastBlock)
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const size_t capacity = (lastBlock - firstBlock) *
+        mm::MaxCompressedBlockBytes(mm::CompressionBlockBytes);
+    if (output_.size() < capacity)
+        output_.resize(capacity);
+    shuffled_.resize(mm::CompressionBlockBytes);
+
+    size_t outputOffset = 0;
+    for (size_t n = firstBlock; n < lastBlock; ++n)
+    {
+        Block& block = job_->blocks[n];
+        const unsigned char* src = job_->src + block.srcOffset;
+        // While the block is in the cache
+        if (job_->rawCopy)
+            std::memcpy(job_->rawCopy + block.srcOffset, src, block.rawBytes);
+        block.entry = mm::CompressBlock(src, block.rawBytes, job_->elementSize,
+            shuffled_.data(), output_.data() + outputOffset);
+        block.outputOffset = outputOffset;
+        outputOffset += mm::CompressedBlockBytes(block.entry);
+    }
+
+    busy_ = std::chrono::steady_clock::now() - start;
+}
+
+void TaskSet_CompressFrame::ATask::Write(size_t firstBlock, size_t lastBlock)
+{
+    for (size_t n = firstBlock; n < lastBlock; ++n)
+    {
+        const Block& block = job_->blocks[n];
+        mm::WriteCompressionEntry(job_->dst + block.headerOffset,
+            block.indexInChannel, block.entry);
+        std::memcpy(job_->dst + block.dstOffset, output_.data() + block.outputOffset,
+            mm::CompressedBlockBytes(block.entry));
+    }
+}
+
+TaskSet_CompressFrame::TaskSet_CompressFrame(std::shared_ptr<ThreadPool> pool)
+    : TaskSet(pool)
+{
+    CreateTasks<ATask>();
+}
+
+std::size_t TaskSet_CompressFrame::Compress(const unsigned char* src,
+    unsigned numChannels, std::size_t channelBytes, unsigned elementSize,
+    unsigned char* rawCopy)
+{
+    job_.writing = false;
+    job_.src = src;
+    job_.rawCopy = rawCopy;
+    job_.elementSize = elementSize;
+    job_.dst = nullptr;
+
+    const size_t blocksPerChannel = mm::CompressionBlockCount(channelBytes);
+    job_.blocks.resize(numChannels * blocksPerChannel);
+    for (unsigned channel = 0; channel < numChannels; ++channel)
+    {
+        for (size_t i = 0; i < blocksPerChannel; ++i)
+        {
+            Block& block = job_.blocks[channel * blocksPerChannel + i];
+            block.srcOffset = channel * channelBytes + i * mm::CompressionBlockBytes;
+            block.rawBytes = (std::min)(mm::CompressionBlockBytes,
+                channelBytes - i * mm::CompressionBlockBytes);
+            block.indexInChannel = i;
+        }
+    }
+
+    usedTaskCount_ = std::max<size_t>(1, std::min<size_t>(tasks_.size(),
+        job_.blocks.size() / minBlocksPerTask));
+    for (size_t n = 0; n < usedTaskCount_; ++n)
+        static_cast<ATask*>(tasks_[n])->SetUp(&job_, usedTaskCount_);
+    Execute();
+    Wait();
+
+    // Lay out the channels' block tables and data
+    channelOffsets_.resize(numChannels);
+    size_t offset = 0;
+    for (unsigned channel = 0; channel < numChannels; ++channel)
+    {
+        channelOffsets_[channel] = offset;
+        offset += mm::CompressionHeaderBytes(channelBytes);
+        for (size_t i = 0; i < blocksPerChannel; ++i)
+        {
+            Block& block = job_.blocks[channel * blocksPerChannel + i];
+            block.headerOffset = channelOffsets_[channel];
+            block.dstOffset = offset;
+            offset += mm::CompressedBlockBytes(block.entry);
+        }
+    }
+    return offset;
+}
+
+void TaskSet_CompressFrame::Write(unsigned char* dst)
+{
+    job_.writing = true;
+    job_.dst = dst;
+    Execute();
+    Wait();
+}
+
+std::chrono::steady_clock::duration TaskSet_CompressFrame::GetCpuTime() const
+{
+    std::chrono::steady_clock::duration total{};
+    for (size_t n = 0; n < usedTaskCount_; ++n)
+        total += static_cast<const ATask*>(tasks_[n])->GetBusyTime();
+    return total;
+}
@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          TaskSet_CompressFrame.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Parallel compression of frames for the sequence buffer
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "TaskSet.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+class TaskSet_CompressFrame : public TaskSet
+{
+private:
+    struct Block
+    {
+        std::size_t srcOffset;
+        std::size_t rawBytes;
+        std::uint32_t entry; // See mm::CompressBlock()
+        std::size_t outputOffset; // In the task's output
+        std::size_t headerOffset; // Of the channel's block table, in dst
+        std::size_t indexInChannel;
+        std::size_t dstOffset;
+    };
+
+    struct Job
+    {
+        bool writing;
+        const unsigned char* src;
+        unsigned char* rawCopy;
+        unsigned elementSize;
+        unsigned char* dst;
+        std::vector<Block> blocks;
+    };
+
+    class ATask : public Task
+    {
+    public:
+        explicit ATask(std::shared_ptr<Semaphore> semDone, size_t taskIndex, size_t totalTaskCount);
+
+        void SetUp(Job* job, size_t usedTaskCount);
+
+        virtual void Execute() override;
+
+        std::chrono::steady_clock::duration GetBusyTime() const { return busy_; }
+
+    private:
+        void Compress(size_t firstBlock, size_t lastBlock);
+        void Write(size_t firstBlock, size_t lastBlock);
+
+        Job* job_{ nullptr };
+        std::vector<unsigned char> output_;
+        std::vector<unsigned char> shuffled_;
+        std::chrono::steady_clock::duration busy_{};
+    };
+
+public:
+    explicit TaskSet_CompressFrame(std::shared_ptr<ThreadPool> pool);
+
+    // Compress numChannels images of channelBytes each, stored back to back
+    // in src, with pixel values of elementSize bytes. src is copied to
+    // rawCopy (if not null) along the way. Returns the size of the
+    // compressed frame: the compressed images (see FrameCompression.h) of
+    // the channels back to back.
+    std::size_t Compress(const unsigned char* src, unsigned numChannels,
+        std::size_t channelBytes, unsigned elementSize, unsigned char* rawCopy);
+
+    // Offset of the channel's compressed image in the compressed frame
+    std::size_t GetChannelOffset(unsigned channel) const { return channelOffsets_[channel]; }
+
+    // Write out the frame compressed by the last call to Compress()
+    void Write(unsigned char* dst);
+
+    // Time spent by the tasks on the last call to Compress()
+    std::chrono::steady_clock::duration GetCpuTime() const;
+
+private:
+    Job job_{};
+    std::vector<std::size_t> channelOffsets_;
+};
@@ -23,21 +23,53 @@
 
 #include "TaskSet_CopyMemory.h"
 
+#include "MemoryCopy.h"
+
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstring>
+#include <limits>
+#include <map>
+
+namespace
+{
+    // Found experimentally before calibration was available
+    const size_t defaultBytesPerTask = 1000000;
+
+    // Copies smaller than the cache gain nothing from bypassing it
+    size_t DefaultNonTemporalThreshold()
+    {
+        const size_t cacheSize = mm::GetLastLevelCacheSize();
+        if (cacheSize == 0 || std::strcmp(mm::NonTemporalCopyInstructionSet(), "None") == 0)
+            return std::numeric_limits<size_t>::max();
+        return cacheSize;
+    }
+
+    void Copy(void* dst, const void* src, size_t bytes, bool nonTemporal)
+    {
+        if (nonTemporal)
+            mm::CopyMemoryNonTemporal(dst, src, bytes);
+        else
+            std::memcpy(dst, src, bytes);
+    }
+}
+
+std::atomic<size_t> TaskSet_CopyMemory::bytesPerTask_{ defaultBytesPerTask };
+std::atomic<size_t> TaskSet_CopyMemory::nonTemporalThreshold_{ DefaultNonTemporalThreshold() };
 
 TaskSet_CopyMemory::ATask::ATask(std::shared_ptr<Semaphore> semDone, size_t taskIndex, size_t totalTaskCount)
     : Task(semDone, taskIndex, totalTaskCount)
 {
 }
 
-void TaskSet_CopyMemory::ATask::SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount)
+void TaskSet_CopyMemory::ATask::SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount, bool nonTemporal)
 {
     dst_ = dst;
     src_ = src;
     bytes_ = bytes;
     usedTaskCount_ = usedTaskCount;
+    nonTemporal_ = nonTemporal;
 }
 
 void TaskSet_CopyMemory::ATask::Execute()
@@ -53,7 +85,7 @@ void TaskSet_CopyMemory::ATask::Execute()
     void* dst = static_cast<char*>(dst_) + chunkOffset;
     const void* src = static_cast<const char*>(src_) + chunkOffset;
 
-    std::memcpy(dst, src, chunkBytes);
+    Copy(dst, src, chunkBytes, nonTemporal_);
 }
 
 TaskSet_CopyMemory::TaskSet_CopyMemory(std::shared_ptr<ThreadPool> pool)
@@ -62,24 +94,161 @@ TaskSet_CopyMemory::TaskSet_CopyMemory(std::shared_ptr<ThreadPool> pool)
     CreateTasks<ATask>();
 }
 
+TaskSet_CopyMemory::Tuning TaskSet_CopyMemory::GetDefaultTuning()
+{
+    return Tuning{ defaultBytesPerTask, DefaultNonTemporalThreshold() };
+}
+
+TaskSet_CopyMemory::Tuning TaskSet_CopyMemory::GetTuning()
+{
+    return Tuning{ bytesPerTask_.load(), nonTemporalThreshold_.load() };
+}
+
+void TaskSet_CopyMemory::SetTuning(const Tuning& tuning)
+{
+    assert(tuning.bytesPerTask > 0);
+    bytesPerTask_ = tuning.bytesPerTask;
+    nonTemporalThreshold_ = tuning.nonTemporalThreshold;
+}
+
+TaskSet_CopyMemory::Tuning TaskSet_CopyMemory::Calibrate(std::shared_ptr<ThreadPool> pool,
+    std::vector<Measurement>* measurements)
+{
+    const bool haveNonTemporal = std::strcmp(mm::NonTemporalCopyInstructionSet(), "None") != 0;
+    TaskSet_CopyMemory taskSet(pool);
+    const size_t maxTaskCount = taskSet.GetTaskCount();
+
+    // Sizes range from well inside the cache to well beyond it
+    std::vector<size_t> sizes{ 256 << 10, 1 << 20, 4 << 20, 16 << 20, 64 << 20 };
+    const size_t cacheSize = mm::GetLastLevelCacheSize();
+    if (2 * cacheSize > sizes.back())
+        sizes.push_back(std::min<size_t>(2 * cacheSize, 256 << 20));
+
+    std::vector<size_t> taskCounts;
+    for (size_t n = 1; n < maxTaskCount; n *= 2)
+        taskCounts.push_back(n);
+    taskCounts.push_back(maxTaskCount);
+
+    std::vector<char> src(sizes.back(), 1);
+    std::vector<char> dst(sizes.back(), 0);
+
+    // Best bandwidth per size, task count and method
+    std::map<size_t, std::map<size_t, double>> memcpyRates;
+    std::map<size_t, std::map<size_t, double>> nonTemporalRates;
+    for (size_t bytes : sizes)
+    {
+        // Repeat small copies so that each run moves at least 16 MB
+        const size_t repeats = std::max<size_t>(1, (16 << 20) / bytes);
+        for (size_t taskCount : taskCounts)
+        {
+            for (int nonTemporal = 0; nonTemporal <= (haveNonTemporal ? 1 : 0); ++nonTemporal)
+            {
+                double bestSeconds = std::numeric_limits<double>::max();
+                for (int run = 0; run < 3; ++run)
+                {
+                    const auto start = std::chrono::steady_clock::now();
+                    for (size_t i = 0; i < repeats; ++i)
+                    {
+                        taskSet.SetUp(dst.data(), src.data(), bytes, taskCount, nonTemporal != 0);
+                        taskSet.Execute();
+                        taskSet.Wait();
+                    }
+                    const std::chrono::duration<double> elapsed =
+                        std::chrono::steady_clock::now() - start;
+                    bestSeconds = std::min(bestSeconds, elapsed.count());
+                }
+                const double rate = double(bytes) * repeats / std::max(bestSeconds, 1e-9);
+                (nonTemporal ? nonTemporalRates : memcpyRates)[bytes][taskCount] = rate;
+                if (measurements)
+                    measurements->push_back(Measurement{ bytes, taskCount, nonTemporal != 0, rate });
+            }
+        }
+    }
+
+    auto bestRate = [](const std::map<size_t, double>& rates) {
+        double best = 0.0;
+        for (const auto& entry : rates)
+            best = std::max(best, entry.second);
+        return best;
+    };
+
+    // Bypass the cache from the smallest size at and above which doing so
+    // is clearly (by 5%) faster
+    Tuning tuning{ defaultBytesPerTask, std::numeric_limits<size_t>::max() };
+    if (haveNonTemporal)
+    {
+        for (auto it = sizes.rbegin(); it != sizes.rend(); ++it)
+        {
+            if (bestRate(nonTemporalRates[*it]) <= 1.05 * bestRate(memcpyRates[*it]))
+                break;
+            tuning.nonTemporalThreshold = *it;
+        }
+    }
+
+    // Choose the bytes per task whose resulting task counts come closest to
+    // the best measured bandwidth, summed over all sizes. Candidates are the
+    // values at which a measured task count starts being used. With a single
+    // thread there is nothing to learn and the default is kept.
+    std::vector<size_t> candidates;
+    if (maxTaskCount > 1)
+        candidates.push_back(std::numeric_limits<size_t>::max());
+    for (size_t bytes : sizes)
+    {
+        for (size_t taskCount : taskCounts)
+        {
+            if (taskCount > 1 && bytes / (taskCount - 1) > 0)
+                candidates.push_back(bytes / (taskCount - 1));
+        }
+    }
+    double bestScore = -1.0;
+    for (size_t bytesPerTask : candidates)
+    {
+        double score = 0.0;
+        for (size_t bytes : sizes)
+        {
+            const std::map<size_t, double>& rates = bytes >= tuning.nonTemporalThreshold ?
+                nonTemporalRates[bytes] : memcpyRates[bytes];
+            const size_t taskCount = std::min(1 + bytes / bytesPerTask, maxTaskCount);
+            // Largest measured task count not exceeding the one that would be used
+            auto it = rates.upper_bound(taskCount);
+            --it;
+            score += it->second / bestRate(rates);
+        }
+        // On a tie, prefer fewer tasks
+        if (score > bestScore + 1e-6 ||
+            (score > bestScore - 1e-6 && bytesPerTask > tuning.bytesPerTask))
+        {
+            bestScore = std::max(bestScore, score);
+            tuning.bytesPerTask = bytesPerTask;
+        }
+    }
+    return tuning;
+}
+
 void TaskSet_CopyMemory::SetUp(void* dst, const void* src, size_t bytes)
+{
+    // Call memcpy directly without threading for small frames; otherwise do
+    // parallel copy and add one thread for each bytesPerTask_
+    const size_t usedTaskCount = std::min<size_t>(1 + bytes / bytesPerTask_, tasks_.size());
+    SetUp(dst, src, bytes, usedTaskCount, bytes >= nonTemporalThreshold_);
+}
+
+void TaskSet_CopyMemory::SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount, bool nonTemporal)
 {
     assert(dst);
     assert(src);
     assert(bytes > 0);
+    assert(usedTaskCount > 0 && usedTaskCount <= tasks_.size());
 
-    // Call memcpy directly without threading for small frames up to 1MB
-    // Otherwise do parallel copy and add one thread for each 1MB
-    // The limits were found experimentally
-    usedTaskCount_ = std::min<size_t>(1 + bytes / 1000000, tasks_.size());
+    usedTaskCount_ = usedTaskCount;
     if (usedTaskCount_ == 1)
     {
-        std::memcpy(dst, src, bytes);
+        Copy(dst, src, bytes, nonTemporal);
         return;
     }
 
     for (Task* task : tasks_)
-        static_cast<ATask*>(task)->SetUp(dst, src, bytes, usedTaskCount_);
+        static_cast<ATask*>(task)->SetUp(dst, src, bytes, usedTaskCount_, nonTemporal);
 }
 
 void TaskSet_CopyMemory::Execute()
@@ -25,6 +25,9 @@
 
 #include "TaskSet.h"
 
+#include <atomic>
+#include <vector>
+
 class TaskSet_CopyMemory : public TaskSet
 {
 private:
@@ -33,7 +36,7 @@ private:
     public:
         explicit ATask(std::shared_ptr<Semaphore> semDone, size_t taskIndex, size_t totalTaskCount);
 
-        void SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount);
+        void SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount, bool nonTemporal);
 
         virtual void Execute() override;
 
@@ -41,16 +44,50 @@ private:
         void* dst_{ nullptr };
         const void* src_{ nullptr };
         size_t bytes_{ 0 };
+        bool nonTemporal_{ false };
+    };
+
+public:
+    // Parameters deciding how a copy is split and performed
+    struct Tuning
+    {
+        size_t bytesPerTask;         // One more task is used for each this many bytes
+        size_t nonTemporalThreshold; // Copies this large bypass the cache
+    };
+
+    // Copy bandwidth measured by Calibrate for one configuration
+    struct Measurement
+    {
+        size_t bytes;
+        size_t taskCount;
+        bool nonTemporal;
+        double bytesPerSecond;
     };
 
 public:
     explicit TaskSet_CopyMemory(std::shared_ptr<ThreadPool> pool);
 
+    // The tuning is shared by all instances
+    static Tuning GetDefaultTuning();
+    static Tuning GetTuning();
+    static void SetTuning(const Tuning& tuning);
+
+    // Measures copy bandwidth for several sizes, task counts and both copy
+    // methods on the given pool, and returns the best performing tuning
+    // without applying it. Takes in the order of a second.
+    static Tuning Calibrate(std::shared_ptr<ThreadPool> pool,
+        std::vector<Measurement>* measurements = nullptr);
+
     void SetUp(void* dst, const void* src, size_t bytes);
+    void SetUp(void* dst, const void* src, size_t bytes, size_t usedTaskCount, bool nonTemporal);
 
     virtual void Execute() override;
     virtual void Wait() override;
 
     // Helper blocking method calling SetUp, Execute and Wait
     void MemCopy(void* dst, const void* src, size_t bytes);
+
+private:
+    static std::atomic<size_t> bytesPerTask_;
+    static std::atomic<size_t> nonTemporalThreshold_;
 };
@@ -0,0 +1,330 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          TaskSet_PixelStatistics.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Parallel computation of per-image pixel statistics
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#include "TaskSet_PixelStatistics.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MMCORE_X86_64
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // One more task is used for each this many bytes
+    const size_t bytesPerTask = 1 << 20;
+
+    // Pixels are scanned in blocks of this many, so that the histogram pass
+    // finds the block in the cache, and the SSE2 16-bit lane counters cannot
+    // overflow
+    const size_t blockPixels = 32768;
+
+    template <typename T>
+    void ScanScalar(const T* p, size_t n, unsigned saturationLevel,
+        T& min, T& max, unsigned long long& sum, unsigned long long& saturated)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            const T v = p[i];
+            min = (std::min)(min, v);
+            max = (std::max)(max, v);
+            sum += v;
+            if (v >= saturationLevel)
+                ++saturated;
+        }
+    }
+
+    void Scan(const uint8_t* p, size_t n, unsigned saturationLevel, TaskSet_PixelStatistics::Partial& r)
+    {
+        uint8_t min = 0xff;
+        uint8_t max = 0;
+        unsigned long long sum = 0;
+        unsigned long long saturated = 0;
+        size_t i = 0;
+#ifdef MMCORE_X86_64
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        const __m128i sat = _mm_set1_epi8(static_cast<char>(saturationLevel));
+        __m128i vmin = _mm_set1_epi8(static_cast<char>(0xff));
+        __m128i vmax = zero;
+        __m128i vsum = zero; // Two 64-bit sums
+        __m128i vsat = zero;
+        for (; i + 16 <= n; i += 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            vmin = _mm_min_epu8(vmin, v);
+            vmax = _mm_max_epu8(vmax, v);
+            vsum = _mm_add_epi64(vsum, _mm_sad_epu8(v, zero));
+            const __m128i atLeastSat = _mm_cmpeq_epi8(_mm_max_epu8(v, sat), v);
+            vsat = _mm_add_epi64(vsat, _mm_sad_epu8(_mm_and_si128(atLeastSat, one), zero));
+        }
+        alignas(16) uint8_t mins[16];
+        alignas(16) uint8_t maxs[16];
+        alignas(16) unsigned long long sums[2];
+        alignas(16) unsigned long long sats[2];
+        _mm_store_si128(reinterpret_cast<__m128i*>(mins), vmin);
+        _mm_store_si128(reinterpret_cast<__m128i*>(maxs), vmax);
+        _mm_store_si128(reinterpret_cast<__m128i*>(sums), vsum);
+        _mm_store_si128(reinterpret_cast<__m128i*>(sats), vsat);
+        min = *std::min_element(mins, mins + 16);
+        max = *std::max_element(maxs, maxs + 16);
+        sum = sums[0] + sums[1];
+        saturated = sats[0] + sats[1];
+#endif
+        ScanScalar(p + i, n - i, saturationLevel, min, max, sum, saturated);
+        r.min = (std::min)(r.min, static_cast<double>(min));
+        r.max = (std::max)(r.max, static_cast<double>(max));
+        r.integerSum += sum;
+        r.saturatedCount += saturated;
+    }
+
+    void Scan(const uint16_t* p, size_t n, unsigned saturationLevel, TaskSet_PixelStatistics::Partial& r)
+    {
+        uint16_t min = 0xffff;
+        uint16_t max = 0;
+        unsigned long long sum = 0;
+        unsigned long long saturated = 0;
+        size_t i = 0;
+#ifdef MMCORE_X86_64
+        // SSE2 only compares signed 16-bit values, so values are compared
+        // with their sign bit flipped
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+        const __m128i sat = _mm_set1_epi16(static_cast<short>((saturationLevel - 1) ^ 0x8000));
+        __m128i vmin = _mm_set1_epi16(0x7fff);
+        __m128i vmax = _mm_set1_epi16(static_cast<short>(0x8000));
+        __m128i vsum = zero; // Two 64-bit sums
+        __m128i vsat = zero; // Eight 16-bit counts (n <= blockPixels)
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            const __m128i b = _mm_xor_si128(v, bias);
+            vmin = _mm_min_epi16(vmin, b);
+            vmax = _mm_max_epi16(vmax, b);
+            const __m128i pairs = _mm_add_epi32(_mm_unpacklo_epi16(v, zero),
+                _mm_unpackhi_epi16(v, zero));
+            vsum = _mm_add_epi64(vsum, _mm_add_epi64(_mm_unpacklo_epi32(pairs, zero),
+                _mm_unpackhi_epi32(pairs, zero)));
+            // Subtracting -1 (all bits set) counts one
+            vsat = _mm_sub_epi16(vsat, _mm_cmpgt_epi16(b, sat));
+        }
+        alignas(16) uint16_t mins[8];
+        alignas(16) uint16_t maxs[8];
+        alignas(16) unsigned long long sums[2];
+        alignas(16) uint16_t sats[8];
+        _mm_store_si128(reinterpret_cast<__m128i*>(mins), _mm_xor_si128(vmin, bias));
+        _mm_store_si128(reinterpret_cast<__m128i*>(maxs), _mm_xor_si128(vmax, bias));
+        _mm_store_si128(reinterpret_cast<__m128i*>(sums), vsum);
+        _mm_store_si128(reinterpret_cast<__m128i*>(sats), vsat);
+        min = *std::min_element(mins, mins + 8);
+        max = *std::max_element(maxs, maxs + 8);
+        sum = sums[0] + sums[1];
+        for (uint16_t count : sats)
+            saturated += count;
+#endif
+        ScanScalar(p + i, n - i, saturationLevel, min, max, sum, saturated);
+        r.min = (std::min)(r.min, static_cast<double>(min));
+        r.max = (std::max)(r.max, static_cast<double>(max));
+        r.integerSum += sum;
+        r.saturatedCount += saturated;
+    }
+
+    void Scan(const float* p, size_t n, TaskSet_PixelStatistics::Partial& r)
+    {
+        float min = std::numeric_limits<float>::infinity();
+        float max = -std::numeric_limits<float>::infinity();
+        double sum = 0.0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            min = (std::min)(min, p[i]);
+            max = (std::max)(max, p[i]);
+            sum += p[i];
+        }
+        r.min = (std::min)(r.min, static_cast<double>(min));
+        r.max = (std::max)(r.max, static_cast<double>(max));
+        r.floatSum += sum;
+    }
+
+    template <typename T>
+    void AddToHistogram(const T* p, size_t n, unsigned shift, unsigned* histogram, unsigned bins)
+    {
+        const unsigned last = bins - 1;
+        for (size_t i = 0; i < n; ++i)
+            ++histogram[(std::min)(static_cast<unsigned>(p[i] >> shift), last)];
+    }
+
+    template <typename T>
+    void ScanBlocks(const T* p, size_t n, unsigned saturationLevel,
+        unsigned histogramShift, TaskSet_PixelStatistics::Partial& r)
+    {
+        unsigned* histogram = r.histogram.empty() ? nullptr : r.histogram.data();
+        const unsigned bins = static_cast<unsigned>(r.histogram.size());
+        for (size_t i = 0; i < n; i += blockPixels)
+        {
+            const size_t count = (std::min)(blockPixels, n - i);
+            Scan(p + i, count, saturationLevel, r);
+            if (histogram)
+                AddToHistogram(p + i, count, histogramShift, histogram, bins);
+        }
+    }
+}
+
+TaskSet_PixelStatistics::ATask::ATask(std::shared_ptr<Semaphore> semDone, size_t taskIndex, size_t totalTaskCount)
+    : Task(semDone, taskIndex, totalTaskCount)
+{
+}
+
+void TaskSet_PixelStatistics::ATask::SetUp(const Settings* settings, Partial* result, size_t usedTaskCount)
+{
+    settings_ = settings;
+    result_ = result;
+    usedTaskCount_ = usedTaskCount;
+}
+
+void TaskSet_PixelStatistics::ATask::Execute()
+{
+    if (taskIndex_ >= usedTaskCount_)
+        return;
+
+    const Settings& s = *settings_;
+    size_t chunkPixels = s.pixelCount / usedTaskCount_;
+    const size_t chunkOffset = taskIndex_ * chunkPixels;
+    if (taskIndex_ == usedTaskCount_ - 1)
+        chunkPixels += s.pixelCount % usedTaskCount_;
+
+    Partial& r = *result_;
+    r.min = std::numeric_limits<double>::infinity();
+    r.max = -std::numeric_limits<double>::infinity();
+    r.integerSum = 0;
+    r.floatSum = 0.0;
+    r.saturatedCount = 0;
+    r.histogram.assign(s.histogramBins, 0);
+
+    switch (s.bytesPerPixel)
+    {
+    case 1:
+        ScanBlocks(static_cast<const uint8_t*>(s.pixels) + chunkOffset, chunkPixels,
+            s.saturationLevel, s.histogramShift, r);
+        break;
+    case 2:
+        ScanBlocks(static_cast<const uint16_t*>(s.pixels) + chunkOffset, chunkPixels,
+            s.saturationLevel, s.histogramShift, r);
+        break;
+    case 4:
+        Scan(static_cast<const float*>(s.pixels) + chunkOffset, chunkPixels, r);
+        break;
+    }
+}
+
+TaskSet_PixelStatistics::TaskSet_PixelStatistics(std::shared_ptr<ThreadPool> pool)
+    : TaskSet(pool)
+{
+    CreateTasks<ATask>();
+    partials_.resize(tasks_.size());
+}
+
+bool TaskSet_PixelStatistics::IsSupported(unsigned bytesPerPixel, unsigned nComponents)
+{
+    return nComponents == 1 &&
+        (bytesPerPixel == 1 || bytesPerPixel == 2 || bytesPerPixel == 4);
+}
+
+void TaskSet_PixelStatistics::SetUp(const void* pixels, size_t pixelCount,
+    unsigned bytesPerPixel, unsigned bitDepth, unsigned histogramBins)
+{
+    settings_.pixels = pixels;
+    settings_.pixelCount = pixelCount;
+    settings_.bytesPerPixel = bytesPerPixel;
+
+    if (bytesPerPixel == 4)
+    {
+        // Floating point values have no fixed range
+        settings_.saturationLevel = 0;
+        settings_.histogramBins = 0;
+        settings_.histogramShift = 0;
+    }
+    else
+    {
+        const unsigned valueBits = (bitDepth == 0 || bitDepth > 8 * bytesPerPixel) ?
+            8 * bytesPerPixel : bitDepth;
+        settings_.saturationLevel = (1u << valueBits) - 1;
+        settings_.histogramBins = histogramBins;
+        unsigned binBits = 0;
+        while ((1u << binBits) < histogramBins)
+            ++binBits;
+        settings_.histogramShift = valueBits > binBits ? valueBits - binBits : 0;
+    }
+
+    const size_t bytes = pixelCount * bytesPerPixel;
+    usedTaskCount_ = std::max<size_t>(1,
+        std::min<size_t>(tasks_.size(), (bytes + bytesPerTask - 1) / bytesPerTask));
+    for (size_t n = 0; n < usedTaskCount_; ++n)
+        static_cast<ATask*>(tasks_[n])->SetUp(&settings_, &partials_[n], usedTaskCount_);
+}
+
+void TaskSet_PixelStatistics::Execute()
+{
+    TaskSet::Execute();
+}
+
+void TaskSet_PixelStatistics::Wait()
+{
+    TaskSet::Wait();
+}
+
+void TaskSet_PixelStatistics::GetResult(mm::PixelStatistics& stats) const
+{
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    unsigned long long integerSum = 0;
+    double floatSum = 0.0;
+    unsigned long long saturatedCount = 0;
+    stats.histogram.assign(settings_.histogramBins, 0);
+    for (size_t n = 0; n < usedTaskCount_; ++n)
+    {
+        const Partial& r = partials_[n];
+        min = (std::min)(min, r.min);
+        max = (std::max)(max, r.max);
+        integerSum += r.integerSum;
+        floatSum += r.floatSum;
+        saturatedCount += r.saturatedCount;
+        for (size_t i = 0; i < stats.histogram.size(); ++i)
+            stats.histogram[i] += r.histogram[i];
+    }
+
+    const size_t count = settings_.pixelCount;
+    stats.min = count > 0 ? min : 0.0;
+    stats.max = count > 0 ? max : 0.0;
+    const double sum = settings_.bytesPerPixel == 4 ?
+        floatSum : static_cast<double>(integerSum);
+    stats.mean = count > 0 ? sum / count : 0.0;
+    stats.saturatedCount = saturatedCount;
+}
+
+void TaskSet_PixelStatistics::Compute(const void* pixels, size_t pixelCount,
+    unsigned bytesPerPixel, unsigned bitDepth, unsigned histogramBins,
+    mm::PixelStatistics& stats)
+{
+    SetUp(pixels, pixelCount, bytesPerPixel, bitDepth, histogramBins);
+    Execute();
+    Wait();
+    GetResult(stats);
+}
@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          TaskSet_PixelStatistics.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     MMCore
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Parallel computation of per-image pixel statistics
+//
+// LICENSE:       This file is distributed under the "Lesser GPL" (LGPL) license.
+//                License text is included with the source distribution.
+//
+//                This file is distributed in the hope that it will be useful,
+//                but WITHOUT ANY WARRANTY; without even the implied warranty
+//                of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//                IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+//                CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//                INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES.
+
+#pragma once
+
+#include "FrameMetadata.h"
+#include "TaskSet.h"
+
+#include <vector>
+
+class TaskSet_PixelStatistics : public TaskSet
+{
+public:
+    // Statistics over one task's share of the pixels
+    struct Partial
+    {
+        double min;
+        double max;
+        unsigned long long integerSum;
+        double floatSum;
+        unsigned long long saturatedCount;
+        std::vector<unsigned> histogram;
+    };
+
+private:
+    struct Settings
+    {
+        const void* pixels;
+        size_t pixelCount;
+        unsigned bytesPerPixel;
+        unsigned saturationLevel;
+        unsigned histogramBins;
+        unsigned histogramShift;
+    };
+
+    class ATask : public Task
+    {
+    public:
+        explicit ATask(std::shared_ptr<Semaphore> semDone, size_t taskIndex, size_t totalTaskCount);
+
+        void SetUp(const Settings* settings, Partial* result, size_t usedTaskCount);
+
+        virtual void Execute() override;
+
+    private:
+        const Settings* settings_{ nullptr };
+        Partial* result_{ nullptr };
+    };
+
+public:
+    explicit TaskSet_PixelStatistics(std::shared_ptr<ThreadPool> pool);
+
+    // Supported: 8- and 16-bit and 32-bit float grayscale images
+    static bool IsSupported(unsigned bytesPerPixel, unsigned nComponents);
+
+    // bitDepth is the camera's; histogramBins is 0 (no histogram), 256 or
+    // 4096
+    void SetUp(const void* pixels, size_t pixelCount, unsigned bytesPerPixel,
+        unsigned bitDepth, unsigned histogramBins);
+
+    virtual void Execute() override;
+    virtual void Wait() override;
+
+    // Combine the results of the tasks, after Wait()
+    void GetResult(mm::PixelStatistics& stats) const;
+
+    // Helper blocking method calling SetUp, Execute, Wait and GetResult
+    void Compute(const void* pixels, size_t pixelCount, unsigned bytesPerPixel,
+        unsigned bitDepth, unsigned histogramBins, mm::PixelStatistics& stats);
+
+private:
+    Settings settings_{};
+    std::vector<Partial> partials_;
+};
@@ -31,76 +31,268 @@
 #include <mutex>
 #include <thread>
 
-ThreadPool::ThreadPool()
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+
+// The pool whose worker is running on this thread, if any
+thread_local const ThreadPool* currentPool = nullptr;
+
+// Bind the calling thread to the workerIndex-th CPU that the thread may run
+// on (wrapping around if there are more workers than CPUs)
+void PinCurrentThread(size_t workerIndex)
 {
-    const size_t hwThreadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
-    for (size_t n = 0; n < hwThreadCount; ++n)
+#ifdef _WIN32
+    DWORD_PTR processMask = 0;
+    DWORD_PTR systemMask = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+        return;
+    std::vector<unsigned> cpus;
+    for (unsigned bit = 0; bit < 8 * sizeof(DWORD_PTR); ++bit)
     {
-        auto thread = std::make_unique<std::thread>(&ThreadPool::ThreadFunc, this);
-        threads_.push_back(std::move(thread));
+        if (processMask & (DWORD_PTR(1) << bit))
+            cpus.push_back(bit);
+    }
+    if (cpus.empty())
+        return;
+    SetThreadAffinityMask(GetCurrentThread(),
+        DWORD_PTR(1) << cpus[workerIndex % cpus.size()]);
+#elif defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &allowed))
+            cpus.push_back(cpu);
     }
+    if (cpus.empty())
+        return;
+    cpu_set_t target;
+    CPU_ZERO(&target);
+    CPU_SET(cpus[workerIndex % cpus.size()], &target);
+    pthread_setaffinity_np(pthread_self(), sizeof(target), &target);
+#else
+    // Not supported (macOS only offers affinity hints)
+    (void)workerIndex;
+#endif
 }
 
-ThreadPool::~ThreadPool()
+} // anonymous namespace
+
+ThreadPool::ThreadPool(size_t threadCount, bool pinThreads)
 {
-    {
-        std::lock_guard<std::mutex> lock(mx_);
-        abortFlag_ = true;
-    }
-    cv_.notify_all();
+    Start(threadCount, pinThreads);
+}
 
-    for (const auto& thread : threads_)
-        thread->join();
+ThreadPool::~ThreadPool()
+{
+    // Jobs still queued are discarded
+    Stop();
 }
 
 size_t ThreadPool::GetSize() const
 {
+    std::shared_lock<std::shared_timed_mutex> lock(workersMx_);
     return threads_.size();
 }
 
-void ThreadPool::Execute(Task* task)
+bool ThreadPool::GetPinThreads() const
 {
-    assert(task);
+    std::shared_lock<std::shared_timed_mutex> lock(workersMx_);
+    return pinThreads_;
+}
+
+void ThreadPool::Reconfigure(size_t threadCount, bool pinThreads)
+{
+    assert(!IsWorkerThread());
+
+    std::unique_lock<std::shared_timed_mutex> lock(workersMx_);
+    Stop();
+
+    std::vector<Job> queued;
+    for (const auto& queue : queues_)
     {
-        std::lock_guard<std::mutex> lock(mx_);
-        if (abortFlag_)
-            return;
-        queue_.push_back(task);
+        for (Job& job : queue->jobs)
+            queued.push_back(std::move(job));
     }
-    cv_.notify_one();
+
+    Start(threadCount, pinThreads);
+
+    for (size_t n = 0; n < queued.size(); ++n)
+    {
+        WorkerQueue& queue = *queues_[n % queues_.size()];
+        std::lock_guard<std::mutex> queueLock(queue.mx);
+        queue.jobs.push_back(std::move(queued[n]));
+    }
+    {
+        std::lock_guard<std::mutex> wakeLock(mx_);
+    }
+    cv_.notify_all();
+}
+
+void ThreadPool::Execute(Task* task)
+{
+    assert(task);
+    Enqueue([task] {
+        task->Execute();
+        task->Done();
+    });
 }
 
 void ThreadPool::Execute(const std::vector<Task*>& tasks)
 {
     assert(!tasks.empty());
 
+    if (IsWorkerThread())
     {
-        std::lock_guard<std::mutex> lock(mx_);
-        if (abortFlag_)
-            return;
+        for (Task* task : tasks)
+        {
+            task->Execute();
+            task->Done();
+        }
+        return;
+    }
+
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(workersMx_);
         for (Task* task : tasks)
         {
             assert(task);
-            queue_.push_back(task);
+            pendingCount_.fetch_add(1);
+            WorkerQueue& queue = *queues_[nextQueue_.fetch_add(1) % queues_.size()];
+            std::lock_guard<std::mutex> queueLock(queue.mx);
+            queue.jobs.push_back([task] {
+                task->Execute();
+                task->Done();
+            });
         }
     }
+    {
+        std::lock_guard<std::mutex> wakeLock(mx_);
+    }
+    cv_.notify_all();
+}
+
+bool ThreadPool::IsWorkerThread() const
+{
+    return currentPool == this;
+}
+
+void ThreadPool::Start(size_t threadCount, bool pinThreads)
+{
+    if (threadCount == 0)
+        threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    pinThreads_ = pinThreads;
+
+    queues_.clear();
+    for (size_t n = 0; n < threadCount; ++n)
+        queues_.push_back(std::make_unique<WorkerQueue>());
+    for (size_t n = 0; n < threadCount; ++n)
+    {
+        auto thread = std::make_unique<std::thread>(&ThreadPool::ThreadFunc, this, n);
+        threads_.push_back(std::move(thread));
+    }
+}
+
+void ThreadPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mx_);
+        stopFlag_ = true;
+    }
     cv_.notify_all();
+
+    for (const auto& thread : threads_)
+        thread->join();
+    threads_.clear();
+
+    std::lock_guard<std::mutex> lock(mx_);
+    stopFlag_ = false;
+}
+
+void ThreadPool::Enqueue(Job job)
+{
+    if (IsWorkerThread())
+    {
+        job();
+        return;
+    }
+
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(workersMx_);
+        // Counted before it is visible, so that a worker finding the queues
+        // empty never goes to sleep while the job is being queued
+        pendingCount_.fetch_add(1);
+        WorkerQueue& queue = *queues_[nextQueue_.fetch_add(1) % queues_.size()];
+        std::lock_guard<std::mutex> queueLock(queue.mx);
+        queue.jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> wakeLock(mx_);
+    }
+    cv_.notify_one();
+}
+
+bool ThreadPool::TryPop(size_t workerIndex, Job& job)
+{
+    // Own queue first, oldest job first; then steal the newest job of
+    // another worker, which is the one its owner would reach last
+    const size_t queueCount = queues_.size();
+    for (size_t n = 0; n < queueCount; ++n)
+    {
+        WorkerQueue& queue = *queues_[(workerIndex + n) % queueCount];
+        std::lock_guard<std::mutex> lock(queue.mx);
+        if (queue.jobs.empty())
+            continue;
+        if (n == 0)
+        {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+        }
+        else
+        {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        }
+        pendingCount_.fetch_sub(1);
+        return true;
+    }
+    return false;
 }
 
-void ThreadPool::ThreadFunc()
+void ThreadPool::ThreadFunc(size_t workerIndex)
 {
+    currentPool = this;
+    if (pinThreads_)
+        PinCurrentThread(workerIndex);
+
     for (;;)
     {
-        Task* task = nullptr;
         {
             std::unique_lock<std::mutex> lock(mx_);
-            cv_.wait(lock, [&]() { return abortFlag_ || !queue_.empty(); });
-            if (abortFlag_)
+            cv_.wait(lock, [&]() { return stopFlag_ || pendingCount_.load() > 0; });
+            if (stopFlag_)
                 break;
-            task = queue_.front();
-            queue_.pop_front();
         }
-        task->Execute();
-        task->Done();
+
+        Job job;
+        while (TryPop(workerIndex, job))
+        {
+            job();
+            job = nullptr;
+            if (stopFlag_)
+                return;
+        }
     }
 }
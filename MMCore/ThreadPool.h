@@ -24,33 +24,87 @@
 
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <deque>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
+#include <utility>
 #include <vector>
 
 class Task;
 
+// Worker threads shared by the Core's parallel work (image copies, buffer
+// pre-faulting, device initialization).
+//
+// Each worker has its own queue. Work submitted from outside the pool is
+// spread over the queues, and a worker whose queue is empty steals from the
+// others, so that one long job does not hold up the jobs queued behind it.
+// Work submitted from one of the pool's own threads is run immediately on
+// that thread, so that a job waiting for the jobs it submits can never
+// deadlock the pool.
 class ThreadPool final
 {
 public:
-    explicit ThreadPool();
+    // threadCount 0 means one thread per hardware thread. If pinThreads is
+    // set, each worker is bound to one CPU (where supported).
+    explicit ThreadPool(size_t threadCount = 0, bool pinThreads = false);
     ~ThreadPool();
 
     size_t GetSize() const;
+    bool GetPinThreads() const;
+
+    // Replace the worker threads; queued work is kept. Waits for running
+    // jobs to finish. Must not be called from a worker thread.
+    void Reconfigure(size_t threadCount, bool pinThreads);
 
     void Execute(Task* task);
     void Execute(const std::vector<Task*>& tasks);
 
+    // Run func on the pool; the returned future receives its result or
+    // exception.
+    template <typename F>
+    std::future<decltype(std::declval<F&>()())> Submit(F func)
+    {
+        using Result = decltype(std::declval<F&>()());
+        auto job = std::make_shared<std::packaged_task<Result()>>(std::move(func));
+        std::future<Result> result = job->get_future();
+        Enqueue([job] { (*job)(); });
+        return result;
+    }
+
+    bool IsWorkerThread() const;
+
 private:
-    void ThreadFunc();
+    using Job = std::function<void()>;
+
+    struct WorkerQueue
+    {
+        std::mutex mx{};
+        std::deque<Job> jobs{};
+    };
+
+    void Start(size_t threadCount, bool pinThreads);
+    void Stop();
+    void Enqueue(Job job);
+    bool TryPop(size_t workerIndex, Job& job);
+    void ThreadFunc(size_t workerIndex);
 
 private:
     std::vector<std::unique_ptr<std::thread>> threads_{};
-    bool abortFlag_{ false };
+    std::vector<std::unique_ptr<WorkerQueue>> queues_{};
+    bool pinThreads_{ false };
+
+    // Held shared while queuing and exclusively while replacing the workers
+    mutable std::shared_timed_mutex workersMx_{};
+
+    std::atomic<size_t> nextQueue_{ 0 };
+    std::atomic<long> pendingCount_{ 0 };
+    std::atomic<bool> stopFlag_{ false }; // Set with mx_ held
     std::mutex mx_{};
     std::condition_variable cv_{};
-    std::deque<Task*> queue_{};
 };
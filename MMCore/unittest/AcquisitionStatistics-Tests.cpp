@@ -0,0 +1,125 @@
+#include <catch2/catch_all.hpp>
+
+#include "AcquisitionStatistics.h"
+#include "CircularBuffer.h"
+#include "MMCore.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+TEST_CASE("Acquisition statistics count frames and latencies", "[AcquisitionStatistics]")
+{
+   using mm::AcquisitionStatistics;
+   using std::chrono::microseconds;
+   AcquisitionStatistics stats;
+
+   std::map<std::string, double> snapshot;
+   stats.GetSnapshot(snapshot);
+   CHECK(snapshot["FramesInserted"] == 0.0);
+   CHECK(snapshot["AverageFrameRate"] == 0.0);
+   CHECK(snapshot["CopyLatencyCount"] == 0.0);
+
+   stats.RecordStage(AcquisitionStatistics::StageCopy, microseconds(0));
+   stats.RecordStage(AcquisitionStatistics::StageCopy, microseconds(1));
+   stats.RecordStage(AcquisitionStatistics::StageCopy, microseconds(3));
+   stats.RecordStage(AcquisitionStatistics::StageCopy, microseconds(4));
+   stats.RecordStage(AcquisitionStatistics::StageCopy, std::chrono::seconds(10));
+   stats.RecordStage(AcquisitionStatistics::StageMetadata, microseconds(100));
+   for (int i = 0; i < 3; ++i)
+      stats.RecordInserted();
+   stats.RecordRejected();
+
+   stats.GetSnapshot(snapshot);
+   CHECK(snapshot["FramesInserted"] == 3.0);
+   CHECK(snapshot["FramesRejected"] == 1.0);
+   CHECK(snapshot["AverageFrameRate"] > 0.0);
+   CHECK(snapshot["CurrentFrameRate"] > 0.0);
+
+   CHECK(snapshot["CopyLatencyCount"] == 5.0);
+   CHECK(snapshot["CopyLatencyBelow1us"] == 1.0);
+   CHECK(snapshot["CopyLatencyBelow2us"] == 1.0);
+   CHECK(snapshot["CopyLatencyBelow4us"] == 1.0);
+   CHECK(snapshot["CopyLatencyBelow8us"] == 1.0);
+   CHECK(snapshot["CopyLatencyAtLeast524288us"] == 1.0);
+   CHECK(snapshot["CopyLatencyMaxUs"] == 10e6);
+   CHECK(snapshot["MetadataLatencyCount"] == 1.0);
+   CHECK(snapshot["MetadataLatencyMeanUs"] == 100.0);
+   CHECK(snapshot["ProcessingLatencyCount"] == 0.0);
+
+   stats.Reset();
+   stats.GetSnapshot(snapshot);
+   CHECK(snapshot["FramesInserted"] == 0.0);
+   CHECK(snapshot["CopyLatencyBelow1us"] == 0.0);
+   CHECK(snapshot["CopyLatencyMaxUs"] == 0.0);
+}
+
+TEST_CASE("Acquisition statistics detect hardware frame gaps", "[AcquisitionStatistics]")
+{
+   mm::AcquisitionStatistics stats;
+   CHECK(stats.RecordHardwareFrameNumber(10) == -1);
+   CHECK(stats.RecordHardwareFrameNumber(11) == 10);
+   CHECK(stats.RecordHardwareFrameNumber(14) == 11);
+   CHECK(stats.RecordHardwareFrameNumber(20) == 14);
+   CHECK(stats.RecordHardwareFrameNumber(20) == 20);
+   CHECK(stats.RecordHardwareFrameNumber(0) == 20);
+   CHECK(stats.RecordHardwareFrameNumber(1) == 0);
+
+   double previous;
+   CHECK(stats.RecordHardwareTimestamp(100.0, previous));
+   CHECK(stats.RecordHardwareTimestamp(200.0, previous));
+   CHECK(previous == 100.0);
+   CHECK_FALSE(stats.RecordHardwareTimestamp(200.0, previous));
+   CHECK_FALSE(stats.RecordHardwareTimestamp(50.0, previous));
+   CHECK(previous == 200.0);
+   CHECK(stats.RecordHardwareTimestamp(60.0, previous));
+
+   std::map<std::string, double> snapshot;
+   stats.GetSnapshot(snapshot);
+   CHECK(snapshot["HardwareFrameGaps"] == 2.0);
+   CHECK(snapshot["HardwareFramesMissed"] == 7.0);
+   CHECK(snapshot["HardwareFrameNumberRegressions"] == 2.0);
+   CHECK(snapshot["HardwareTimestampRegressions"] == 2.0);
+
+   stats.Reset();
+   CHECK(stats.RecordHardwareFrameNumber(5) == -1);
+   CHECK(stats.RecordHardwareTimestamp(0.0, previous));
+   stats.GetSnapshot(snapshot);
+   CHECK(snapshot["HardwareFrameGaps"] == 0.0);
+   CHECK(snapshot["HardwareFramesMissed"] == 0.0);
+   CHECK(snapshot["HardwareFrameNumberRegressions"] == 0.0);
+   CHECK(snapshot["HardwareTimestampRegressions"] == 0.0);
+}
+
+TEST_CASE("Circular buffer counts popped frames and the high-water mark", "[AcquisitionStatistics]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 16, 16, 1));
+   std::vector<unsigned char> pixels(16 * 16);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   for (int i = 0; i < 5; ++i)
+      REQUIRE(cb.InsertImage(pixels.data(), 16, 16, 1, &md));
+   CHECK(cb.GetHighWaterMark() == 5);
+
+   std::vector<const mm::ImgBuffer*> images;
+   CHECK(cb.GetNextImageBuffers(3, 0, images) == 3);
+   CHECK(cb.GetNextImageBuffer(0) != nullptr);
+   CHECK(cb.LeaseNextImage(0) != nullptr);
+   CHECK(cb.GetPoppedCount() == 5);
+   REQUIRE(cb.InsertImage(pixels.data(), 16, 16, 1, &md));
+   CHECK(cb.GetHighWaterMark() == 5);
+
+   cb.Clear();
+   CHECK(cb.GetPoppedCount() == 0);
+   CHECK(cb.GetHighWaterMark() == 0);
+}
+
+TEST_CASE("CMMCore acquisition statistics require a camera", "[AcquisitionStatistics]")
+{
+   CMMCore c;
+   CHECK_THROWS_AS(c.getAcquisitionStatistics(), CMMError);
+   CHECK_THROWS_AS(c.getAcquisitionStatistics("NoSuchCamera"), CMMError);
+   CHECK_THROWS_AS(c.resetAcquisitionStatistics("NoSuchCamera"), CMMError);
+}
@@ -0,0 +1,79 @@
+#include <catch2/catch_all.hpp>
+
+#include "BufferMemory.h"
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <memory>
+
+namespace {
+
+const std::size_t testSize = 40 * (1 << 20) + 123;
+
+void CheckWritable(const mm::BufferMemory& mem)
+{
+   unsigned char* data = mem.Data();
+   REQUIRE(data != nullptr);
+   CHECK(data[0] == 0);
+   CHECK(data[mem.Size() - 1] == 0);
+   data[0] = 1;
+   data[mem.Size() - 1] = 2;
+   CHECK(data[0] == 1);
+   CHECK(data[mem.Size() - 1] == 2);
+}
+
+}
+
+TEST_CASE("BufferMemory with default options", "[BufferMemory]")
+{
+   auto pool = std::make_shared<ThreadPool>();
+   mm::BufferMemory mem(testSize, mm::BufferAllocationOptions(), pool);
+   CHECK(mem.Size() == testSize);
+   CHECK(mem.GetHugePageKind() == mm::BufferMemory::HugePagesNone);
+   CHECK_FALSE(mem.IsLocked());
+   CHECK_FALSE(mem.IsPrefaulted());
+   CheckWritable(mem);
+}
+
+TEST_CASE("BufferMemory prefault reports progress", "[BufferMemory]")
+{
+   auto pool = std::make_shared<ThreadPool>();
+   mm::BufferAllocationOptions options;
+   options.prefault = true;
+   options.hugePages = true; // Best effort; must not fail
+   std::size_t lastDone = 0;
+   std::size_t lastTotal = 0;
+   int calls = 0;
+   mm::BufferMemory mem(testSize, options, pool,
+         [&](std::size_t done, std::size_t total) {
+            CHECK(done > lastDone);
+            lastDone = done;
+            lastTotal = total;
+            ++calls;
+         });
+   CHECK(mem.IsPrefaulted());
+   CHECK(calls >= 1);
+   CHECK(lastDone == lastTotal);
+   CHECK(lastTotal >= testSize);
+   CheckWritable(mem);
+}
+
+TEST_CASE("File-backed BufferMemory", "[BufferMemory]")
+{
+   auto pool = std::make_shared<ThreadPool>();
+   mm::BufferAllocationOptions options;
+   options.backingFile = "BufferMemory-Tests.tmp";
+   {
+      mm::BufferMemory mem(testSize, options, pool);
+      CHECK(mem.IsFileBacked());
+      CheckWritable(mem);
+   }
+   // The file has been removed, so can be created again
+   {
+      mm::BufferMemory mem(testSize, options, pool);
+      CheckWritable(mem);
+   }
+
+   options.lockInRAM = true;
+   CHECK_THROWS_AS(mm::BufferMemory(testSize, options, pool), CMMError);
+}
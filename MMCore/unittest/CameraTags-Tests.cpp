@@ -0,0 +1,116 @@
+#include <catch2/catch_all.hpp>
+
+#include "Devices/CameraInstance.h"
+#include "LogManager.h"
+
+#include "../MMDevice/DeviceBase.h"
+
+#include <memory>
+#include <string>
+
+namespace {
+
+class TagTestCamera : public CCameraBase<TagTestCamera>
+{
+public:
+   explicit TagTestCamera(bool versioned) : getTagsCalls(0)
+   {
+      if (versioned)
+         EnableTagsVersion();
+   }
+
+   int Initialize() { return DEVICE_OK; }
+   int Shutdown() { return DEVICE_OK; }
+   void GetName(char* name) const
+   { CDeviceUtils::CopyLimitedString(name, "TagTestCamera"); }
+
+   int SnapImage() { return DEVICE_OK; }
+   const unsigned char* GetImageBuffer() { return &pixel_; }
+   unsigned GetImageWidth() const { return 1; }
+   unsigned GetImageHeight() const { return 1; }
+   unsigned GetImageBytesPerPixel() const { return 1; }
+   unsigned GetBitDepth() const { return 8; }
+   long GetImageBufferSize() const { return 1; }
+   double GetExposure() const { return 1.0; }
+   void SetExposure(double) {}
+   int SetROI(unsigned, unsigned, unsigned, unsigned) { return DEVICE_OK; }
+   int GetROI(unsigned& x, unsigned& y, unsigned& xSize, unsigned& ySize)
+   { x = y = 0; xSize = ySize = 1; return DEVICE_OK; }
+   int ClearROI() { return DEVICE_OK; }
+   int GetBinning() const { return 1; }
+   int SetBinning(int) { return DEVICE_OK; }
+   int IsExposureSequenceable(bool& seq) const { seq = false; return DEVICE_OK; }
+
+   // Counts the fetches (for testing only; a camera that overrides GetTags()
+   // would normally not enable the tags version)
+   void GetTags(char* serializedMetadata)
+   {
+      ++getTagsCalls;
+      CCameraBase<TagTestCamera>::GetTags(serializedMetadata);
+   }
+
+   int getTagsCalls;
+
+private:
+   unsigned char pixel_ = 0;
+};
+
+struct TagTestFixture
+{
+   mm::LogManager logManager;
+   TagTestCamera* camera;
+   std::unique_ptr<CameraInstance> instance;
+
+   explicit TagTestFixture(bool versioned) :
+      camera(new TagTestCamera(versioned))
+   {
+      instance.reset(new CameraInstance(nullptr,
+            std::shared_ptr<LoadedDeviceAdapter>(), "TagTestCamera", camera,
+            [](MM::Device* device) { delete device; }, "Camera",
+            logManager.NewLogger("Camera"), logManager.NewLogger("Core")));
+      instance->Initialize();
+   }
+
+   std::string MergedValue(const char* key)
+   {
+      Metadata md;
+      instance->MergeCachedTags(md);
+      return md.GetSingleTag(key).GetValue();
+   }
+};
+
+}
+
+TEST_CASE("Versioned camera tags are cached", "[CameraTags]")
+{
+   TagTestFixture f(true);
+   CHECK(f.instance->GetTagsVersion() >= 0);
+
+   f.instance->AddTag("Key", "Camera", "1");
+   CHECK(f.MergedValue("Camera-Key") == "1");
+   CHECK(f.MergedValue("Camera-Key") == "1");
+   CHECK(f.camera->getTagsCalls == 1);
+
+   f.instance->AddTag("Key", "Camera", "2");
+   CHECK(f.MergedValue("Camera-Key") == "2");
+   CHECK(f.camera->getTagsCalls == 2);
+   CHECK(f.MergedValue("Camera-Key") == "2");
+   CHECK(f.camera->getTagsCalls == 2);
+
+   f.instance->RemoveTag("Camera-Key");
+   Metadata md;
+   f.instance->MergeCachedTags(md);
+   CHECK_FALSE(md.HasTag("Camera-Key"));
+   CHECK(f.camera->getTagsCalls == 3);
+}
+
+TEST_CASE("Unversioned camera tags are fetched for every image", "[CameraTags]")
+{
+   TagTestFixture f(false);
+   CHECK(f.instance->GetTagsVersion() == -1);
+
+   f.instance->AddTag("Key", "Camera", "1");
+   CHECK(f.MergedValue("Camera-Key") == "1");
+   CHECK(f.MergedValue("Camera-Key") == "1");
+   CHECK(f.camera->getTagsCalls == 2);
+}
@@ -0,0 +1,548 @@
+#include <catch2/catch_all.hpp>
+
+#include "CircularBuffer.h"
+#include "CoreFeatures.h"
+#include "MMCore.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+bool InsertTestImage(CircularBuffer& cb, unsigned width, unsigned height)
+{
+   std::vector<unsigned char> pixels(width * height);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   return cb.InsertImage(pixels.data(), width, height, 1, &md);
+}
+
+// Frames of a single value, so that torn frames can be detected
+bool InsertFilledImage(CircularBuffer& cb, unsigned width, unsigned height,
+      unsigned char value)
+{
+   std::vector<unsigned char> pixels(width * height, value);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   return cb.InsertImage(pixels.data(), width, height, 1, &md);
+}
+
+bool IsUniform(const mm::ImgBuffer& image)
+{
+   const unsigned char* pixels = image.GetPixels();
+   const std::size_t size = image.Width() * image.Height() * image.Depth();
+   for (std::size_t i = 1; i < size; ++i)
+   {
+      if (pixels[i] != pixels[0])
+         return false;
+   }
+   return true;
+}
+
+class EnabledFeature
+{
+public:
+   explicit EnabledFeature(const char* name) : name_(name)
+   { mm::features::enableFeature(name_, true); }
+   ~EnabledFeature() { mm::features::enableFeature(name_, false); }
+private:
+   std::string name_;
+};
+
+}
+
+TEST_CASE("waitForNextImage times out on empty buffer", "[CircularBuffer]")
+{
+   CMMCore c;
+   CHECK_FALSE(c.waitForNextImage(0));
+   CHECK_FALSE(c.waitForNextImage(10));
+   Metadata md;
+   CHECK_THROWS_AS(c.waitForNextImageMD(10, md), CMMError);
+   CHECK_THROWS_AS(c.waitForNextImage(-1), CMMError);
+}
+
+TEST_CASE("WaitForImage wakes on insert", "[CircularBuffer]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 16, 16, 1));
+
+   unsigned long finished = cb.GetAcquisitionFinishedCount();
+   std::thread producer([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      InsertTestImage(cb, 16, 16);
+   });
+   CHECK(cb.WaitForImage(10000, finished));
+   producer.join();
+   CHECK(cb.GetNextImageBuffer(0) != nullptr);
+   CHECK_FALSE(cb.WaitForImage(0, finished));
+}
+
+TEST_CASE("WaitForImage wakes on acquisition finished", "[CircularBuffer]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 16, 16, 1));
+
+   unsigned long finished = cb.GetAcquisitionFinishedCount();
+   std::thread finisher([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      cb.NotifyAcquisitionFinished();
+   });
+   auto start = std::chrono::steady_clock::now();
+   CHECK_FALSE(cb.WaitForImage(10000, finished));
+   CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+   finisher.join();
+}
+
+TEST_CASE("GetNextImageBuffers removes up to maxCount images", "[CircularBuffer]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 16, 16, 1));
+   for (int i = 0; i < 5; ++i)
+      REQUIRE(InsertTestImage(cb, 16, 16));
+
+   std::vector<const mm::ImgBuffer*> images;
+   CHECK(cb.GetNextImageBuffers(3, 0, images) == 3);
+   CHECK(images.size() == 3);
+   CHECK(images[0]->GetMetadata().GetSingleTag(
+            MM::g_Keyword_Metadata_ImageNumber).GetValue() == "0");
+   CHECK(cb.GetRemainingImageCount() == 2);
+   CHECK(cb.GetNextImageBuffers(10, 0, images) == 2);
+   CHECK(images.size() == 5);
+   CHECK(images[4]->GetMetadata().GetSingleTag(
+            MM::g_Keyword_Metadata_ImageNumber).GetValue() == "4");
+   CHECK(cb.GetNextImageBuffers(10, 0, images) == 0);
+}
+
+TEST_CASE("Batches of leased frames survive ring mode", "[CircularBuffer]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 512, 512, 1));
+   REQUIRE(cb.GetSize() == 4);
+   cb.SetOverwriteOldest(true);
+
+   std::vector<unsigned char> pixels(512 * 512);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   for (unsigned char i = 0; i < 3; ++i)
+   {
+      pixels[0] = i;
+      REQUIRE(cb.InsertImage(pixels.data(), 512, 512, 1, &md));
+   }
+
+   std::vector<std::shared_ptr<const mm::ImgBuffer>> images;
+   CHECK(cb.LeaseNextImages(2, 0, images) == 2);
+   REQUIRE(images.size() == 2);
+   CHECK(cb.GetLeaseCount() == 2);
+   CHECK(cb.GetRemainingImageCount() == 1);
+
+   // New frames do not touch the leased ones
+   pixels[0] = 3;
+   REQUIRE(cb.InsertImage(pixels.data(), 512, 512, 1, &md));
+   CHECK(images[0]->GetPixels()[0] == 0);
+   CHECK(images[1]->GetPixels()[0] == 1);
+
+   images.clear();
+   CHECK(cb.GetLeaseCount() == 0);
+   CHECK(cb.LeaseNextImages(10, 0, images) == 2);
+   CHECK(images[1]->GetPixels()[0] == 3);
+}
+
+TEST_CASE("Frames keep their pixels across slab wrap-around", "[CircularBuffer]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 512, 512, 1));
+   const unsigned long capacity = cb.GetSize();
+   REQUIRE(capacity == 4);
+
+   // Change of image size reuses the slab
+   REQUIRE(cb.Initialize(1, 300, 300, 1));
+   CHECK(cb.GetSize() == (1 << 20) / 90048); // Frames are 64-byte aligned
+
+   std::vector<unsigned char> pixels(300 * 300);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   unsigned long inserted = 0;
+   unsigned long nextToRead = 0;
+   for (int round = 0; round < 5; ++round)
+   {
+      for (;;)
+      {
+         pixels[0] = static_cast<unsigned char>(inserted);
+         if (!cb.InsertImage(pixels.data(), 300, 300, 1, &md))
+            break;
+         ++inserted;
+      }
+      CHECK(inserted - nextToRead == cb.GetRemainingImageCount());
+      CHECK(cb.GetRemainingImageCount() >= cb.GetSize() - 1);
+
+      // Read half the frames and check they were not overwritten
+      for (unsigned long i = 0; i < cb.GetSize() / 2; ++i, ++nextToRead)
+      {
+         const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+         REQUIRE(img != 0);
+         CHECK(img->GetPixels()[0] == static_cast<unsigned char>(nextToRead));
+      }
+   }
+   CHECK(inserted > 2 * cb.GetSize());
+}
+
+TEST_CASE("Multi-channel frames are inserted in one go", "[CircularBuffer]")
+{
+   CircularBuffer cb(8, mm::BufferAllocationOptions(),
+         mm::BufferMemory::ProgressFunction(), std::make_shared<ThreadPool>(3));
+   REQUIRE(cb.Initialize(3, 512, 512, 2));
+
+   // Large enough to be split across the pool's threads
+   const std::size_t channelBytes = 512 * 512 * 2;
+   std::vector<unsigned char> pixels(3 * channelBytes);
+   for (std::size_t i = 0; i < pixels.size(); ++i)
+      pixels[i] = static_cast<unsigned char>(i / channelBytes + 1);
+
+   Metadata noLabel;
+   CHECK_THROWS_AS(cb.InsertMultiChannel(pixels.data(), 3, 512, 512, 2, &noLabel), CMMError);
+   CHECK(cb.GetRemainingImageCount() == 0);
+
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   md.PutImageTag("Custom", "Value");
+   for (int frame = 0; frame < 2; ++frame)
+      REQUIRE(cb.InsertMultiChannel(pixels.data(), 3, 512, 512, 2, &md));
+   CHECK(cb.GetRemainingImageCount() == 2);
+
+   for (unsigned channel = 0; channel < 3; ++channel)
+   {
+      const mm::ImgBuffer* img = cb.GetNthFromTopImageBuffer(0, channel);
+      REQUIRE(img != nullptr);
+      CHECK(img->GetPixels()[0] == channel + 1);
+      CHECK(img->GetPixels()[channelBytes - 1] == channel + 1);
+
+      Metadata imgMd = img->GetMetadata();
+      CHECK(imgMd.GetSingleTag(MM::g_Keyword_Metadata_CameraLabel).GetValue() == "Camera");
+      CHECK(imgMd.GetSingleTag("Custom").GetValue() == "Value");
+      CHECK(imgMd.GetSingleTag("Width").GetValue() == "512");
+      // Each channel has its own image number
+      CHECK(imgMd.GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue() ==
+            std::to_string(3 + channel));
+   }
+
+   // Zero-copy insertion would only fill channel 0
+   CHECK_THROWS_AS(cb.AcquireWriteSlot(512, 512, 2, 1), CMMError);
+   CHECK(cb.GetWriteSlot() == nullptr);
+   REQUIRE(cb.InsertMultiChannel(pixels.data(), 3, 512, 512, 2, &md));
+}
+
+TEST_CASE("Ring mode drops the oldest images when full", "[CircularBuffer]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 512, 512, 1));
+   REQUIRE(cb.GetSize() == 4);
+
+   std::vector<unsigned char> pixels(512 * 512);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   for (int i = 0; i < 4; ++i)
+      REQUIRE(cb.InsertImage(pixels.data(), 512, 512, 1, &md));
+   CHECK_FALSE(cb.InsertImage(pixels.data(), 512, 512, 1, &md));
+   CHECK(cb.Overflow());
+   CHECK(cb.GetDroppedCount() == 0);
+
+   cb.Clear();
+   cb.SetOverwriteOldest(true);
+   for (int i = 0; i < 10; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      REQUIRE(cb.InsertImage(pixels.data(), 512, 512, 1, &md));
+   }
+   CHECK_FALSE(cb.Overflow());
+   CHECK(cb.GetDroppedCount() == 6);
+   CHECK(cb.GetRemainingImageCount() == 4);
+   for (int i = 6; i < 10; ++i)
+   {
+      const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+      REQUIRE(img != 0);
+      CHECK(img->GetPixels()[0] == i);
+      CHECK(img->GetMetadata().GetSingleTag(
+               MM::g_Keyword_Metadata_ImageNumber).GetValue() ==
+            std::to_string(i));
+   }
+
+   cb.Clear();
+   CHECK(cb.GetDroppedCount() == 0);
+}
+
+TEST_CASE("Aborted write slots leave the buffer unchanged", "[CircularBuffer]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 512, 512, 1));
+   REQUIRE(cb.GetSize() == 4);
+
+   std::vector<unsigned char> pixels(512 * 512);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+
+   // A slot reserved in place returns its slab space when aborted
+   for (int i = 0; i < 3; ++i)
+   {
+      unsigned char* slot = cb.AcquireWriteSlot(512, 512, 1, 1);
+      REQUIRE(slot != nullptr);
+      cb.AbortWriteSlot();
+      REQUIRE(cb.InsertImage(pixels.data(), 512, 512, 1, &md));
+   }
+   REQUIRE(cb.InsertImage(pixels.data(), 512, 512, 1, &md));
+   CHECK(cb.GetRemainingImageCount() == 4);
+   CHECK_FALSE(cb.Overflow());
+
+   // In ring mode, room for a full buffer's slot is only made on commit
+   cb.Clear();
+   cb.SetOverwriteOldest(true);
+   for (int i = 0; i < 4; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      REQUIRE(cb.InsertImage(pixels.data(), 512, 512, 1, &md));
+   }
+   unsigned char* slot = cb.AcquireWriteSlot(512, 512, 1, 1);
+   REQUIRE(slot != nullptr);
+   std::memset(slot, 0xff, 512 * 512);
+   cb.AbortWriteSlot();
+   CHECK(cb.GetDroppedCount() == 0);
+   CHECK(cb.GetRemainingImageCount() == 4);
+   const mm::ImgBuffer* oldest = cb.GetNthFromTopImageBuffer(3, 0);
+   REQUIRE(oldest != nullptr);
+   CHECK(oldest->GetPixels()[0] == 0);
+   CHECK(oldest->GetPixels()[1] == 0);
+
+   slot = cb.AcquireWriteSlot(512, 512, 1, 1);
+   REQUIRE(slot != nullptr);
+   slot[0] = 4;
+   REQUIRE(cb.CommitWriteSlot(&md));
+   CHECK(cb.GetDroppedCount() == 1);
+   CHECK(cb.GetRemainingImageCount() == 4);
+   for (int i = 1; i < 5; ++i)
+   {
+      const mm::ImgBuffer* img = cb.GetNextImageBuffer(0);
+      REQUIRE(img != nullptr);
+      CHECK(img->GetPixels()[0] == i);
+      CHECK(img->GetMetadata().GetSingleTag(
+               MM::g_Keyword_Metadata_ImageNumber).GetValue() ==
+            std::to_string(i));
+   }
+}
+
+TEST_CASE("Leased frames are not overwritten", "[CircularBuffer]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 512, 512, 1));
+   REQUIRE(cb.GetSize() == 4);
+
+   std::vector<unsigned char> pixels(512 * 512);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   auto insert = [&](unsigned char value) {
+      pixels[0] = value;
+      return cb.InsertImage(pixels.data(), 512, 512, 1, &md);
+   };
+
+   REQUIRE(insert(0));
+   std::shared_ptr<const mm::ImgBuffer> last = cb.LeaseNthFromTopImage(0, 0);
+   REQUIRE(last);
+   CHECK(cb.GetLeaseCount() == 1);
+   std::shared_ptr<const mm::ImgBuffer> popped = cb.LeaseNextImage(0);
+   REQUIRE(popped);
+   CHECK(popped->GetPixels() == last->GetPixels());
+   CHECK(cb.GetRemainingImageCount() == 0);
+   CHECK_FALSE(cb.LeaseNextImage(0));
+
+   // The popped, leased frame blocks the buffer as if it were unread
+   for (unsigned char i = 1; i < 4; ++i)
+   {
+      REQUIRE(insert(i));
+      REQUIRE(cb.GetNextImageBuffer(0) != nullptr);
+   }
+   CHECK_FALSE(insert(4));
+   CHECK(cb.Overflow());
+   CHECK(last->GetPixels()[0] == 0);
+   CHECK(last->GetMetadata().GetSingleTag(
+            MM::g_Keyword_Metadata_ImageNumber).GetValue() == "0");
+
+   // Clearing does not release it either
+   cb.Clear();
+   CHECK_FALSE(insert(4));
+   CHECK(last->GetPixels()[0] == 0);
+
+   last.reset();
+   CHECK(cb.GetLeaseCount() == 1);
+   popped.reset();
+   CHECK(cb.GetLeaseCount() == 0);
+   CHECK(insert(4));
+}
+
+TEST_CASE("Ring mode keeps unread frames behind a lease", "[CircularBuffer]")
+{
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 512, 512, 1));
+   REQUIRE(cb.GetSize() == 4);
+   cb.SetOverwriteOldest(true);
+
+   std::vector<unsigned char> pixels(512 * 512);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   auto insert = [&](unsigned char value) {
+      pixels[0] = value;
+      return cb.InsertImage(pixels.data(), 512, 512, 1, &md);
+   };
+
+   // A popped, leased frame: discarding the unread ones would not help
+   REQUIRE(insert(0));
+   std::shared_ptr<const mm::ImgBuffer> popped = cb.LeaseNextImage(0);
+   REQUIRE(popped);
+   for (unsigned char i = 1; i < 4; ++i)
+      REQUIRE(insert(i));
+   CHECK_FALSE(insert(4));
+   CHECK(cb.Overflow());
+   CHECK(cb.GetDroppedCount() == 0);
+   CHECK(cb.GetRemainingImageCount() == 3);
+   popped.reset();
+
+   // An unread, leased frame: only the frames before it are discarded
+   cb.Clear();
+   for (unsigned char i = 0; i < 4; ++i)
+      REQUIRE(insert(i));
+   std::shared_ptr<const mm::ImgBuffer> leased = cb.LeaseNthFromTopImage(2, 0);
+   REQUIRE(leased);
+   CHECK(leased->GetPixels()[0] == 1);
+   CHECK(insert(4));
+   CHECK(cb.GetDroppedCount() == 1);
+   CHECK_FALSE(insert(5));
+   CHECK(cb.Overflow());
+   CHECK(cb.GetDroppedCount() == 1);
+   CHECK(cb.GetRemainingImageCount() == 4);
+   const mm::ImgBuffer* next = cb.GetNextImageBuffer(0);
+   REQUIRE(next != nullptr);
+   CHECK(next->GetPixels()[0] == 1);
+}
+
+TEST_CASE("Leases outlive the buffer", "[CircularBuffer]")
+{
+   std::shared_ptr<const mm::ImgBuffer> lease;
+   {
+      CircularBuffer cb(1);
+      REQUIRE(cb.Initialize(1, 16, 16, 1));
+      REQUIRE(InsertTestImage(cb, 16, 16));
+      lease = cb.LeaseNthFromTopImage(0, 0);
+      REQUIRE(lease);
+      CHECK_FALSE(cb.LeaseNthFromTopImage(1, 0));
+      CHECK_FALSE(cb.LeaseNthFromTopImage(0, 1)); // No such channel
+      CHECK(cb.GetLeaseCount() == 1);
+   }
+   CHECK(lease->Width() == 16);
+   CHECK(lease->GetPixels()[16 * 16 - 1] == 0);
+}
+
+TEST_CASE("Lock-free readers are safe against inserts and resizes", "[CircularBuffer]")
+{
+   EnabledFeature lockFree("LockFreeSequenceBuffer");
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 16, 16, 1));
+   REQUIRE(cb.IsLockFree());
+   cb.SetOverwriteOldest(true);
+
+   std::atomic<bool> stop(false);
+   std::atomic<unsigned> size(16);
+   std::atomic<long> inserted(0), popped(0), peeked(0), tornFrames(0);
+
+   std::thread producer([&] {
+      for (unsigned char value = 0; !stop; ++value)
+      {
+         const unsigned s = size;
+         try
+         {
+            if (InsertFilledImage(cb, s, s, value))
+               ++inserted;
+         }
+         catch (const CMMError&)
+         {
+            // Resized in the meantime
+         }
+      }
+   });
+   std::thread popper([&] {
+      std::vector<std::shared_ptr<const mm::ImgBuffer>> leases;
+      std::vector<const mm::ImgBuffer*> images;
+      while (!stop)
+      {
+         leases.clear();
+         popped += cb.LeaseNextImages(4, 0, leases);
+         for (const auto& lease : leases)
+         {
+            if (lease && !IsUniform(*lease))
+               ++tornFrames;
+         }
+         if (cb.GetNextImageBuffer(0))
+            ++popped;
+         images.clear();
+         popped += cb.GetNextImageBuffers(4, 0, images);
+         std::shared_ptr<const mm::ImgBuffer> lease = cb.LeaseNextImage(0);
+         if (lease)
+         {
+            ++popped;
+            if (!IsUniform(*lease))
+               ++tornFrames;
+         }
+      }
+   });
+   std::thread peeker([&] {
+      while (!stop)
+      {
+         std::shared_ptr<const mm::ImgBuffer> lease = cb.LeaseNthFromTopImage(0, 0);
+         if (lease)
+         {
+            ++peeked;
+            if (!IsUniform(*lease))
+               ++tornFrames;
+         }
+         cb.GetNthFromTopImageBuffer(1, 0);
+         cb.GetTopImage();
+      }
+   });
+
+   // Resize while the readers are peeking and popping
+   for (int i = 0; i < 200; ++i)
+   {
+      const unsigned s = (i % 2) ? 16 : 32;
+      REQUIRE(cb.Initialize(1, s, s, 1));
+      size = s;
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+   }
+   stop = true;
+   producer.join();
+   popper.join();
+   peeker.join();
+
+   CHECK(inserted > 0);
+   CHECK(popped > 0);
+   CHECK(peeked > 0);
+   CHECK(tornFrames == 0);
+   CHECK(cb.GetLeaseCount() == 0);
+}
+
+TEST_CASE("CMMCore image leases", "[CircularBuffer]")
+{
+   CMMCore c;
+   CHECK_THROWS_AS(c.getLastImageLease(), CMMError);
+   CHECK_THROWS_AS(c.popNextImageLease(), CMMError);
+   CHECK(c.popNextImageLeases(4).empty());
+   std::vector<Metadata> md(1);
+   CHECK(c.popNextImages(4, md).empty());
+   CHECK(md.empty());
+   ImageLease lease;
+   CHECK_FALSE(lease.isValid());
+   CHECK(lease.getPixels() == nullptr);
+   CHECK(lease.getImageWidth() == 0);
+}
@@ -0,0 +1,161 @@
+#include <catch2/catch_all.hpp>
+
+#include "CoreFeatures.h"
+#include "MMCore.h"
+#include "MockDeviceAdapter.h"
+
+#include "../MMDevice/DeviceBase.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+const unsigned width = 512, height = 512;
+
+template <class T>
+class TestCameraBase : public CCameraBase<T>
+{
+public:
+   int Initialize() { return DEVICE_OK; }
+   int Shutdown() { return DEVICE_OK; }
+
+   int SnapImage() { return DEVICE_OK; }
+   const unsigned char* GetImageBuffer() { return pixels_.data(); }
+   unsigned GetImageWidth() const { return width; }
+   unsigned GetImageHeight() const { return height; }
+   unsigned GetImageBytesPerPixel() const { return 1; }
+   unsigned GetBitDepth() const { return 8; }
+   long GetImageBufferSize() const { return width * height; }
+   double GetExposure() const { return 1.0; }
+   void SetExposure(double) {}
+   int SetROI(unsigned, unsigned, unsigned, unsigned) { return DEVICE_OK; }
+   int GetROI(unsigned& x, unsigned& y, unsigned& xSize, unsigned& ySize)
+   { x = y = 0; xSize = width; ySize = height; return DEVICE_OK; }
+   int ClearROI() { return DEVICE_OK; }
+   int GetBinning() const { return 1; }
+   int SetBinning(int) { return DEVICE_OK; }
+   int IsExposureSequenceable(bool& seq) const { seq = false; return DEVICE_OK; }
+
+protected:
+   TestCameraBase() : pixels_(width * height) {}
+
+   std::vector<unsigned char> pixels_;
+};
+
+// Inserts frames until its buffer is full, without a thread
+class PhysicalCamera : public TestCameraBase<PhysicalCamera>
+{
+public:
+   PhysicalCamera() : inserted(0) {}
+
+   void GetName(char* name) const
+   { CDeviceUtils::CopyLimitedString(name, "PhysicalCamera"); }
+
+   int StartSequenceAcquisition(long numImages, double, bool)
+   {
+      int ret = GetCoreCallback()->PrepareForAcq(this);
+      if (ret != DEVICE_OK)
+         return ret;
+      for (long i = 0; i < numImages; ++i)
+      {
+         if (GetCoreCallback()->InsertImage(this, pixels_.data(), width,
+                  height, 1) != DEVICE_OK)
+            break;
+         ++inserted;
+      }
+      return DEVICE_OK;
+   }
+
+   long inserted;
+};
+
+// Streams by starting the physical cameras, like Utilities' Multi Camera
+class CompositeCamera : public TestCameraBase<CompositeCamera>
+{
+public:
+   void GetName(char* name) const
+   { CDeviceUtils::CopyLimitedString(name, "CompositeCamera"); }
+
+   int StartSequenceAcquisition(long numImages, double intervalMs,
+         bool stopOnOverflow)
+   {
+      const char* labels[] = { "A", "B" };
+      for (const char* label : labels)
+      {
+         MM::Camera* camera = static_cast<MM::Camera*>(GetDevice(label));
+         int ret = camera->StartSequenceAcquisition(numImages, intervalMs,
+               stopOnOverflow);
+         if (ret != DEVICE_OK)
+            return ret;
+      }
+      return DEVICE_OK;
+   }
+};
+
+class CameraAdapter : public MockDeviceAdapter
+{
+public:
+   void InitializeModuleData(RegisterDeviceFunction registerDevice)
+   {
+      registerDevice("PhysicalCamera", MM::CameraDevice, "Physical camera");
+      registerDevice("CompositeCamera", MM::CameraDevice, "Composite camera");
+   }
+
+   MM::Device* CreateDevice(const char* name)
+   {
+      const std::string deviceName(name);
+      if (deviceName == "PhysicalCamera")
+      {
+         physicalCameras.push_back(new PhysicalCamera());
+         return physicalCameras.back();
+      }
+      if (deviceName == "CompositeCamera")
+         return new CompositeCamera();
+      return 0;
+   }
+
+   void DeleteDevice(MM::Device* device) { delete device; }
+
+   std::vector<PhysicalCamera*> physicalCameras;
+};
+
+}
+
+TEST_CASE("Cameras started by a composite camera get their own buffers", "[CompositeCamera]")
+{
+   CameraAdapter adapter;
+   CMMCore core;
+   core.loadMockDeviceAdapter("CameraAdapter", &adapter);
+   core.loadDevice("A", "CameraAdapter", "PhysicalCamera");
+   core.loadDevice("B", "CameraAdapter", "PhysicalCamera");
+   core.loadDevice("Multi", "CameraAdapter", "CompositeCamera");
+   core.initializeAllDevices();
+   REQUIRE(adapter.physicalCameras.size() == 2);
+   PhysicalCamera* cameraA = adapter.physicalCameras[0];
+   PhysicalCamera* cameraB = adapter.physicalCameras[1];
+
+   // 4 MB for the two cameras that stream; 256 kB frames
+   core.setCircularBufferMemoryFootprint(4);
+   mm::features::enableFeature("PerCameraSequenceBuffers", true);
+   try
+   {
+      for (int run = 0; run < 2; ++run)
+      {
+         cameraA->inserted = cameraB->inserted = 0;
+         core.startSequenceAcquisition("Multi", 100, 0.0, true);
+
+         CHECK(cameraA->inserted == 8);
+         CHECK(cameraB->inserted == 8);
+         CHECK(core.getRemainingImageCount("A") == 8);
+         CHECK(core.getRemainingImageCount("B") == 8);
+         CHECK_THROWS_AS(core.getRemainingImageCount("Multi"), CMMError);
+      }
+   }
+   catch (...)
+   {
+      mm::features::enableFeature("PerCameraSequenceBuffers", false);
+      throw;
+   }
+   mm::features::enableFeature("PerCameraSequenceBuffers", false);
+}
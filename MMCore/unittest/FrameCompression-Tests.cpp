@@ -0,0 +1,269 @@
+#include <catch2/catch_all.hpp>
+
+#include "CircularBuffer.h"
+#include "CoreFeatures.h"
+#include "FrameCompression.h"
+#include "TaskSet_CompressFrame.h"
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// 12-bit camera-like image: a gradient with a little noise
+std::vector<std::uint16_t> TestImage(std::size_t count, unsigned seed)
+{
+   std::vector<std::uint16_t> pixels(count);
+   std::uint32_t state = seed * 2654435761u + 1;
+   for (std::size_t i = 0; i < count; ++i)
+   {
+      state = state * 1664525u + 1013904223u;
+      pixels[i] = static_cast<std::uint16_t>((i / 64 + (state >> 29)) & 0xfff);
+   }
+   return pixels;
+}
+
+std::vector<unsigned char> CompressImage(TaskSet_CompressFrame& tasks,
+      const unsigned char* src, std::size_t bytes, unsigned elementSize)
+{
+   std::vector<unsigned char> copy(bytes);
+   const std::size_t compressedBytes =
+      tasks.Compress(src, 1, bytes, elementSize, copy.data());
+   CHECK(std::memcmp(copy.data(), src, bytes) == 0);
+   std::vector<unsigned char> compressed(compressedBytes);
+   tasks.Write(compressed.data());
+   return compressed;
+}
+
+Metadata CameraMetadata()
+{
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   return md;
+}
+
+} // anonymous namespace
+
+TEST_CASE("Compressed images decompress to the original", "[FrameCompression]")
+{
+   TaskSet_CompressFrame tasks(std::make_shared<ThreadPool>(3));
+
+   // Partial blocks, and a frame split among the tasks
+   for (std::size_t bytes : { 1, 100, 65536, 65539, 1000003 })
+   {
+      const std::vector<std::uint16_t> image = TestImage(bytes / 2 + 1, 1);
+      const unsigned char* src = reinterpret_cast<const unsigned char*>(image.data());
+      for (unsigned elementSize : { 1, 2, 4 })
+      {
+         const std::vector<unsigned char> compressed =
+            CompressImage(tasks, src, bytes, elementSize);
+         std::vector<unsigned char> decompressed(bytes);
+         REQUIRE(mm::DecompressImage(compressed.data(), bytes, elementSize,
+                  decompressed.data()));
+         CHECK(std::memcmp(decompressed.data(), src, bytes) == 0);
+      }
+   }
+}
+
+TEST_CASE("Incompressible blocks are stored", "[FrameCompression]")
+{
+   TaskSet_CompressFrame tasks(std::make_shared<ThreadPool>(2));
+
+   std::vector<unsigned char> noise(200000);
+   std::uint32_t state = 12345;
+   for (unsigned char& b : noise)
+   {
+      state = state * 1664525u + 1013904223u;
+      b = static_cast<unsigned char>(state >> 24);
+   }
+   const std::vector<unsigned char> compressed =
+      CompressImage(tasks, noise.data(), noise.size(), 2);
+   CHECK(compressed.size() == mm::CompressionHeaderBytes(noise.size()) + noise.size());
+
+   std::vector<unsigned char> decompressed(noise.size());
+   REQUIRE(mm::DecompressImage(compressed.data(), noise.size(), 2, decompressed.data()));
+   CHECK(decompressed == noise);
+}
+
+TEST_CASE("Corrupt compressed images are detected", "[FrameCompression]")
+{
+   TaskSet_CompressFrame tasks(std::make_shared<ThreadPool>(1));
+
+   const std::vector<std::uint16_t> image = TestImage(100000, 2);
+   const std::size_t bytes = image.size() * 2;
+   std::vector<unsigned char> compressed = CompressImage(tasks,
+         reinterpret_cast<const unsigned char*>(image.data()), bytes, 2);
+   REQUIRE(compressed.size() < bytes / 2);
+
+   std::vector<unsigned char> decompressed(bytes);
+   std::vector<unsigned char> truncatedBlock = compressed;
+   mm::WriteCompressionEntry(truncatedBlock.data(), 0, 10);
+   CHECK_FALSE(mm::DecompressImage(truncatedBlock.data(), bytes, 2, decompressed.data()));
+
+   std::vector<unsigned char> wrongStoredSize = compressed;
+   mm::WriteCompressionEntry(wrongStoredSize.data(), 0, mm::CompressionStoredFlag | 10);
+   CHECK_FALSE(mm::DecompressImage(wrongStoredSize.data(), bytes, 2, decompressed.data()));
+}
+
+TEST_CASE("Compressed sequence buffer holds more frames", "[FrameCompression]")
+{
+   const unsigned width = 256, height = 256;
+   const std::size_t frameBytes = width * height * 2;
+
+   mm::features::enableFeature("CompressedSequenceBuffer", true);
+   CircularBuffer cb(1, mm::BufferAllocationOptions(),
+         mm::BufferMemory::ProgressFunction(), std::make_shared<ThreadPool>(2));
+   const bool initialized = cb.Initialize(1, width, height, 2);
+   mm::features::enableFeature("CompressedSequenceBuffer", false);
+   REQUIRE(initialized);
+   REQUIRE(cb.IsCompressed());
+
+   // Eight uncompressed frames would fit
+   const unsigned frameCount = 20;
+   std::vector<std::vector<std::uint16_t>> frames;
+   const Metadata md = CameraMetadata();
+   for (unsigned i = 0; i < frameCount; ++i)
+   {
+      frames.push_back(TestImage(width * height, i));
+      REQUIRE(cb.InsertImage(reinterpret_cast<unsigned char*>(frames.back().data()),
+               width, height, 2, &md));
+   }
+   CHECK_FALSE(cb.Overflow());
+   CHECK(cb.GetRemainingImageCount() == frameCount);
+
+   // The newest frame is not decompressed
+   const mm::ImgBuffer* top = cb.GetTopImageBuffer(0);
+   REQUIRE(top != nullptr);
+   CHECK(std::memcmp(top->GetPixels(), frames[frameCount - 1].data(), frameBytes) == 0);
+   CHECK(top->GetFrameMetadata().GetImageNumber() == frameCount - 1);
+   CHECK(cb.GetCompressionStatistics().imagesDecompressed == 0);
+
+   const mm::ImgBuffer* older = cb.GetNthFromTopImageBuffer(3, 0);
+   REQUIRE(older != nullptr);
+   CHECK(std::memcmp(older->GetPixels(), frames[frameCount - 4].data(), frameBytes) == 0);
+   CHECK(older->Width() == width);
+
+   const mm::ImgBuffer* next = cb.GetNextImageBuffer(0);
+   REQUIRE(next != nullptr);
+   CHECK(std::memcmp(next->GetPixels(), frames[0].data(), frameBytes) == 0);
+   CHECK(next->GetFrameMetadata().GetImageNumber() == 0);
+
+   std::shared_ptr<const mm::ImgBuffer> lease = cb.LeaseNextImage(0);
+   REQUIRE(lease);
+   CHECK(std::memcmp(lease->GetPixels(), frames[1].data(), frameBytes) == 0);
+   CHECK(cb.GetLeaseCount() == 0); // Decompressed leases hold no frame
+
+   std::vector<const mm::ImgBuffer*> images;
+   CHECK(cb.GetNextImageBuffers(100, 0, images) == frameCount - 2);
+   REQUIRE(images.size() == frameCount - 2);
+   for (unsigned i = 0; i < frameCount - 2; ++i)
+      CHECK(std::memcmp(images[i]->GetPixels(), frames[i + 2].data(), frameBytes) == 0);
+
+   const CircularBuffer::CompressionStatistics stats = cb.GetCompressionStatistics();
+   CHECK(stats.framesCompressed == frameCount);
+   CHECK(stats.rawBytes == frameCount * frameBytes);
+   CHECK(stats.compressedBytes * 2 < stats.rawBytes);
+   // All popped images but the newest, and the one read from the top
+   CHECK(stats.imagesDecompressed == frameCount);
+
+   // Zero-copy insertion writes to the uncompressed live frame
+   unsigned char* slot = cb.AcquireWriteSlot(width, height, 2, 1);
+   REQUIRE(slot != nullptr);
+   std::memcpy(slot, frames[5].data(), frameBytes);
+   REQUIRE(cb.CommitWriteSlot(&md));
+   std::shared_ptr<const mm::ImgBuffer> newest = cb.LeaseNthFromTopImage(0, 0);
+   REQUIRE(newest);
+   CHECK(std::memcmp(newest->GetPixels(), frames[5].data(), frameBytes) == 0);
+
+   // Once another frame is inserted, it is decompressed
+   REQUIRE(cb.InsertImage(reinterpret_cast<unsigned char*>(frames[6].data()),
+            width, height, 2, &md));
+   CHECK(std::memcmp(newest->GetPixels(), frames[5].data(), frameBytes) == 0);
+   next = cb.GetNextImageBuffer(0);
+   REQUIRE(next != nullptr);
+   CHECK(std::memcmp(next->GetPixels(), frames[5].data(), frameBytes) == 0);
+   CHECK(cb.GetCompressionStatistics().imagesDecompressed == frameCount + 1);
+
+   cb.Clear();
+   CHECK(cb.GetCompressionStatistics().framesCompressed == 0);
+}
+
+TEST_CASE("Compressed write slots that do not fit keep image numbers", "[FrameCompression]")
+{
+   const unsigned width = 256, height = 256;
+   const std::size_t frameBytes = width * height * 2;
+
+   mm::features::enableFeature("CompressedSequenceBuffer", true);
+   CircularBuffer cb(1, mm::BufferAllocationOptions(),
+         mm::BufferMemory::ProgressFunction(), std::make_shared<ThreadPool>(2));
+   const bool initialized = cb.Initialize(1, width, height, 2);
+   mm::features::enableFeature("CompressedSequenceBuffer", false);
+   REQUIRE(initialized);
+   REQUIRE(cb.IsCompressed());
+
+   // Noise does not compress, so the slab fills up long before the slots
+   std::vector<unsigned char> noise(frameBytes);
+   std::uint32_t state = 1;
+   for (std::size_t i = 0; i < noise.size(); ++i)
+   {
+      state = state * 1664525u + 1013904223u;
+      noise[i] = static_cast<unsigned char>(state >> 24);
+   }
+   const Metadata md = CameraMetadata();
+   long inserted = 0;
+   while (cb.InsertImage(noise.data(), width, height, 2, &md))
+      ++inserted;
+   REQUIRE(cb.Overflow());
+
+   unsigned char* slot = cb.AcquireWriteSlot(width, height, 2, 1);
+   REQUIRE(slot != nullptr);
+   std::memcpy(slot, noise.data(), frameBytes);
+   CHECK_FALSE(cb.CommitWriteSlot(&md));
+
+   // Make room; the next frame gets the number the failed one did not use
+   while (cb.GetNextImageBuffer(0))
+      ;
+   slot = cb.AcquireWriteSlot(width, height, 2, 1);
+   REQUIRE(slot != nullptr);
+   std::memcpy(slot, noise.data(), frameBytes);
+   REQUIRE(cb.CommitWriteSlot(&md));
+   const mm::ImgBuffer* top = cb.GetTopImageBuffer(0);
+   REQUIRE(top != nullptr);
+   CHECK(top->GetFrameMetadata().GetImageNumber() == inserted);
+}
+
+TEST_CASE("Compressed buffers hold images separately", "[FrameCompression]")
+{
+   const unsigned width = 64, height = 64;
+   const std::size_t frameBytes = width * height * 2;
+
+   mm::features::enableFeature("CompressedSequenceBuffer", true);
+   CircularBuffer first(1), second(1);
+   const bool initialized = first.Initialize(1, width, height, 2) &&
+      second.Initialize(1, width, height, 2);
+   mm::features::enableFeature("CompressedSequenceBuffer", false);
+   REQUIRE(initialized);
+
+   const Metadata md = CameraMetadata();
+   const std::vector<std::uint16_t> a = TestImage(width * height, 1);
+   const std::vector<std::uint16_t> b = TestImage(width * height, 2);
+   for (int i = 0; i < 2; ++i)
+   {
+      REQUIRE(first.InsertImage(reinterpret_cast<const unsigned char*>(a.data()),
+               width, height, 2, &md));
+      REQUIRE(second.InsertImage(reinterpret_cast<const unsigned char*>(b.data()),
+               width, height, 2, &md));
+   }
+
+   // Popping from one buffer does not release the image held for the other
+   const mm::ImgBuffer* fromFirst = first.GetNextImageBuffer(0);
+   REQUIRE(fromFirst != nullptr);
+   const mm::ImgBuffer* fromSecond = second.GetNextImageBuffer(0);
+   REQUIRE(fromSecond != nullptr);
+   CHECK(std::memcmp(fromFirst->GetPixels(), a.data(), frameBytes) == 0);
+   CHECK(std::memcmp(fromSecond->GetPixels(), b.data(), frameBytes) == 0);
+}
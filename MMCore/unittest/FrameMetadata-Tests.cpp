@@ -0,0 +1,77 @@
+#include <catch2/catch_all.hpp>
+
+#include "FrameMetadata.h"
+
+TEST_CASE("FrameMetadata round-trips single and array tags", "[FrameMetadata]")
+{
+   Metadata md;
+   md.PutImageTag("Exposure", 10);
+   md.PutTag("Position", "Stage", "1.5");
+   MetadataArrayTag atag("Pair", "_", false);
+   atag.AddValue("a");
+   atag.AddValue("");
+   md.SetTag(atag);
+
+   mm::FrameMetadata fmd;
+   fmd.Assign(md);
+   CHECK(fmd.Size() == 3);
+   CHECK(fmd.HasTag("Stage-Position"));
+   CHECK(std::string(fmd.FindValue("Exposure")) == "10");
+   CHECK(fmd.FindValue("Pair") == nullptr);
+
+   Metadata out;
+   fmd.ToMetadata(out);
+   CHECK(out.GetKeys() == md.GetKeys());
+   CHECK(out.GetSingleTag("Stage-Position").GetValue() == "1.5");
+   CHECK(out.GetSingleTag("Stage-Position").GetDevice() == "Stage");
+   MetadataArrayTag outArray = out.GetArrayTag("Pair");
+   CHECK_FALSE(outArray.IsReadOnly());
+   REQUIRE(outArray.GetSize() == 2);
+   CHECK(outArray.GetValue(0) == "a");
+   CHECK(outArray.GetValue(1) == "");
+}
+
+TEST_CASE("FrameMetadata PutImageTag replaces existing tag", "[FrameMetadata]")
+{
+   mm::FrameMetadata fmd;
+   fmd.PutImageTag("Width", "512");
+   fmd.PutImageTag("Width", "1024");
+   CHECK(fmd.Size() == 1);
+   CHECK(std::string(fmd.FindValue("Width")) == "1024");
+
+   mm::FrameMetadata copy;
+   copy = fmd;
+   fmd.Clear();
+   CHECK(fmd.IsEmpty());
+   CHECK_FALSE(fmd.HasTag("Width"));
+   CHECK(std::string(copy.FindValue("Width")) == "1024");
+}
+
+TEST_CASE("FrameMetadata formats standard tags on conversion", "[FrameMetadata]")
+{
+   Metadata md;
+   md.PutImageTag("Width", "1");
+   md.PutImageTag("Camera", "Cam");
+
+   mm::FrameMetadata fmd;
+   fmd.Assign(md);
+   CHECK_FALSE(fmd.HasTag(MM::g_Keyword_Elapsed_Time_ms));
+   fmd.SetImageNumber(42);
+   fmd.SetElapsedTime(std::chrono::milliseconds(1500));
+   fmd.SetImageFormat(640, 480, 4, 4);
+   CHECK(fmd.HasTag(MM::g_Keyword_Elapsed_Time_ms));
+   CHECK(fmd.HasTag("PixelType"));
+   CHECK_FALSE(fmd.HasTag(MM::g_Keyword_Metadata_TimeInCore));
+
+   Metadata out;
+   fmd.ToMetadata(out);
+   CHECK(out.GetSingleTag("Camera").GetValue() == "Cam");
+   CHECK(out.GetSingleTag(MM::g_Keyword_Metadata_ImageNumber).GetValue() == "42");
+   CHECK(out.GetSingleTag(MM::g_Keyword_Elapsed_Time_ms).GetValue() == "1500");
+   CHECK(out.GetSingleTag("Width").GetValue() == "640");
+   CHECK(out.GetSingleTag("Height").GetValue() == "480");
+   CHECK(out.GetSingleTag("PixelType").GetValue() == "RGB32");
+
+   fmd.Clear();
+   CHECK_FALSE(fmd.HasTag("Width"));
+}
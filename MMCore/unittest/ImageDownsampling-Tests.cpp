@@ -0,0 +1,139 @@
+#include <catch2/catch_all.hpp>
+
+#include "ImageDownsampling.h"
+#include "MMCore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Straightforward version to compare against
+template <typename T>
+std::vector<double> ReferenceDownsample(const std::vector<T>& src,
+      unsigned width, unsigned height, unsigned numComponents, unsigned factor,
+      mm::DownsamplingMode mode)
+{
+   std::vector<double> result;
+   for (unsigned y = 0; y < height / factor; ++y)
+   {
+      for (unsigned x = 0; x < width / factor; ++x)
+      {
+         for (unsigned c = 0; c < numComponents; ++c)
+         {
+            double sum = 0.0;
+            double max = 0.0;
+            for (unsigned dy = 0; dy < factor; ++dy)
+            {
+               for (unsigned dx = 0; dx < factor; ++dx)
+               {
+                  const double v = src[((y * factor + dy) * width +
+                        x * factor + dx) * numComponents + c];
+                  sum += v;
+                  max = (std::max)(max, v);
+               }
+            }
+            const double first = src[(y * factor * width + x * factor) *
+               numComponents + c];
+            result.push_back(mode == mm::DownsampleNearest ? first :
+                  mode == mm::DownsampleMax ? max : sum / (factor * factor));
+         }
+      }
+   }
+   return result;
+}
+
+template <typename T>
+void CheckDownsampling(unsigned numComponents, double maxValue)
+{
+   const unsigned width = 67;
+   const unsigned height = 23;
+   std::vector<T> src(width * height * numComponents);
+   for (std::size_t i = 0; i < src.size(); ++i)
+      src[i] = static_cast<T>(std::fmod(i * 7919.0 + (i % 13) * 1009.0, maxValue));
+   const unsigned bytesPerPixel = sizeof(T) * numComponents;
+
+   for (mm::DownsamplingMode mode : { mm::DownsampleMean, mm::DownsampleMax,
+         mm::DownsampleNearest })
+   {
+      for (unsigned factor : { 1, 2, 3, 5, 16 })
+      {
+         const std::vector<double> expected = ReferenceDownsample(src, width,
+               height, numComponents, factor, mode);
+
+         std::vector<T> dst(expected.size());
+         mm::DownsampleImage(reinterpret_cast<const unsigned char*>(src.data()),
+               width, height, bytesPerPixel, numComponents, factor, mode,
+               reinterpret_cast<unsigned char*>(dst.data()));
+         bool same = true;
+         for (std::size_t i = 0; i < expected.size(); ++i)
+         {
+            if (std::abs(dst[i] - expected[i]) > 0.5 + expected[i] * 1e-6)
+               same = false;
+         }
+         CHECK(same);
+
+         const double displayMin = maxValue / 4;
+         const double displayMax = maxValue / 2;
+         std::vector<std::uint8_t> dst8(expected.size());
+         mm::DownsampleImageTo8Bit(
+               reinterpret_cast<const unsigned char*>(src.data()), width,
+               height, bytesPerPixel, numComponents, factor, mode, displayMin,
+               displayMax, dst8.data());
+         same = true;
+         for (std::size_t i = 0; i < expected.size(); ++i)
+         {
+            const double scaled = (std::min)(255.0, (std::max)(0.0,
+                     (expected[i] - displayMin) * 255.0 / (displayMax - displayMin)));
+            if (std::abs(dst8[i] - scaled) > 1.0)
+               same = false;
+         }
+         CHECK(same);
+      }
+   }
+}
+
+} // anonymous namespace
+
+TEST_CASE("Downsampling matches the reference for all pixel formats", "[ImageDownsampling]")
+{
+   INFO("Instruction set: " << mm::DownsamplingInstructionSet());
+   CheckDownsampling<std::uint8_t>(1, 256.0);
+   CheckDownsampling<std::uint16_t>(1, 65536.0);
+   CheckDownsampling<float>(1, 1e6);
+   CheckDownsampling<std::uint8_t>(4, 256.0);
+   CheckDownsampling<std::uint16_t>(4, 65536.0);
+}
+
+TEST_CASE("Mean downsampling of 16-bit images does not overflow", "[ImageDownsampling]")
+{
+   const unsigned size = mm::MaxDownsamplingFactor;
+   std::vector<std::uint16_t> src(size * size, 65535);
+   std::uint16_t mean = 0;
+   mm::DownsampleImage(reinterpret_cast<const unsigned char*>(src.data()),
+         size, size, 2, 1, size, mm::DownsampleMean,
+         reinterpret_cast<unsigned char*>(&mean));
+   CHECK(mean == 65535);
+}
+
+TEST_CASE("Downsampling modes and formats are validated", "[ImageDownsampling]")
+{
+   mm::DownsamplingMode mode;
+   CHECK(mm::ParseDownsamplingMode("Max", mode));
+   CHECK(mode == mm::DownsampleMax);
+   CHECK_FALSE(mm::ParseDownsamplingMode("Median", mode));
+   CHECK(mm::IsDownsamplingSupported(2, 1));
+   CHECK(mm::IsDownsamplingSupported(8, 4));
+   CHECK_FALSE(mm::IsDownsamplingSupported(3, 1));
+
+   CMMCore c;
+   CHECK_THROWS_AS(c.getLastImageDownsampled(2, "Median"), CMMError);
+   CHECK_THROWS_AS(c.getLastImageDownsampled(0, "Mean"), CMMError);
+   CHECK_THROWS_AS(c.getLastImageDownsampled(257, "Mean"), CMMError);
+   CHECK_THROWS_AS(c.getLastImageDownsampled8Bit(2, "Mean", 100.0, 100.0), CMMError);
+   // Empty buffer
+   CHECK_THROWS_AS(c.getLastImageDownsampled(2, "Mean"), CMMError);
+}
@@ -0,0 +1,118 @@
+#include <catch2/catch_all.hpp>
+
+#include "LatestFrameBuffer.h"
+#include "MMCore.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Latest frame buffer holds the most recent frame", "[LatestFrameBuffer]")
+{
+   mm::LatestFrameBuffer buffer;
+   mm::LatestFrameBuffer::Frame frame;
+   CHECK_FALSE(buffer.CopyLatestFrame(frame));
+   CHECK(buffer.GetPublishedCount() == 0);
+
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   for (unsigned char i = 1; i <= 5; ++i)
+   {
+      std::vector<unsigned char> pixels(16 * 8 * 2, i);
+      buffer.Publish(pixels.data(), 16, 8, 2, 1, md);
+   }
+   CHECK(buffer.GetPublishedCount() == 5);
+
+   REQUIRE(buffer.CopyLatestFrame(frame));
+   CHECK(frame.width == 16);
+   CHECK(frame.height == 8);
+   CHECK(frame.bytesPerPixel == 2);
+   CHECK(frame.pixels.size() == 16 * 8 * 2);
+   CHECK(frame.pixels[0] == 5);
+   CHECK(frame.frameNumber == 4);
+
+   Metadata frameMd;
+   frame.metadata.ToMetadata(frameMd);
+   CHECK(frameMd.GetSingleTag(MM::g_Keyword_Metadata_CameraLabel).GetValue() == "Camera");
+   CHECK(frameMd.GetSingleTag("PixelType").GetValue() == "GRAY16");
+
+   // Without a newer frame, the same frame is returned
+   mm::LatestFrameBuffer::Frame again;
+   REQUIRE(buffer.CopyLatestFrame(again));
+   CHECK(again.frameNumber == 4);
+   CHECK(again.pixels[0] == 5);
+
+   unsigned char* slot = buffer.AcquireWriteSlot(4, 4, 1, 1);
+   std::memset(slot, 9, 16);
+   buffer.AbortWriteSlot();
+   CHECK(buffer.GetPublishedCount() == 5);
+   REQUIRE(buffer.CopyLatestFrame(frame));
+   CHECK(frame.pixels[0] == 5);
+
+   slot = buffer.AcquireWriteSlot(4, 4, 1, 1);
+   std::memset(slot, 9, 16);
+   buffer.CommitWriteSlot(md);
+   REQUIRE(buffer.CopyLatestFrame(frame));
+   CHECK(frame.width == 4);
+   CHECK(frame.pixels.size() == 16);
+   CHECK(frame.pixels[0] == 9);
+}
+
+TEST_CASE("Latest frame is never torn", "[LatestFrameBuffer]")
+{
+   mm::LatestFrameBuffer buffer;
+   std::atomic<bool> stop(false);
+   std::thread writer([&] {
+      Metadata md;
+      std::vector<unsigned char> pixels(256 * 256);
+      unsigned char value = 0;
+      while (!stop)
+      {
+         std::memset(pixels.data(), ++value, pixels.size());
+         buffer.Publish(pixels.data(), 256, 256, 1, 1, md);
+      }
+   });
+
+   // Two readers, each of which must see whole frames despite the other
+   // swapping the front slot
+   std::atomic<bool> intact(true);
+   std::atomic<bool> monotonic(true);
+   auto read = [&] {
+      unsigned long long lastFrameNumber = 0;
+      mm::LatestFrameBuffer::Frame frame;
+      for (int i = 0; i < 2000; ++i)
+      {
+         if (!buffer.CopyLatestFrame(frame))
+            continue;
+         if (frame.frameNumber < lastFrameNumber)
+            monotonic = false;
+         lastFrameNumber = frame.frameNumber;
+         const unsigned char value = frame.pixels[0];
+         for (std::size_t j = 0; j < frame.pixels.size(); j += 61)
+         {
+            if (frame.pixels[j] != value)
+               intact = false;
+         }
+      }
+   };
+   std::thread otherReader(read);
+   read();
+   otherReader.join();
+   stop = true;
+   writer.join();
+   CHECK(intact);
+   CHECK(monotonic);
+}
+
+TEST_CASE("CMMCore latest frame requires the feature", "[LatestFrameBuffer]")
+{
+   CMMCore c;
+   Metadata md;
+   CHECK_THROWS_AS(c.getLatestFrameMD(md), CMMError);
+   CHECK_THROWS_AS(c.getLatestFrameCount(), CMMError);
+   c.enableFeature("LatestFrameBuffers", true);
+   CHECK_THROWS_AS(c.getLatestFrameMD(md), CMMError); // No camera
+   CHECK_THROWS_AS(c.getLatestFrameCount("NoSuchCamera"), CMMError);
+   c.enableFeature("LatestFrameBuffers", false);
+}
@@ -0,0 +1,76 @@
+#include <catch2/catch_all.hpp>
+
+#include "MMCore.h"
+#include "MemoryCopy.h"
+#include "TaskSet_CopyMemory.h"
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+TEST_CASE("Non-temporal copy handles unaligned ranges", "[MemoryCopy]")
+{
+   std::vector<unsigned char> src(4096 + 64);
+   for (std::size_t i = 0; i < src.size(); ++i)
+      src[i] = static_cast<unsigned char>(i * 7 + 3);
+
+   for (std::size_t srcOffset : { 0, 1, 13 })
+   {
+      for (std::size_t dstOffset : { 0, 5, 31 })
+      {
+         for (std::size_t bytes : { 0, 1, 63, 64, 129, 1000, 4096 })
+         {
+            std::vector<unsigned char> dst(src.size(), 0);
+            mm::CopyMemoryNonTemporal(dst.data() + dstOffset,
+                  src.data() + srcOffset, bytes);
+            CHECK(std::memcmp(dst.data() + dstOffset, src.data() + srcOffset, bytes) == 0);
+            // Nothing is written outside the range
+            bool untouched = true;
+            for (std::size_t i = 0; i < dst.size(); ++i)
+            {
+               if ((i < dstOffset || i >= dstOffset + bytes) && dst[i] != 0)
+                  untouched = false;
+            }
+            CHECK(untouched);
+         }
+      }
+   }
+}
+
+TEST_CASE("Parallel copy is correct for each method", "[MemoryCopy]")
+{
+   auto pool = std::make_shared<ThreadPool>(3);
+   TaskSet_CopyMemory copy(pool);
+   std::vector<unsigned char> src(1000003);
+   for (std::size_t i = 0; i < src.size(); ++i)
+      src[i] = static_cast<unsigned char>(i % 251);
+
+   for (std::size_t taskCount = 1; taskCount <= 3; ++taskCount)
+   {
+      for (bool nonTemporal : { false, true })
+      {
+         std::vector<unsigned char> dst(src.size(), 0);
+         copy.SetUp(dst.data(), src.data(), src.size(), taskCount, nonTemporal);
+         copy.Execute();
+         copy.Wait();
+         CHECK(dst == src);
+      }
+   }
+}
+
+TEST_CASE("Image copy calibration chooses a usable tuning", "[MemoryCopy]")
+{
+   const TaskSet_CopyMemory::Tuning previous = TaskSet_CopyMemory::GetTuning();
+   CMMCore c;
+   std::map<std::string, double> result = c.calibrateImageCopy();
+   CHECK(result.count("BytesPerTask") == 1);
+   CHECK(result["BytesPerTask"] > 0.0);
+   CHECK(result.count("NonTemporalThresholdBytes") == 1);
+   CHECK(result["NonTemporalThresholdBytes"] > 0.0);
+   CHECK(double(TaskSet_CopyMemory::GetTuning().bytesPerTask) == result["BytesPerTask"]);
+   TaskSet_CopyMemory::SetTuning(previous);
+}
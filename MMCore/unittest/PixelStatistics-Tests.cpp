@@ -0,0 +1,151 @@
+#include <catch2/catch_all.hpp>
+
+#include "CircularBuffer.h"
+#include "MMCore.h"
+#include "TaskSet_PixelStatistics.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Straightforward version to compare against
+template <typename T>
+mm::PixelStatistics ReferenceStatistics(const std::vector<T>& pixels,
+      unsigned bitDepth, unsigned bins)
+{
+   mm::PixelStatistics stats;
+   stats.min = stats.max = pixels[0];
+   double sum = 0.0;
+   stats.histogram.assign(bins, 0);
+   const double range = std::pow(2.0, bitDepth);
+   for (T v : pixels)
+   {
+      stats.min = (std::min)(stats.min, double(v));
+      stats.max = (std::max)(stats.max, double(v));
+      sum += v;
+      if (v >= range - 1)
+         ++stats.saturatedCount;
+      if (bins > 0)
+      {
+         const double width = (std::max)(1.0, range / bins);
+         ++stats.histogram[(std::min)(unsigned(v / width), bins - 1)];
+      }
+   }
+   stats.mean = sum / pixels.size();
+   return stats;
+}
+
+template <typename T>
+void CheckStatistics(TaskSet_PixelStatistics& tasks, std::size_t count,
+      unsigned bitDepth, unsigned bins)
+{
+   std::vector<T> pixels(count);
+   const unsigned maxValue = (1u << bitDepth) - 1;
+   for (std::size_t i = 0; i < count; ++i)
+      pixels[i] = static_cast<T>((i * 7919 + (i % 13) * 1009) % (maxValue + 1));
+   pixels[count / 2] = static_cast<T>(maxValue);
+   if (count > 8)
+      pixels[3] = static_cast<T>(maxValue);
+
+   const mm::PixelStatistics expected = ReferenceStatistics(pixels, bitDepth, bins);
+   mm::PixelStatistics stats;
+   tasks.Compute(pixels.data(), count, sizeof(T), bitDepth, bins, stats);
+   CHECK(stats.min == expected.min);
+   CHECK(stats.max == expected.max);
+   CHECK(stats.mean == expected.mean);
+   CHECK(stats.saturatedCount == expected.saturatedCount);
+   CHECK(stats.histogram == expected.histogram);
+}
+
+} // anonymous namespace
+
+TEST_CASE("Pixel statistics match the reference", "[PixelStatistics]")
+{
+   TaskSet_PixelStatistics tasks(std::make_shared<ThreadPool>(3));
+
+   // Small images use a single task; the large ones are split, with
+   // lengths not divisible by the vector width or the task count
+   for (std::size_t count : { 1, 15, 1001, 1500001 })
+   {
+      CheckStatistics<std::uint8_t>(tasks, count, 8, 0);
+      CheckStatistics<std::uint8_t>(tasks, count, 8, 256);
+      CheckStatistics<std::uint8_t>(tasks, count, 6, 4096);
+      CheckStatistics<std::uint16_t>(tasks, count, 16, 256);
+      CheckStatistics<std::uint16_t>(tasks, count, 12, 4096);
+      CheckStatistics<std::uint16_t>(tasks, count, 11, 0);
+   }
+
+   std::vector<float> pixels = { 1.5f, -2.0f, 8.25f, 0.0f };
+   mm::PixelStatistics stats;
+   tasks.Compute(pixels.data(), pixels.size(), 4, 32, 256, stats);
+   CHECK(stats.min == -2.0);
+   CHECK(stats.max == 8.25);
+   CHECK(stats.mean == 1.9375);
+   CHECK(stats.saturatedCount == 0);
+   CHECK(stats.histogram.empty());
+
+   CHECK(TaskSet_PixelStatistics::IsSupported(2, 1));
+   CHECK_FALSE(TaskSet_PixelStatistics::IsSupported(4, 4));
+}
+
+TEST_CASE("Inserted frames carry their pixel statistics", "[PixelStatistics]")
+{
+   CircularBuffer cb(8, mm::BufferAllocationOptions(),
+         mm::BufferMemory::ProgressFunction(), std::make_shared<ThreadPool>(2));
+   REQUIRE(cb.Initialize(2, 64, 32, 2));
+
+   std::vector<std::uint16_t> pixels(2 * 64 * 32, 100);
+   pixels[5] = 4095; // Saturated at 12 bits
+   pixels[64 * 32] = 7; // Second channel
+
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   REQUIRE(cb.InsertMultiChannel(reinterpret_cast<unsigned char*>(pixels.data()),
+         2, 64, 32, 2, &md));
+   CHECK(cb.GetNthFromTopImageBuffer(0, 0)->GetFrameMetadata().GetPixelStatistics() == nullptr);
+
+   cb.SetPixelStatistics(true, 12, 256);
+   REQUIRE(cb.InsertMultiChannel(reinterpret_cast<unsigned char*>(pixels.data()),
+         2, 64, 32, 2, &md));
+
+   const mm::PixelStatistics* stats =
+      cb.GetNthFromTopImageBuffer(0, 0)->GetFrameMetadata().GetPixelStatistics();
+   REQUIRE(stats != nullptr);
+   CHECK(stats->min == 100);
+   CHECK(stats->max == 4095);
+   CHECK(stats->saturatedCount == 1);
+   REQUIRE(stats->histogram.size() == 256);
+   CHECK(stats->histogram[100 / 16] == 64 * 32 - 1);
+   CHECK(stats->histogram[255] == 1);
+
+   stats = cb.GetNthFromTopImageBuffer(0, 1)->GetFrameMetadata().GetPixelStatistics();
+   REQUIRE(stats != nullptr);
+   CHECK(stats->min == 7);
+   CHECK(stats->saturatedCount == 0);
+
+   Metadata imgMd = cb.GetNthFromTopImageBuffer(0, 0)->GetMetadata();
+   CHECK(imgMd.GetSingleTag(MM::g_Keyword_Metadata_PixelMax).GetValue() == "4095");
+   CHECK(imgMd.GetSingleTag(MM::g_Keyword_Metadata_SaturatedPixelCount).GetValue() == "1");
+   CHECK(imgMd.GetArrayTag(MM::g_Keyword_Metadata_PixelHistogram).GetSize() == 256);
+}
+
+TEST_CASE("Pixel statistics histogram sizes are validated", "[PixelStatistics]")
+{
+   CMMCore c;
+   CHECK(c.getPixelStatisticsHistogramBins() == 0);
+   c.setPixelStatisticsHistogramBins(4096);
+   CHECK(c.getPixelStatisticsHistogramBins() == 4096);
+   CHECK_THROWS_AS(c.setPixelStatisticsHistogramBins(1000), CMMError);
+   CHECK(c.getPixelStatisticsHistogramBins() == 4096);
+
+   c.enableFeature("FramePixelStatistics", true);
+   CHECK(c.isFeatureEnabled("FramePixelStatistics"));
+   c.enableFeature("FramePixelStatistics", false);
+}
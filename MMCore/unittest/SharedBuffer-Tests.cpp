@@ -0,0 +1,150 @@
+#include <catch2/catch_all.hpp>
+
+#include "CircularBuffer.h"
+#include "CoreFeatures.h"
+#include "SharedBufferReader/SharedBufferReader.h"
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string UniqueSegmentName()
+{
+   return "MMCoreTest-" + std::to_string(
+         std::chrono::steady_clock::now().time_since_epoch().count());
+}
+
+std::unique_ptr<CircularBuffer> SharedBuffer(const std::string& name)
+{
+   mm::BufferAllocationOptions options;
+   options.sharedMemoryName = name;
+   std::unique_ptr<CircularBuffer> cb(new CircularBuffer(1, options));
+   REQUIRE(cb->Initialize(1, 512, 512, 1));
+   return cb;
+}
+
+bool InsertFrame(CircularBuffer& cb, unsigned char value)
+{
+   std::vector<unsigned char> pixels(512 * 512, value);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   return cb.InsertImage(pixels.data(), 512, 512, 1, &md);
+}
+
+}
+
+TEST_CASE("Shared buffer frames can be read by name", "[SharedBuffer]")
+{
+   const std::string name = UniqueSegmentName();
+   std::unique_ptr<CircularBuffer> cb = SharedBuffer(name);
+   REQUIRE(cb->GetSize() == 4);
+
+   mm::sharedbuffer::Reader reader(name);
+   CHECK(reader.GetPublishedCount() == 0);
+   CHECK_FALSE(reader.IsWriterClosed());
+   CHECK_FALSE(reader.WaitForFrame(0, 10));
+
+   REQUIRE(InsertFrame(*cb, 7));
+   REQUIRE(reader.WaitForFrame(0, 0));
+   mm::sharedbuffer::Frame frame;
+   REQUIRE(reader.Peek(0, frame));
+   CHECK(frame.width == 512);
+   CHECK(frame.height == 512);
+   CHECK(frame.bytesPerPixel == 1);
+   CHECK(frame.numComponents == 1);
+   CHECK(frame.numChannels == 1);
+   CHECK(frame.bytes == 512 * 512);
+   CHECK(frame.imageNumber == 0);
+   CHECK(frame.cameraLabel == "Camera");
+   CHECK(frame.pixels[0] == 7);
+   CHECK(frame.pixels[512 * 512 - 1] == 7);
+   CHECK(reader.IsIntact(frame));
+
+   // The Core's own reader works as usual and does not affect the export
+   CHECK(cb->GetNextImageBuffer(0)->GetPixels()[0] == 7);
+   CHECK(reader.IsIntact(frame));
+   CHECK_FALSE(reader.Peek(1, frame));
+}
+
+TEST_CASE("Shared buffer frames are invalidated when overwritten", "[SharedBuffer]")
+{
+   const std::string name = UniqueSegmentName();
+   std::unique_ptr<CircularBuffer> cb = SharedBuffer(name);
+   mm::sharedbuffer::Reader reader(name);
+
+   for (unsigned char i = 0; i < 4; ++i)
+      REQUIRE(InsertFrame(*cb, i));
+   mm::sharedbuffer::Frame oldest;
+   REQUIRE(reader.Peek(0, oldest));
+
+   // Make room for one frame, which reuses the oldest frame's memory
+   REQUIRE(cb->GetNextImageBuffer(0) != nullptr);
+   REQUIRE(InsertFrame(*cb, 4));
+   CHECK_FALSE(reader.IsIntact(oldest));
+   CHECK_FALSE(reader.Peek(0, oldest));
+
+   mm::sharedbuffer::Frame frame;
+   std::vector<unsigned char> pixels;
+   for (unsigned char i = 1; i < 5; ++i)
+   {
+      REQUIRE(reader.Copy(i, frame, pixels));
+      CHECK(pixels[0] == i);
+   }
+   REQUIRE(reader.PeekLatest(frame));
+   CHECK(frame.frameNumber == 4);
+
+   // Frame numbers continue across clearing
+   cb->Clear();
+   CHECK(reader.GetClearCount() == 2); // Initialize() cleared it, too
+   CHECK_FALSE(reader.Peek(4, frame));
+   REQUIRE(InsertFrame(*cb, 5));
+   REQUIRE(reader.Peek(5, frame));
+   CHECK(frame.imageNumber == 0);
+}
+
+TEST_CASE("Shared buffer readers see the writer close", "[SharedBuffer]")
+{
+   const std::string name = UniqueSegmentName();
+   std::unique_ptr<CircularBuffer> cb = SharedBuffer(name);
+   {
+      mm::BufferAllocationOptions options;
+      options.sharedMemoryName = name;
+      CircularBuffer duplicate(1, options);
+      CHECK_THROWS_AS(duplicate.Initialize(1, 512, 512, 1), CMMError);
+   }
+
+   mm::sharedbuffer::Reader reader(name);
+   REQUIRE(InsertFrame(*cb, 1));
+   cb.reset();
+   CHECK(reader.IsWriterClosed());
+   mm::sharedbuffer::Frame frame;
+   CHECK(reader.Peek(0, frame)); // Still mapped by the reader
+
+   CHECK_THROWS_AS(mm::sharedbuffer::Reader(name), std::runtime_error);
+}
+
+TEST_CASE("Shared buffer frames are exported uncompressed", "[SharedBuffer]")
+{
+   const std::string name = UniqueSegmentName();
+   mm::BufferAllocationOptions options;
+   options.sharedMemoryName = name;
+   CircularBuffer cb(1, options);
+   mm::features::enableFeature("CompressedSequenceBuffer", true);
+   const bool initialized = cb.Initialize(1, 512, 512, 1);
+   mm::features::enableFeature("CompressedSequenceBuffer", false);
+   REQUIRE(initialized);
+   CHECK_FALSE(cb.IsCompressed());
+
+   mm::sharedbuffer::Reader reader(name);
+   REQUIRE(InsertFrame(cb, 9));
+   mm::sharedbuffer::Frame frame;
+   REQUIRE(reader.Peek(0, frame));
+   CHECK(frame.bytes == 512 * 512);
+   CHECK(frame.pixels[0] == 9);
+   CHECK(frame.pixels[512 * 512 - 1] == 9);
+   CHECK(reader.IsIntact(frame));
+}
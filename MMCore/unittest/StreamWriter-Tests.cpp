@@ -0,0 +1,136 @@
+#include <catch2/catch_all.hpp>
+
+#include "CircularBuffer.h"
+#include "LogManager.h"
+#include "MMCore.h"
+#include "StreamWriter.h"
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+void InsertImages(CircularBuffer& cb, int count)
+{
+   std::vector<unsigned char> pixels(64 * 32 * 2);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   for (int i = 0; i < count; ++i)
+   {
+      pixels[0] = static_cast<unsigned char>(i);
+      REQUIRE(cb.InsertImage(pixels.data(), 64, 32, 2, &md));
+   }
+}
+
+long FileSize(const std::string& path)
+{
+   std::ifstream f(path.c_str(), std::ios::binary | std::ios::ate);
+   return f ? static_cast<long>(f.tellg()) : -1;
+}
+
+}
+
+TEST_CASE("StreamWriter writes raw images and index", "[StreamWriter]")
+{
+   const std::string path = "StreamWriter-Tests.raw";
+   std::remove(path.c_str());
+   std::remove((path + ".idx").c_str());
+
+   mm::LogManager logManager;
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 64, 32, 2));
+   InsertImages(cb, 3);
+   {
+      mm::StreamWriter writer(&cb, path, mm::StreamWriter::FormatRaw, false,
+            logManager.NewLogger("Test"));
+      InsertImages(cb, 2);
+      writer.Stop();
+      CHECK_FALSE(writer.IsRunning());
+      CHECK(writer.GetStatistics()["FramesWritten"] == 5.0);
+   }
+   CHECK(cb.GetRemainingImageCount() == 0);
+   CHECK(FileSize(path) == 5 * 64 * 32 * 2);
+
+   std::ifstream index((path + ".idx").c_str());
+   std::string line;
+   int lines = 0;
+   while (std::getline(index, line))
+      ++lines;
+   CHECK(lines == 6); // Header and one line per image
+
+   // Existing files are not overwritten
+   CHECK_THROWS_AS(mm::StreamWriter(&cb, path, mm::StreamWriter::FormatRaw,
+            false, logManager.NewLogger("Test")), CMMError);
+
+   std::remove(path.c_str());
+   std::remove((path + ".idx").c_str());
+}
+
+TEST_CASE("StreamWriter writes TIFF", "[StreamWriter]")
+{
+   const std::string path = "StreamWriter-Tests.tif";
+   std::remove(path.c_str());
+
+   mm::LogManager logManager;
+   CircularBuffer cb(1);
+   REQUIRE(cb.Initialize(1, 64, 32, 2));
+   InsertImages(cb, 4);
+   mm::StreamWriter writer(&cb, path, mm::StreamWriter::FormatTIFF, false,
+         logManager.NewLogger("Test"));
+   writer.Stop();
+
+   // Header, then a directory (126 bytes) and the pixels for each page
+   CHECK(FileSize(path) == 8 + 4 * (126 + 64 * 32 * 2));
+   std::ifstream f(path.c_str(), std::ios::binary);
+   char header[4];
+   f.read(header, 4);
+   CHECK(std::string(header, 4) == std::string("II*\0", 4));
+
+   CHECK_THROWS_AS(mm::StreamWriter::ParseFormat("jpeg"), CMMError);
+   std::remove(path.c_str());
+}
+
+TEST_CASE("StreamWriter statistics outlive the buffer", "[StreamWriter]")
+{
+   const std::string path = "StreamWriter-Tests-Stats.raw";
+   std::remove(path.c_str());
+   std::remove((path + ".idx").c_str());
+
+   mm::LogManager logManager;
+   std::unique_ptr<CircularBuffer> cb(new CircularBuffer(1));
+   REQUIRE(cb->Initialize(1, 64, 32, 2));
+   std::vector<unsigned char> pixels(64 * 32 * 2);
+   Metadata md;
+   md.put(MM::g_Keyword_Metadata_CameraLabel, "Camera");
+   unsigned long inserted = 0;
+   while (cb->InsertImage(pixels.data(), 64, 32, 2, &md))
+      ++inserted;
+   REQUIRE(cb->Overflow());
+
+   mm::StreamWriter writer(cb.get(), path, mm::StreamWriter::FormatRaw,
+         false, logManager.NewLogger("Test"));
+   writer.Stop();
+   cb.reset();
+
+   std::map<std::string, double> stats = writer.GetStatistics();
+   CHECK(stats["FramesWritten"] == static_cast<double>(inserted));
+   CHECK(stats["BufferOverflowed"] == 1.0);
+
+   std::remove(path.c_str());
+   std::remove((path + ".idx").c_str());
+}
+
+TEST_CASE("CMMCore does not stream from per-camera buffers", "[StreamWriter]")
+{
+   const std::string path = "StreamWriter-Tests-PerCamera.raw";
+   CMMCore c;
+   c.enableFeature("PerCameraSequenceBuffers", true);
+   CHECK_THROWS_AS(c.startStreamingToDisk(path.c_str(), "raw"), CMMError);
+   CHECK_FALSE(c.isStreamingToDisk());
+   c.enableFeature("PerCameraSequenceBuffers", false);
+   CHECK(FileSize(path) == -1);
+}
@@ -0,0 +1,96 @@
+#include <catch2/catch_all.hpp>
+
+#include "MMCore.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+TEST_CASE("Thread pool runs submitted jobs", "[ThreadPool]")
+{
+   ThreadPool pool(3);
+   CHECK(pool.GetSize() == 3);
+   CHECK_FALSE(pool.IsWorkerThread());
+
+   std::vector<std::future<int>> results;
+   for (int i = 0; i < 100; ++i)
+      results.push_back(pool.Submit([i] { return i * i; }));
+   for (int i = 0; i < 100; ++i)
+      CHECK(results[i].get() == i * i);
+
+   std::future<void> failing = pool.Submit([] { throw std::runtime_error("failed"); });
+   CHECK_THROWS_AS(failing.get(), std::runtime_error);
+
+   // Jobs submitted from a pool thread run right away on that thread
+   std::future<bool> nested = pool.Submit([&pool] {
+      std::future<bool> inner = pool.Submit([&pool] { return pool.IsWorkerThread(); });
+      return inner.wait_for(std::chrono::seconds(0)) == std::future_status::ready &&
+         inner.get();
+   });
+   CHECK(nested.get());
+}
+
+TEST_CASE("Thread pool workers steal queued jobs", "[ThreadPool]")
+{
+   ThreadPool pool(2);
+   std::promise<void> release;
+   std::shared_future<void> released = release.get_future().share();
+   std::future<void> blocking = pool.Submit([released] { released.wait(); });
+
+   // Half of these are queued behind the blocked job
+   std::atomic<int> done(0);
+   std::vector<std::future<void>> quick;
+   for (int i = 0; i < 20; ++i)
+      quick.push_back(pool.Submit([&done] { ++done; }));
+   for (auto& f : quick)
+      REQUIRE(f.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+   CHECK(done == 20);
+
+   release.set_value();
+   blocking.get();
+}
+
+TEST_CASE("Thread pool can be resized with work queued", "[ThreadPool]")
+{
+   ThreadPool pool(1);
+   std::promise<void> release;
+   std::shared_future<void> released = release.get_future().share();
+   std::future<void> blocking = pool.Submit([released] { released.wait(); });
+   std::future<int> queued = pool.Submit([] { return 42; });
+
+   std::thread resizer([&pool] { pool.Reconfigure(4, true); });
+   release.set_value(); // Reconfigure() waits for running jobs
+   resizer.join();
+   CHECK(pool.GetSize() == 4);
+   CHECK(pool.GetPinThreads());
+   blocking.get();
+   CHECK(queued.get() == 42);
+}
+
+TEST_CASE("CMMCore thread pool properties", "[ThreadPool]")
+{
+   CMMCore c;
+   CHECK(c.getThreadPoolSize() >= 1);
+   CHECK_FALSE(c.getThreadPoolAffinity());
+
+   c.setThreadPoolSize(2);
+   CHECK(c.getThreadPoolSize() == 2);
+   CHECK(c.getProperty("Core", "ThreadPoolSize") == "2");
+
+   c.setProperty("Core", "ThreadPoolSize", "1");
+   CHECK(c.getThreadPoolSize() == 1);
+   c.setProperty("Core", "ThreadPoolAffinity", "1");
+   CHECK(c.getThreadPoolAffinity());
+   CHECK(c.getThreadPoolSize() == 1);
+
+   CHECK_THROWS_AS(c.setProperty("Core", "ThreadPoolSize", "-1"), CMMError);
+   CHECK_THROWS_AS(c.setThreadPoolSize(100000), CMMError);
+
+   c.setThreadPoolSize(0);
+   CHECK(c.getThreadPoolSize() >= 1);
+   CHECK(c.getProperty("Core", "ThreadPoolSize") == std::to_string(c.getThreadPoolSize()));
+}
@@ -0,0 +1,219 @@
+#include <catch2/catch_all.hpp>
+
+#include "CircularBuffer.h"
+#include "CoreCallback.h"
+#include "MMCore.h"
+
+#include "../MMDevice/DeviceBase.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const unsigned width = 4, height = 4;
+
+// Sends the frame callbacks to its own buffer, recording them
+class RecordingCore : public CoreCallback
+{
+public:
+   explicit RecordingCore(CMMCore* core) :
+      CoreCallback(core), buffer(1), frameHeld(false), acquires(0), copies(0)
+   {
+      buffer.Initialize(1, width, height, 1);
+   }
+
+   int AcquireWritableFrame(const MM::Device*, unsigned w, unsigned h,
+         unsigned byteDepth, unsigned nComponents, unsigned char** ppBuf)
+   {
+      ++acquires;
+      *ppBuf = buffer.AcquireWriteSlot(w, h, byteDepth, nComponents);
+      if (!*ppBuf)
+         return DEVICE_BUFFER_OVERFLOW;
+      frameHeld = true;
+      return DEVICE_OK;
+   }
+
+   int CommitFrame(const MM::Device*, const char* const* mdKeys,
+         const char* const* mdValues, unsigned mdCount, const bool = true)
+   {
+      frameHeld = false;
+      const Metadata md = ToMetadata(mdKeys, mdValues, mdCount);
+      return buffer.CommitWriteSlot(&md) ? DEVICE_OK : DEVICE_ERR;
+   }
+
+   int AbortFrame(const MM::Device*)
+   {
+      frameHeld = false;
+      buffer.AbortWriteSlot();
+      return DEVICE_OK;
+   }
+
+   int InsertImage(const MM::Device*, const unsigned char* buf, unsigned w,
+         unsigned h, unsigned byteDepth, unsigned,
+         const char* const* mdKeys, const char* const* mdValues,
+         unsigned mdCount, const bool = true)
+   {
+      ++copies;
+      const Metadata md = ToMetadata(mdKeys, mdValues, mdCount);
+      return buffer.InsertImage(buf, w, h, byteDepth, &md) ?
+         DEVICE_OK : DEVICE_BUFFER_OVERFLOW;
+   }
+
+   CircularBuffer buffer;
+   bool frameHeld;
+   int acquires;
+   int copies;
+
+private:
+   static Metadata ToMetadata(const char* const* keys,
+         const char* const* values, unsigned count)
+   {
+      Metadata md;
+      for (unsigned i = 0; i < count; ++i)
+         md.put(keys[i], values[i]);
+      return md;
+   }
+};
+
+// Exposes a frame of a single value, then transfers it
+class SplitSnapCamera : public CCameraBase<SplitSnapCamera>
+{
+public:
+   SplitSnapCamera(RecordingCore& core, bool zeroCopy) :
+      core_(core), zeroCopy_(zeroCopy), pixels_(width * height),
+      exposures(0), exposuresWhileHeld(0), transfers(0), snaps(0),
+      failTransfer(false)
+   {
+      SetCallback(&core);
+      SetLabel("Camera");
+   }
+
+   int Initialize() { return DEVICE_OK; }
+   int Shutdown() { return DEVICE_OK; }
+   void GetName(char* name) const
+   { CDeviceUtils::CopyLimitedString(name, "SplitSnapCamera"); }
+
+   bool SupportsZeroCopy() const { return zeroCopy_; }
+
+   int ExposeImageForBuffer()
+   {
+      ++exposures;
+      if (core_.frameHeld)
+         ++exposuresWhileHeld;
+      std::memset(pixels_.data(), exposures, pixels_.size());
+      return DEVICE_OK;
+   }
+
+   int SnapImageIntoBuffer(unsigned char* pBuf)
+   {
+      if (failTransfer)
+      {
+         pBuf[0] = 0xff; // Partially transferred
+         return DEVICE_ERR;
+      }
+      ++transfers;
+      std::memcpy(pBuf, pixels_.data(), pixels_.size());
+      return DEVICE_OK;
+   }
+
+   int SnapImage()
+   {
+      ++snaps;
+      std::memset(pixels_.data(), 100 + snaps, pixels_.size());
+      return DEVICE_OK;
+   }
+   const unsigned char* GetImageBuffer() { return pixels_.data(); }
+   unsigned GetImageWidth() const { return width; }
+   unsigned GetImageHeight() const { return height; }
+   unsigned GetImageBytesPerPixel() const { return 1; }
+   unsigned GetBitDepth() const { return 8; }
+   long GetImageBufferSize() const { return width * height; }
+   double GetExposure() const { return 1.0; }
+   void SetExposure(double) {}
+   int SetROI(unsigned, unsigned, unsigned, unsigned) { return DEVICE_OK; }
+   int GetROI(unsigned& x, unsigned& y, unsigned& xSize, unsigned& ySize)
+   { x = y = 0; xSize = width; ySize = height; return DEVICE_OK; }
+   int ClearROI() { return DEVICE_OK; }
+   int GetBinning() const { return 1; }
+   int SetBinning(int) { return DEVICE_OK; }
+   int IsExposureSequenceable(bool& seq) const { seq = false; return DEVICE_OK; }
+
+   // One iteration of the sequence acquisition thread
+   int RunOnce() { return ThreadRun(); }
+
+private:
+   RecordingCore& core_;
+   bool zeroCopy_;
+   std::vector<unsigned char> pixels_;
+
+public:
+   int exposures;
+   int exposuresWhileHeld;
+   int transfers;
+   int snaps;
+   bool failTransfer;
+};
+
+}
+
+TEST_CASE("Zero-copy cameras expose before holding a frame", "[ZeroCopyCamera]")
+{
+   CMMCore mmcore;
+   RecordingCore core(&mmcore);
+   SplitSnapCamera camera(core, true);
+
+   for (int i = 0; i < 3; ++i)
+      REQUIRE(camera.RunOnce() == DEVICE_OK);
+   CHECK(camera.exposures == 3);
+   CHECK(camera.exposuresWhileHeld == 0);
+   CHECK(camera.transfers == 3);
+   CHECK(camera.snaps == 0);
+   CHECK(core.copies == 0);
+
+   REQUIRE(core.buffer.GetRemainingImageCount() == 3);
+   for (int i = 1; i <= 3; ++i)
+   {
+      const mm::ImgBuffer* img = core.buffer.GetNextImageBuffer(0);
+      REQUIRE(img != nullptr);
+      CHECK(img->GetPixels()[0] == i);
+      CHECK(img->GetPixels()[width * height - 1] == i);
+   }
+}
+
+TEST_CASE("Failed transfers abort the frame", "[ZeroCopyCamera]")
+{
+   CMMCore mmcore;
+   RecordingCore core(&mmcore);
+   SplitSnapCamera camera(core, true);
+
+   camera.failTransfer = true;
+   CHECK(camera.RunOnce() == DEVICE_ERR);
+   CHECK_FALSE(core.frameHeld);
+   CHECK(core.buffer.GetWriteSlot() == nullptr);
+   CHECK(core.buffer.GetRemainingImageCount() == 0);
+
+   camera.failTransfer = false;
+   REQUIRE(camera.RunOnce() == DEVICE_OK);
+   const mm::ImgBuffer* img = core.buffer.GetNextImageBuffer(0);
+   REQUIRE(img != nullptr);
+   CHECK(img->GetPixels()[0] == 2);
+   CHECK(img->GetMetadata().GetSingleTag(
+            MM::g_Keyword_Metadata_ImageNumber).GetValue() == "0");
+}
+
+TEST_CASE("Cameras without zero-copy support are never probed", "[ZeroCopyCamera]")
+{
+   CMMCore mmcore;
+   RecordingCore core(&mmcore);
+   SplitSnapCamera camera(core, false);
+
+   REQUIRE(camera.RunOnce() == DEVICE_OK);
+   CHECK(core.acquires == 0);
+   CHECK(camera.exposures == 0);
+   CHECK(camera.snaps == 1);
+   CHECK(core.copies == 1);
+   const mm::ImgBuffer* img = core.buffer.GetNextImageBuffer(0);
+   REQUIRE(img != nullptr);
+   CHECK(img->GetPixels()[0] == 101);
+}
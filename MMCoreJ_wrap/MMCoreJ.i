@@ -510,6 +510,181 @@
    }
 }
 
+// Java typemaps
+// map the void* return values of getLastImageDownsampled() and
+// getLastImageDownsampled8Bit() as for void* above, but with the reduced
+// image size
+//
+// Assumes that class has the following methods defined:
+// unsigned GetImageWidth()
+// unsigned GetImageHeight()
+// unsigned GetNumberOfComponents()
+
+%typemap(out) void* getLastImageDownsampled
+{
+   long lSize = ((arg1)->getImageWidth() / arg2) * ((arg1)->getImageHeight() / arg2);
+   unsigned bytesPerPixel = (arg1)->getBytesPerPixel();
+   unsigned numComponents = (arg1)->getNumberOfComponents();
+
+   jarray data = 0;
+   if (bytesPerPixel == 1)
+   {
+      jbyteArray a = JCALL1(NewByteArray, jenv, lSize);
+      if (a != 0)
+         JCALL4(SetByteArrayRegion, jenv, a, 0, lSize, (jbyte*)result);
+      data = a;
+   }
+   else if (bytesPerPixel == 2)
+   {
+      jshortArray a = JCALL1(NewShortArray, jenv, lSize);
+      if (a != 0)
+         JCALL4(SetShortArrayRegion, jenv, a, 0, lSize, (jshort*)result);
+      data = a;
+   }
+   else if (bytesPerPixel == 4 && numComponents == 1)
+   {
+      jfloatArray a = JCALL1(NewFloatArray, jenv, lSize);
+      if (a != 0)
+         JCALL4(SetFloatArrayRegion, jenv, a, 0, lSize, (jfloat*)result);
+      data = a;
+   }
+   else if (bytesPerPixel == 4)
+   {
+      jbyteArray a = JCALL1(NewByteArray, jenv, lSize * 4);
+      if (a != 0)
+         JCALL4(SetByteArrayRegion, jenv, a, 0, lSize * 4, (jbyte*)result);
+      data = a;
+   }
+   else if (bytesPerPixel == 8)
+   {
+      jshortArray a = JCALL1(NewShortArray, jenv, lSize * 4);
+      if (a != 0)
+         JCALL4(SetShortArrayRegion, jenv, a, 0, lSize * 4, (jshort*)result);
+      data = a;
+   }
+   else
+   {
+      // don't know how to map
+      $result = 0;
+      return $result;
+   }
+
+   if (data == 0)
+   {
+      jclass excep = jenv->FindClass("java/lang/OutOfMemoryError");
+      if (excep)
+         jenv->ThrowNew(excep, "The system ran out of memory!");
+      $result = 0;
+      return $result;
+   }
+   $result = data;
+}
+
+%typemap(out) void* getLastImageDownsampled8Bit
+{
+   long lSize = ((arg1)->getImageWidth() / arg2) * ((arg1)->getImageHeight() / arg2) *
+      (arg1)->getNumberOfComponents();
+
+   jbyteArray data = JCALL1(NewByteArray, jenv, lSize);
+   if (data == 0)
+   {
+      jclass excep = jenv->FindClass("java/lang/OutOfMemoryError");
+      if (excep)
+         jenv->ThrowNew(excep, "The system ran out of memory!");
+      $result = 0;
+      return $result;
+   }
+   JCALL4(SetByteArrayRegion, jenv, data, 0, lSize, (jbyte*)result);
+   $result = data;
+}
+
+// Java typemap
+// change default SWIG mapping of std::vector<ImageLease> return values
+// (popNextImages(), see below) to return a List of pixel arrays, each mapped
+// as for void* above but sized by the leased image itself. The pixels are
+// copied straight out of the circular buffer; the leases are released when
+// the conversion is done.
+
+%typemap(jni) std::vector<ImageLease>        "jobject"
+%typemap(jtype) std::vector<ImageLease>      "java.util.List<Object>"
+%typemap(jstype) std::vector<ImageLease>     "java.util.List<Object>"
+%typemap(javaout) std::vector<ImageLease> {
+   return $jnicall;
+}
+%typemap(out) std::vector<ImageLease>
+{
+   const std::vector<ImageLease>& images = $1;
+
+   jclass listClass = jenv->FindClass("java/util/ArrayList");
+   jmethodID listCtor = jenv->GetMethodID(listClass, "<init>", "(I)V");
+   jmethodID listAdd = jenv->GetMethodID(listClass, "add", "(Ljava/lang/Object;)Z");
+   jobject list = jenv->NewObject(listClass, listCtor, (jint)images.size());
+
+   for (size_t i = 0; i < images.size(); ++i)
+   {
+      long lSize = images[i].getImageWidth() * images[i].getImageHeight();
+      unsigned bytesPerPixel = images[i].getBytesPerPixel();
+      unsigned numComponents = images[i].getNumberOfComponents();
+      const void* pixels = images[i].getPixels();
+
+      jarray data = 0;
+      if (bytesPerPixel == 1)
+      {
+         jbyteArray a = JCALL1(NewByteArray, jenv, lSize);
+         if (a != 0)
+            JCALL4(SetByteArrayRegion, jenv, a, 0, lSize, (jbyte*)pixels);
+         data = a;
+      }
+      else if (bytesPerPixel == 2)
+      {
+         jshortArray a = JCALL1(NewShortArray, jenv, lSize);
+         if (a != 0)
+            JCALL4(SetShortArrayRegion, jenv, a, 0, lSize, (jshort*)pixels);
+         data = a;
+      }
+      else if (bytesPerPixel == 4 && numComponents == 1)
+      {
+         jfloatArray a = JCALL1(NewFloatArray, jenv, lSize);
+         if (a != 0)
+            JCALL4(SetFloatArrayRegion, jenv, a, 0, lSize, (jfloat*)pixels);
+         data = a;
+      }
+      else if (bytesPerPixel == 4)
+      {
+         jbyteArray a = JCALL1(NewByteArray, jenv, lSize * 4);
+         if (a != 0)
+            JCALL4(SetByteArrayRegion, jenv, a, 0, lSize * 4, (jbyte*)pixels);
+         data = a;
+      }
+      else if (bytesPerPixel == 8)
+      {
+         jshortArray a = JCALL1(NewShortArray, jenv, lSize * 4);
+         if (a != 0)
+            JCALL4(SetShortArrayRegion, jenv, a, 0, lSize * 4, (jshort*)pixels);
+         data = a;
+      }
+      else
+      {
+         // don't know how to map
+         $result = 0;
+         return $result;
+      }
+
+      if (data == 0)
+      {
+         jclass excep = jenv->FindClass("java/lang/OutOfMemoryError");
+         if (excep)
+            jenv->ThrowNew(excep, "The system ran out of memory!");
+         $result = 0;
+         return $result;
+      }
+      jenv->CallBooleanMethod(list, listAdd, data);
+      jenv->DeleteLocalRef(data);
+   }
+
+   $result = list;
+}
+
 // Java typemap
 // change default SWIG mapping of void* return values
 // to return CObject containing array of pixel values
@@ -632,6 +807,29 @@
 %ignore MetadataKeyError;
 %ignore MetadataIndexError;
 
+// The void* typemap above sizes pixel arrays using the current camera, which
+// is wrong for images from another camera's own sequence buffer.
+%ignore CMMCore::getLastImage(const char*);
+%ignore CMMCore::getLastImageMD(const char*, Metadata&) const;
+%ignore CMMCore::popNextImage(const char*);
+%ignore CMMCore::popNextImageMD(const char*, Metadata&);
+%ignore CMMCore::getLatestFrameMD(const char*, Metadata&);
+
+// Leases only avoid copying pixels in C++; Java receives copies anyway.
+%ignore ImageLease;
+%ignore CMMCore::getLastImageLease;
+%ignore CMMCore::popNextImageLease;
+%ignore CMMCore::popNextImageLeases;
+
+// Mock device adapters are implemented in C++, for testing
+%ignore MockDeviceAdapter;
+%ignore CMMCore::loadMockDeviceAdapter;
+
+// Java's popNextImages() converts leased images, instead of copying the
+// pixels once into C++ storage and then again into Java arrays.
+%ignore CMMCore::popNextImages;
+%rename(popNextImages) CMMCore::popNextImageLeasesMD;
+
 
 %typemap(javaimports) CMMCore %{
    import mmcorej.org.json.JSONObject;
@@ -806,6 +1004,22 @@
       return popNextTaggedImage(0);
    }
 
+   public java.util.List<TaggedImage> popNextTaggedImages(int maxCount) throws java.lang.Exception {
+      MetadataVector mds = new MetadataVector();
+      java.util.List<Object> pixels = popNextImages(maxCount, mds);
+      java.util.List<TaggedImage> images = new java.util.ArrayList<TaggedImage>(pixels.size());
+      for (int i = 0; i < pixels.size(); ++i) {
+         images.add(createTaggedImage(pixels.get(i), mds.get(i), 0));
+      }
+      return images;
+   }
+
+   public TaggedImage waitForNextTaggedImage(int timeoutMs) throws java.lang.Exception {
+      Metadata md = new Metadata();
+      Object pixels = waitForNextImageMD(timeoutMs, md);
+      return createTaggedImage(pixels, md, 0);
+   }
+
    // convenience functions follow
    
    /*
@@ -1227,6 +1441,7 @@ namespace std {
     %template(UnsignedVector) vector<unsigned>;
     %template(pair_ss)      pair<string, string>;
     %template(StrMap)       map<string, string>;
+    %template(StrDoubleMap) map<string, double>;
 
 
 
@@ -1236,7 +1451,21 @@ namespace std {
 
 %include "../MMDevice/MMDeviceConstants.h"
 %include "../MMCore/Configuration.h"
-%include "../MMCore/MMCore.h"
+// Metadata and MetadataVector must be declared before MMCore.h uses them
 %include "../MMDevice/ImageMetadata.h"
+%template(MetadataVector) std::vector<Metadata>;
+%include "../MMCore/MMCore.h"
+
+%extend CMMCore {
+   std::vector<ImageLease> popNextImageLeasesMD(unsigned maxCount,
+         std::vector<Metadata>& md) throw (CMMError)
+   {
+      std::vector<ImageLease> leases = $self->popNextImageLeases(maxCount);
+      md.assign(leases.size(), Metadata());
+      for (size_t i = 0; i < leases.size(); ++i)
+         leases[i].getMetadata(md[i]);
+      return leases;
+   }
+}
 %include "../MMCore/MMEventCallback.h"
 
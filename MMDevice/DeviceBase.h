@@ -33,6 +33,7 @@
 #include <math.h>
 #include <assert.h>
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <iomanip>
@@ -1300,7 +1301,8 @@ public:
    virtual unsigned GetImageBytesPerPixel() const = 0;
    virtual int SnapImage() = 0;
 
-   CCameraBase() : busy_(false), stopWhenCBOverflows_(false), thd_(0)
+   CCameraBase() : busy_(false), stopWhenCBOverflows_(false),
+      tagsVersion_(0), tagsVersioned_(false), thd_(0)
    {
       // create and initialize common transpose properties
       std::vector<std::string> allowedValues;
@@ -1468,12 +1470,23 @@ public:
    virtual void AddTag(const char* key, const char* deviceLabel, const char* value)
    {
       metadata_.PutTag(key, deviceLabel, value);
+      ++tagsVersion_;
    }
 
 
    virtual void RemoveTag(const char* key)
    {
       metadata_.RemoveTag(key);
+      ++tagsVersion_;
+   }
+
+   /**
+    * Returns -1 (tags are refetched for every image) unless the camera has
+    * called EnableTagsVersion().
+    */
+   virtual long GetTagsVersion()
+   {
+      return tagsVersioned_ ? tagsVersion_.load() : -1;
    }
 
    virtual bool SupportsMultiROI()
@@ -1519,11 +1532,25 @@ protected:
       return metadata_.GetSingleTag(key).GetValue();
    }
 
+   /**
+    * Lets the Core cache this camera's tags and refetch them only after
+    * AddTag() or RemoveTag(). Only call this (e.g. from the constructor) if
+    * the camera does not override GetTags(), AddTag() or RemoveTag().
+    */
+   void EnableTagsVersion()
+   {
+      tagsVersioned_ = true;
+   }
+
    // Do actual capturing
    // Called from inside the thread
    virtual int ThreadRun (void)
    {
-      int ret=DEVICE_ERR;
+      int ret = InsertImageZeroCopy();
+      if (ret != DEVICE_UNSUPPORTED_COMMAND)
+      {
+         return ret;
+      }
       ret = SnapImage();
       if (ret != DEVICE_OK)
       {
@@ -1541,22 +1568,95 @@ protected:
    {
       char label[MM::MaxStrLength];
       this->GetLabel(label);
-      Metadata md;
-      md.put(MM::g_Keyword_Metadata_CameraLabel, label);
+      const char* mdKeys[] = { MM::g_Keyword_Metadata_CameraLabel };
+      const char* mdValues[] = { label };
       int ret = GetCoreCallback()->InsertImage(this, GetImageBuffer(), GetImageWidth(),
-         GetImageHeight(), GetImageBytesPerPixel(),
-         md.Serialize().c_str());
+         GetImageHeight(), GetImageBytesPerPixel(), 1,
+         mdKeys, mdValues, 1);
       if (!stopWhenCBOverflows_ && ret == DEVICE_BUFFER_OVERFLOW)
       {
          // do not stop on overflow - just reset the buffer
          GetCoreCallback()->ClearImageBuffer(this);
          return GetCoreCallback()->InsertImage(this, GetImageBuffer(), GetImageWidth(),
-            GetImageHeight(), GetImageBytesPerPixel(),
-            md.Serialize().c_str());
+            GetImageHeight(), GetImageBytesPerPixel(), 1,
+            mdKeys, mdValues, 1);
       } else
          return ret;
    }
 
+   // Whether the camera implements ExposeImageForBuffer() and
+   // SnapImageIntoBuffer(), so that ThreadRun() inserts sequence frames
+   // without a copy. The default returns false.
+   virtual bool SupportsZeroCopy() const
+   {
+      return false;
+   }
+
+   // Expose the next sequence frame and wait until it can be transferred by
+   // SnapImageIntoBuffer(). Called before a frame of the sequence buffer is
+   // held, so that other inserts are not blocked for the exposure; do any
+   // rendering or processing here too. The default returns DEVICE_OK.
+   virtual int ExposeImageForBuffer()
+   {
+      return DEVICE_OK;
+   }
+
+   // Transfer the frame exposed by ExposeImageForBuffer() into pBuf, which
+   // holds GetImageWidth() * GetImageHeight() * GetImageBytesPerPixel()
+   // bytes of sequence buffer memory. Cameras that can DMA or otherwise
+   // transfer into caller-supplied memory override this to avoid the copy
+   // made by InsertImage(). The frame is held (and other inserts blocked)
+   // for the duration of the call, which should only transfer the pixels.
+   // Only used for single-channel cameras. The default returns
+   // DEVICE_UNSUPPORTED_COMMAND.
+   virtual int SnapImageIntoBuffer(unsigned char* /* pBuf */)
+   {
+      return DEVICE_UNSUPPORTED_COMMAND;
+   }
+
+   // Insert a frame via ExposeImageForBuffer() and SnapImageIntoBuffer().
+   // Returns DEVICE_UNSUPPORTED_COMMAND, without touching the buffer, if the
+   // camera does not support this (see SupportsZeroCopy()), so that callers
+   // can fall back to SnapImage() + InsertImage().
+   virtual int InsertImageZeroCopy()
+   {
+      if (!SupportsZeroCopy() || GetNumberOfChannels() != 1)
+         return DEVICE_UNSUPPORTED_COMMAND;
+
+      int ret = ExposeImageForBuffer();
+      if (ret != DEVICE_OK)
+         return ret;
+
+      MM::Core* core = GetCoreCallback();
+      unsigned char* pBuf = 0;
+      ret = core->AcquireWritableFrame(this, GetImageWidth(),
+            GetImageHeight(), GetImageBytesPerPixel(),
+            GetNumberOfComponents(), &pBuf);
+      if (!stopWhenCBOverflows_ && ret == DEVICE_BUFFER_OVERFLOW)
+      {
+         // do not stop on overflow - just reset the buffer
+         core->ClearImageBuffer(this);
+         ret = core->AcquireWritableFrame(this, GetImageWidth(),
+               GetImageHeight(), GetImageBytesPerPixel(),
+               GetNumberOfComponents(), &pBuf);
+      }
+      if (ret != DEVICE_OK)
+         return ret;
+
+      ret = SnapImageIntoBuffer(pBuf);
+      if (ret != DEVICE_OK)
+      {
+         core->AbortFrame(this);
+         return ret;
+      }
+
+      char label[MM::MaxStrLength];
+      this->GetLabel(label);
+      const char* mdKeys[] = { MM::g_Keyword_Metadata_CameraLabel };
+      const char* mdValues[] = { label };
+      return core->CommitFrame(this, mdKeys, mdValues, 1);
+   }
+
    virtual double GetIntervalMs() {return thd_->GetIntervalMs();}
    virtual long GetImageCounter() {return thd_->GetImageCounter();}
    virtual long GetNumberOfImages() {return thd_->GetNumberOfImages();}
@@ -1709,6 +1809,8 @@ private:
    bool busy_;
    bool stopWhenCBOverflows_;
    Metadata metadata_;
+   std::atomic<long> tagsVersion_;
+   bool tagsVersioned_;
 
    BaseSequenceThread * thd_;
    friend class BaseSequenceThread;
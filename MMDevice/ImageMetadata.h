@@ -406,6 +406,18 @@ public:
       }
    }
 
+#ifndef SWIG
+   /*
+    * Call visitor(const MetadataTag&) for each tag, in key order.
+    */
+   template <class Visitor>
+   void VisitTags(Visitor& visitor) const
+   {
+      for (TagConstIter it = tags_.begin(), end = tags_.end(); it != end; ++it)
+         visitor(*it->second);
+   }
+#endif
+
    std::string Serialize() const
    {
       std::string str;
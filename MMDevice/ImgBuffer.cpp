@@ -27,15 +27,24 @@
 // ImgBuffer class
 //
 ImgBuffer::ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth) :
-   pixels_(0), width_(xSize), height_(ySize), pixDepth_(pixDepth)
+   pixels_(0), ownsPixels_(true), width_(xSize), height_(ySize), pixDepth_(pixDepth)
 {
    pixels_ = new unsigned char[xSize * ySize * pixDepth];
    assert(pixels_);
    std::memset(pixels_, 0, xSize * ySize * pixDepth);
 }
 
+ImgBuffer::ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth,
+      unsigned char* externalPixels) :
+   pixels_(externalPixels), ownsPixels_(false),
+   width_(xSize), height_(ySize), pixDepth_(pixDepth)
+{
+   assert(pixels_);
+}
+
 ImgBuffer::ImgBuffer() :
    pixels_(0),
+   ownsPixels_(true),
    width_(0),
    height_(0),
    pixDepth_(0)
@@ -45,12 +54,21 @@ ImgBuffer::ImgBuffer() :
 ImgBuffer::ImgBuffer(const ImgBuffer& right)                
 {
    pixels_ = 0;
+   ownsPixels_ = true;
    *this = right;
 }
 
 ImgBuffer::~ImgBuffer()
 {
-   delete[] pixels_;
+   ReleasePixels();
+}
+
+void ImgBuffer::ReleasePixels()
+{
+   if (ownsPixels_)
+      delete[] pixels_;
+   pixels_ = 0;
+   ownsPixels_ = true;
 }
 
 const unsigned char* ImgBuffer::GetPixels() const
@@ -105,7 +123,7 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize, unsigned pixDepth)
    // re-allocate internal buffer if it is not big enough
    if (width_ * height_ * pixDepth_ < xSize * ySize * pixDepth)
    {
-      delete[] pixels_;
+      ReleasePixels();
       pixels_ = new unsigned char [xSize * ySize * pixDepth];
       assert(pixels_);
    }
@@ -120,7 +138,7 @@ void ImgBuffer::Resize(unsigned xSize, unsigned ySize)
    // re-allocate internal buffer if it is not big enough
    if (width_ * height_ < xSize * ySize)
    {
-      delete[] pixels_;
+      ReleasePixels();
       pixels_ = new unsigned char[xSize * ySize * pixDepth_];
    }
 
@@ -143,8 +161,7 @@ ImgBuffer& ImgBuffer::operator=(const ImgBuffer& img)
    if(this == &img)
       return *this;
 
-   if (pixels_)
-      delete[] pixels_;
+   ReleasePixels();
 
    width_ = img.Width();
    height_ = img.Height();
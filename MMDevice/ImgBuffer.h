@@ -36,6 +36,12 @@ class ImgBuffer
 {
 public:
    ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth);
+   // Wrap externally owned memory (e.g. a frame obtained with
+   // MM::Core::AcquireWritableFrame()) without copying it. The memory must
+   // outlive this object; resizing beyond its size switches to an internally
+   // allocated buffer.
+   ImgBuffer(unsigned xSize, unsigned ySize, unsigned pixDepth,
+         unsigned char* externalPixels);
    ImgBuffer(const ImgBuffer& ib);
    ImgBuffer();
    ~ImgBuffer();
@@ -62,7 +68,10 @@ public:
    ImgBuffer& operator=(const ImgBuffer& rhs);
 
 private:
+   void ReleasePixels();
+
    unsigned char* pixels_;
+   bool ownsPixels_;
    unsigned int width_;
    unsigned int height_;
    unsigned int pixDepth_;
@@ -28,7 +28,7 @@
 // Header version
 // If any of the class definitions changes, the interface version
 // must be incremented
-#define DEVICE_INTERFACE_VERSION 71
+#define DEVICE_INTERFACE_VERSION 74
 ///////////////////////////////////////////////////////////////////////////////
 
 // N.B.
@@ -534,6 +534,16 @@ namespace MM {
        */
       virtual void RemoveTag(const char* key) = 0;
 
+      /**
+       * Returns a number that changes whenever the tags returned by GetTags()
+       * change, i.e. on each call to AddTag() or RemoveTag(), or -1 if the
+       * tags are not versioned.
+       * The Core keeps a parsed copy of the tags and only calls GetTags()
+       * again when this value changes; a negative value makes it call
+       * GetTags() for every image.
+       */
+      virtual long GetTagsVersion() = 0;
+
       /**
        * Returns whether a camera's exposure time can be sequenced.
        * If returning true, then a Camera adapter class should also inherit
@@ -1403,11 +1413,42 @@ namespace MM {
       virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const Metadata* md = 0, const bool doProcess = true) = 0;
       /// \deprecated Use the other forms instead.
       virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, const char* serializedMetadata, const bool doProcess = true) = 0;
+      /// Insert an image with metadata given as key-value pairs.
+      /**
+       * Each of the mdCount pairs mdKeys[i], mdValues[i] becomes an image tag
+       * (as with Metadata::PutImageTag()). Unlike the serializedMetadata
+       * forms, this requires no text serialization or parsing per frame.
+       */
+      virtual int InsertImage(const Device* caller, const unsigned char* buf, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, const char* const* mdKeys, const char* const* mdValues, unsigned mdCount, const bool doProcess = true) = 0;
       virtual void ClearImageBuffer(const Device* caller) = 0;
       virtual bool InitializeImageBuffer(unsigned channels, unsigned slices, unsigned int w, unsigned int h, unsigned int pixDepth) = 0;
       /// \deprecated Use the other forms instead.
       virtual int InsertMultiChannel(const Device* caller, const unsigned char* buf, unsigned numChannels, unsigned width, unsigned height, unsigned byteDepth, Metadata* md = 0) = 0;
 
+      /// Obtain a writable frame in the sequence buffer (zero-copy insert).
+      /**
+       * On success, *ppBuf points to width * height * byteDepth bytes of
+       * Core-owned memory that will become the next image in the sequence
+       * buffer. The camera may render or transfer pixels directly into it
+       * and must then call exactly one of CommitFrame() or AbortFrame(),
+       * from the same thread. Other inserts are blocked in the meantime, so
+       * the frame should be held only as long as it takes to transfer the
+       * pixels; render or process them beforehand instead.
+       *
+       * Returns DEVICE_BUFFER_OVERFLOW if the buffer is full and
+       * DEVICE_INCOMPATIBLE_IMAGE if the dimensions do not match the buffer
+       * or the buffer holds more than one channel;
+       * in either case *ppBuf is not modified and no frame is held. Cameras
+       * can fall back to InsertImage() if this call fails.
+       */
+      virtual int AcquireWritableFrame(const Device* caller, unsigned width, unsigned height, unsigned byteDepth, unsigned nComponents, unsigned char** ppBuf) = 0;
+      /// Publish the frame obtained with AcquireWritableFrame().
+      virtual int CommitFrame(const Device* caller, const char* serializedMetadata, const bool doProcess = true) = 0;
+      /// Publish the frame obtained with AcquireWritableFrame(), with metadata given as key-value pairs (see InsertImage()).
+      virtual int CommitFrame(const Device* caller, const char* const* mdKeys, const char* const* mdValues, unsigned mdCount, const bool doProcess = true) = 0;
+      /// Release the frame obtained with AcquireWritableFrame() without inserting it.
+      virtual int AbortFrame(const Device* caller) = 0;
+
       // Formerly intended for use by autofocus
       MM_DEPRECATED(virtual const char* GetImage()) = 0;
       MM_DEPRECATED(virtual int GetImageDimensions(int& width, int& height, int& depth)) = 0;
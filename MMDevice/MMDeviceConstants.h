@@ -131,6 +131,8 @@ namespace MM {
    const char* const g_Keyword_CoreSLM          = "SLM";
    const char* const g_Keyword_CoreGalvo        = "Galvo";
    const char* const g_Keyword_CoreTimeoutMs    = "TimeoutMs";
+   const char* const g_Keyword_CoreThreadPoolSize = "ThreadPoolSize";
+   const char* const g_Keyword_CoreThreadPoolAffinity = "ThreadPoolAffinity";
    const char* const g_Keyword_Channel          = "Channel";
    const char* const g_Keyword_Version          = "Version";
    const char* const g_Keyword_ColorMode        = "ColorMode";
@@ -151,6 +153,18 @@ namespace MM {
    const char* const g_Keyword_Metadata_ROI_X       = "ROI-X-start";
    const char* const g_Keyword_Metadata_ROI_Y       = "ROI-Y-start";
    const char* const g_Keyword_Metadata_TimeInCore  = "TimeReceivedByCore";
+   // Optional; added by cameras whose hardware provides them. The frame
+   // number is the camera's own frame counter, which increases by one for
+   // each frame it sends; the timestamp is the camera's time of the frame in
+   // microseconds. The Core uses them to detect lost frames.
+   const char* const g_Keyword_Metadata_HardwareFrameNumber = "HardwareFrameNumber";
+   const char* const g_Keyword_Metadata_HardwareTimestamp   = "HardwareTimestamp-us";
+   // Added by the Core when the FramePixelStatistics feature is enabled
+   const char* const g_Keyword_Metadata_PixelMin            = "PixelMin";
+   const char* const g_Keyword_Metadata_PixelMax            = "PixelMax";
+   const char* const g_Keyword_Metadata_PixelMean           = "PixelMean";
+   const char* const g_Keyword_Metadata_SaturatedPixelCount = "SaturatedPixelCount";
+   const char* const g_Keyword_Metadata_PixelHistogram      = "PixelHistogram";
 
    // configuration file format constants
    const char* const g_FieldDelimiters = ",";